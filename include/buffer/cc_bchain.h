@@ -0,0 +1,106 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <buffer/cc_buf.h>
+#include <cc_array.h>
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * bchain: a buffer made of a chain of bufs borrowed from the buf pool.
+ *
+ * Unlike a dbuf, a bchain grows by appending another buf instead of copying
+ * everything into one twice as large, and gives bufs back to the pool as
+ * soon as they have been read. Data is written to the end of the chain and
+ * read from its front; only the last buf holding data may be partially
+ * filled, bufs after it are empty.
+ *
+ * For vectored I/O, bchain_riov describes the data as iovecs for tcp_sendv,
+ * after which bchain_consume drops what was sent; bchain_wiov describes room
+ * for tcp_recvv, growing the chain as needed, after which bchain_commit
+ * marks what was received as data. iovecs are appended to an array of struct
+ * iovec (see cc_array.h) until it is full, the array is never grown.
+ */
+
+/*          name                type                default             description */
+#define BCHAIN_OPTION(ACTION)                                                                   \
+    ACTION( bchain_max_nbuf,    OPTION_TYPE_UINT,   BCHAIN_MAX_NBUF,    "max # bufs per chain" )
+
+typedef struct {
+    BCHAIN_OPTION(OPTION_DECLARE)
+} bchain_options_st;
+
+#define BCHAIN_MAX_NBUF 256 /* with 16KiB default size, this gives us 4 MiB */
+
+/*          name                type            description */
+#define BCHAIN_METRIC(ACTION)                                           \
+    ACTION( bchain_grow,        METRIC_COUNTER, "# bufs appended"      )\
+    ACTION( bchain_grow_ex,     METRIC_COUNTER, "# appends failed"     )\
+    ACTION( bchain_shrink,      METRIC_COUNTER, "# bufs released"      )
+
+typedef struct {
+    BCHAIN_METRIC(METRIC_DECLARE)
+} bchain_metrics_st;
+
+struct bchain {
+    struct buf_sqh  bufq;   /* bufs in the chain */
+    struct buf      *wbuf;  /* first buf with room, NULL if none */
+    uint32_t        nbuf;   /* # bufs in the chain */
+    size_t          rsize;  /* # bytes of data */
+};
+
+/* Setup/teardown chained buffer module */
+void bchain_setup(bchain_options_st *options, bchain_metrics_st *metrics);
+void bchain_teardown(void);
+
+void bchain_init(struct bchain *chain);
+void bchain_deinit(struct bchain *chain); /* returns all bufs to the pool */
+
+static inline size_t
+bchain_rsize(const struct bchain *chain)
+{
+    return chain->rsize;
+}
+
+/* these return # bytes copied, less than count if out of data or bufs */
+uint32_t bchain_write(struct bchain *chain, const char *src, uint32_t count);
+uint32_t bchain_read(char *dst, struct bchain *chain, uint32_t count);
+uint32_t bchain_peek(char *dst, const struct bchain *chain, uint32_t count);
+
+/* drop the first count bytes of data */
+void bchain_consume(struct bchain *chain, size_t count);
+
+/* describe data in iov, return # bytes described */
+size_t bchain_riov(struct bchain *chain, struct array *iov);
+/* describe room for at least count bytes if possible, return # bytes */
+size_t bchain_wiov(struct bchain *chain, struct array *iov, size_t count);
+/* mark count bytes written into the room as data */
+void bchain_commit(struct bchain *chain, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -30,6 +30,7 @@ extern "C" {
 #include <cc_define.h>
 #include <cc_metric.h>
 #include <cc_option.h>
+#include <cc_pool.h>
 #include <cc_queue.h>
 #include <cc_util.h>
 
@@ -37,10 +38,12 @@ extern "C" {
 #include <sys/param.h>
 
 
-/*          name            type                default             description */
-#define BUF_OPTION(ACTION)                                                                       \
-    ACTION( buf_init_size,  OPTION_TYPE_UINT,   BUF_DEFAULT_SIZE,   "init buf size incl header" )\
-    ACTION( buf_poolsize,   OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size"             )
+/*          name                type                default             description */
+#define BUF_OPTION(ACTION)                                                                            \
+    ACTION( buf_init_size,      OPTION_TYPE_UINT,   BUF_DEFAULT_SIZE,   "init buf size incl header"  )\
+    ACTION( buf_poolsize,       OPTION_TYPE_UINT,   BUF_POOLSIZE,       "buf pool size"              )\
+    ACTION( buf_tcache_high,    OPTION_TYPE_UINT,   BUF_TCACHE_HIGH,    "max # free buf per thread"  )\
+    ACTION( buf_tcache_low,     OPTION_TYPE_UINT,   BUF_TCACHE_LOW,     "free buf kept after spill"  )
 
 typedef struct {
     BUF_OPTION(OPTION_DECLARE)
@@ -56,7 +59,8 @@ typedef struct {
     ACTION( buf_borrow,       METRIC_COUNTER, "# buf borrows"                          )\
     ACTION( buf_borrow_ex,    METRIC_COUNTER, "# buf borrow exceptions"                )\
     ACTION( buf_return,       METRIC_COUNTER, "# buf returns"                          )\
-    ACTION( buf_memory,       METRIC_GAUGE,   "memory alloc'd to buf including header" )
+    ACTION( buf_memory,       METRIC_GAUGE,   "memory alloc'd to buf including header" )\
+    POOL_METRIC_PREFIX(ACTION, buf_pool_)
 
 typedef struct {
     BUF_METRIC(METRIC_DECLARE)
@@ -67,6 +71,7 @@ struct buf {
     char              *rpos;    /* read marker */
     char              *wpos;    /* write marker */
     char              *end;     /* end of buffer */
+    int32_t           fixed;    /* index as registered I/O buffer, -1 if not */
     bool              free;     /* is this buf free? */
     char              begin[];  /* beginning of buffer */
 };
@@ -74,6 +79,8 @@ struct buf {
 #define BUF_HDR_SIZE       offsetof(struct buf, begin)
 #define BUF_DEFAULT_SIZE   16 * KiB
 #define BUF_POOLSIZE       0    /* unlimited */
+#define BUF_TCACHE_HIGH    64   /* 0 disables the per-thread cache */
+#define BUF_TCACHE_LOW     16
 
 STAILQ_HEAD(buf_sqh, buf); /* corresponding header type for the STAILQ */
 
@@ -93,7 +100,14 @@ extern buf_metrics_st *buf_metrics;
 void buf_setup(buf_options_st *options, buf_metrics_st *metrics);
 void buf_teardown(void);
 
-/* Obtain/return a buffer from the pool */
+/**
+ * Obtain/return a buffer from the pool, safe to call from any thread.
+ *
+ * Free bufs are cached per thread in front of a pool shared by all threads,
+ * buf_tcache_high and buf_tcache_low are the watermarks of the per-thread
+ * cache (see cc_pool.h). buf_teardown must be called after all other threads
+ * have stopped using bufs.
+ */
 struct buf *buf_borrow(void);
 void buf_return(struct buf **buf);
 
@@ -42,11 +42,14 @@ typedef struct {
 typedef int (*array_compare_fn)(const void *, const void *);
 typedef rstatus_i (*array_each_fn)(void *, void *);
 
+struct arena;
+
 struct array {
-    size_t   size;      /* element size */
-    uint32_t nalloc;    /* # allocated element */
-    uint32_t nelem;     /* # element */
-    uint8_t  *data;     /* elements */
+    size_t          size;   /* element size */
+    uint32_t        nalloc; /* # allocated element */
+    uint32_t        nelem;  /* # element */
+    uint8_t         *data;  /* elements */
+    struct arena    *arena; /* memory comes from this arena if not NULL */
 };
 
 
@@ -82,6 +85,7 @@ array_reset(struct array *arr)
     arr->nalloc = 0;
     arr->nelem = 0;
     arr->data = NULL;
+    arr->arena = NULL;
 }
 
 /* initialize arry of given size parameters and allocated data memory */
@@ -92,6 +96,7 @@ array_data_assign(struct array *arr, uint32_t nalloc, size_t size, void *data)
     arr->nalloc = nalloc;
     arr->nelem = 0;
     arr->data = data;
+    arr->arena = NULL;
 }
 
 /**
@@ -135,6 +140,13 @@ void array_data_destroy(struct array *arr);
 rstatus_i array_create(struct array **arr, uint32_t nalloc, size_t size);
 void array_destroy(struct array **arr);
 
+/*
+ * the array and its data live in arena, and go away when it is reset:
+ * array_destroy only clears the pointer, expansion copies into new space
+ */
+rstatus_i array_create_arena(struct array **arr, uint32_t nalloc, size_t size,
+        struct arena *arena);
+
 void *array_push(struct array *arr);
 void *array_pop(struct array *arr);
 void array_sort(struct array *arr, array_compare_fn compare);
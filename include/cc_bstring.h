@@ -29,6 +29,8 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 
+struct arena;
+
 /* TODO(yao): separate byte string related functionalities into cc_bstring */
 struct bstring {
     uint32_t len;   /* string length */
@@ -57,6 +59,8 @@ int bstring_compare(const struct bstring *s1, const struct bstring *s2);
 
 struct bstring *bstring_alloc(uint32_t size);
 void bstring_free(struct bstring **bstring);
+/* allocated from arena, released by arena_reset instead of bstring_free */
+struct bstring *bstring_alloc_arena(uint32_t size, struct arena *arena);
 
 /* efficient implementation of string comparion of short strings */
 #define str2cmp(m, c0, c1)                                                     \
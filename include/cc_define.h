@@ -55,10 +55,18 @@ extern "C" {
 #define CC_DEBUG_MM 1
 #endif
 
+#ifdef HAVE_SLAB_MM
+#define CC_SLAB_MM 1
+#endif
+
 #ifdef HAVE_ITT_INSTRUMENTATION
 #define CC_ITT 1
 #endif
 
+#ifdef HAVE_IO_URING
+#define CC_IO_URING 1
+#endif
+
 #define CC_OK        0
 #define CC_ERROR    -1
 
@@ -25,23 +25,63 @@ extern "C" {
 #include <cc_metric.h>
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <sys/uio.h>
 
 #define EVENT_READ  0x0000ff
 #define EVENT_WRITE 0x00ff00
 #define EVENT_ERR   0xff0000
 
+/* registration modes, see event_add_read_mode */
+#define EVENT_MODE_ET           0x1 /* edge-triggered */
+#define EVENT_MODE_EXCLUSIVE    0x2 /* wake one of the bases sharing the fd */
+
 /*          name                type            description */
 #define EVENT_METRIC(ACTION)                                            \
     ACTION( event_total,        METRIC_COUNTER, "# events returned"    )\
     ACTION( event_loop,         METRIC_COUNTER, "# event loop returns" )\
     ACTION( event_read,         METRIC_COUNTER, "# reads registered"   )\
-    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )
+    ACTION( event_write,        METRIC_COUNTER, "# writes registered"  )\
+    ACTION( event_io,           METRIC_COUNTER, "# I/O submitted"      )\
+    ACTION( event_io_fixed,     METRIC_COUNTER, "# I/O w/ fixed buf"   )\
+    ACTION( event_batch,        METRIC_COUNTER, "# batches dispatched" )\
+    ACTION( event_spin_hit,     METRIC_COUNTER, "# waits hit spinning" )\
+    ACTION( event_spin_block,   METRIC_COUNTER, "# spins then blocked" )\
+    ACTION( event_wait_0,       METRIC_COUNTER, "# waits w/ 0 event"   )\
+    ACTION( event_wait_1,       METRIC_COUNTER, "# waits w/ 1 event"   )\
+    ACTION( event_wait_2,       METRIC_COUNTER, "# waits w/ 2-3"       )\
+    ACTION( event_wait_4,       METRIC_COUNTER, "# waits w/ 4-7"       )\
+    ACTION( event_wait_8,       METRIC_COUNTER, "# waits w/ 8-15"      )\
+    ACTION( event_wait_16,      METRIC_COUNTER, "# waits w/ 16-31"     )\
+    ACTION( event_wait_32,      METRIC_COUNTER, "# waits w/ 32-63"     )\
+    ACTION( event_wait_64,      METRIC_COUNTER, "# waits w/ 64-127"    )\
+    ACTION( event_wait_128,     METRIC_COUNTER, "# waits w/ 128-255"   )\
+    ACTION( event_wait_256,     METRIC_COUNTER, "# waits w/ 256-511"   )\
+    ACTION( event_wait_512,     METRIC_COUNTER, "# waits w/ 512-1023"  )\
+    ACTION( event_wait_1024,    METRIC_COUNTER, "# waits w/ 1024+"     )
+
+#define EVENT_WAIT_NBUCKET 12   /* # event_wait_* histogram buckets */
 
 typedef struct {
     EVENT_METRIC(METRIC_DECLARE)
 } event_metrics_st;
 
 typedef void (*event_cb_fn)(void *, uint32_t);  /* event callback */
+typedef void (*event_io_cb_fn)(void *, uint32_t, int); /* I/O completion */
+
+/* a ready event as handed to the batch callback */
+struct event_item {
+    void        *data;      /* data given when the event was added */
+    uint32_t    events;     /* EVENT_READ/WRITE/ERR */
+};
+
+typedef void (*event_batch_fn)(struct event_item *, int); /* batch callback */
+
+/**
+ * The backend is chosen at build time: kqueue on Darwin; epoll on Linux, or
+ * io_uring if configured with HAVE_IO_URING. All backends behave the same
+ * (level-triggered) through this interface.
+ */
 
 struct event_base;
 
@@ -67,9 +107,79 @@ int event_add_read(struct event_base *evb, int fd, void *data);
 int event_add_write(struct event_base *evb, int fd, void *data);
 int event_del(struct event_base *evb, int fd);
 
+/**
+ * event_add_read with a mode, event_add_read is the same as mode 0:
+ * - EVENT_MODE_ET: only report a fd when it becomes readable, so it must be
+ *   drained until EAGAIN before waiting again (for listeners: call tcp_accept
+ *   until it fails with sc->err set to EAGAIN). Backends without edge
+ *   triggering (io_uring) report level-triggered, which drain code handles.
+ * - EVENT_MODE_EXCLUSIVE: for a listening socket added to the event bases of
+ *   several workers, wake only one of them per incoming connection instead
+ *   of all (EPOLLEXCLUSIVE, linux 4.5). Ignored by kqueue.
+ * A fd's mode is set when it is first added, and changing it requires a del.
+ */
+int event_add_read_mode(struct event_base *evb, int fd, void *data,
+        uint32_t mode);
+
 /* event wait */
 int event_wait(struct event_base *evb, int timeout);
 
+/**
+ * Adaptive spinning: with a budget set, a wait that may block first polls
+ * without blocking for up to that many microseconds, and only blocks for the
+ * rest of the timeout if nothing turned up, trading cpu for the wakeup latency
+ * of a blocking wait. A spin never outlasts the timeout: one that uses it all
+ * up returns 0 without blocking. The time spun adapts to the load: it is
+ * halved (down to 1/16 of the budget) after each spin that ended up blocking,
+ * and restored after a spin that found events. Where the kernel supports it (linux 6.9+),
+ * the epoll backend also has the kernel busy poll the device queues during
+ * waits. event_spin_hit and event_spin_block count the outcomes of spins;
+ * each poll made while spinning counts as an event_loop return, while the
+ * event_wait_* histogram only records what a wait returned in the end.
+ *
+ * A budget of 0, the default, disables spinning.
+ */
+void event_base_set_spin(struct event_base *evb, uint32_t us);
+
+/**
+ * Batched dispatch: once a batch callback is set, event_wait hands all ready
+ * events of a wakeup to it in a single call instead of calling the event
+ * callback once per event, so the application can e.g. prefetch connection
+ * state before touching any of it. Items with EVENT_READ are placed before
+ * the others; an item may refer to a fd deleted earlier in the same batch.
+ * Items carry no fd, since epoll only hands back the data of an event.
+ * Setting the callback to NULL restores per-event dispatch.
+ *
+ * Regardless of the mode, the # events returned by each wakeup is recorded
+ * in the event_wait_* histogram, which helps with sizing nevent.
+ */
+int event_base_set_batch_cb(struct event_base *evb, event_batch_fn cb);
+
+/* completion-based I/O */
+/**
+ * Instead of reporting readiness and leaving the syscall to the caller, the
+ * backend performs the transfer itself and reports the outcome through the
+ * I/O callback, with EVENT_READ or EVENT_WRITE identifying the operation and
+ * the result being the # of bytes transferred or a negative errno.
+ *
+ * At most one recv and one send can be outstanding per fd, outstanding I/O is
+ * canceled by event_del, and completions are delivered by event_wait.
+ *
+ * Buffers registered with event_register_buf are pinned by the kernel, and
+ * I/O whose memory falls within registered buffer `idx' skips the per-call
+ * page mapping. Registered memory must stay valid until the event base is
+ * destroyed; pass idx -1 for memory that is not registered. At most
+ * EVENT_NBUF_MAX buffers can be registered, which is the kernel's limit.
+ *
+ * Only the io_uring backend supports this, the others fail with ENOTSUP.
+ */
+#define EVENT_NBUF_MAX 16384
+
+void event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb);
+int event_register_buf(struct event_base *evb, const struct iovec *iov, int niov);
+int event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx, void *data);
+int event_send(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx, void *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,126 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * event group: a group of worker threads, each running its own event base,
+ * and the means for an acceptor thread to hand connections over to them.
+ *
+ * The acceptor calls event_group_dispatch with a newly accepted connection,
+ * which is queued for the least loaded worker over a ring_array (the acceptor
+ * is the only producer, the worker the consumer), and the worker is woken up
+ * through a pipe if it may be waiting. The worker then takes ownership of the
+ * connection in conn_cb, typically by registering it with its event base.
+ * Connections still queued when the group is destroyed are handed to close_cb
+ * instead, on the destroying thread.
+ *
+ * With stealing enabled, a worker that has been idle for a whole wait
+ * takes connections still queued for the most backlogged worker, since a
+ * worker busy with its own events can take a while to get to its queue.
+ * Connections a worker already owns are never moved: their event
+ * registration and state belong to the owner thread.
+ *
+ * The event callback of all workers is the same, event_worker_self tells
+ * which worker it is called on. Per-event dispatch only.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_event.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EVENT_GROUP_NWORKER 4
+#define EVENT_GROUP_NEVENT  1024
+#define EVENT_GROUP_TIMEOUT 100     /* in ms */
+#define EVENT_GROUP_QUEUE   1024
+
+/*          name                    type                default                 description */
+#define EVENT_GROUP_OPTION(ACTION)                                                                          \
+    ACTION( event_group_nworker,    OPTION_TYPE_UINT,   EVENT_GROUP_NWORKER,    "# worker threads"         )\
+    ACTION( event_group_nevent,     OPTION_TYPE_UINT,   EVENT_GROUP_NEVENT,     "# events per worker wait" )\
+    ACTION( event_group_timeout,    OPTION_TYPE_UINT,   EVENT_GROUP_TIMEOUT,    "worker wait timeout (ms)" )\
+    ACTION( event_group_queue,      OPTION_TYPE_UINT,   EVENT_GROUP_QUEUE,      "conn queue per worker"    )\
+    ACTION( event_group_pin,        OPTION_TYPE_BOOL,   false,                  "pin worker i to cpu i"    )\
+    ACTION( event_group_steal,      OPTION_TYPE_BOOL,   false,                  "idle workers steal conns" )
+
+typedef struct {
+    EVENT_GROUP_OPTION(OPTION_DECLARE)
+} event_group_options_st;
+
+/*          name                type            description */
+#define EVENT_WORKER_METRIC(ACTION)                                             \
+    ACTION( worker_conn_curr,   METRIC_GAUGE,   "# conns owned by worker"      )\
+    ACTION( worker_queue_curr,  METRIC_GAUGE,   "# conns queued for worker"    )\
+    ACTION( worker_handoff,     METRIC_COUNTER, "# conns handed to worker"     )\
+    ACTION( worker_handoff_ex,  METRIC_COUNTER, "# conns not queued: full"     )\
+    ACTION( worker_steal,       METRIC_COUNTER, "# conns stolen by worker"     )\
+    ACTION( worker_wakeup,      METRIC_COUNTER, "# wakeups sent to worker"     )\
+    ACTION( worker_loop,        METRIC_COUNTER, "# worker event loop returns"  )\
+    ACTION( worker_event,       METRIC_COUNTER, "# events handled by worker"   )
+
+typedef struct {
+    EVENT_WORKER_METRIC(METRIC_DECLARE)
+} event_worker_metrics_st;
+
+struct event_group;
+struct event_worker;
+struct tcp_conn;
+
+/* called on the worker that now owns the connection */
+typedef void (*event_group_conn_fn)(struct event_worker *, struct tcp_conn *);
+/* called on a connection no worker has taken, when the group is destroyed */
+typedef void (*event_group_close_fn)(struct tcp_conn *);
+
+struct event_group *event_group_create(event_group_options_st *options,
+        event_cb_fn cb, event_group_conn_fn conn_cb,
+        event_group_close_fn close_cb);
+void event_group_destroy(struct event_group **g);
+
+/* start/stop worker threads */
+rstatus_i event_group_start(struct event_group *g);
+void event_group_stop(struct event_group *g);
+
+/* acceptor: hand a connection over to a worker, only one thread may call it */
+rstatus_i event_group_dispatch(struct event_group *g, struct tcp_conn *c);
+
+uint32_t event_group_nworker(struct event_group *g);
+/*
+ * the event base of worker id, e.g. to register a listener of its own (see
+ * tcp_listen_reuseport) before event_group_start
+ */
+struct event_base *event_group_base(struct event_group *g, uint32_t id);
+event_worker_metrics_st *event_group_metrics(struct event_group *g,
+        uint32_t id);
+
+/* worker: the worker of the calling thread, NULL if not a worker */
+struct event_worker *event_worker_self(void);
+uint32_t event_worker_id(struct event_worker *w);
+struct event_base *event_worker_base(struct event_worker *w);
+/* a connection owned by the worker is closed, to keep its load accurate */
+void event_worker_release(struct event_worker *w);
+
+#ifdef __cplusplus
+}
+#endif
@@ -86,6 +86,17 @@ extern "C" {
     }                                                                       \
 } while(0)
 
+/**
+ * A histogram is declared as consecutive counters of the same metrics struct,
+ * one per bucket: bucket 0 counts value 0, bucket i counts values within
+ * [2^(i-1), 2^i), and the last bucket also counts anything larger.
+ * INCR_LOG2 increments the bucket of _val, with _first being bucket 0.
+ */
+#define INCR_LOG2(_base, _first, _nbucket, _val) do {                       \
+    if ((_base) != NULL) {                                                  \
+         metric_incr((&(_base)->_first)[metric_log2_bucket(_val, _nbucket)]);\
+    }                                                                       \
+} while(0)
 
 #define METRIC_DECLARE(_name, _type, _description)   \
     struct metric _name;
@@ -103,6 +114,7 @@ extern "C" {
 #define DECR(_base, _metric)
 #define DECR_N(_base, _metric, _delta)
 #define UPDATE_VAL(_base, _metric, _val)
+#define INCR_LOG2(_base, _first, _nbucket, _val)
 
 #define METRIC_DECLARE(_name, _type, _description)
 #define METRIC_INIT(_name, _type, _description)
@@ -135,6 +147,15 @@ struct metric {
     };
 };
 
+/* histogram bucket of val, see INCR_LOG2 */
+static inline unsigned int
+metric_log2_bucket(uint64_t val, unsigned int nbucket)
+{
+    unsigned int i = (val == 0) ? 0 : 64 - __builtin_clzll(val);
+
+    return i < nbucket ? i : nbucket - 1;
+}
+
 void metric_reset(struct metric sarr[], unsigned int nmetric);
 size_t metric_print(char *buf, size_t nbuf, char *fmt, struct metric *m);
 void metric_describe_all(struct metric metrics[], unsigned int nmetric);
@@ -22,8 +22,72 @@ extern "C" {
 #endif
 
 #include <cc_define.h>
+#include <cc_metric.h>
 
 #include <stddef.h>
+#include <stdint.h>
+
+/*
+ * With HAVE_SLAB_MM, cc_alloc and friends are served by a slab allocator
+ * instead of libc: requests of up to 64KiB are rounded up to a power of two
+ * and taken from per-class free lists, which are kept per thread and backed
+ * by class-wide lists filled from 2MiB regions mapped as transparent huge
+ * pages where supported. Memory in regions is reused within its class but
+ * never returned to the OS. Larger requests go to libc.
+ */
+
+#define MM_NCLASS 13    /* 16B to 64KiB */
+
+/*
+ * cc_mmap_ex flags. Each is best effort: if a request cannot be honored the
+ * mapping falls back to what is available, which mm_mmap_* metrics record.
+ *
+ * MM_MMAP_HUGETLB  explicit hugepages (MAP_HUGETLB) from the reserved pool,
+ *                  only tried for multiples of MM_HUGEPAGE_SIZE, falls back to
+ *                  transparent hugepages
+ * MM_MMAP_THP      transparent hugepages, with the mapping aligned to
+ *                  MM_HUGEPAGE_SIZE so it can be fully backed by them
+ * MM_MMAP_POPULATE pre-fault all pages now instead of on first touch
+ *
+ * A node >= 0 binds the memory to that NUMA node, before it is pre-faulted.
+ */
+#define MM_MMAP_HUGETLB     0x1
+#define MM_MMAP_THP         0x2
+#define MM_MMAP_POPULATE    0x4
+
+#define MM_HUGEPAGE_SIZE    (2 * 1024 * 1024)
+
+/*          name                type            description */
+#define MM_METRIC(ACTION)                                                       \
+    ACTION( mm_region_curr,     METRIC_GAUGE,   "# slab regions mapped"        )\
+    ACTION( mm_large_curr,      METRIC_GAUGE,   "# allocs too large for slab"  )\
+    ACTION( mm_mmap_hugetlb,    METRIC_COUNTER, "# mmaps w/ explicit hugepages")\
+    ACTION( mm_mmap_thp,        METRIC_COUNTER, "# mmaps w/ transparent hp"    )\
+    ACTION( mm_mmap_default,    METRIC_COUNTER, "# mmaps w/ default pages"     )\
+    ACTION( mm_mmap_numa,       METRIC_COUNTER, "# mmaps bound to a numa node" )\
+    ACTION( mm_mmap_populate,   METRIC_COUNTER, "# mmaps pre-faulted"          )\
+    ACTION( mm_mmap_fallback,   METRIC_COUNTER, "# mmap requests not honored"  )\
+    ACTION( mm_slab_16,         METRIC_GAUGE,   "# 16B slab objects in use"    )\
+    ACTION( mm_slab_32,         METRIC_GAUGE,   "# 32B slab objects in use"    )\
+    ACTION( mm_slab_64,         METRIC_GAUGE,   "# 64B slab objects in use"    )\
+    ACTION( mm_slab_128,        METRIC_GAUGE,   "# 128B slab objects in use"   )\
+    ACTION( mm_slab_256,        METRIC_GAUGE,   "# 256B slab objects in use"   )\
+    ACTION( mm_slab_512,        METRIC_GAUGE,   "# 512B slab objects in use"   )\
+    ACTION( mm_slab_1k,         METRIC_GAUGE,   "# 1KiB slab objects in use"   )\
+    ACTION( mm_slab_2k,         METRIC_GAUGE,   "# 2KiB slab objects in use"   )\
+    ACTION( mm_slab_4k,         METRIC_GAUGE,   "# 4KiB slab objects in use"   )\
+    ACTION( mm_slab_8k,         METRIC_GAUGE,   "# 8KiB slab objects in use"   )\
+    ACTION( mm_slab_16k,        METRIC_GAUGE,   "# 16KiB slab objects in use"  )\
+    ACTION( mm_slab_32k,        METRIC_GAUGE,   "# 32KiB slab objects in use"  )\
+    ACTION( mm_slab_64k,        METRIC_GAUGE,   "# 64KiB slab objects in use"  )
+
+typedef struct {
+    MM_METRIC(METRIC_DECLARE)
+} mm_metrics_st;
+
+/* slab metrics are only updated with HAVE_SLAB_MM; works without setup */
+void mm_setup(mm_metrics_st *metrics);
+void mm_teardown(void);
 
 /*
  * Memory allocation and free wrappers with debugging information.
@@ -36,6 +100,7 @@ extern "C" {
  * cc_free
  *
  * cc_mmap
+ * cc_mmap_ex
  * cc_munmap
  */
 #define cc_alloc(_s)                                            \
@@ -63,6 +128,9 @@ extern "C" {
 #define cc_mmap(_s)                                             \
     _cc_mmap((size_t)(_s), __FILE__, __LINE__)
 
+#define cc_mmap_ex(_s, _f, _n)                                  \
+    _cc_mmap_ex((size_t)(_s), _f, _n, __FILE__, __LINE__)
+
 #define cc_munmap(_p, _s)                                       \
     _cc_munmap(_p, (size_t)(_s), __FILE__, __LINE__)
 
@@ -76,9 +144,33 @@ void * _cc_realloc(void *ptr, size_t size, const char *name, int line);
 void * _cc_realloc_move(void *ptr, size_t size, const char *name, int line);
 void _cc_free(void *ptr, const char *name, int line);
 void * _cc_mmap(size_t size, const char *name, int line);
+void * _cc_mmap_ex(size_t size, uint32_t flags, int node, const char *name,
+        int line);
 int _cc_munmap(void *p, size_t size, const char *name, int line);
 size_t _cc_alloc_usable_size(void *ptr, const char *name, int line);
 
+/*
+ * arena: a bump-pointer allocator for objects that share a lifetime, such as
+ * those of a request or of an event loop iteration. Objects are not freed one
+ * by one: arena_reset releases all of them at once and keeps the memory for
+ * the next round, arena_destroy returns it. Not thread-safe.
+ *
+ * Memory is carved from chunks of chunk_size bytes; a request larger than a
+ * quarter of that gets a chunk of its own, freed on reset.
+ */
+
+#define ARENA_CHUNK_SIZE    (64 * 1024)
+#define ARENA_ALIGN         16
+
+struct arena;
+
+struct arena *arena_create(size_t chunk_size); /* 0 for ARENA_CHUNK_SIZE */
+void arena_destroy(struct arena **arena);
+/* ARENA_ALIGN aligned, NULL if size is 0 or OOM */
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_zalloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,11 +22,17 @@ extern "C" {
 #endif
 
 #include <cc_debug.h>
+#include <cc_metric.h>
 #include <cc_queue.h>
 
 #include <inttypes.h>
 #include <stdbool.h>
 
+/*
+ * FREEPOOL: a single-threaded pool of objects linked through a STAILQ field,
+ * expanded in place for each object type.
+ */
+
 #define FREEPOOL(pool, name, type)                                  \
 STAILQ_HEAD(name, type);                                            \
 struct pool {                                                       \
@@ -96,6 +102,95 @@ struct pool {                                                       \
     (pool)->nused--;                                                \
 } while (0)
 
+/*
+ * pool: a pool of objects that can be borrowed and returned from any thread.
+ *
+ * Each thread has a magazine of free objects in front of a depot shared by
+ * all threads. Borrow and return only touch the calling thread's magazine
+ * until it runs dry or holds more than high objects; then up to low objects
+ * are taken from the depot, or all but the low most recently returned ones
+ * are moved to it, in one block, so the depot is visited at most once per
+ * high - low objects. The depot is a lock-free stack of such blocks. A
+ * thread's magazine is moved to the depot when the thread exits. With high
+ * set to 0 there are no magazines and every call goes to the depot.
+ *
+ * An object is borrowed as is: resetting its state is up to the caller, as
+ * is remembering whether it is free. Objects are only destroyed when the
+ * pool is, which must happen after all other threads stopped using it;
+ * objects still borrowed at that point are not destroyed.
+ */
+
+#define POOL_CACHE_HIGH 64
+#define POOL_CACHE_LOW  16
+
+/*
+ * A module reports on its pools by embedding POOL_METRIC_PREFIX in its own
+ * metrics, with a prefix naming the pool, and passing POOL_METRICS of them
+ * to pool_create. Like a histogram, the embedded metrics are consecutive
+ * and laid out as pool_metrics_st.
+ */
+/*          name                type            description */
+#define POOL_METRIC_PREFIX(ACTION, _p)                                      \
+    ACTION( _p##curr,           METRIC_GAUGE,   "# objects created"        )\
+    ACTION( _p##active,         METRIC_GAUGE,   "# objects borrowed"       )\
+    ACTION( _p##create,         METRIC_COUNTER, "# object creates"         )\
+    ACTION( _p##borrow,         METRIC_COUNTER, "# object borrows"         )\
+    ACTION( _p##borrow_ex,      METRIC_COUNTER, "# failed object borrows"  )\
+    ACTION( _p##return,         METRIC_COUNTER, "# object returns"         )\
+    ACTION( _p##spill,          METRIC_COUNTER, "# magazine spills"        )\
+    ACTION( _p##refill,         METRIC_COUNTER, "# magazine refills"       )
+
+#define POOL_METRIC(ACTION) POOL_METRIC_PREFIX(ACTION, pool_)
+
+typedef struct {
+    POOL_METRIC(METRIC_DECLARE)
+} pool_metrics_st;
+
+#if defined CC_STATS && CC_STATS == 1
+#define POOL_METRICS(_base, _p)                                             \
+    ((_base) == NULL ? NULL : (pool_metrics_st *)&(_base)->_p##curr)
+#else
+#define POOL_METRICS(_base, _p) NULL
+#endif
+
+typedef void *(*pool_create_fn)(void);
+typedef void (*pool_destroy_fn)(void *);
+typedef void (*pool_iter_fn)(void *, void *);
+
+struct pool;
+
+/*
+ * max caps the number of objects created by the pool, 0 for unlimited;
+ * metrics can be NULL
+ */
+struct pool *pool_create(const char *name, uint32_t max, uint32_t high,
+        uint32_t low, pool_create_fn create, pool_destroy_fn destroy,
+        pool_metrics_st *metrics);
+void pool_destroy(struct pool **pool);
+
+/* create objects into the depot until it holds n, return # free objects */
+uint32_t pool_prealloc(struct pool *pool, uint32_t n);
+
+/* NULL if the pool is at max or creating an object failed */
+void *pool_borrow(struct pool *pool);
+void pool_return(struct pool *pool, void *obj);
+
+/* borrow up to n objects into obj, return # borrowed */
+uint32_t pool_borrow_n(struct pool *pool, void **obj, uint32_t n);
+void pool_return_n(struct pool *pool, void **obj, uint32_t n);
+
+/* move the calling thread's magazine to the depot */
+void pool_flush(struct pool *pool);
+
+/* # free objects in the depot and all magazines, approximate */
+uint32_t pool_nfree(struct pool *pool);
+
+/*
+ * call fn(obj, arg) on every free object, other threads must not use the
+ * pool meanwhile
+ */
+void pool_foreach_free(struct pool *pool, pool_iter_fn fn, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
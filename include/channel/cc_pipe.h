@@ -23,6 +23,7 @@ extern "C" {
 
 #include <cc_debug.h>
 #include <cc_metric.h>
+#include <cc_pool.h>
 #include <channel/cc_channel.h>
 
 #include <stdbool.h>
@@ -61,7 +62,8 @@ typedef struct {
     ACTION( pipe_send,           METRIC_COUNTER, "# send attempted"              )\
     ACTION( pipe_send_ex,        METRIC_COUNTER, "# send exceptions"             )\
     ACTION( pipe_send_byte,      METRIC_COUNTER, "# bytes sent"                  )\
-    ACTION( pipe_flag_ex,        METRIC_COUNTER, "# pipe flag exceptions"        )
+    ACTION( pipe_flag_ex,        METRIC_COUNTER, "# pipe flag exceptions"        )\
+    POOL_METRIC_PREFIX(ACTION, pipe_conn_pool_)
 
 typedef struct {
     PIPE_METRIC(METRIC_DECLARE)
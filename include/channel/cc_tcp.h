@@ -25,11 +25,13 @@ extern "C" {
 #include <cc_define.h>
 #include <cc_event.h>
 #include <cc_option.h>
+#include <cc_pool.h>
 #include <cc_queue.h>
 #include <cc_util.h>
 #include <channel/cc_channel.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -38,13 +40,23 @@ extern "C" {
  * This implements the channel interface for TCP.
  */
 
-#define TCP_BACKLOG  128
-#define TCP_POOLSIZE 0 /* unlimited */
-
-/*          name            type                default         description */
-#define TCP_OPTION(ACTION)                                                                \
-    ACTION( tcp_backlog,    OPTION_TYPE_UINT,   TCP_BACKLOG,    "tcp conn backlog limit" )\
-    ACTION( tcp_poolsize,   OPTION_TYPE_UINT,   TCP_POOLSIZE,   "tcp conn pool size"     )
+#define TCP_BACKLOG      128
+#define TCP_POOLSIZE     0 /* unlimited */
+#define TCP_ZCOPY_MIN    (16 * KiB)
+#define TCP_SENDFILE_MAX (1 * MiB)
+#define TCP_ACCEPT_RATE  0 /* unlimited */
+#define TCP_MAX_ACTIVE   0 /* unlimited */
+#define TCP_ACCEPT_SHED  false
+
+/*          name                type                default             description */
+#define TCP_OPTION(ACTION)                                                                          \
+    ACTION( tcp_backlog,        OPTION_TYPE_UINT,   TCP_BACKLOG,        "tcp conn backlog limit"   )\
+    ACTION( tcp_poolsize,       OPTION_TYPE_UINT,   TCP_POOLSIZE,       "tcp conn pool size"       )\
+    ACTION( tcp_zcopy_min,      OPTION_TYPE_UINT,   TCP_ZCOPY_MIN,      "zero-copy send threshold" )\
+    ACTION( tcp_sendfile_max,   OPTION_TYPE_UINT,   TCP_SENDFILE_MAX,   "max size of one sendfile" )\
+    ACTION( tcp_accept_rate,    OPTION_TYPE_UINT,   TCP_ACCEPT_RATE,    "max accepts/sec in batch" )\
+    ACTION( tcp_max_active,     OPTION_TYPE_UINT,   TCP_MAX_ACTIVE,     "max tcp conn borrowed"    )\
+    ACTION( tcp_accept_shed,    OPTION_TYPE_BOOL,   TCP_ACCEPT_SHED,    "reject conns over limits" )
 
 typedef struct {
     TCP_OPTION(OPTION_DECLARE)
@@ -72,7 +84,18 @@ typedef struct {
     ACTION( tcp_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
     ACTION( tcp_send,           METRIC_COUNTER, "# send attempted"             )\
     ACTION( tcp_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
-    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )
+    ACTION( tcp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( tcp_zcopy,          METRIC_COUNTER, "# zero-copy sends"            )\
+    ACTION( tcp_zcopy_fallback, METRIC_COUNTER, "# zero-copy sends copied"     )\
+    ACTION( tcp_zcopy_done,     METRIC_COUNTER, "# zero-copy sends completed"  )\
+    ACTION( tcp_zcopy_copied,   METRIC_COUNTER, "# completed by kernel copy"   )\
+    ACTION( tcp_sendfile,       METRIC_COUNTER, "# sendfile attempted"         )\
+    ACTION( tcp_sendfile_byte,  METRIC_COUNTER, "# bytes sent by sendfile"     )\
+    ACTION( tcp_accept_batch,   METRIC_COUNTER, "# batch accepts attempted"    )\
+    ACTION( tcp_accept_full,    METRIC_COUNTER, "# batches cut by max active"  )\
+    ACTION( tcp_accept_paced,   METRIC_COUNTER, "# batches cut by accept rate" )\
+    ACTION( tcp_accept_shed,    METRIC_COUNTER, "# conns rejected over limits" )\
+    POOL_METRIC_PREFIX(ACTION, tcp_conn_pool_)
 
 typedef struct {
     TCP_METRIC(METRIC_DECLARE)
@@ -91,6 +114,14 @@ struct tcp_conn {
     unsigned                state:4;        /* channel state */
     unsigned                flags:12;       /* annotation fields */
 
+    bool                    zcopy;          /* SO_ZEROCOPY enabled? */
+    uint32_t                zc_sent;        /* # zero-copy sends issued */
+    uint32_t                zc_done;        /* # zero-copy sends completed */
+
+    TAILQ_ENTRY(tcp_conn)   info_tqe;       /* for tcp_info sampler */
+    bool                    sampled;        /* in a tcp_info sampler? */
+    uint32_t                info_retrans;   /* # retrans as of last sample */
+
     err_i                   err;            /* errno */
 };
 
@@ -127,14 +158,77 @@ ssize_t tcp_send(struct tcp_conn *c, void *buf, size_t nbyte); /* channel_send_f
 ssize_t tcp_recvv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 ssize_t tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte);
 
+/*
+ * open n listeners on the same address with SO_REUSEPORT, c[i] of them can
+ * be registered with the event base of worker i (see event_group_base), which
+ * then accepts its own connections without a handoff. With steer, a
+ * connection goes to listener i if it arrives on cpu i (modulo n), best paired
+ * with pinned workers; if it can't be set up, the call fails and err of the
+ * listener concerned tells why. On failure, none of them is left open.
+ */
+bool tcp_listen_reuseport(struct addrinfo *ai, struct tcp_conn **c, uint32_t n,
+        bool steer);
+
+/**
+ * Zero-copy send (Linux MSG_ZEROCOPY): once enabled on a connection, sends of
+ * at least tcp_zcopy_min bytes hand pages to the kernel instead of copying
+ * them, so the memory sent must be left unchanged until the send completes.
+ * Smaller sends, or sends on a connection without zero-copy, copy as usual.
+ *
+ * Right after a send, tcp_zcopy_ticket returns a ticket for it, and the
+ * memory sent can be reused once tcp_zcopy_done returns true for the ticket.
+ * Completions arrive on the socket error queue, which is signaled as an error
+ * event (e.g. EPOLLERR); tcp_zcopy_reap processes them and returns how many
+ * sends completed, or CC_ERROR.
+ */
+rstatus_i tcp_zcopy_enable(struct tcp_conn *c);
+ssize_t tcp_send_zcopy(struct tcp_conn *c, void *buf, size_t nbyte);
+ssize_t tcp_sendv_zcopy(struct tcp_conn *c, struct array *bufv, size_t nbyte);
+int tcp_zcopy_reap(struct tcp_conn *c);
+
+static inline uint32_t
+tcp_zcopy_ticket(const struct tcp_conn *c)
+{
+    return c->zc_sent;
+}
+
+static inline bool
+tcp_zcopy_done(const struct tcp_conn *c, uint32_t ticket)
+{
+    return (int32_t)(c->zc_done - ticket) >= 0;
+}
+
+/*
+ * send up to nbyte (capped at tcp_sendfile_max) from fd at *offset without
+ * copying through user space, *offset is advanced by the bytes sent
+ */
+ssize_t tcp_sendfile(struct tcp_conn *c, int fd, off_t *offset, size_t nbyte);
+
+/* on failure sc->err tells why, EAGAIN meaning no more connection pending */
 bool tcp_accept(struct tcp_conn *sc, struct tcp_conn *c);   /* channel_accept_fn */
 void tcp_reject(struct tcp_conn *sc);                       /* channel_reject_fn */
 void tcp_reject_all(struct tcp_conn *sc);                   /* channel_reject_fn */
 
+/*
+ * accept up to n pending connections into tcp_conns borrowed from the pool,
+ * stored in c, and return the number accepted. sc->err is 0 if n were
+ * accepted, EAGAIN if the backlog was drained, or EBUSY if tcp_max_active
+ * (borrowed connections, including those not from this call), the pool size
+ * or tcp_accept_rate stopped it short. Connections over these limits are left
+ * in the backlog, or accepted and closed with tcp_accept_shed, at most n per
+ * call; EAGAIN then means the backlog was drained by shedding.
+ *
+ * The accept rate is accounted for the module as a whole in one-second
+ * windows, and is meant to be enforced by a single accepting thread.
+ */
+int tcp_accept_batch(struct tcp_conn *sc, struct tcp_conn **c, uint32_t n);
+
 /* functions getting/setting connection attribute */
 int tcp_set_blocking(int sd);
 int tcp_set_nonblocking(int sd);
 int tcp_set_reuseaddr(int sd);
+int tcp_set_reuseport(int sd);
+int tcp_set_incoming_cpu(int sd, int cpu);
 int tcp_set_tcpnodelay(int sd);
 int tcp_set_keepalive(int sd);
 int tcp_set_linger(int sd, int timeout);
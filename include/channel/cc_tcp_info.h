@@ -0,0 +1,152 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <channel/cc_tcp.h>
+
+#include <stdint.h>
+
+/**
+ * TCP_INFO sampling: the kernel's view of a connection (RTT, retransmits,
+ * congestion window, unacked segments) tells a slow network apart from a
+ * slow server. Connections added to a sampler are sampled round-robin,
+ * tcp_info_nsample at a time, each time tcp_info_sample is called, which is
+ * meant to be driven by a recurring timing wheel event:
+ *
+ *     timing_wheel_insert(tw, &intvl, true, tcp_info_sample, sampler);
+ *
+ * and every sample is recorded in the histograms below; retransmits are
+ * counted since the previous sample of the connection. A sampler is not
+ * thread-safe, connections owned by different threads go to samplers of
+ * their own, which can share the module metrics.
+ *
+ * A connection must be deleted from its sampler before it is closed.
+ * Linux only, sampling fails with ENOTSUP elsewhere.
+ */
+
+#define TCP_INFO_NSAMPLE    64
+
+/*          name                type                default             description */
+#define TCP_INFO_OPTION(ACTION)                                                                   \
+    ACTION( tcp_info_nsample,   OPTION_TYPE_UINT,   TCP_INFO_NSAMPLE,   "# conns sampled per run" )
+
+typedef struct {
+    TCP_INFO_OPTION(OPTION_DECLARE)
+} tcp_info_options_st;
+
+/* histograms, see INCR_LOG2 */
+/*          name                 type            description */
+#define TCP_INFO_METRIC(ACTION)                                           \
+    ACTION( tcp_info_sample,     METRIC_COUNTER, "# conns sampled"       )\
+    ACTION( tcp_info_sample_ex,  METRIC_COUNTER, "# failed samples"      )\
+    ACTION( tcp_rtt_0,           METRIC_COUNTER, "# rtt 0us"             )\
+    ACTION( tcp_rtt_1,           METRIC_COUNTER, "# rtt 1us"             )\
+    ACTION( tcp_rtt_2,           METRIC_COUNTER, "# rtt 2-3us"           )\
+    ACTION( tcp_rtt_4,           METRIC_COUNTER, "# rtt 4-7us"           )\
+    ACTION( tcp_rtt_8,           METRIC_COUNTER, "# rtt 8-15us"          )\
+    ACTION( tcp_rtt_16,          METRIC_COUNTER, "# rtt 16-31us"         )\
+    ACTION( tcp_rtt_32,          METRIC_COUNTER, "# rtt 32-63us"         )\
+    ACTION( tcp_rtt_64,          METRIC_COUNTER, "# rtt 64-127us"        )\
+    ACTION( tcp_rtt_128,         METRIC_COUNTER, "# rtt 128-255us"       )\
+    ACTION( tcp_rtt_256,         METRIC_COUNTER, "# rtt 256-511us"       )\
+    ACTION( tcp_rtt_512,         METRIC_COUNTER, "# rtt 512-1023us"      )\
+    ACTION( tcp_rtt_1024,        METRIC_COUNTER, "# rtt 1024-2047us"     )\
+    ACTION( tcp_rtt_2048,        METRIC_COUNTER, "# rtt 2048-4095us"     )\
+    ACTION( tcp_rtt_4096,        METRIC_COUNTER, "# rtt 4096-8191us"     )\
+    ACTION( tcp_rtt_8192,        METRIC_COUNTER, "# rtt 8192-16383us"    )\
+    ACTION( tcp_rtt_16384,       METRIC_COUNTER, "# rtt 16384-32767us"   )\
+    ACTION( tcp_rtt_32768,       METRIC_COUNTER, "# rtt 32768-65535us"   )\
+    ACTION( tcp_rtt_65536,       METRIC_COUNTER, "# rtt 65536-131071us"  )\
+    ACTION( tcp_rtt_131072,      METRIC_COUNTER, "# rtt 131072-262143us" )\
+    ACTION( tcp_rtt_262144,      METRIC_COUNTER, "# rtt 262144us+"       )\
+    ACTION( tcp_retrans_0,       METRIC_COUNTER, "# retrans 0"           )\
+    ACTION( tcp_retrans_1,       METRIC_COUNTER, "# retrans 1"           )\
+    ACTION( tcp_retrans_2,       METRIC_COUNTER, "# retrans 2-3"         )\
+    ACTION( tcp_retrans_4,       METRIC_COUNTER, "# retrans 4-7"         )\
+    ACTION( tcp_retrans_8,       METRIC_COUNTER, "# retrans 8-15"        )\
+    ACTION( tcp_retrans_16,      METRIC_COUNTER, "# retrans 16-31"       )\
+    ACTION( tcp_retrans_32,      METRIC_COUNTER, "# retrans 32-63"       )\
+    ACTION( tcp_retrans_64,      METRIC_COUNTER, "# retrans 64+"         )\
+    ACTION( tcp_cwnd_0,          METRIC_COUNTER, "# cwnd segs 0"         )\
+    ACTION( tcp_cwnd_1,          METRIC_COUNTER, "# cwnd segs 1"         )\
+    ACTION( tcp_cwnd_2,          METRIC_COUNTER, "# cwnd segs 2-3"       )\
+    ACTION( tcp_cwnd_4,          METRIC_COUNTER, "# cwnd segs 4-7"       )\
+    ACTION( tcp_cwnd_8,          METRIC_COUNTER, "# cwnd segs 8-15"      )\
+    ACTION( tcp_cwnd_16,         METRIC_COUNTER, "# cwnd segs 16-31"     )\
+    ACTION( tcp_cwnd_32,         METRIC_COUNTER, "# cwnd segs 32-63"     )\
+    ACTION( tcp_cwnd_64,         METRIC_COUNTER, "# cwnd segs 64-127"    )\
+    ACTION( tcp_cwnd_128,        METRIC_COUNTER, "# cwnd segs 128-255"   )\
+    ACTION( tcp_cwnd_256,        METRIC_COUNTER, "# cwnd segs 256-511"   )\
+    ACTION( tcp_cwnd_512,        METRIC_COUNTER, "# cwnd segs 512+"      )\
+    ACTION( tcp_unacked_0,       METRIC_COUNTER, "# unacked segs 0"      )\
+    ACTION( tcp_unacked_1,       METRIC_COUNTER, "# unacked segs 1"      )\
+    ACTION( tcp_unacked_2,       METRIC_COUNTER, "# unacked segs 2-3"    )\
+    ACTION( tcp_unacked_4,       METRIC_COUNTER, "# unacked segs 4-7"    )\
+    ACTION( tcp_unacked_8,       METRIC_COUNTER, "# unacked segs 8-15"   )\
+    ACTION( tcp_unacked_16,      METRIC_COUNTER, "# unacked segs 16-31"  )\
+    ACTION( tcp_unacked_32,      METRIC_COUNTER, "# unacked segs 32-63"  )\
+    ACTION( tcp_unacked_64,      METRIC_COUNTER, "# unacked segs 64-127" )\
+    ACTION( tcp_unacked_128,     METRIC_COUNTER, "# unacked segs 128-255")\
+    ACTION( tcp_unacked_256,     METRIC_COUNTER, "# unacked segs 256-511")\
+    ACTION( tcp_unacked_512,     METRIC_COUNTER, "# unacked segs 512+"   )
+
+#define TCP_RTT_NBUCKET     20
+#define TCP_RETRANS_NBUCKET 8
+#define TCP_CWND_NBUCKET    11
+#define TCP_UNACKED_NBUCKET 11
+
+typedef struct {
+    TCP_INFO_METRIC(METRIC_DECLARE)
+} tcp_info_metrics_st;
+
+/* what is sampled of a connection */
+struct tcp_conn_info {
+    uint32_t    rtt;        /* smoothed rtt in usec */
+    uint32_t    rttvar;     /* rtt variance in usec */
+    uint32_t    retrans;    /* total # retransmitted segments */
+    uint32_t    cwnd;       /* congestion window in segments */
+    uint32_t    unacked;    /* # segments sent but not acked */
+};
+
+struct tcp_info_sampler;
+
+void tcp_info_setup(tcp_info_options_st *options, tcp_info_metrics_st *metrics);
+void tcp_info_teardown(void);
+
+struct tcp_info_sampler *tcp_info_sampler_create(void);
+void tcp_info_sampler_destroy(struct tcp_info_sampler **s);
+
+void tcp_info_add(struct tcp_info_sampler *s, struct tcp_conn *c);
+void tcp_info_del(struct tcp_info_sampler *s, struct tcp_conn *c);
+
+/* sample the next tcp_info_nsample connections of sampler s, a timeout_cb_fn */
+void tcp_info_sample(void *s);
+
+/* read TCP_INFO of a connection, without recording it */
+rstatus_i tcp_info_get(struct tcp_conn *c, struct tcp_conn_info *info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,185 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <cc_pool.h>
+#include <cc_queue.h>
+#include <channel/cc_channel.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+/**
+ * This implements the channel interface for UDP.
+ *
+ * Besides the per-datagram udp_recv/udp_send, which conform to the channel
+ * interface, datagrams can be moved in batches: udp_recv_batch and
+ * udp_send_batch take an array of datagrams borrowed from the datagram pool,
+ * and move as many as possible with one recvmmsg/sendmmsg on Linux (one
+ * recvmsg/sendmsg per datagram elsewhere). A single read event registered
+ * with event_add_read on udp_read_id can then be served with one call.
+ *
+ * On Linux, a datagram with segsz set is sent as datagrams of segsz bytes
+ * each (UDP GSO), and with udp_set_gro a received datagram may contain
+ * several datagrams of segsz bytes each, the last one possibly shorter (UDP
+ * GRO). GRO can deliver up to 64KiB at once, udp_dgram_size must be set to
+ * accommodate that. segsz is ignored on other platforms.
+ */
+
+#define UDP_POOLSIZE    0       /* unlimited */
+#define UDP_DGRAM_SIZE  2048    /* payload capacity */
+#define UDP_DGRAM_POOL  0       /* unlimited */
+#define UDP_BATCH_MAX   64      /* max # datagrams moved per call */
+
+/*          name                type                default             description */
+#define UDP_OPTION(ACTION)                                                                      \
+    ACTION( udp_poolsize,       OPTION_TYPE_UINT,   UDP_POOLSIZE,       "udp conn pool size"   )\
+    ACTION( udp_dgram_size,     OPTION_TYPE_UINT,   UDP_DGRAM_SIZE,     "datagram capacity"    )\
+    ACTION( udp_dgram_poolsize, OPTION_TYPE_UINT,   UDP_DGRAM_POOL,     "datagram pool size"   )
+
+typedef struct {
+    UDP_OPTION(OPTION_DECLARE)
+} udp_options_st;
+
+/*          name                type            description */
+#define UDP_METRIC(ACTION)                                                      \
+    ACTION( udp_conn_create,    METRIC_COUNTER, "# udp connections created"    )\
+    ACTION( udp_conn_create_ex, METRIC_COUNTER, "# udp conn create exceptions" )\
+    ACTION( udp_conn_destroy,   METRIC_COUNTER, "# udp connections destroyed"  )\
+    ACTION( udp_conn_curr,      METRIC_GAUGE,   "# udp conn allocated"         )\
+    ACTION( udp_conn_borrow,    METRIC_COUNTER, "# udp connections borrowed"   )\
+    ACTION( udp_conn_borrow_ex, METRIC_COUNTER, "# udp conn borrow exceptions" )\
+    ACTION( udp_conn_return,    METRIC_COUNTER, "# udp connections returned"   )\
+    ACTION( udp_conn_active,    METRIC_GAUGE,   "# udp conn being borrowed"    )\
+    ACTION( udp_open,           METRIC_COUNTER, "# udp binds/connects made"    )\
+    ACTION( udp_open_ex,        METRIC_COUNTER, "# udp open exceptions"        )\
+    ACTION( udp_close,          METRIC_COUNTER, "# udp connection closed"      )\
+    ACTION( udp_recv,           METRIC_COUNTER, "# recv attempted"             )\
+    ACTION( udp_recv_ex,        METRIC_COUNTER, "# recv exceptions"            )\
+    ACTION( udp_recv_dgram,     METRIC_COUNTER, "# datagrams received"         )\
+    ACTION( udp_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
+    ACTION( udp_recv_trunc,     METRIC_COUNTER, "# datagrams truncated"        )\
+    ACTION( udp_send,           METRIC_COUNTER, "# send attempted"             )\
+    ACTION( udp_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
+    ACTION( udp_send_dgram,     METRIC_COUNTER, "# datagrams sent"             )\
+    ACTION( udp_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( udp_dgram_curr,     METRIC_GAUGE,   "# datagrams allocated"        )\
+    ACTION( udp_dgram_active,   METRIC_GAUGE,   "# datagrams being borrowed"   )\
+    ACTION( udp_dgram_ex,       METRIC_COUNTER, "# datagram borrow exceptions" )\
+    POOL_METRIC_PREFIX(ACTION, udp_conn_pool_)\
+    POOL_METRIC_PREFIX(ACTION, udp_dgram_pool_)
+
+typedef struct {
+    UDP_METRIC(METRIC_DECLARE)
+} udp_metrics_st;
+
+struct udp_conn {
+    STAILQ_ENTRY(udp_conn)  next;           /* for conn pool */
+    bool                    free;           /* in use? */
+
+    ch_level_e              level;          /* meta or base */
+    int                     sd;             /* socket descriptor */
+
+    size_t                  recv_nbyte;     /* received (read) bytes */
+    size_t                  send_nbyte;     /* sent (written) bytes */
+
+    unsigned                state:4;        /* channel state */
+    unsigned                flags:12;       /* annotation fields */
+
+    err_i                   err;            /* errno */
+};
+
+STAILQ_HEAD(udp_conn_sqh, udp_conn); /* corresponding header type for the STAILQ */
+
+struct udp_dgram {
+    STAILQ_ENTRY(udp_dgram) next;           /* for app use */
+    bool                    free;           /* in use? */
+
+    struct sockaddr_storage addr;           /* peer, source or destination */
+    socklen_t               addrlen;        /* 0: the connected peer */
+    uint16_t                segsz;          /* GSO/GRO segment size, or 0 */
+    bool                    truncated;      /* didn't fit, len is 0 */
+
+    uint32_t                len;            /* # bytes of payload */
+    uint32_t                cap;            /* payload capacity */
+    char                    data[];
+};
+
+STAILQ_HEAD(udp_dgram_sqh, udp_dgram);
+
+void udp_setup(udp_options_st *options, udp_metrics_st *metrics);
+void udp_teardown(void);
+
+void udp_conn_reset(struct udp_conn *c);
+
+/* resource management */
+struct udp_conn *udp_conn_create(void);     /* channel_get_fn, with allocation */
+void udp_conn_destroy(struct udp_conn **c); /* channel_put_fn, with deallocation  */
+
+struct udp_conn *udp_conn_borrow(void);     /* channel_get_fn, with resource pool */
+void udp_conn_return(struct udp_conn **c);  /* channel_put_fn, with resource pool */
+
+/* datagrams come from a pool, data is undefined and len 0 when borrowed */
+struct udp_dgram *udp_dgram_borrow(void);
+void udp_dgram_return(struct udp_dgram **dg);
+
+static inline ch_id_i udp_read_id(struct udp_conn *c)
+{
+    return c->sd;
+}
+
+static inline ch_id_i udp_write_id(struct udp_conn *c)
+{
+    return c->sd;
+}
+
+/* basic channel maintenance, sockets are nonblocking */
+bool udp_bind(struct addrinfo *ai, struct udp_conn *c);     /* channel_open_fn, server */
+bool udp_connect(struct addrinfo *ai, struct udp_conn *c);  /* channel_open_fn, client */
+void udp_close(struct udp_conn *c);                         /* channel_term_fn */
+
+/* one datagram on a connected socket */
+ssize_t udp_recv(struct udp_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
+ssize_t udp_send(struct udp_conn *c, void *buf, size_t nbyte); /* channel_send_fn */
+
+/*
+ * move up to n (capped at UDP_BATCH_MAX) datagrams, return the number moved
+ * or CC_EAGAIN/CC_ERROR if none was; received datagrams get len, addr and
+ * segsz filled in. A datagram larger than cap is dropped by the kernel past
+ * cap: it still takes its slot, but comes back with truncated set and len 0
+ */
+int udp_recv_batch(struct udp_conn *c, struct udp_dgram **dg, uint32_t n);
+int udp_send_batch(struct udp_conn *c, struct udp_dgram **dg, uint32_t n);
+
+/* functions getting/setting connection attribute */
+int udp_set_nonblocking(int sd);
+int udp_set_reuseaddr(int sd);
+int udp_set_gro(int sd);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,162 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_metric.h>
+#include <cc_option.h>
+#include <cc_pool.h>
+#include <cc_queue.h>
+#include <channel/cc_channel.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * This implements the channel interface for Unix domain (stream) sockets.
+ *
+ * Besides data, file descriptors can be passed to the peer (SCM_RIGHTS). This
+ * lets a process hand its listening sockets and live connections over to
+ * another one, e.g. during a hot restart: the old process sends the sd of each
+ * tcp_conn along with whatever state the new process needs to take over, and
+ * the new process wraps the fds it receives in connections of its own. The
+ * sockets stay open throughout, so no connection is dropped or re-established.
+ *
+ * unix_send_fd sends at least one byte of data along with the fds, which stay
+ * open in the sender, and unix_recv_fd receives them with that data as new
+ * (close-on-exec where supported) fds.
+ */
+
+#define UNIX_BACKLOG  128
+#define UNIX_POOLSIZE 0     /* unlimited */
+#define UNIX_NFD_MAX  64    /* max # fds passed per message */
+
+/*          name            type                default         description */
+#define UNIX_OPTION(ACTION)                                                                 \
+    ACTION( unix_backlog,   OPTION_TYPE_UINT,   UNIX_BACKLOG,   "unix conn backlog limit" )\
+    ACTION( unix_poolsize,  OPTION_TYPE_UINT,   UNIX_POOLSIZE,  "unix conn pool size"     )
+
+typedef struct {
+    UNIX_OPTION(OPTION_DECLARE)
+} unix_options_st;
+
+/*          name                  type            description */
+#define UNIX_METRIC(ACTION)                                                       \
+    ACTION( unix_conn_create,    METRIC_COUNTER, "# unix connections created"   )\
+    ACTION( unix_conn_create_ex, METRIC_COUNTER, "# unix conn create exceptions")\
+    ACTION( unix_conn_destroy,   METRIC_COUNTER, "# unix connections destroyed" )\
+    ACTION( unix_conn_curr,      METRIC_GAUGE,   "# unix conn allocated"        )\
+    ACTION( unix_conn_borrow,    METRIC_COUNTER, "# unix connections borrowed"  )\
+    ACTION( unix_conn_borrow_ex, METRIC_COUNTER, "# unix conn borrow exceptions")\
+    ACTION( unix_conn_return,    METRIC_COUNTER, "# unix connections returned"  )\
+    ACTION( unix_conn_active,    METRIC_GAUGE,   "# unix conn being borrowed"   )\
+    ACTION( unix_accept,         METRIC_COUNTER, "# unix connection accepts"    )\
+    ACTION( unix_accept_ex,      METRIC_COUNTER, "# unix accept exceptions"     )\
+    ACTION( unix_reject,         METRIC_COUNTER, "# unix connection rejects"    )\
+    ACTION( unix_reject_ex,      METRIC_COUNTER, "# unix reject exceptions"     )\
+    ACTION( unix_connect,        METRIC_COUNTER, "# unix connects made"         )\
+    ACTION( unix_connect_ex,     METRIC_COUNTER, "# unix connect exceptions"    )\
+    ACTION( unix_close,          METRIC_COUNTER, "# unix connection closed"     )\
+    ACTION( unix_recv,           METRIC_COUNTER, "# recv attempted"             )\
+    ACTION( unix_recv_ex,        METRIC_COUNTER, "# recv exceptions"            )\
+    ACTION( unix_recv_byte,      METRIC_COUNTER, "# bytes received"             )\
+    ACTION( unix_recv_fd,        METRIC_COUNTER, "# fds received"               )\
+    ACTION( unix_send,           METRIC_COUNTER, "# send attempted"             )\
+    ACTION( unix_send_ex,        METRIC_COUNTER, "# send exceptions"            )\
+    ACTION( unix_send_byte,      METRIC_COUNTER, "# bytes sent"                 )\
+    ACTION( unix_send_fd,        METRIC_COUNTER, "# fds sent"                   )\
+    POOL_METRIC_PREFIX(ACTION, unix_conn_pool_)
+
+typedef struct {
+    UNIX_METRIC(METRIC_DECLARE)
+} unix_metrics_st;
+
+struct unix_conn {
+    STAILQ_ENTRY(unix_conn) next;           /* for conn pool */
+    bool                    free;           /* in use? */
+
+    ch_level_e              level;          /* meta or base */
+    int                     sd;             /* socket descriptor */
+
+    size_t                  recv_nbyte;     /* received (read) bytes */
+    size_t                  send_nbyte;     /* sent (written) bytes */
+
+    unsigned                state:4;        /* channel state */
+    unsigned                flags:12;       /* annotation fields */
+
+    err_i                   err;            /* errno */
+};
+
+STAILQ_HEAD(unix_conn_sqh, unix_conn); /* corresponding header type for the STAILQ */
+
+void unix_setup(unix_options_st *options, unix_metrics_st *metrics);
+void unix_teardown(void);
+
+void unix_conn_reset(struct unix_conn *c);
+
+/* resource management */
+struct unix_conn *unix_conn_create(void);       /* channel_get_fn, with allocation */
+void unix_conn_destroy(struct unix_conn **c);   /* channel_put_fn, with deallocation  */
+
+struct unix_conn *unix_conn_borrow(void);       /* channel_get_fn, with resource pool */
+void unix_conn_return(struct unix_conn **c);    /* channel_put_fn, with resource pool */
+
+static inline ch_id_i unix_read_id(struct unix_conn *c)
+{
+    return c->sd;
+}
+
+static inline ch_id_i unix_write_id(struct unix_conn *c)
+{
+    return c->sd;
+}
+
+/*
+ * basic channel maintenance; a socket file at path nobody listens on is
+ * replaced, unix_listen fails with EADDRINUSE if somebody does
+ */
+bool unix_connect(const char *path, struct unix_conn *c);   /* channel_open_fn, client */
+bool unix_listen(const char *path, struct unix_conn *c);    /* channel_open_fn, server */
+void unix_close(struct unix_conn *c);                       /* channel_term_fn */
+ssize_t unix_recv(struct unix_conn *c, void *buf, size_t nbyte); /* channel_recv_fn */
+ssize_t unix_send(struct unix_conn *c, void *buf, size_t nbyte); /* channel_send_fn */
+
+/* on failure sc->err tells why, EAGAIN meaning no more connection pending */
+bool unix_accept(struct unix_conn *sc, struct unix_conn *c); /* channel_accept_fn */
+void unix_reject(struct unix_conn *sc);                      /* channel_reject_fn */
+
+/*
+ * pass nfd (up to UNIX_NFD_MAX) fds along with nbyte (> 0) bytes of data;
+ * on receipt *nfd is set to the number of fds received into fd, which has
+ * room for UNIX_NFD_MAX
+ */
+ssize_t unix_send_fd(struct unix_conn *c, void *buf, size_t nbyte,
+        const int *fd, uint32_t nfd);
+ssize_t unix_recv_fd(struct unix_conn *c, void *buf, size_t nbyte, int *fd,
+        uint32_t *nfd);
+
+int unix_set_nonblocking(int sd);
+
+#ifdef __cplusplus
+}
+#endif
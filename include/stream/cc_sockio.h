@@ -47,17 +47,23 @@ extern "C" {
 
 #include <cc_stream.h>
 
+#include <cc_array.h>
 #include <cc_define.h>
+#include <cc_event.h>
 #include <cc_metric.h>
+#include <cc_pool.h>
+#include <time/cc_wheel.h>
 
 #include <inttypes.h>
 #include <stdlib.h>
 
 #define BUFSOCK_POOLSIZE 0 /* unlimited */
+#define BUFSOCK_WQ_SIZE  16
 
 /*          name                type                default             description */
-#define SOCKIO_OPTION(ACTION)                                                             \
-    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit" )
+#define SOCKIO_OPTION(ACTION)                                                                   \
+    ACTION( buf_sock_poolsize,  OPTION_TYPE_UINT,   BUFSOCK_POOLSIZE,   "buf_sock limit"       )\
+    ACTION( buf_sock_wq_size,   OPTION_TYPE_UINT,   BUFSOCK_WQ_SIZE,    "max # queued writes"  )
 
 typedef struct {
     SOCKIO_OPTION(OPTION_DECLARE)
@@ -72,12 +78,28 @@ typedef struct {
     ACTION( buf_sock_borrow,    METRIC_COUNTER, "# buf sock borrowed"          )\
     ACTION( buf_sock_borrow_ex, METRIC_COUNTER, "# buf sock borrow exceptions" )\
     ACTION( buf_sock_return,    METRIC_COUNTER, "# buf sock returned"          )\
-    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )
+    ACTION( buf_sock_active,    METRIC_GAUGE,   "# buf sock being borrowed"    )\
+    ACTION( buf_sock_writev,    METRIC_COUNTER, "# write queue flushes"        )\
+    ACTION( buf_sock_wq_full,   METRIC_COUNTER, "# writes not queued: full"    )\
+    ACTION( buf_sock_idle_to,   METRIC_COUNTER, "# idle buf sock timed out"    )\
+    ACTION( buf_sock_req_to,    METRIC_COUNTER, "# requests timed out"         )\
+    ACTION( buf_sock_dl_check,  METRIC_COUNTER, "# deadline checks deferred"   )\
+    POOL_METRIC_PREFIX(ACTION, buf_sock_pool_)
 
 typedef struct {
     SOCKIO_METRIC(METRIC_DECLARE)
 } sockio_metrics_st;
 
+/* called once a queued region has been sent, or discarded with the buf_sock */
+typedef void (*buf_sock_release_fn)(void *arg);
+
+struct buf_sock;
+
+/* called once a deadline has passed, idle tells which one */
+typedef void (*buf_sock_expire_fn)(struct buf_sock *s, bool idle);
+
+struct buf_sock_wseg; /* a queued write */
+
 struct buf_sock {
     /* these fields are useful for resource managmenet */
     STAILQ_ENTRY(buf_sock)  next;
@@ -91,6 +113,23 @@ struct buf_sock {
     struct tcp_conn         *ch;
     struct buf              *rbuf;
     struct buf              *wbuf;
+
+    /* write queue, see buf_tcp_writev */
+    struct buf_sock_wseg    *wq;        /* ring of queued writes */
+    uint32_t                wq_head;    /* index of the oldest write */
+    uint32_t                wq_nseg;    /* # queued writes */
+    uint32_t                wq_wbuf;    /* # bytes of wbuf data queued */
+    struct array            *wiov;      /* iovecs of a flush */
+
+    /* deadlines, see buf_sock_deadline_arm */
+    struct timing_wheel     *tw;        /* wheel checking the deadlines */
+    timeout_handle_i        tev;        /* pending check, stale once fired */
+    buf_sock_expire_fn      expire;
+    struct timeout          idle;       /* idle timeout, unset if none */
+    struct timeout          req;        /* request timeout, unset if none */
+    struct timeout          idle_due;   /* last activity + idle */
+    struct timeout          req_due;    /* request start + req, or unset */
+    struct timeout          check_due;  /* when tev fires */
 };
 
 STAILQ_HEAD(buf_sock_sqh, buf_sock); /* corresponding header type for the STAILQ */
@@ -112,6 +151,71 @@ rstatus_i buf_tcp_write(struct buf_sock *);
 rstatus_i dbuf_tcp_read(struct buf_sock *); /* buf_tcp_read with
                                                doubling buffer */
 
+/**
+ * Scatter/gather alternative to buf_tcp_write: besides what is written into
+ * wbuf, whole bufs and memory owned by someone else (e.g. item payloads) can
+ * be queued for sending without copying them into wbuf first.
+ *
+ * buf_sock_queue_buf takes over a buf with data, which is returned to the pool
+ * once sent. buf_sock_queue_ref queues len bytes at data, which must stay
+ * valid and unchanged until release is called with arg. Data in wbuf is sent
+ * in order with queued writes, as of the time of queueing or flushing; while
+ * the queue isn't empty wbuf may be grown or shifted (e.g. by dbuf_double),
+ * but data in it must not be read off or reset.
+ * Up to buf_sock_wq_size writes can be queued, CC_ENOMEM is returned if the
+ * queue is full, in which case ownership stays with the caller.
+ *
+ * buf_tcp_writev flushes the queue with a single writev and returns the same
+ * status as buf_tcp_write. Writes that are left over are kept in the queue
+ * for the next call. Queued writes are discarded (and released) when the
+ * buf_sock is reset or destroyed.
+ */
+rstatus_i buf_sock_queue_buf(struct buf_sock *s, struct buf *buf);
+rstatus_i buf_sock_queue_ref(struct buf_sock *s, const void *data, size_t len,
+        buf_sock_release_fn release, void *arg);
+rstatus_i buf_tcp_writev(struct buf_sock *s);
+
+/**
+ * Idle and request deadlines, checked by a timing wheel: up to one timeout
+ * event is pending per buf_sock, no matter how often it is active.
+ *
+ * buf_sock_deadline_arm sets the idle and/or request timeout (intervals, NULL
+ * for none) of s and schedules its first check on tw. Activity only records a
+ * timestamp, read off the cached clock (time/cc_clock.h): buf_sock_touch
+ * (called by the read functions on receipt of data) pushes the idle deadline
+ * out, and buf_sock_request_start/done set and clear the deadline of the
+ * request in progress. When the check fires, it looks at these timestamps and
+ * either schedules itself again for the earliest one still ahead, or calls
+ * expire with s->ch->err set to ETIMEDOUT. expire is expected to close the
+ * connection, it may return s to the pool.
+ *
+ * A new request deadline earlier than the pending check moves the check, which
+ * happens at most once per request timeout while requests keep coming. Checks
+ * further out than the wheel covers are split into several.
+ * The deadlines are disarmed when the buf_sock is reset or destroyed.
+ */
+rstatus_i buf_sock_deadline_arm(struct timing_wheel *tw, struct buf_sock *s,
+        struct timeout *idle, struct timeout *req, buf_sock_expire_fn expire);
+void buf_sock_deadline_disarm(struct buf_sock *s);
+void buf_sock_touch(struct buf_sock *s);
+rstatus_i buf_sock_request_start(struct buf_sock *s);
+void buf_sock_request_done(struct buf_sock *s);
+
+/**
+ * Completion-based alternative to buf_tcp_read/buf_tcp_write: submit hands
+ * the transfer to the event base (see event_recv/event_send in cc_event.h),
+ * and done is called from the I/O callback with the result to advance the
+ * buffer and map the result to the same status buf_tcp_read/write return.
+ *
+ * buf_sock_register registers the rbuf/wbuf of all pooled buf_socks with the
+ * event base, so that transfers on them use fixed buffers.
+ */
+rstatus_i buf_sock_register(struct event_base *evb);
+rstatus_i buf_tcp_read_submit(struct event_base *evb, struct buf_sock *s);
+rstatus_i buf_tcp_read_done(struct buf_sock *s, int res);
+rstatus_i buf_tcp_write_submit(struct event_base *evb, struct buf_sock *s);
+rstatus_i buf_tcp_write_done(struct buf_sock *s, int res);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,79 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <cc_define.h>
+#include <cc_option.h>
+#include <time/cc_timer.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * A coarse, cached clock for hot paths that need "now" many times per event
+ * loop iteration but can live with it being slightly behind: stamping reads
+ * and requests, arming deadlines, prefixing log lines.
+ *
+ * The clock is refreshed by clock_update(): event_wait does so every time the
+ * wait returns, before any callback runs, and a ticker thread started at setup
+ * when clock_ticker_us is non-zero does so periodically. Readers only load the
+ * cached value, so the clock is at most one update behind the system clock;
+ * a thread that neither waits on events nor runs the ticker must update it.
+ *
+ * The monotonic reading is in the same domain as struct timeout, so cached
+ * and precise timeouts can be mixed freely. Before the module is set up, or
+ * after it's torn down, every reader falls back to reading the system clock.
+ */
+
+#define CLOCK_TICKER_US 0   /* no ticker thread, updated by the event loop */
+
+/*          name              type              default          description */
+#define CLOCK_OPTION(ACTION)                                                                       \
+    ACTION( clock_ticker_us,  OPTION_TYPE_UINT, CLOCK_TICKER_US, "clock update interval, 0: none" )
+
+typedef struct {
+    CLOCK_OPTION(OPTION_DECLARE)
+} clock_options_st;
+
+rstatus_i clock_setup(clock_options_st *options);
+void clock_teardown(void);
+
+/* refresh the cached clock, thread-safe */
+void clock_update(void);
+
+/* read the cached monotonic clock, since an unspecified point */
+int64_t clock_ns(void);
+int64_t clock_us(void);
+int64_t clock_ms(void);
+int64_t clock_sec(void);
+/* read the cached wall clock, seconds since the epoch */
+time_t clock_unix(void);
+
+/* timeout_add_intvl, timeout_ns and timeout_expired against the cached clock */
+void clock_timeout_add(struct timeout *e, struct timeout *t);
+int64_t clock_timeout_ns(struct timeout *e);
+bool clock_timeout_expired(struct timeout *e);
+
+#ifdef __cplusplus
+}
+#endif
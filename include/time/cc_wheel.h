@@ -46,7 +46,10 @@ extern "C" {
     ACTION( timing_wheel_event,     METRIC_GAUGE,   "# tevents in timing wheels"   )\
     ACTION( timing_wheel_process,   METRIC_COUNTER, "# tevents processed"          )\
     ACTION( timing_wheel_tick,      METRIC_COUNTER, "# ticks processed"            )\
-    ACTION( timing_wheel_exec,      METRIC_COUNTER, "# timing wheel executions "   )
+    ACTION( timing_wheel_cascade,   METRIC_COUNTER, "# tevents moved down a level" )\
+    ACTION( timing_wheel_exec,      METRIC_COUNTER, "# timing wheel executions "   )\
+    ACTION( timing_wheel_queue,     METRIC_COUNTER, "# tevent ops queued"          )\
+    ACTION( timing_wheel_apply,     METRIC_COUNTER, "# queued tevent ops applied"  )
 
 typedef struct {
     TIMING_WHEEL_METRIC(METRIC_DECLARE)
@@ -54,8 +57,13 @@ typedef struct {
 
 typedef void (*timeout_cb_fn)(void *); /* timeout callback */
 
+typedef uint64_t timeout_handle_i; /* generation << 32 | index of an event */
+
+#define TIMEOUT_HANDLE_INVALID 0
+
 /**
- * We use TAILQ because for request timeouts it is very important to have
+ * We use doubly linked lists (of event indices rather than pointers, to keep
+ * events small) because for request timeouts it is very important to have
  * low overhead removing entries, as most requests will *not* time out.
  * For background maintenance tasks, the situation is the opposite- everything
  * times out. However, the volume of such events are so low that performance
@@ -91,6 +99,12 @@ typedef void (*timeout_cb_fn)(void *); /* timeout callback */
  * For insertions that may or may not be removed before due, the caller is
  * expected to clear the pointer returned in the callback, but _not_ attempt to
  * remove it (since it is already removed).
+ *
+ * Alternatively, the caller keeps a handle (timeout_event_handle) instead of
+ * the pointer, and cancels with it: a handle of an event that has fired or
+ * been canceled is stale, and canceling it does nothing. Events are kept in
+ * slabs, and a handle is made of the index of the event and the generation of
+ * its slot, which changes every time the slot is reused.
  */
 
 /**
@@ -104,38 +118,84 @@ struct timing_wheel {
     /* basic properties of the timing wheel */
     struct timeout      tick;       /* tick interval */
     size_t              cap;        /* capacity as # ticks in the time wheel */
+    size_t              nlevel;     /* # levels, each cap times coarser */
     size_t              max_ntick;  /* max # ticks to cover in one execution */
     /* the following is used internally */
     uint64_t            tick_ns;    /* tick in nanoseconds */
+    uint64_t            span;       /* # ticks covered by all levels */
     /* state of the wheel */
     bool                active;     /* is the wheel supposed to be turning? */
     struct timeout      due;        /* next trigger time */
     size_t              curr;       /* index of current tick */
     uint64_t            nevent;     /* # of timeout_event objects in wheel */
+    uint32_t            queue;      /* ops queued by other threads, LIFO */
 
     struct tevent_tqh   *table;     /* an array of header each points to a list
                                      * of timeouts expiring in the same tick.
-                                     * table should contain exactly cap entries,
-                                     * each corresponding to a TALQ for the
-                                     * corresponding tick
+                                     * table should contain exactly cap entries
+                                     * per level, each corresponding to a TALQ
+                                     * for the corresponding tick (level 0) or
+                                     * cap^level ticks
                                      */
+    uint64_t            *occupied;  /* bitmap of non-empty table entries */
     /* some metrics of the most important aspects */
     uint64_t            nprocess;   /* total # timeout events processed */
     uint64_t            nexec;      /* total # executions */
     uint64_t            ntick;      /* total # ticks processed */
 };
 
+/**
+ * A wheel of cap slots takes timeouts up to (cap - 1) ticks. For longer ones,
+ * timing_wheel_create_nlevel stacks up nlevel wheels, each slot of a level
+ * covering a full rotation of the level below, for a total of cap^nlevel
+ * ticks. Events further out sit in a coarse slot and are moved down a level
+ * at a time as they get closer, so they still fire on the tick they are due,
+ * insertion and removal stay O(1), and memory grows with cap * nlevel.
+ */
 struct timing_wheel *timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick);
+struct timing_wheel *timing_wheel_create_nlevel(struct timeout *tick, size_t cap, size_t nlevel, size_t ntick);
 void timing_wheel_destroy(struct timing_wheel **tw);
 
 struct timeout_event * timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur, timeout_cb_fn cb, void *arg);
 void timing_wheel_remove(struct timing_wheel *tw, struct timeout_event **tev);
 
+timeout_handle_i timeout_event_handle(struct timeout_event *tev);
+bool timing_wheel_cancel(struct timing_wheel *tw, timeout_handle_i h); /* false if stale */
+
+/**
+ * The functions above and below are to be called by the thread owning the
+ * wheel. Other threads insert and cancel through a queue instead, which the
+ * owner drains at the beginning of timing_wheel_execute (and flush). Queueing
+ * takes an atomic push, and applying the operation is O(1) as it is with the
+ * owner's own calls. The delay of a queued insertion runs from the time it
+ * is queued. An insertion that is canceled before being applied is dropped.
+ *
+ * Since the event may fire any time, other threads only get a handle, which
+ * is TIMEOUT_HANDLE_INVALID if the insertion fails.
+ */
+timeout_handle_i timing_wheel_insert_async(struct timing_wheel *tw, struct timeout *delay, bool recur, timeout_cb_fn cb, void *arg);
+rstatus_i timing_wheel_cancel_async(struct timing_wheel *tw, timeout_handle_i h);
+
 void timing_wheel_start(struct timing_wheel *tw);
 void timing_wheel_stop(struct timing_wheel *tw);
 void timing_wheel_execute(struct timing_wheel *tw);
 void timing_wheel_flush(struct timing_wheel *tw); /* triggering all, useful for teardown */
 
+/**
+ * Instead of waking up every tick, an event loop can sleep until there is work
+ * for the wheel: timing_wheel_next_ns returns the time until the next tick
+ * with events to process (or to cascade), found by scanning a bitmap of the
+ * occupied slots, 0 if there are queued operations to apply, and -1 if the
+ * wheel is empty or stopped.
+ *
+ * timing_wheel_event_wait waits for events on evb for up to that long (but no
+ * longer than timeout ms, -1 for no limit), then executes the wheel. It
+ * returns what event_wait returns. Operations queued by other threads while
+ * it waits are only applied after it returns.
+ */
+int64_t timing_wheel_next_ns(struct timing_wheel *tw);
+int timing_wheel_event_wait(struct timing_wheel *tw, struct event_base *evb, int timeout);
+
 void timing_wheel_setup(timing_wheel_metrics_st *metrics);
 void timing_wheel_teardown(void);
 
@@ -0,0 +1,271 @@
+#include <buffer/cc_bchain.h>
+
+#include <cc_bstring.h>
+#include <cc_debug.h>
+
+#include <stddef.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+
+#define BCHAIN_MODULE_NAME "ccommon::buffer::bchain"
+
+static bool bchain_init_done = false;
+
+static uint32_t max_nbuf = BCHAIN_MAX_NBUF;
+static bchain_metrics_st *bchain_metrics = NULL;
+
+void
+bchain_setup(bchain_options_st *options, bchain_metrics_st *metrics)
+{
+    log_info("set up the %s module", BCHAIN_MODULE_NAME);
+
+    if (bchain_init_done) {
+        log_warn("%s has already been setup, overwrite", BCHAIN_MODULE_NAME);
+    }
+
+    bchain_metrics = metrics;
+
+    if (options != NULL) {
+        max_nbuf = option_uint(&options->bchain_max_nbuf);
+    }
+
+    bchain_init_done = true;
+}
+
+void
+bchain_teardown(void)
+{
+    log_info("tear down the %s module", BCHAIN_MODULE_NAME);
+
+    if (!bchain_init_done) {
+        log_warn("%s was not setup", BCHAIN_MODULE_NAME);
+    }
+
+    bchain_metrics = NULL;
+    bchain_init_done = false;
+}
+
+void
+bchain_init(struct bchain *chain)
+{
+    ASSERT(chain != NULL);
+
+    STAILQ_INIT(&chain->bufq);
+    chain->wbuf = NULL;
+    chain->nbuf = 0;
+    chain->rsize = 0;
+}
+
+/* buf_return expects a buf that is not linked to anything */
+static void
+_bchain_release_head(struct bchain *chain)
+{
+    struct buf *b = STAILQ_FIRST(&chain->bufq);
+
+    STAILQ_REMOVE_HEAD(&chain->bufq, next);
+    STAILQ_NEXT(b, next) = NULL;
+    chain->nbuf--;
+    if (chain->wbuf == b) {
+        chain->wbuf = NULL;
+    }
+    buf_return(&b);
+    INCR(bchain_metrics, bchain_shrink);
+}
+
+void
+bchain_deinit(struct bchain *chain)
+{
+    ASSERT(chain != NULL);
+
+    while (!STAILQ_EMPTY(&chain->bufq)) {
+        _bchain_release_head(chain);
+    }
+    chain->rsize = 0;
+}
+
+static struct buf *
+_bchain_grow(struct bchain *chain)
+{
+    struct buf *b;
+
+    if (chain->nbuf >= max_nbuf) {
+        log_verb("bchain %p already has %"PRIu32" bufs", chain, chain->nbuf);
+        INCR(bchain_metrics, bchain_grow_ex);
+        return NULL;
+    }
+
+    b = buf_borrow();
+    if (b == NULL) {
+        INCR(bchain_metrics, bchain_grow_ex);
+        return NULL;
+    }
+
+    STAILQ_INSERT_TAIL(&chain->bufq, b, next);
+    chain->nbuf++;
+    if (chain->wbuf == NULL) {
+        chain->wbuf = b;
+    }
+    INCR(bchain_metrics, bchain_grow);
+
+    return b;
+}
+
+uint32_t
+bchain_write(struct bchain *chain, const char *src, uint32_t count)
+{
+    uint32_t len, n = 0;
+
+    ASSERT(chain != NULL && src != NULL);
+
+    while (n < count) {
+        if (chain->wbuf == NULL && _bchain_grow(chain) == NULL) {
+            break;
+        }
+        len = buf_write(chain->wbuf, (char *)src + n, count - n);
+        n += len;
+        if (BUF_FULL(chain->wbuf)) {
+            chain->wbuf = STAILQ_NEXT(chain->wbuf, next);
+        }
+    }
+    chain->rsize += n;
+
+    return n;
+}
+
+uint32_t
+bchain_peek(char *dst, const struct bchain *chain, uint32_t count)
+{
+    struct buf *b;
+    uint32_t len, n = 0;
+
+    ASSERT(chain != NULL && dst != NULL);
+
+    STAILQ_FOREACH(b, &chain->bufq, next) {
+        if (n == count || buf_rsize(b) == 0) {
+            break;
+        }
+        len = MIN(buf_rsize(b), count - n);
+        cc_memcpy(dst + n, b->rpos, len);
+        n += len;
+    }
+
+    return n;
+}
+
+uint32_t
+bchain_read(char *dst, struct bchain *chain, uint32_t count)
+{
+    uint32_t n = bchain_peek(dst, chain, count);
+
+    bchain_consume(chain, n);
+
+    return n;
+}
+
+void
+bchain_consume(struct bchain *chain, size_t count)
+{
+    struct buf *b;
+    uint32_t len;
+
+    ASSERT(chain != NULL);
+    ASSERT(count <= chain->rsize);
+
+    chain->rsize -= count;
+    while (count > 0) {
+        b = STAILQ_FIRST(&chain->bufq);
+        len = (uint32_t)MIN(buf_rsize(b), count);
+        b->rpos += len;
+        count -= len;
+        if (buf_rsize(b) > 0) {
+            continue;
+        }
+        if (b == chain->wbuf) {
+            /* drained but still being written to, start over */
+            b->rpos = b->wpos = b->begin;
+        } else {
+            _bchain_release_head(chain);
+        }
+    }
+
+    /* keep one buf for the next write, give back room grown for a read */
+    if (chain->rsize == 0) {
+        while (chain->nbuf > 1) {
+            b = STAILQ_FIRST(&chain->bufq);
+            ASSERT(buf_rsize(b) == 0);
+            _bchain_release_head(chain);
+        }
+        chain->wbuf = STAILQ_FIRST(&chain->bufq);
+    }
+}
+
+size_t
+bchain_riov(struct bchain *chain, struct array *iov)
+{
+    struct buf *b;
+    struct iovec *v;
+    size_t n = 0;
+
+    ASSERT(chain != NULL && iov != NULL);
+
+    STAILQ_FOREACH(b, &chain->bufq, next) {
+        if (array_nfree(iov) == 0 || buf_rsize(b) == 0) {
+            break;
+        }
+        v = array_push(iov);
+        v->iov_base = b->rpos;
+        v->iov_len = buf_rsize(b);
+        n += v->iov_len;
+    }
+
+    return n;
+}
+
+size_t
+bchain_wiov(struct bchain *chain, struct array *iov, size_t count)
+{
+    struct buf *b;
+    struct iovec *v;
+    size_t room = 0, n = 0;
+
+    ASSERT(chain != NULL && iov != NULL);
+
+    for (b = chain->wbuf; b != NULL; b = STAILQ_NEXT(b, next)) {
+        room += buf_wsize(b);
+    }
+    while (room < count && (b = _bchain_grow(chain)) != NULL) {
+        room += buf_wsize(b);
+    }
+
+    for (b = chain->wbuf; b != NULL; b = STAILQ_NEXT(b, next)) {
+        if (array_nfree(iov) == 0) {
+            break;
+        }
+        v = array_push(iov);
+        v->iov_base = b->wpos;
+        v->iov_len = buf_wsize(b);
+        n += v->iov_len;
+    }
+
+    return n;
+}
+
+void
+bchain_commit(struct bchain *chain, size_t count)
+{
+    uint32_t len;
+
+    ASSERT(chain != NULL);
+
+    chain->rsize += count;
+    while (count > 0) {
+        ASSERT(chain->wbuf != NULL);
+
+        len = (uint32_t)MIN(buf_wsize(chain->wbuf), count);
+        chain->wbuf->wpos += len;
+        count -= len;
+        if (BUF_FULL(chain->wbuf)) {
+            chain->wbuf = STAILQ_NEXT(chain->wbuf, next);
+        }
+    }
+}
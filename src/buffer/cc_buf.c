@@ -24,47 +24,54 @@
 
 #define BUF_MODULE_NAME "ccommon::buffer:buf"
 
-FREEPOOL(buf_pool, bufq, buf);
-static struct buf_pool bufp;
+static struct pool *bufp = NULL;
+static uint32_t tcache_high = BUF_TCACHE_HIGH;
+static uint32_t tcache_low = BUF_TCACHE_LOW;
 
 static bool buf_init = false;
-static bool bufp_init = false;
 
 uint32_t buf_init_size = BUF_INIT_SIZE;
 buf_metrics_st *buf_metrics = NULL;
 
+static void *
+_buf_create(void)
+{
+    return buf_create();
+}
+
 static void
-buf_pool_destroy(void)
+_buf_destroy(void *buf)
 {
-    struct buf *buf, *nbuf;
+    buf_destroy((struct buf **)&buf);
+}
 
-    if (!bufp_init) {
+static void
+buf_pool_destroy(void)
+{
+    if (bufp == NULL) {
         log_warn("buf pool was never created, ignoring destroy");
 
         return;
     }
 
-    log_info("destroying buf pool: free %"PRIu32, bufp.nfree);
-
-    FREEPOOL_DESTROY(buf, nbuf, &bufp, next, buf_destroy);
-    bufp_init = false;
+    pool_destroy(&bufp);
 }
 
 static void
 buf_pool_create(uint32_t max)
 {
-    struct buf *buf;
-
-    if (bufp_init) {
+    if (bufp != NULL) {
         log_warn("buf pool has already been created, re-creating");
 
         buf_pool_destroy();
     }
 
-    log_info("creating buf pool: max %"PRIu32, max);
-
-    FREEPOOL_CREATE(&bufp, max);
-    bufp_init = true;
+    bufp = pool_create("buf", max, tcache_high, tcache_low, _buf_create,
+            _buf_destroy, POOL_METRICS(buf_metrics, buf_pool_));
+    if (bufp == NULL) {
+        log_crit("cannot create buf pool, OOM. abort");
+        exit(EXIT_FAILURE);
+    }
 
     /**
      * NOTE: Right now I decide to preallocate if max != 0
@@ -72,9 +79,7 @@ buf_pool_create(uint32_t max)
      * not preallocated is a question for future exploration.
      * So far I see no point of that.
      */
-
-    FREEPOOL_PREALLOC(buf, &bufp, max, next, buf_create);
-    if (bufp.nfree < max) {
+    if (pool_prealloc(bufp, max) < max) {
         log_crit("cannot preallocate buf pool, OOM. abort");
         exit(EXIT_FAILURE);
     }
@@ -83,9 +88,7 @@ buf_pool_create(uint32_t max)
 struct buf *
 buf_borrow(void)
 {
-    struct buf *buf;
-
-    FREEPOOL_BORROW(buf, &bufp, next, buf_create);
+    struct buf *buf = pool_borrow(bufp);
 
     if (buf == NULL) {
         log_warn("borrow buf failed, OOM or over limit");
@@ -94,6 +97,7 @@ buf_borrow(void)
         return NULL;
     }
 
+    STAILQ_NEXT(buf, next) = NULL;
     buf_reset(buf);
     INCR(buf_metrics, buf_borrow);
     INCR(buf_metrics, buf_active);
@@ -118,7 +122,7 @@ buf_return(struct buf **buf)
     log_verb("return buf %p", elm);
 
     elm->free = true;
-    FREEPOOL_RETURN(elm, &bufp, next);
+    pool_return(bufp, elm);
 
     *buf = NULL;
     INCR(buf_metrics, buf_return);
@@ -138,6 +142,7 @@ buf_create(void)
     }
 
     buf->end = (char *)buf + buf_init_size;
+    buf->fixed = -1;
     buf_reset(buf);
     INCR(buf_metrics, buf_create);
     INCR(buf_metrics, buf_curr);
@@ -182,6 +187,8 @@ buf_setup(buf_options_st *options, buf_metrics_st *metrics)
     if (options != NULL) {
         buf_init_size = option_uint(&options->buf_init_size);
         max = option_uint(&options->buf_poolsize);
+        tcache_high = option_uint(&options->buf_tcache_high);
+        tcache_low = option_uint(&options->buf_tcache_low);
     }
 
     buf_pool_create(max);
@@ -73,6 +73,8 @@ _dbuf_resize(struct buf **buf, uint32_t nsize)
     nbuf->end = (char *)nbuf + nsize;
     nbuf->rpos = nbuf->begin + roffset;
     nbuf->wpos = nbuf->begin + woffset;
+    /* memory registered with the kernel is no longer what the buf points to */
+    nbuf->fixed = -1;
     *buf = nbuf;
     DECR_N(buf_metrics, buf_memory, osize);
     INCR_N(buf_metrics, buf_memory, nsize);
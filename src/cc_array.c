@@ -17,6 +17,7 @@
 
 #include <cc_array.h>
 
+#include <cc_bstring.h>
 #include <cc_debug.h>
 #include <cc_define.h>
 #include <cc_mm.h>
@@ -49,6 +50,7 @@ array_data_create(struct array *arr, uint32_t nalloc, size_t size)
     arr->nelem = 0;
     arr->size = size;
     arr->nalloc = nalloc;
+    arr->arena = NULL;
 
     return CC_OK;
 }
@@ -57,7 +59,9 @@ array_data_create(struct array *arr, uint32_t nalloc, size_t size)
 void
 array_data_destroy(struct array *arr)
 {
-    if (arr->data != NULL) {
+    if (arr->arena != NULL) {
+        arr->data = NULL;
+    } else if (arr->data != NULL) {
         cc_free(arr->data);
     }
 }
@@ -100,11 +104,44 @@ array_destroy(struct array **arr)
         return;
     }
 
+    if ((*arr)->arena != NULL) {
+        *arr = NULL;
+        return;
+    }
+
     array_data_destroy(*arr);
     cc_free(*arr);
     *arr = NULL;
 }
 
+rstatus_i
+array_create_arena(struct array **arr, uint32_t nalloc, size_t size,
+        struct arena *arena)
+{
+    ASSERT(nalloc != 0 && size != 0 && arena != NULL);
+
+    *arr = (struct array *)arena_alloc(arena, sizeof(**arr));
+    if (*arr == NULL) {
+        log_info("array creation failed due to OOM");
+
+        return CC_ENOMEM;
+    }
+
+    (*arr)->data = arena_alloc(arena, nalloc * size);
+    if ((*arr)->data == NULL) {
+        log_info("array data creation failed due to OOM");
+        *arr = NULL;
+
+        return CC_ENOMEM;
+    }
+    (*arr)->nelem = 0;
+    (*arr)->size = size;
+    (*arr)->nalloc = nalloc;
+    (*arr)->arena = arena;
+
+    return CC_OK;
+}
+
 /*
  * expands the array by:
  * 1) doubling, if nelem is less than max_nelem_delta;
@@ -124,7 +161,15 @@ _array_expand(struct array *arr)
         nelem *= 2;
     }
     nbyte = nelem * arr->size;
-    data = cc_realloc(arr->data, nbyte);
+    if (arr->arena != NULL) {
+        /* the old data stays in the arena until it is reset */
+        data = arena_alloc(arr->arena, nbyte);
+        if (data != NULL) {
+            cc_memcpy(data, arr->data, arr->nelem * arr->size);
+        }
+    } else {
+        data = cc_realloc(arr->data, nbyte);
+    }
     if (data == NULL) {
         return CC_ERROR;
     }
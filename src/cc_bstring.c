@@ -204,6 +204,24 @@ bstring_alloc(uint32_t size)
     return bs;
 }
 
+struct bstring *
+bstring_alloc_arena(uint32_t size, struct arena *arena)
+{
+    struct bstring *bs = arena_alloc(arena, sizeof(*bs));
+    if (bs == NULL) {
+        return NULL;
+    }
+    bstring_init(bs);
+
+    bs->len = size;
+    bs->data = arena_alloc(arena, size);
+    if (bs->data == NULL && size > 0) {
+        return NULL;
+    }
+
+    return bs;
+}
+
 void
 bstring_free(struct bstring **ptr)
 {
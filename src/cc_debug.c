@@ -20,6 +20,7 @@
 #include <cc_log.h>
 #include <cc_mm.h>
 #include <cc_print.h>
+#include <time/cc_clock.h>
 
 #include <ctype.h>
 #include <errno.h>
@@ -39,6 +40,8 @@
 struct debug_logger default_logger;
 struct debug_logger *dlog = &default_logger;
 static bool debug_init = false;
+static __thread time_t log_sec = -1;    /* second log_timestr is of */
+static __thread char log_timestr[32];   /* same format as asctime */
 static char * level_str[] = {
     "ALWAYS",
     "CRIT",
@@ -190,9 +193,9 @@ void
 _log(struct debug_logger *dl, const char *file, int line, int level, const char *fmt, ...)
 {
     int len, size, errno_save;
-    char buf[LOG_MAX_LEN], *timestr;
+    char buf[LOG_MAX_LEN];
     va_list args;
-    struct tm *local;
+    struct tm local;
     time_t t;
 
     if (dl == NULL || dl->logger == NULL || dl->level < level) {
@@ -203,15 +206,20 @@ _log(struct debug_logger *dl, const char *file, int line, int level, const char
     len = 0;            /* length of output buffer */
     size = LOG_MAX_LEN; /* size of output buffer */
 
-    t = time(NULL);
-    local = localtime(&t);
-    timestr = asctime(local);
+    /* format the timestamp once per second rather than once per line */
+    t = clock_unix();
+    if (t != log_sec) {
+        localtime_r(&t, &local);
+        strftime(log_timestr, sizeof(log_timestr), "%a %b %e %H:%M:%S %Y",
+                &local);
+        log_sec = t;
+    }
 
     char pname[16] = "noName"; 
     pthread_getname_np(pthread_self(), pname, 16);
 
-    len += cc_scnprintf(buf + len, size - len, "[%.*s][tid=%s][%s] %s:%d ",
-            strlen(timestr) - 1, timestr, pname, level_str[level], file, line);
+    len += cc_scnprintf(buf + len, size - len, "[%s][tid=%s][%s] %s:%d ",
+            log_timestr, pname, level_str[level], file, line);
 
     va_start(args, fmt);
     len += cc_vscnprintf(buf + len, size - len, fmt, args);
@@ -18,11 +18,19 @@
 #include <cc_mm.h>
 
 #include <cc_debug.h>
+#include <cc_util.h>
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#ifdef OS_LINUX
+#include <sys/syscall.h>
+#endif
 
 #ifdef OS_DARWIN
 #   define MAP_ANONYMOUS MAP_ANON
@@ -32,6 +40,358 @@
 #include <malloc.h>
 #endif
 
+static mm_metrics_st *mm_metrics = NULL;
+
+#if defined CC_SLAB_MM && CC_SLAB_MM == 1
+
+#include <pthread.h>
+
+#define MM_MAGIC        0xdeadbeef
+#define MM_CLASS_MIN    4           /* 2^4 = 16 bytes */
+#define MM_CLASS_LARGE  UINT32_MAX  /* not from a slab */
+#define MM_REGION_SIZE  (2 * MiB)
+#define MM_BATCH_SIZE   (64 * KiB)  /* bytes moved between lists at a time */
+#define MM_BATCH_MAX    64
+
+/*
+ * Every object carries a header, so an object of class c takes 2^(c+4) bytes
+ * plus the header: requests that are already powers of two, such as bufs,
+ * do not spill over into the next class.
+ */
+struct mm_hdr {
+    uint32_t            magic;
+    uint32_t            cls;
+    union {
+        size_t          size;   /* large: size requested */
+        struct mm_hdr   *next;  /* slab: next free object */
+    };
+};
+
+#define MM_HDR_SIZE         sizeof(struct mm_hdr)
+#define MM_CLASS_SIZE(_c)   ((size_t)1 << ((_c) + MM_CLASS_MIN))
+#define MM_MAX_SIZE         MM_CLASS_SIZE(MM_NCLASS - 1)
+
+struct mm_list {
+    struct mm_hdr       *head;
+    uint32_t            nfree;
+};
+
+struct mm_tcache {
+    struct mm_list      list[MM_NCLASS];
+    bool                initialized;
+    bool                exited; /* thread is exiting, use the global lists */
+};
+
+static __thread struct mm_tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/* protects the class-wide free lists and the current region */
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mm_list slab_list[MM_NCLASS];
+static char *region_pos = NULL;
+static char *region_end = NULL;
+
+#if defined CC_STATS && CC_STATS == 1
+#define MM_SLAB_INCR(_c) do {                                       \
+    if (mm_metrics != NULL) {                                       \
+        metric_incr((&mm_metrics->mm_slab_16)[_c]);                 \
+    }                                                               \
+} while (0)
+#define MM_SLAB_DECR(_c) do {                                       \
+    if (mm_metrics != NULL) {                                       \
+        metric_decr((&mm_metrics->mm_slab_16)[_c]);                 \
+    }                                                               \
+} while (0)
+#else
+#define MM_SLAB_INCR(_c)
+#define MM_SLAB_DECR(_c)
+#endif
+
+static inline uint32_t
+_slab_class(size_t size)
+{
+    if (size <= MM_CLASS_SIZE(0)) {
+        return 0;
+    }
+
+    return 64 - __builtin_clzll(size - 1) - MM_CLASS_MIN;
+}
+
+static inline uint32_t
+_slab_batch(uint32_t cls)
+{
+    return MIN(MAX(MM_BATCH_SIZE / (MM_CLASS_SIZE(cls) + MM_HDR_SIZE), 1),
+            MM_BATCH_MAX);
+}
+
+/* move up to n objects from the head of src to dst */
+static uint32_t
+_slab_move(struct mm_list *dst, struct mm_list *src, uint32_t n)
+{
+    struct mm_hdr *hdr;
+    uint32_t i;
+
+    for (i = 0; i < n && src->head != NULL; i++) {
+        hdr = src->head;
+        src->head = hdr->next;
+        hdr->next = dst->head;
+        dst->head = hdr;
+    }
+    src->nfree -= i;
+    dst->nfree += i;
+
+    return i;
+}
+
+/* carve n objects of class cls into list, with slab_lock held */
+static uint32_t
+_slab_carve(struct mm_list *list, uint32_t cls, uint32_t n)
+{
+    size_t osize = MM_CLASS_SIZE(cls) + MM_HDR_SIZE;
+    struct mm_hdr *hdr;
+    uint32_t i;
+    char *p;
+
+    for (i = 0; i < n; i++) {
+        if (region_end - region_pos < (ptrdiff_t)osize) {
+            /* the tail of the current region, if any, is left unused */
+            p = _cc_mmap_ex(MM_REGION_SIZE, MM_MMAP_THP, -1, __FILE__,
+                    __LINE__);
+            if (p == NULL) {
+                break;
+            }
+            region_pos = p;
+            region_end = p + MM_REGION_SIZE;
+            INCR(mm_metrics, mm_region_curr);
+        }
+
+        hdr = (struct mm_hdr *)region_pos;
+        region_pos += osize;
+        hdr->magic = MM_MAGIC;
+        hdr->cls = cls;
+        hdr->next = list->head;
+        list->head = hdr;
+        list->nfree++;
+    }
+
+    return i;
+}
+
+static void
+_tcache_exit(void *arg)
+{
+    struct mm_tcache *tc = arg;
+    uint32_t c;
+
+    pthread_mutex_lock(&slab_lock);
+    for (c = 0; c < MM_NCLASS; c++) {
+        _slab_move(&slab_list[c], &tc->list[c], tc->list[c].nfree);
+    }
+    pthread_mutex_unlock(&slab_lock);
+
+    /* frees from later destructors go straight to the global lists */
+    tc->exited = true;
+}
+
+static void
+_tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, _tcache_exit);
+}
+
+/* free list of the calling thread, or the global one if it is exiting */
+static inline struct mm_list *
+_slab_list(uint32_t cls, bool *global)
+{
+    if (!tcache.initialized) {
+        pthread_once(&tcache_once, _tcache_key_create);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.initialized = true;
+    }
+
+    *global = tcache.exited;
+
+    return *global ? &slab_list[cls] : &tcache.list[cls];
+}
+
+static void *
+_slab_alloc(size_t size)
+{
+    struct mm_list *list;
+    struct mm_hdr *hdr;
+    uint32_t cls, n;
+    bool global;
+
+    if (size > MM_MAX_SIZE) {
+        hdr = malloc(size + MM_HDR_SIZE);
+        if (hdr == NULL) {
+            return NULL;
+        }
+        hdr->magic = MM_MAGIC;
+        hdr->cls = MM_CLASS_LARGE;
+        hdr->size = size;
+        INCR(mm_metrics, mm_large_curr);
+
+        return hdr + 1;
+    }
+
+    cls = _slab_class(size);
+    list = _slab_list(cls, &global);
+    if (global) {
+        pthread_mutex_lock(&slab_lock);
+    }
+    if (list->head == NULL && global) {
+        _slab_carve(list, cls, 1);
+    } else if (list->head == NULL) {
+        /* refill a batch from the class-wide list, carve what is missing */
+        pthread_mutex_lock(&slab_lock);
+        n = _slab_batch(cls);
+        n -= _slab_move(list, &slab_list[cls], n);
+        if (n > 0) {
+            _slab_carve(list, cls, n);
+        }
+        pthread_mutex_unlock(&slab_lock);
+    }
+    hdr = list->head;
+    if (hdr != NULL) {
+        list->head = hdr->next;
+        list->nfree--;
+    }
+    if (global) {
+        pthread_mutex_unlock(&slab_lock);
+    }
+
+    if (hdr == NULL) {
+        return NULL;
+    }
+    ASSERT(hdr->magic == MM_MAGIC && hdr->cls == cls);
+    MM_SLAB_INCR(cls);
+
+    return hdr + 1;
+}
+
+static void
+_slab_free(void *ptr)
+{
+    struct mm_hdr *hdr;
+    struct mm_list *list;
+    uint32_t cls, n;
+    bool global;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    hdr = (struct mm_hdr *)ptr - 1;
+    ASSERT(hdr->magic == MM_MAGIC);
+
+    if (hdr->cls == MM_CLASS_LARGE) {
+        DECR(mm_metrics, mm_large_curr);
+        free(hdr);
+
+        return;
+    }
+
+    cls = hdr->cls;
+    MM_SLAB_DECR(cls);
+    list = _slab_list(cls, &global);
+    if (global) {
+        pthread_mutex_lock(&slab_lock);
+    }
+    hdr->next = list->head;
+    list->head = hdr;
+    list->nfree++;
+    if (global) {
+        pthread_mutex_unlock(&slab_lock);
+
+        return;
+    }
+
+    /* keep at most two batches per thread, the older one goes back */
+    n = _slab_batch(cls);
+    if (list->nfree > 2 * n) {
+        pthread_mutex_lock(&slab_lock);
+        _slab_move(&slab_list[cls], list, n);
+        pthread_mutex_unlock(&slab_lock);
+    }
+}
+
+static size_t
+_slab_usable_size(void *ptr)
+{
+    struct mm_hdr *hdr = (struct mm_hdr *)ptr - 1;
+
+    ASSERT(hdr->magic == MM_MAGIC);
+
+    return hdr->cls == MM_CLASS_LARGE ? hdr->size : MM_CLASS_SIZE(hdr->cls);
+}
+
+static void *
+_slab_realloc(void *ptr, size_t size)
+{
+    struct mm_hdr *hdr;
+    size_t usable;
+    void *p;
+
+    if (ptr == NULL) {
+        return _slab_alloc(size);
+    }
+
+    hdr = (struct mm_hdr *)ptr - 1;
+    usable = _slab_usable_size(ptr);
+    if (hdr->cls != MM_CLASS_LARGE && size <= usable) {
+        return ptr;
+    }
+    if (hdr->cls == MM_CLASS_LARGE && size > MM_MAX_SIZE) {
+        hdr = realloc(hdr, size + MM_HDR_SIZE);
+        if (hdr == NULL) {
+            return NULL;
+        }
+        hdr->size = size;
+
+        return hdr + 1;
+    }
+
+    p = _slab_alloc(size);
+    if (p != NULL) {
+        memcpy(p, ptr, MIN(usable, size));
+        _slab_free(ptr);
+    }
+
+    return p;
+}
+
+#define _mm_alloc       _slab_alloc
+#define _mm_free        _slab_free
+#define _mm_realloc     _slab_realloc
+#define _mm_usable_size _slab_usable_size
+
+#else
+
+#define _mm_alloc       malloc
+#define _mm_free        free
+#define _mm_realloc     realloc
+#define _mm_usable_size malloc_usable_size
+
+#endif
+
+void
+mm_setup(mm_metrics_st *metrics)
+{
+    log_info("set up the ccommon::mm module");
+
+    mm_metrics = metrics;
+}
+
+void
+mm_teardown(void)
+{
+    log_info("tear down the ccommon::mm module");
+
+    mm_metrics = NULL;
+}
+
 void *
 _cc_alloc(size_t size, const char *name, int line)
 {
@@ -42,7 +402,7 @@ _cc_alloc(size_t size, const char *name, int line)
         return NULL;
     }
 
-    p = malloc(size);
+    p = _mm_alloc(size);
     if (p == NULL) {
         log_error("malloc(%zu) failed @ %s:%d", size, name, line);
     } else {
@@ -77,12 +437,12 @@ _cc_realloc(void *ptr, size_t size, const char *name, int line)
     void *p;
 
     if (size == 0) {
-        free(ptr);
+        _mm_free(ptr);
         log_debug("realloc(0) @ %s:%d", name, line);
         return NULL;
     }
 
-    p = realloc(ptr, size);
+    p = _mm_realloc(ptr, size);
     if (p == NULL) {
         log_error("realloc(%zu) failed @ %s:%d", size, name, line);
     } else {
@@ -98,7 +458,7 @@ _cc_realloc_move(void *ptr, size_t size, const char *name, int line)
     void *p = NULL, *pr;
 
     if (size == 0) {
-        free(ptr);
+        _mm_free(ptr);
         log_debug("realloc(0) @ %s:%d", name, line);
         return NULL;
     }
@@ -109,14 +469,15 @@ _cc_realloc_move(void *ptr, size_t size, const char *name, int line)
      * copy size bytes, and calling malloc before the realloc'd data is free'd
      * gives us a new address for the memory object.
      */
-    if (((pr = realloc(ptr, size)) == NULL || (p = malloc(size)) == NULL)) {
+    if (((pr = _mm_realloc(ptr, size)) == NULL ||
+            (p = _mm_alloc(size)) == NULL)) {
         log_error("realloc(%zu) failed @ %s:%d", size, name, line);
     } else {
         log_vverb("realloc(%zu) at %p @ %s:%d", size, p, name, line);
         memcpy(p, pr, size);
     }
 
-    free(pr);
+    _mm_free(pr);
     return p;
 }
 
@@ -124,7 +485,7 @@ void
 _cc_free(void *ptr, const char *name, int line)
 {
     log_vverb("free(%p) @ %s:%d", ptr, name, line);
-    free(ptr);
+    _mm_free(ptr);
 }
 
 void *
@@ -150,6 +511,152 @@ _cc_mmap(size_t size, const char *name, int line)
     return p;
 }
 
+/* map size bytes aligned to MM_HUGEPAGE_SIZE, by trimming a larger mapping */
+static void *
+_mmap_aligned(size_t size)
+{
+    char *p, *q;
+    size_t head, tail;
+
+    p = mmap(NULL, size + MM_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    q = (char *)(((uintptr_t)p + MM_HUGEPAGE_SIZE - 1) &
+            ~((uintptr_t)MM_HUGEPAGE_SIZE - 1));
+    head = q - p;
+    tail = MM_HUGEPAGE_SIZE - head;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    if (tail > 0) {
+        munmap(q + size, tail);
+    }
+
+    return q;
+}
+
+static bool
+_mmap_bind(void *p, size_t size, int node)
+{
+#if defined OS_LINUX && defined SYS_mbind
+/* from linux/mempolicy.h */
+#define MM_MPOL_BIND    2
+#define MM_MAX_NODE     1024
+    unsigned long mask[MM_MAX_NODE / (8 * sizeof(unsigned long))] = {0};
+    size_t bits = 8 * sizeof(unsigned long);
+
+    if (node >= MM_MAX_NODE) {
+        errno = EINVAL;
+        return false;
+    }
+    mask[node / bits] = 1UL << (node % bits);
+
+    /* the kernel reads one bit less than maxnode */
+    return syscall(SYS_mbind, p, size, MM_MPOL_BIND, mask, MM_MAX_NODE + 1,
+            0) == 0;
+#else
+    errno = ENOTSUP;
+    return false;
+#endif
+}
+
+static void
+_mmap_prefault(void *p, size_t size)
+{
+    size_t off, pagesize;
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+
+    pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    for (off = 0; off < size; off += pagesize) {
+        ((volatile char *)p)[off] = 0;
+    }
+}
+
+void *
+_cc_mmap_ex(size_t size, uint32_t flags, int node, const char *name, int line)
+{
+    void *p = MAP_FAILED;
+    bool thp = flags & (MM_MMAP_THP | MM_MMAP_HUGETLB);
+
+    ASSERT(size != 0);
+
+    /* nothing is faulted in by mmap itself: binding must come first */
+#ifdef MAP_HUGETLB
+    if ((flags & MM_MMAP_HUGETLB) && size % MM_HUGEPAGE_SIZE == 0) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            thp = false;
+            INCR(mm_metrics, mm_mmap_hugetlb);
+        } else {
+            log_info("no explicit hugepages for %zu bytes @ %s:%d: %s", size,
+                    name, line, strerror(errno));
+        }
+    }
+#endif
+    if ((flags & MM_MMAP_HUGETLB) && p == MAP_FAILED) {
+        INCR(mm_metrics, mm_mmap_fallback);
+    }
+
+    if (p == MAP_FAILED) {
+        if (thp && size >= MM_HUGEPAGE_SIZE) {
+            p = _mmap_aligned(size);
+        } else {
+            p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (p == MAP_FAILED) {
+            log_error("mmap %zu bytes @ %s:%d failed: %s", size, name, line,
+                    strerror(errno));
+            return NULL;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (thp && madvise(p, size, MADV_HUGEPAGE) == 0) {
+            INCR(mm_metrics, mm_mmap_thp);
+        } else {
+            thp = false;
+        }
+#else
+        thp = false;
+#endif
+        if (!thp) {
+            if (flags & MM_MMAP_THP) {
+                INCR(mm_metrics, mm_mmap_fallback);
+            }
+            INCR(mm_metrics, mm_mmap_default);
+        }
+    }
+
+    if (node >= 0) {
+        if (_mmap_bind(p, size, node)) {
+            INCR(mm_metrics, mm_mmap_numa);
+        } else {
+            log_info("cannot bind %zu bytes @ %s:%d to node %d: %s", size,
+                    name, line, node, strerror(errno));
+            INCR(mm_metrics, mm_mmap_fallback);
+        }
+    }
+
+    if (flags & MM_MMAP_POPULATE) {
+        _mmap_prefault(p, size);
+        INCR(mm_metrics, mm_mmap_populate);
+    }
+
+    log_vverb("mmap %zu bytes at %p flags %#x node %d @ %s:%d", size, p,
+            flags, node, name, line);
+
+    return p;
+}
+
 int
 _cc_munmap(void *p, size_t size, const char *name, int line)
 {
@@ -175,5 +682,148 @@ size_t
 _cc_alloc_usable_size(void *ptr, const char *name, int line)
 {
     log_vverb("malloc_usable_size(%p) @ %s:%d", ptr, name, line);
-    return malloc_usable_size(ptr);
+    return _mm_usable_size(ptr);
+}
+
+struct arena_chunk {
+    struct arena_chunk  *next;
+    size_t              size;   /* # bytes in data */
+    char                data[];
+};
+
+struct arena {
+    struct arena_chunk  *used;  /* chunks in use, the current one first */
+    struct arena_chunk  *large; /* oversized chunks, freed on reset */
+    struct arena_chunk  *free;  /* chunks kept for reuse */
+    char                *pos;   /* next free byte in the current chunk */
+    char                *end;
+    size_t              chunk_size;
+};
+
+#define ARENA_CHUNK_HDR_SIZE    offsetof(struct arena_chunk, data)
+
+static void
+_arena_chunk_free_all(struct arena_chunk **head)
+{
+    struct arena_chunk *chunk;
+
+    while ((chunk = *head) != NULL) {
+        *head = chunk->next;
+        cc_free(chunk);
+    }
+}
+
+struct arena *
+arena_create(size_t chunk_size)
+{
+    struct arena *arena = cc_alloc(sizeof(*arena));
+
+    if (arena == NULL) {
+        log_info("arena creation failed due to OOM");
+
+        return NULL;
+    }
+
+    arena->used = NULL;
+    arena->large = NULL;
+    arena->free = NULL;
+    arena->pos = NULL;
+    arena->end = NULL;
+    arena->chunk_size = chunk_size > ARENA_CHUNK_HDR_SIZE ? chunk_size :
+        ARENA_CHUNK_SIZE;
+
+    return arena;
+}
+
+void
+arena_destroy(struct arena **arena)
+{
+    struct arena *a;
+
+    if (arena == NULL || (a = *arena) == NULL) {
+        return;
+    }
+
+    _arena_chunk_free_all(&a->used);
+    _arena_chunk_free_all(&a->large);
+    _arena_chunk_free_all(&a->free);
+    cc_free(a);
+    *arena = NULL;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t csize = arena->chunk_size - ARENA_CHUNK_HDR_SIZE;
+    void *p;
+
+    if (size == 0) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+
+    if (size <= (size_t)(arena->end - arena->pos)) {
+        p = arena->pos;
+        arena->pos += size;
+
+        return p;
+    }
+
+    if (size > csize / 4) {
+        chunk = cc_alloc(ARENA_CHUNK_HDR_SIZE + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->next = arena->large;
+        arena->large = chunk;
+
+        return chunk->data;
+    }
+
+    /* the rest of the current chunk is left unused */
+    chunk = arena->free;
+    if (chunk != NULL) {
+        arena->free = chunk->next;
+    } else {
+        chunk = cc_alloc(arena->chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = csize;
+    }
+    chunk->next = arena->used;
+    arena->used = chunk;
+    arena->pos = chunk->data + size;
+    arena->end = chunk->data + chunk->size;
+
+    return chunk->data;
+}
+
+void *
+arena_zalloc(struct arena *arena, size_t size)
+{
+    void *p = arena_alloc(arena, size);
+
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+
+    return p;
+}
+
+void
+arena_reset(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+
+    _arena_chunk_free_all(&arena->large);
+    while ((chunk = arena->used) != NULL) {
+        arena->used = chunk->next;
+        chunk->next = arena->free;
+        arena->free = chunk;
+    }
+    arena->pos = NULL;
+    arena->end = NULL;
 }
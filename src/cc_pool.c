@@ -0,0 +1,524 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_pool.h>
+
+#include <cc_bstring.h>
+#include <cc_mm.h>
+
+#include <pthread.h>
+#include <sys/param.h>
+
+/*
+ * The depot is a lock-free (Treiber) stack of blocks, each holding up to
+ * bsize free objects, which is enough for a magazine to spill in one push.
+ * Emptied blocks are kept on a second stack for reuse. To avoid ABA, the head
+ * of either stack carries a tag in its upper bits that is bumped on every
+ * update, which works because user space pointers fit in 48 bits. Blocks are
+ * only freed when the pool is destroyed, so a racing pop reading the link of
+ * a block that was just taken is harmless: the tag has changed and its CAS
+ * fails.
+ */
+#define POOL_TAG_SHIFT  48
+#define POOL_PTR_MASK   ((1ULL << POOL_TAG_SHIFT) - 1)
+#define POOL_BLOCK_MIN  16  /* min # objects per depot block */
+
+struct pool_blk {
+    struct pool_blk         *next;
+    uint32_t                nobj;
+    void                    *obj[]; /* bsize slots, newest last */
+};
+
+struct pool_mag {
+    TAILQ_ENTRY(pool_mag)   tqe;    /* in the pool's list of magazines */
+    struct pool             *pool;
+    uint32_t                nfree;
+    void                    *obj[]; /* high + 1 slots, newest last */
+};
+
+TAILQ_HEAD(pool_mag_tqh, pool_mag);
+
+struct pool {
+    const char              *name;
+    pool_create_fn          create;
+    pool_destroy_fn         destroy;
+    pool_metrics_st         *metrics;
+    uint32_t                nmax;   /* UINT32_MAX if unlimited */
+    uint32_t                nobj;   /* # objects created, updated atomically */
+    uint32_t                high;
+    uint32_t                low;
+    uint32_t                bsize;  /* # objects per depot block */
+    pthread_key_t           key;    /* magazine of the calling thread */
+
+    uint64_t                depot;  /* tagged head of blocks w/ free objects */
+    uint64_t                spare;  /* tagged head of empty blocks */
+    uint32_t                ndepot; /* # objects in the depot, approximate */
+
+    pthread_mutex_t         lock;   /* protects mags */
+    struct pool_mag_tqh     mags;
+};
+
+/* depot ops */
+
+static void
+_stack_push(uint64_t *head, struct pool_blk *blk)
+{
+    uint64_t h, nh;
+
+    ASSERT(((uintptr_t)blk & ~POOL_PTR_MASK) == 0);
+
+    h = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&blk->next,
+                (struct pool_blk *)(uintptr_t)(h & POOL_PTR_MASK),
+                __ATOMIC_RELAXED);
+        nh = (((h >> POOL_TAG_SHIFT) + 1) << POOL_TAG_SHIFT) | (uintptr_t)blk;
+    } while (!__atomic_compare_exchange_n(head, &h, nh, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static struct pool_blk *
+_stack_pop(uint64_t *head)
+{
+    uint64_t h, nh;
+    struct pool_blk *blk, *next;
+
+    h = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    do {
+        blk = (struct pool_blk *)(uintptr_t)(h & POOL_PTR_MASK);
+        if (blk == NULL) {
+            return NULL;
+        }
+        next = __atomic_load_n(&blk->next, __ATOMIC_RELAXED);
+        nh = (((h >> POOL_TAG_SHIFT) + 1) << POOL_TAG_SHIFT) | (uintptr_t)next;
+    } while (!__atomic_compare_exchange_n(head, &h, nh, true,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return blk;
+}
+
+/* an empty block, reused if possible */
+static struct pool_blk *
+_blk_get(struct pool *pool)
+{
+    struct pool_blk *blk;
+
+    blk = _stack_pop(&pool->spare);
+    if (blk == NULL) {
+        blk = cc_alloc(sizeof(*blk) + pool->bsize * sizeof(void *));
+    }
+
+    return blk;
+}
+
+static void
+_depot_put(struct pool *pool, void **obj, uint32_t n)
+{
+    struct pool_blk *blk;
+    uint32_t i, k;
+
+    for (; n > 0; obj += k, n -= k) {
+        blk = _blk_get(pool);
+        if (blk == NULL) {
+            log_error("cannot grow %s pool depot, destroying %"PRIu32" free "
+                    "objects", pool->name, n);
+            for (i = 0; i < n; i++) {
+                pool->destroy(obj[i]);
+            }
+            __atomic_sub_fetch(&pool->nobj, n, __ATOMIC_RELAXED);
+            DECR_N(pool->metrics, pool_curr, n);
+
+            return;
+        }
+
+        k = MIN(n, pool->bsize);
+        cc_memcpy(blk->obj, obj, k * sizeof(void *));
+        blk->nobj = k;
+        __atomic_add_fetch(&pool->ndepot, k, __ATOMIC_RELAXED);
+        _stack_push(&pool->depot, blk);
+    }
+}
+
+/*
+ * take up to n objects from the depot, and if mag is given (empty by now),
+ * top it up from what is left of the last block, as if it had been refilled
+ * to low objects before serving the borrow
+ */
+static uint32_t
+_depot_take(struct pool *pool, void **obj, uint32_t n, struct pool_mag *mag)
+{
+    struct pool_blk *blk;
+    uint32_t got = 0, k, nobj;
+
+    while (got < n && (blk = _stack_pop(&pool->depot)) != NULL) {
+        nobj = blk->nobj;
+        k = MIN(n - got, blk->nobj);
+        blk->nobj -= k;
+        cc_memcpy(obj + got, blk->obj + blk->nobj, k * sizeof(void *));
+        got += k;
+
+        if (mag != NULL && blk->nobj > 0) { /* got == n */
+            ASSERT(mag->nfree == 0);
+            k = pool->low > got ? MIN(pool->low - got, blk->nobj) : 0;
+            blk->nobj -= k;
+            cc_memcpy(mag->obj, blk->obj + blk->nobj, k * sizeof(void *));
+            mag->nfree = k;
+        }
+
+        __atomic_sub_fetch(&pool->ndepot, nobj - blk->nobj, __ATOMIC_RELAXED);
+        _stack_push(blk->nobj > 0 ? &pool->depot : &pool->spare, blk);
+    }
+
+    if (mag != NULL && got > 0) {
+        INCR(pool->metrics, pool_refill);
+    }
+
+    return got;
+}
+
+/* magazine ops */
+
+/* move all but the keep newest objects of the magazine to the depot */
+static void
+_mag_spill(struct pool_mag *mag, uint32_t keep)
+{
+    struct pool *pool = mag->pool;
+    uint32_t n;
+
+    if (mag->nfree <= keep) {
+        return;
+    }
+
+    n = mag->nfree - keep;
+    _depot_put(pool, mag->obj, n);
+
+    cc_memmove(mag->obj, mag->obj + n, keep * sizeof(void *));
+    mag->nfree = keep;
+    INCR(pool->metrics, pool_spill);
+}
+
+static void
+_mag_exit(void *arg)
+{
+    struct pool_mag *mag = arg;
+    struct pool *pool = mag->pool;
+
+    _mag_spill(mag, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    TAILQ_REMOVE(&pool->mags, mag, tqe);
+    pthread_mutex_unlock(&pool->lock);
+
+    cc_free(mag);
+}
+
+/* magazine of the calling thread, NULL if magazines are disabled or OOM */
+static struct pool_mag *
+_mag_get(struct pool *pool)
+{
+    struct pool_mag *mag;
+
+    if (pool->high == 0) {
+        return NULL;
+    }
+
+    mag = pthread_getspecific(pool->key);
+    if (mag != NULL) {
+        return mag;
+    }
+
+    mag = cc_alloc(sizeof(*mag) + (pool->high + 1) * sizeof(void *));
+    if (mag == NULL) {
+        log_warn("cannot allocate %s pool magazine, using depot", pool->name);
+
+        return NULL;
+    }
+    mag->pool = pool;
+    mag->nfree = 0;
+    if (pthread_setspecific(pool->key, mag) != 0) {
+        cc_free(mag);
+
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    TAILQ_INSERT_TAIL(&pool->mags, mag, tqe);
+    pthread_mutex_unlock(&pool->lock);
+
+    return mag;
+}
+
+static void *
+_pool_obj_create(struct pool *pool)
+{
+    void *obj;
+
+    if (__atomic_add_fetch(&pool->nobj, 1, __ATOMIC_RELAXED) > pool->nmax) {
+        __atomic_sub_fetch(&pool->nobj, 1, __ATOMIC_RELAXED);
+
+        return NULL;
+    }
+
+    obj = pool->create();
+    if (obj == NULL) {
+        __atomic_sub_fetch(&pool->nobj, 1, __ATOMIC_RELAXED);
+
+        return NULL;
+    }
+    INCR(pool->metrics, pool_create);
+    INCR(pool->metrics, pool_curr);
+
+    return obj;
+}
+
+struct pool *
+pool_create(const char *name, uint32_t max, uint32_t high, uint32_t low,
+        pool_create_fn create, pool_destroy_fn destroy,
+        pool_metrics_st *metrics)
+{
+    struct pool *pool;
+
+    ASSERT(name != NULL && create != NULL && destroy != NULL);
+
+    pool = cc_alloc(sizeof(*pool));
+    if (pool == NULL) {
+        log_error("cannot create %s pool: OOM", name);
+
+        return NULL;
+    }
+
+    pool->name = name;
+    pool->create = create;
+    pool->destroy = destroy;
+    pool->metrics = metrics;
+    pool->nmax = max > 0 ? max : UINT32_MAX;
+    pool->nobj = 0;
+    pool->high = high;
+    pool->low = MIN(low, high);
+    pool->bsize = MAX(high + 1, POOL_BLOCK_MIN);
+    pool->depot = 0;
+    pool->spare = 0;
+    pool->ndepot = 0;
+    TAILQ_INIT(&pool->mags);
+
+    if (pthread_key_create(&pool->key, _mag_exit) != 0) {
+        log_error("cannot create %s pool: no thread key", name);
+        cc_free(pool);
+
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+
+    log_info("created %s pool: max %"PRIu32", magazine %"PRIu32"/%"PRIu32,
+            name, max, pool->low, pool->high);
+
+    return pool;
+}
+
+void
+pool_destroy(struct pool **pool)
+{
+    struct pool *p;
+    struct pool_mag *mag, *tmag;
+    struct pool_blk *blk;
+    uint32_t i;
+
+    if (pool == NULL || (p = *pool) == NULL) {
+        return;
+    }
+
+    log_info("destroying %s pool: free %"PRIu32, p->name, pool_nfree(p));
+
+    /* threads still holding magazines are done with the pool by contract */
+    pthread_setspecific(p->key, NULL);
+    pthread_key_delete(p->key);
+    TAILQ_FOREACH_SAFE(mag, &p->mags, tqe, tmag) {
+        TAILQ_REMOVE(&p->mags, mag, tqe);
+        for (i = 0; i < mag->nfree; i++) {
+            p->destroy(mag->obj[i]);
+        }
+        DECR_N(p->metrics, pool_curr, mag->nfree);
+        cc_free(mag);
+    }
+    while ((blk = _stack_pop(&p->depot)) != NULL) {
+        for (i = 0; i < blk->nobj; i++) {
+            p->destroy(blk->obj[i]);
+        }
+        DECR_N(p->metrics, pool_curr, blk->nobj);
+        cc_free(blk);
+    }
+    while ((blk = _stack_pop(&p->spare)) != NULL) {
+        cc_free(blk);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    cc_free(p);
+    *pool = NULL;
+}
+
+uint32_t
+pool_prealloc(struct pool *pool, uint32_t n)
+{
+    struct pool_blk *blk;
+    void *obj;
+
+    while (pool->ndepot < n) {
+        blk = _blk_get(pool);
+        if (blk == NULL) {
+            break;
+        }
+
+        blk->nobj = 0;
+        while (blk->nobj < MIN(pool->bsize, n - pool->ndepot) &&
+                (obj = _pool_obj_create(pool)) != NULL) {
+            blk->obj[blk->nobj++] = obj;
+        }
+        if (blk->nobj == 0) {
+            _stack_push(&pool->spare, blk);
+            break;
+        }
+        __atomic_add_fetch(&pool->ndepot, blk->nobj, __ATOMIC_RELAXED);
+        _stack_push(&pool->depot, blk);
+    }
+
+    return __atomic_load_n(&pool->ndepot, __ATOMIC_RELAXED);
+}
+
+void *
+pool_borrow(struct pool *pool)
+{
+    void *obj;
+
+    return pool_borrow_n(pool, &obj, 1) == 1 ? obj : NULL;
+}
+
+void
+pool_return(struct pool *pool, void *obj)
+{
+    pool_return_n(pool, &obj, 1);
+}
+
+uint32_t
+pool_borrow_n(struct pool *pool, void **obj, uint32_t n)
+{
+    struct pool_mag *mag;
+    uint32_t got = 0;
+
+    ASSERT(pool != NULL);
+
+    mag = _mag_get(pool);
+    if (mag != NULL) {
+        got = MIN(n, mag->nfree);
+        mag->nfree -= got;
+        cc_memcpy(obj, mag->obj + mag->nfree, got * sizeof(void *));
+    }
+
+    if (got < n) {
+        got += _depot_take(pool, obj + got, n - got, mag);
+    }
+
+    while (got < n && (obj[got] = _pool_obj_create(pool)) != NULL) {
+        got++;
+    }
+
+    INCR_N(pool->metrics, pool_borrow, got);
+    INCR_N(pool->metrics, pool_active, got);
+    if (got < n) {
+        log_debug("borrowed %"PRIu32" of %"PRIu32" objects from %s pool: "
+                "OOM or over limit", got, n, pool->name);
+        INCR(pool->metrics, pool_borrow_ex);
+    }
+
+    return got;
+}
+
+void
+pool_return_n(struct pool *pool, void **obj, uint32_t n)
+{
+    struct pool_mag *mag;
+    uint32_t i;
+
+    ASSERT(pool != NULL);
+
+    mag = _mag_get(pool);
+    if (mag == NULL) {
+        _depot_put(pool, obj, n);
+    } else {
+        for (i = 0; i < n; i++) {
+            mag->obj[mag->nfree++] = obj[i];
+            if (mag->nfree > pool->high) {
+                _mag_spill(mag, pool->low);
+            }
+        }
+    }
+
+    INCR_N(pool->metrics, pool_return, n);
+    DECR_N(pool->metrics, pool_active, n);
+}
+
+void
+pool_flush(struct pool *pool)
+{
+    struct pool_mag *mag;
+
+    if (pool->high == 0) {
+        return;
+    }
+
+    mag = pthread_getspecific(pool->key);
+    if (mag != NULL) {
+        _mag_spill(mag, 0);
+    }
+}
+
+uint32_t
+pool_nfree(struct pool *pool)
+{
+    struct pool_mag *mag;
+    uint32_t nfree;
+
+    pthread_mutex_lock(&pool->lock);
+    nfree = __atomic_load_n(&pool->ndepot, __ATOMIC_RELAXED);
+    TAILQ_FOREACH(mag, &pool->mags, tqe) {
+        nfree += __atomic_load_n(&mag->nfree, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return nfree;
+}
+
+void
+pool_foreach_free(struct pool *pool, pool_iter_fn fn, void *arg)
+{
+    struct pool_mag *mag;
+    struct pool_blk *blk;
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    for (blk = (struct pool_blk *)(uintptr_t)(pool->depot & POOL_PTR_MASK);
+            blk != NULL; blk = blk->next) {
+        for (i = 0; i < blk->nobj; i++) {
+            fn(blk->obj[i], arg);
+        }
+    }
+    TAILQ_FOREACH(mag, &pool->mags, tqe) {
+        for (i = 0; i < mag->nfree; i++) {
+            fn(mag->obj[i], arg);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
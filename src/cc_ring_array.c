@@ -92,9 +92,9 @@ ring_array_push(const void *elem, struct ring_array *arr)
 
     cc_memcpy(arr->data + (arr->elem_size * arr->wpos), elem, arr->elem_size);
 
-    /* update wpos atomically */
+    /* update wpos atomically, publishing the element to the consumer */
     new_wpos = (arr->wpos + 1) % (arr->cap + 1);
-    __atomic_store_n(&(arr->wpos), new_wpos, __ATOMIC_RELAXED);
+    __atomic_store_n(&(arr->wpos), new_wpos, __ATOMIC_RELEASE);
 
     return CC_OK;
 }
@@ -108,7 +108,7 @@ ring_array_full(const struct ring_array *arr)
      * only pops and does not push; in other words, only one thread updates
      * either rpos or wpos.
      */
-    uint32_t rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_RELAXED);
+    uint32_t rpos = __atomic_load_n(&(arr->rpos), __ATOMIC_ACQUIRE);
     return ring_array_nelem(rpos, arr->wpos, arr->cap) == arr->cap;
 }
 
@@ -126,9 +126,9 @@ ring_array_pop(void *elem, struct ring_array *arr)
         cc_memcpy(elem, arr->data + (arr->elem_size * arr->rpos), arr->elem_size);
     }
 
-    /* update rpos atomically */
+    /* update rpos atomically, handing the slot back to the producer */
     new_rpos = (arr->rpos + 1) % (arr->cap + 1);
-    __atomic_store_n(&(arr->rpos), new_rpos, __ATOMIC_RELAXED);
+    __atomic_store_n(&(arr->rpos), new_rpos, __ATOMIC_RELEASE);
 
     return CC_OK;
 }
@@ -137,15 +137,15 @@ bool
 ring_array_empty(const struct ring_array *arr)
 {
     /* take snapshot of wpos, since another thread might be pushing */
-    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_RELAXED);
+    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_ACQUIRE);
     return ring_array_nelem(arr->rpos, wpos, arr->cap) == 0;
 }
 
 void
 ring_array_flush(struct ring_array *arr)
 {
-    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_RELAXED);
-    __atomic_store_n(&(arr->rpos), wpos, __ATOMIC_RELAXED);
+    uint32_t wpos = __atomic_load_n(&(arr->wpos), __ATOMIC_ACQUIRE);
+    __atomic_store_n(&(arr->rpos), wpos, __ATOMIC_RELEASE);
 }
 
 struct ring_array *
@@ -31,9 +31,7 @@
 
 #define PIPE_MODULE_NAME "ccommon::pipe"
 
-FREEPOOL(pipe_conn_pool, cq, pipe_conn);
-static struct pipe_conn_pool cp;
-static bool cp_init = false;
+static struct pool *cp = NULL;
 
 static bool pipe_init = false;
 static pipe_metrics_st *pipe_metrics = NULL;
@@ -92,42 +90,49 @@ pipe_conn_reset(struct pipe_conn *c)
     c->err = 0;
 }
 
+static void *
+_pipe_conn_create(void)
+{
+    return pipe_conn_create();
+}
+
 static void
-pipe_conn_pool_destroy(void)
+_pipe_conn_destroy(void *c)
 {
-    struct pipe_conn *c, *tc;
+    pipe_conn_destroy((struct pipe_conn **)&c);
+}
 
-    if (!cp_init) {
+static void
+pipe_conn_pool_destroy(void)
+{
+    if (cp == NULL) {
         log_warn("pipe conn pool was never created, ignore");
 
         return;
     }
 
-    log_info("destroying pipe conn pool: free %"PRIu32, cp.nfree);
-
-    FREEPOOL_DESTROY(c, tc, &cp, next, pipe_conn_destroy);
-    cp_init = false;
+    pool_destroy(&cp);
 }
 
 static void
 pipe_conn_pool_create(uint32_t max)
 {
-    struct pipe_conn *c;
-
-    if (cp_init) {
+    if (cp != NULL) {
         log_warn("conn pool has already been created, re-creating");
 
         pipe_conn_pool_destroy();
     }
 
-    log_info("creating conn pool: max %"PRIu32, max);
-
-    FREEPOOL_CREATE(&cp, max);
-    cp_init = true;
+    cp = pool_create("pipe_conn", max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _pipe_conn_create, _pipe_conn_destroy,
+            POOL_METRICS(pipe_metrics, pipe_conn_pool_));
+    if (cp == NULL) {
+        log_crit("cannot create pipe conn pool, OOM. abort");
+        exit(EXIT_FAILURE);
+    }
 
     /* preallocating, see notes in buffer/cc_buf.c */
-    FREEPOOL_PREALLOC(c, &cp, max, next, pipe_conn_create);
-    if (cp.nfree < max) {
+    if (pool_prealloc(cp, max) < max) {
         log_crit("cannot preallocate pipe conn pool, OOM. abort");
         exit(EXIT_FAILURE);
     }
@@ -136,9 +141,7 @@ pipe_conn_pool_create(uint32_t max)
 struct pipe_conn *
 pipe_conn_borrow(void)
 {
-    struct pipe_conn *c;
-
-    FREEPOOL_BORROW(c, &cp, next, pipe_conn_create);
+    struct pipe_conn *c = pool_borrow(cp);
 
     if (c == NULL) {
         INCR(pipe_metrics, pipe_conn_borrow_ex);
@@ -165,7 +168,7 @@ pipe_conn_return(struct pipe_conn **c)
     log_verb("return conn %p", *c);
 
     (*c)->free = true;
-    FREEPOOL_RETURN(*c, &cp, next);
+    pool_return(cp, *c);
 
     *c = NULL;
     INCR(pipe_metrics, pipe_conn_return);
@@ -23,6 +23,7 @@
 #include <cc_pool.h>
 #include <cc_util.h>
 #include <cc_event.h>
+#include <time/cc_timer.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -31,18 +32,32 @@
 #include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#ifdef OS_LINUX
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <sys/sendfile.h>
+#endif
 
 #define TCP_MODULE_NAME "ccommon::tcp"
 
-FREEPOOL(tcp_conn_pool, cq, tcp_conn);
-static struct tcp_conn_pool cp;
+static struct pool *cp = NULL;
 
 static bool tcp_init = false;
-static bool cp_init = false;
 static tcp_metrics_st *tcp_metrics = NULL;
 static int max_backlog = TCP_BACKLOG;
+static size_t zcopy_min = TCP_ZCOPY_MIN;
+static size_t sendfile_max = TCP_SENDFILE_MAX;
+
+/* backpressure on tcp_accept_batch */
+static uint32_t accept_rate = TCP_ACCEPT_RATE;
+static uint32_t max_active = TCP_MAX_ACTIVE;
+static bool accept_shed = TCP_ACCEPT_SHED;
+static uint32_t nactive = 0; /* borrowed tcp_conn, returned on any thread */
+static struct timeout accept_window;
+static uint32_t accept_nwindow = 0;
 
 void
 tcp_conn_reset(struct tcp_conn *c)
@@ -59,6 +74,13 @@ tcp_conn_reset(struct tcp_conn *c)
     c->state = CHANNEL_UNKNOWN;
     c->flags = 0;
 
+    c->zcopy = false;
+    c->zc_sent = 0;
+    c->zc_done = 0;
+
+    c->sampled = false;
+    c->info_retrans = 0;
+
     c->err = 0;
 }
 
@@ -100,42 +122,49 @@ tcp_conn_destroy(struct tcp_conn **conn)
     DECR(tcp_metrics, tcp_conn_curr);
 }
 
+static void *
+_tcp_conn_create(void)
+{
+    return tcp_conn_create();
+}
+
 static void
-tcp_conn_pool_destroy(void)
+_tcp_conn_destroy(void *c)
 {
-    struct tcp_conn *c, *tc;
+    tcp_conn_destroy((struct tcp_conn **)&c);
+}
 
-    if (!cp_init) {
+static void
+tcp_conn_pool_destroy(void)
+{
+    if (cp == NULL) {
         log_warn("tcp_conn pool was never created, ignore");
 
         return;
     }
 
-    log_info("destroying tcp_conn pool: free %"PRIu32, cp.nfree);
-
-    FREEPOOL_DESTROY(c, tc, &cp, next, tcp_conn_destroy);
-    cp_init = false;
+    pool_destroy(&cp);
 }
 
 static void
 tcp_conn_pool_create(uint32_t max)
 {
-    struct tcp_conn *c;
-
-    if (cp_init) {
+    if (cp != NULL) {
         log_warn("tcp_conn pool has already been created, re-creating");
 
         tcp_conn_pool_destroy();
     }
 
-    log_info("creating tcp_conn pool: max %"PRIu32, max);
-
-    FREEPOOL_CREATE(&cp, max);
-    cp_init = true;
+    cp = pool_create("tcp_conn", max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _tcp_conn_create, _tcp_conn_destroy,
+            POOL_METRICS(tcp_metrics, tcp_conn_pool_));
+    if (cp == NULL) {
+        log_crit("cannot create tcp_conn pool due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
 
     /* preallocating, see notes in buffer/cc_buf.c */
-    FREEPOOL_PREALLOC(c, &cp, max, next, tcp_conn_create);
-    if (cp.nfree < max) {
+    if (pool_prealloc(cp, max) < max) {
         log_crit("cannot preallocate tcp_conn pool due to OOM, abort");
         exit(EXIT_FAILURE);
     }
@@ -144,9 +173,7 @@ tcp_conn_pool_create(uint32_t max)
 struct tcp_conn *
 tcp_conn_borrow(void)
 {
-    struct tcp_conn *c;
-
-    FREEPOOL_BORROW(c, &cp, next, tcp_conn_create);
+    struct tcp_conn *c = pool_borrow(cp);
 
     if (c == NULL) {
         log_debug("borrow tcp_conn failed: OOM or over limit");
@@ -156,6 +183,7 @@ tcp_conn_borrow(void)
     }
 
     tcp_conn_reset(c);
+    __atomic_add_fetch(&nactive, 1, __ATOMIC_RELAXED);
     INCR(tcp_metrics, tcp_conn_borrow);
     INCR(tcp_metrics, tcp_conn_active);
 
@@ -172,9 +200,11 @@ tcp_conn_return(struct tcp_conn **c)
     }
 
     log_verb("return tcp_conn %p", *c);
+    ASSERT(!(*c)->sampled); /* see tcp_info_del */
 
     (*c)->free = true;
-    FREEPOOL_RETURN(*c, &cp, next);
+    pool_return(cp, *c);
+    __atomic_sub_fetch(&nactive, 1, __ATOMIC_RELAXED);
 
     *c = NULL;
     INCR(tcp_metrics, tcp_conn_return);
@@ -244,8 +274,8 @@ error:
     return false;
 }
 
-bool
-tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
+static bool
+_tcp_listen(struct addrinfo *ai, struct tcp_conn *c, bool reuseport)
 {
     int ret;
     int sd;
@@ -264,6 +294,14 @@ tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
         goto error;
     }
 
+    if (reuseport) {
+        ret = tcp_set_reuseport(sd);
+        if (ret < 0) {
+            log_error("reuse port of sd %d failed: %s", sd, strerror(errno));
+            goto error;
+        }
+    }
+
     ret = bind(sd, ai->ai_addr, ai->ai_addrlen);
     if (ret < 0) {
         log_error("bind on sd %d failed: %s", sd, strerror(errno));
@@ -302,6 +340,101 @@ error:
     return false;
 }
 
+bool
+tcp_listen(struct addrinfo *ai, struct tcp_conn *c)
+{
+    return _tcp_listen(ai, c, false);
+}
+
+/*
+ * Have the kernel pick the listener of a new connection by the cpu it
+ * arrived on (where its NIC queue is serviced): listener i takes connections
+ * arriving on cpu i, modulo n. With cBPF the program simply returns the cpu
+ * as an index into the group, in the order the listeners were bound; without
+ * it, SO_INCOMING_CPU on each listener is a preference the kernel applies
+ * when picking among the group.
+ *
+ * On failure, the err of the listener that couldn't be set up tells why.
+ */
+static bool
+_tcp_listen_steer(struct tcp_conn **c, uint32_t n)
+{
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < n; i++) {
+        ret = tcp_set_incoming_cpu(c[i]->sd, (int)i);
+        if (ret < 0) {
+            c[i]->err = errno;
+            log_error("set incoming cpu %"PRIu32" on sd %d failed: %s", i,
+                    c[i]->sd, strerror(errno));
+
+            return false;
+        }
+    }
+
+#if defined(OS_LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    {
+        struct sock_filter code[] = {
+            /* A = raw_smp_processor_id() */
+            { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+            /* A = A % n */
+            { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n },
+            /* return A */
+            { BPF_RET | BPF_A, 0, 0, 0 },
+        };
+        struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+        /* attaching to any socket applies it to the whole group */
+        ret = setsockopt(c[0]->sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                sizeof(prog));
+        if (ret < 0) {
+            c[0]->err = errno;
+            log_error("attach reuseport cbpf on sd %d failed: %s", c[0]->sd,
+                    strerror(errno));
+
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
+bool
+tcp_listen_reuseport(struct addrinfo *ai, struct tcp_conn **c, uint32_t n,
+        bool steer)
+{
+    uint32_t i;
+
+    ASSERT(c != NULL && n > 0);
+
+    for (i = 0; i < n; i++) {
+        if (!_tcp_listen(ai, c[i], true)) {
+            log_error("listen %"PRIu32" of %"PRIu32" with reuseport failed",
+                    i, n);
+            while (i-- > 0) {
+                tcp_close(c[i]);
+            }
+
+            return false;
+        }
+    }
+
+    if (steer && !_tcp_listen_steer(c, n)) {
+        log_error("steering %"PRIu32" listeners with reuseport failed", n);
+        for (i = 0; i < n; i++) {
+            tcp_close(c[i]);
+        }
+
+        return false;
+    }
+
+    log_info("%"PRIu32" listeners set up with reuseport, steer %d", n, steer);
+
+    return true;
+}
+
 void
 tcp_close(struct tcp_conn *c)
 {
@@ -321,7 +454,7 @@ tcp_close(struct tcp_conn *c)
 }
 
 static inline int
-_tcp_accept(struct tcp_conn *sc)
+_tcp_accept(struct tcp_conn *sc, bool cloexec)
 {
     int sd;
 
@@ -353,16 +486,25 @@ _tcp_accept(struct tcp_conn *sc)
      * becomes possible again, and any new connections arriving will be added
      * to the back of the queue until it's full, at which point the client
      * will receive an exception and the connect attempt will fail.
+     *
+     * The errno of a failed accept is kept in sc->err, so that callers can
+     * tell an exhausted backlog (EAGAIN) from the rest. This matters for
+     * listeners registered edge-triggered, which are only reported again
+     * when a new connection arrives and thus must be drained until EAGAIN.
      */
     for (;;) {
 #ifdef CC_ACCEPT4
-        sd = accept4(sc->sd, NULL, NULL, SOCK_NONBLOCK);
+        sd = accept4(sc->sd, NULL, NULL,
+                cloexec ? SOCK_NONBLOCK | SOCK_CLOEXEC : SOCK_NONBLOCK);
 #else
+        (void)cloexec;
         sd = accept(sc->sd, NULL, NULL);
 #endif /* CC_ACCEPT4 */
         if (sd < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 log_debug("accept on sd %d not ready: eagain", sc->sd);
+                sc->err = EAGAIN;
+
                 return -1;
             }
 
@@ -374,6 +516,7 @@ _tcp_accept(struct tcp_conn *sc)
 
             log_error("accept on sd %d failed: %s", sc->sd, strerror(errno));
             INCR(tcp_metrics, tcp_accept_ex);
+            sc->err = errno;
 
             return -1;
         }
@@ -382,6 +525,8 @@ _tcp_accept(struct tcp_conn *sc)
     }
 
     ASSERT(sd >= 0);
+    sc->err = 0;
+
     return sd;
 }
 
@@ -391,7 +536,7 @@ tcp_accept(struct tcp_conn *sc, struct tcp_conn *c)
     int ret;
     int sd;
 
-    sd = _tcp_accept(sc);
+    sd = _tcp_accept(sc, false);
     INCR(tcp_metrics, tcp_accept);
     if (sd < 0) {
         return false;
@@ -426,7 +571,7 @@ tcp_reject(struct tcp_conn *sc)
     int sd;
 
     INCR(tcp_metrics, tcp_reject);
-    sd = _tcp_accept(sc);
+    sd = _tcp_accept(sc, false);
     if (sd < 0) {
         INCR(tcp_metrics, tcp_reject_ex);
         return;
@@ -480,6 +625,125 @@ tcp_reject_all(struct tcp_conn *sc)
     }
 }
 
+/* how many of n connections may be accepted now, by tcp_max_active and rate */
+static inline uint32_t
+_tcp_accept_budget(uint32_t n, bool *full, bool *paced)
+{
+    uint32_t active;
+
+    *full = false;
+    *paced = false;
+
+    if (max_active > 0) {
+        active = __atomic_load_n(&nactive, __ATOMIC_RELAXED);
+        if (active >= max_active || n > max_active - active) {
+            n = active >= max_active ? 0 : max_active - active;
+            *full = true;
+        }
+    }
+
+    if (accept_rate > 0) {
+        if (timeout_expired(&accept_window)) {
+            timeout_add_sec(&accept_window, 1);
+            accept_nwindow = 0;
+        }
+        if (n > accept_rate - accept_nwindow) {
+            n = accept_rate - accept_nwindow;
+            *full = false;
+            *paced = true;
+        }
+    }
+
+    return n;
+}
+
+int
+tcp_accept_batch(struct tcp_conn *sc, struct tcp_conn **c, uint32_t n)
+{
+    uint32_t budget, nborrow, i, nconn = 0;
+    bool full, paced;
+    int ret;
+    int sd;
+
+    ASSERT(sc != NULL && c != NULL);
+
+    INCR(tcp_metrics, tcp_accept_batch);
+
+    budget = _tcp_accept_budget(n, &full, &paced);
+    nborrow = pool_borrow_n(cp, (void **)c, budget);
+    if (nborrow < budget) {
+        log_debug("borrow tcp_conn failed: OOM or over limit");
+        INCR(tcp_metrics, tcp_conn_borrow_ex);
+        full = true;
+        paced = false;
+    }
+
+    sc->err = 0;
+    for (; nconn < nborrow; nconn++) {
+        sd = _tcp_accept(sc, true);
+        if (sd < 0) {
+            break;
+        }
+
+        tcp_conn_reset(c[nconn]);
+        c[nconn]->sd = sd;
+        c[nconn]->level = CHANNEL_BASE;
+        c[nconn]->state = CHANNEL_ESTABLISHED;
+
+#ifndef CC_ACCEPT4 /* if we have accept4, nonblock will already have been set */
+        ret = tcp_set_nonblocking(sd);
+        if (ret < 0) {
+            log_warn("set nonblock on sd %d failed, ignored: %s", sd,
+                    strerror(errno));
+        }
+#endif
+    }
+
+    /* give back what wasn't needed, as tcp_conn_return would */
+    for (i = nconn; i < nborrow; i++) {
+        c[i]->free = true;
+    }
+    pool_return_n(cp, (void **)(c + nconn), nborrow - nconn);
+
+    __atomic_add_fetch(&nactive, nconn, __ATOMIC_RELAXED);
+    accept_nwindow += nconn;
+    INCR_N(tcp_metrics, tcp_accept, nconn);
+    INCR_N(tcp_metrics, tcp_conn_borrow, nconn);
+    INCR_N(tcp_metrics, tcp_conn_active, nconn);
+
+    log_verb("accepted %"PRIu32" of %"PRIu32" conns on sd %d", nconn, n,
+            sc->sd);
+
+    if (nconn < nborrow || nconn == n) { /* backlog drained, failed, or done */
+        return (int)nconn;
+    }
+
+    /* stopped short by a limit, with connections possibly still pending */
+    if (full) {
+        INCR(tcp_metrics, tcp_accept_full);
+    }
+    if (paced) {
+        INCR(tcp_metrics, tcp_accept_paced);
+    }
+    sc->err = EBUSY;
+
+    for (i = nconn; accept_shed && i < n; i++) {
+        sd = _tcp_accept(sc, false);
+        if (sd < 0) {
+            break;
+        }
+
+        ret = close(sd);
+        if (ret < 0) {
+            log_warn("close c %d failed, ignored: %s", sd, strerror(errno));
+        }
+        INCR(tcp_metrics, tcp_accept_shed);
+        sc->err = EBUSY;
+    }
+
+    return (int)nconn;
+}
+
 int
 tcp_set_blocking(int sd)
 {
@@ -518,6 +782,43 @@ tcp_set_reuseaddr(int sd)
     return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
 }
 
+int
+tcp_set_reuseport(int sd)
+{
+#ifdef SO_REUSEPORT
+    int reuse;
+    socklen_t len;
+
+    reuse = 1;
+    len = sizeof(reuse);
+
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, len);
+#else
+    (void)sd;
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+
+int
+tcp_set_incoming_cpu(int sd, int cpu)
+{
+#ifdef SO_INCOMING_CPU
+    socklen_t len;
+
+    len = sizeof(cpu);
+
+    return setsockopt(sd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, len);
+#else
+    (void)sd;
+    (void)cpu;
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+
 /*
  * Disable Nagle algorithm on TCP socket.
  *
@@ -859,7 +1160,7 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
 
     for (;;) {
         n = writev(c->sd, (const struct iovec *)bufv->data, bufv->nelem);
-        INCR(tcp_metrics, tcp_send_ex);
+        INCR(tcp_metrics, tcp_send);
 
         log_verb("writev on sd %d %zd of %zu in %"PRIu32" buffers",
                   c->sd, n, nbyte, bufv->nelem);
@@ -895,6 +1196,247 @@ tcp_sendv(struct tcp_conn *c, struct array *bufv, size_t nbyte)
     return CC_ERROR;
 }
 
+rstatus_i
+tcp_zcopy_enable(struct tcp_conn *c)
+{
+#ifdef SO_ZEROCOPY
+    int one = 1;
+
+    if (setsockopt(c->sd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        c->err = errno;
+        log_info("enable zero-copy on sd %d failed: %s", c->sd,
+                strerror(errno));
+
+        return CC_ERROR;
+    }
+    c->zcopy = true;
+
+    return CC_OK;
+#else
+    log_info("zero-copy send is not supported on this platform");
+
+    return CC_ERROR;
+#endif
+}
+
+static ssize_t
+_tcp_sendmsg_zcopy(struct tcp_conn *c, struct iovec *iov, size_t iovcnt,
+        size_t nbyte)
+{
+    struct msghdr msg;
+    int flags = 0;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+#ifdef MSG_ZEROCOPY
+    if (c->zcopy && nbyte >= zcopy_min) {
+        flags = MSG_ZEROCOPY;
+    }
+#endif
+    if (flags == 0) {
+        INCR(tcp_metrics, tcp_zcopy_fallback);
+    }
+
+    log_verb("zero-copy send on sd %d, total %zu bytes", c->sd, nbyte);
+
+    for (;;) {
+        n = sendmsg(c->sd, &msg, flags);
+        INCR(tcp_metrics, tcp_send);
+
+        log_verb("sendmsg on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            if (flags != 0) {
+                /* the kernel numbers zero-copy sends in the same order */
+                c->zc_sent++;
+                INCR(tcp_metrics, tcp_zcopy);
+            }
+            INCR_N(tcp_metrics, tcp_send_byte, n);
+            c->send_nbyte += (size_t)n;
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("sendmsg on sd %d returned zero", c->sd);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(tcp_metrics, tcp_send_ex);
+        if (errno == EINTR) {
+            log_verb("sendmsg on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == ENOBUFS && flags != 0) {
+            /* out of memory to pin pages, the copy path still works */
+            log_verb("zero-copy on sd %d out of optmem, copy instead", c->sd);
+            flags = 0;
+            INCR(tcp_metrics, tcp_zcopy_fallback);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_verb("sendmsg on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("sendmsg on sd %d failed: %s", c->sd, strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+ssize_t
+tcp_send_zcopy(struct tcp_conn *c, void *buf, size_t nbyte)
+{
+    struct iovec iov;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+
+    return _tcp_sendmsg_zcopy(c, &iov, 1, nbyte);
+}
+
+ssize_t
+tcp_sendv_zcopy(struct tcp_conn *c, struct array *bufv, size_t nbyte)
+{
+    ASSERT(array_nelem(bufv) > 0);
+    ASSERT(nbyte != 0);
+
+    return _tcp_sendmsg_zcopy(c, (struct iovec *)bufv->data, bufv->nelem,
+            nbyte);
+}
+
+int
+tcp_zcopy_reap(struct tcp_conn *c)
+{
+#if defined MSG_ZEROCOPY && defined SO_EE_ORIGIN_ZEROCOPY
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+        CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    uint32_t ncompl;
+    int count = 0;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(c->sd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            c->err = errno;
+            log_error("recv error queue on sd %d failed: %s", c->sd,
+                    strerror(errno));
+
+            return CC_ERROR;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 ||
+                    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            /* sends numbered ee_info through ee_data, inclusive, are done */
+            ncompl = serr->ee_data - serr->ee_info + 1;
+            c->zc_done = serr->ee_data + 1;
+            count += ncompl;
+            INCR_N(tcp_metrics, tcp_zcopy_done, ncompl);
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                INCR_N(tcp_metrics, tcp_zcopy_copied, ncompl);
+            }
+        }
+    }
+
+    log_verb("reaped %d zero-copy completions on sd %d", count, c->sd);
+
+    return count;
+#else
+    (void)c;
+
+    return 0;
+#endif
+}
+
+ssize_t
+tcp_sendfile(struct tcp_conn *c, int fd, off_t *offset, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(offset != NULL);
+    ASSERT(nbyte > 0);
+
+    nbyte = MIN(nbyte, sendfile_max);
+
+    log_verb("sendfile on sd %d from fd %d, total %zu bytes", c->sd, fd, nbyte);
+
+    for (;;) {
+#if defined OS_DARWIN
+        off_t len = (off_t)nbyte;
+
+        /* bytes sent are reported in len, even if interrupted */
+        n = sendfile(fd, c->sd, *offset, &len, NULL, 0);
+        if (len > 0) {
+            *offset += len;
+            n = (ssize_t)len;
+        }
+#else
+        n = sendfile(c->sd, fd, offset, nbyte);
+#endif
+        INCR(tcp_metrics, tcp_sendfile);
+
+        log_verb("sendfile on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            INCR_N(tcp_metrics, tcp_sendfile_byte, n);
+            c->send_nbyte += (size_t)n;
+            return n;
+        }
+
+        if (n == 0) {
+            log_verb("sendfile on sd %d hit end of fd %d", c->sd, fd);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(tcp_metrics, tcp_send_ex);
+        if (errno == EINTR) {
+            log_verb("sendfile on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_verb("sendfile on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("sendfile on sd %d failed: %s", c->sd, strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
 void
 tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
 {
@@ -911,7 +1453,14 @@ tcp_setup(tcp_options_st *options, tcp_metrics_st *metrics)
     if (options != NULL) {
         max_backlog = option_uint(&options->tcp_backlog);
         max = option_uint(&options->tcp_poolsize);
+        zcopy_min = option_uint(&options->tcp_zcopy_min);
+        sendfile_max = option_uint(&options->tcp_sendfile_max);
+        accept_rate = option_uint(&options->tcp_accept_rate);
+        max_active = option_uint(&options->tcp_max_active);
+        accept_shed = option_bool(&options->tcp_accept_shed);
     }
+    timeout_add_sec(&accept_window, 1);
+    accept_nwindow = 0;
     tcp_conn_pool_create(max);
 
     channel_sigpipe_ignore(); /* does it ever fail? */
@@ -929,6 +1478,10 @@ tcp_teardown(void)
 
     tcp_conn_pool_destroy();
     tcp_metrics = NULL;
+    accept_rate = TCP_ACCEPT_RATE;
+    max_active = TCP_MAX_ACTIVE;
+    accept_shed = TCP_ACCEPT_SHED;
+    nactive = 0;
 
     tcp_init = false;
 }
@@ -0,0 +1,211 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_tcp_info.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_queue.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+#define TCP_INFO_MODULE_NAME "ccommon::tcp_info"
+
+TAILQ_HEAD(tcp_conn_tqh, tcp_conn);
+
+struct tcp_info_sampler {
+    struct tcp_conn_tqh     conn;       /* sampled from the head, moved back */
+    uint32_t                nconn;      /* # conns added */
+};
+
+static bool tcp_info_init = false;
+static tcp_info_metrics_st *tcp_info_metrics = NULL;
+static uint32_t nsample = TCP_INFO_NSAMPLE;
+
+struct tcp_info_sampler *
+tcp_info_sampler_create(void)
+{
+    struct tcp_info_sampler *s;
+
+    s = (struct tcp_info_sampler *)cc_alloc(sizeof(*s));
+    if (s == NULL) {
+        log_error("create tcp_info sampler failed due to OOM");
+
+        return NULL;
+    }
+
+    TAILQ_INIT(&s->conn);
+    s->nconn = 0;
+
+    return s;
+}
+
+void
+tcp_info_sampler_destroy(struct tcp_info_sampler **s)
+{
+    struct tcp_conn *c;
+
+    if (*s == NULL) {
+        return;
+    }
+
+    while (!TAILQ_EMPTY(&(*s)->conn)) {
+        c = TAILQ_FIRST(&(*s)->conn);
+        tcp_info_del(*s, c);
+    }
+
+    cc_free(*s);
+    *s = NULL;
+}
+
+void
+tcp_info_add(struct tcp_info_sampler *s, struct tcp_conn *c)
+{
+    ASSERT(s != NULL && c != NULL);
+    ASSERT(!c->sampled);
+
+    TAILQ_INSERT_TAIL(&s->conn, c, info_tqe);
+    c->sampled = true;
+    s->nconn++;
+}
+
+void
+tcp_info_del(struct tcp_info_sampler *s, struct tcp_conn *c)
+{
+    ASSERT(s != NULL && c != NULL);
+
+    if (!c->sampled) {
+        return;
+    }
+
+    TAILQ_REMOVE(&s->conn, c, info_tqe);
+    c->sampled = false;
+    s->nconn--;
+}
+
+rstatus_i
+tcp_info_get(struct tcp_conn *c, struct tcp_conn_info *info)
+{
+#ifdef OS_LINUX
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    if (getsockopt(c->sd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+        c->err = errno;
+        log_debug("get tcp info on sd %d failed: %s", c->sd, strerror(errno));
+
+        return CC_ERROR;
+    }
+
+    info->rtt = ti.tcpi_rtt;
+    info->rttvar = ti.tcpi_rttvar;
+    info->retrans = ti.tcpi_total_retrans;
+    info->cwnd = ti.tcpi_snd_cwnd;
+    info->unacked = ti.tcpi_unacked;
+
+    return CC_OK;
+#else
+    (void)info;
+    c->err = ENOTSUP;
+
+    return CC_ERROR;
+#endif
+}
+
+static void
+_tcp_info_record(struct tcp_conn *c)
+{
+    struct tcp_conn_info info;
+
+    if (tcp_info_get(c, &info) != CC_OK) {
+        INCR(tcp_info_metrics, tcp_info_sample_ex);
+
+        return;
+    }
+
+    INCR(tcp_info_metrics, tcp_info_sample);
+    INCR_LOG2(tcp_info_metrics, tcp_rtt_0, TCP_RTT_NBUCKET, info.rtt);
+    /* the kernel counts retransmits since connect, record those since */
+    INCR_LOG2(tcp_info_metrics, tcp_retrans_0, TCP_RETRANS_NBUCKET,
+            info.retrans - c->info_retrans);
+    c->info_retrans = info.retrans;
+    INCR_LOG2(tcp_info_metrics, tcp_cwnd_0, TCP_CWND_NBUCKET, info.cwnd);
+    INCR_LOG2(tcp_info_metrics, tcp_unacked_0, TCP_UNACKED_NBUCKET,
+            info.unacked);
+
+    log_verb("tcp info of sd %d: rtt %"PRIu32"us rttvar %"PRIu32"us retrans "
+            "%"PRIu32" cwnd %"PRIu32" unacked %"PRIu32, c->sd, info.rtt,
+            info.rttvar, info.retrans, info.cwnd, info.unacked);
+}
+
+void
+tcp_info_sample(void *arg)
+{
+    struct tcp_info_sampler *s = arg;
+    struct tcp_conn *c;
+    uint32_t i, n;
+
+    ASSERT(s != NULL);
+
+    n = MIN(nsample, s->nconn);
+    for (i = 0; i < n; i++) {
+        c = TAILQ_FIRST(&s->conn);
+        TAILQ_REMOVE(&s->conn, c, info_tqe);
+        TAILQ_INSERT_TAIL(&s->conn, c, info_tqe);
+
+        _tcp_info_record(c);
+    }
+}
+
+void
+tcp_info_setup(tcp_info_options_st *options, tcp_info_metrics_st *metrics)
+{
+    log_info("set up the %s module", TCP_INFO_MODULE_NAME);
+
+    if (tcp_info_init) {
+        log_warn("%s has already been setup, overwrite", TCP_INFO_MODULE_NAME);
+    }
+
+    tcp_info_metrics = metrics;
+
+    if (options != NULL) {
+        nsample = option_uint(&options->tcp_info_nsample);
+    }
+
+    tcp_info_init = true;
+}
+
+void
+tcp_info_teardown(void)
+{
+    log_info("tear down the %s module", TCP_INFO_MODULE_NAME);
+
+    if (!tcp_info_init) {
+        log_warn("%s has never been setup", TCP_INFO_MODULE_NAME);
+    }
+
+    tcp_info_metrics = NULL;
+    nsample = TCP_INFO_NSAMPLE;
+
+    tcp_info_init = false;
+}
@@ -0,0 +1,719 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_udp.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_pool.h>
+#include <cc_util.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+
+#define UDP_MODULE_NAME "ccommon::udp"
+
+#if defined UDP_SEGMENT && defined UDP_GRO
+#define UDP_HAVE_GSO 1
+#endif
+
+static struct pool *cp = NULL;
+static struct pool *dp = NULL;
+
+static bool udp_init = false;
+static udp_metrics_st *udp_metrics = NULL;
+static uint32_t dgram_size = UDP_DGRAM_SIZE;
+
+/* per-datagram message state of a batch */
+struct udp_msg {
+    struct iovec    iov;
+#ifdef UDP_HAVE_GSO
+    union {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+#endif
+};
+
+void
+udp_conn_reset(struct udp_conn *c)
+{
+    STAILQ_NEXT(c, next) = NULL;
+    c->free = false;
+
+    c->level = CHANNEL_INVALID;
+    c->sd = 0;
+
+    c->recv_nbyte = 0;
+    c->send_nbyte = 0;
+
+    c->state = CHANNEL_UNKNOWN;
+    c->flags = 0;
+
+    c->err = 0;
+}
+
+struct udp_conn *
+udp_conn_create(void)
+{
+    struct udp_conn *c = (struct udp_conn *)cc_alloc(sizeof(struct udp_conn));
+
+    if (c == NULL) {
+        log_info("connection creation failed due to OOM");
+        INCR(udp_metrics, udp_conn_create_ex);
+
+        return NULL;
+    }
+
+    udp_conn_reset(c);
+    INCR(udp_metrics, udp_conn_create);
+    INCR(udp_metrics, udp_conn_curr);
+
+    log_verb("created udp_conn %p", c);
+
+    return c;
+}
+
+void
+udp_conn_destroy(struct udp_conn **conn)
+{
+    struct udp_conn *c = *conn;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_verb("destroy udp_conn %p", c);
+
+    cc_free(c);
+    *conn = NULL;
+    INCR(udp_metrics, udp_conn_destroy);
+    DECR(udp_metrics, udp_conn_curr);
+}
+
+static void *
+_udp_conn_create(void)
+{
+    return udp_conn_create();
+}
+
+static void
+_udp_conn_destroy(void *c)
+{
+    udp_conn_destroy((struct udp_conn **)&c);
+}
+
+struct udp_conn *
+udp_conn_borrow(void)
+{
+    struct udp_conn *c = pool_borrow(cp);
+
+    if (c == NULL) {
+        log_debug("borrow udp_conn failed: OOM or over limit");
+        INCR(udp_metrics, udp_conn_borrow_ex);
+
+        return NULL;
+    }
+
+    udp_conn_reset(c);
+    INCR(udp_metrics, udp_conn_borrow);
+    INCR(udp_metrics, udp_conn_active);
+
+    log_verb("borrow udp_conn %p", c);
+
+    return c;
+}
+
+void
+udp_conn_return(struct udp_conn **c)
+{
+    if (c == NULL || *c == NULL || (*c)->free) {
+        return;
+    }
+
+    log_verb("return udp_conn %p", *c);
+
+    (*c)->free = true;
+    pool_return(cp, *c);
+
+    *c = NULL;
+    INCR(udp_metrics, udp_conn_return);
+    DECR(udp_metrics, udp_conn_active);
+}
+
+static void *
+_udp_dgram_create(void)
+{
+    struct udp_dgram *dg;
+
+    dg = (struct udp_dgram *)cc_alloc(sizeof(struct udp_dgram) + dgram_size);
+    if (dg == NULL) {
+        return NULL;
+    }
+    dg->cap = dgram_size;
+    INCR(udp_metrics, udp_dgram_curr);
+
+    return dg;
+}
+
+static void
+_udp_dgram_destroy(void *dg)
+{
+    cc_free(dg);
+    DECR(udp_metrics, udp_dgram_curr);
+}
+
+struct udp_dgram *
+udp_dgram_borrow(void)
+{
+    struct udp_dgram *dg = pool_borrow(dp);
+
+    if (dg == NULL) {
+        log_debug("borrow udp_dgram failed: OOM or over limit");
+        INCR(udp_metrics, udp_dgram_ex);
+
+        return NULL;
+    }
+
+    STAILQ_NEXT(dg, next) = NULL;
+    dg->free = false;
+    dg->addrlen = 0;
+    dg->segsz = 0;
+    dg->truncated = false;
+    dg->len = 0;
+    INCR(udp_metrics, udp_dgram_active);
+
+    return dg;
+}
+
+void
+udp_dgram_return(struct udp_dgram **dg)
+{
+    if (dg == NULL || *dg == NULL || (*dg)->free) {
+        return;
+    }
+
+    (*dg)->free = true;
+    pool_return(dp, *dg);
+
+    *dg = NULL;
+    DECR(udp_metrics, udp_dgram_active);
+}
+
+static bool
+_udp_open(struct addrinfo *ai, struct udp_conn *c, bool server)
+{
+    int ret;
+
+    ASSERT(c != NULL);
+
+    INCR(udp_metrics, udp_open);
+    c->sd = socket(ai->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (c->sd < 0) {
+        log_error("socket create for udp_conn %p failed: %s", c,
+                strerror(errno));
+
+        goto error;
+    }
+
+    if (server) {
+        ret = udp_set_reuseaddr(c->sd);
+        if (ret < 0) {
+            log_error("reuse of sd %d failed: %s", c->sd, strerror(errno));
+            goto error;
+        }
+        ret = bind(c->sd, ai->ai_addr, ai->ai_addrlen);
+    } else {
+        ret = connect(c->sd, ai->ai_addr, ai->ai_addrlen);
+    }
+    if (ret < 0) {
+        log_error("%s on sd %d failed: %s", server ? "bind" : "connect",
+                c->sd, strerror(errno));
+        goto error;
+    }
+
+    ret = udp_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    c->level = CHANNEL_BASE;
+    c->state = CHANNEL_ESTABLISHED;
+    log_info("udp %s on sd %d", server ? "bound" : "connected", c->sd);
+
+    return true;
+
+error:
+    c->err = errno;
+    INCR(udp_metrics, udp_open_ex);
+    if (c->sd > 0) {
+        udp_close(c);
+    }
+
+    return false;
+}
+
+bool
+udp_bind(struct addrinfo *ai, struct udp_conn *c)
+{
+    return _udp_open(ai, c, true);
+}
+
+bool
+udp_connect(struct addrinfo *ai, struct udp_conn *c)
+{
+    return _udp_open(ai, c, false);
+}
+
+void
+udp_close(struct udp_conn *c)
+{
+    int ret;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_info("closing udp_conn %p sd %d", c, c->sd);
+
+    INCR(udp_metrics, udp_close);
+    ret = close(c->sd);
+    if (ret < 0) {
+        log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+    }
+}
+
+int
+udp_set_nonblocking(int sd)
+{
+    int flags;
+
+    flags = fcntl(sd, F_GETFL, 0);
+    if (flags < 0) {
+        return flags;
+    }
+
+    return fcntl(sd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int
+udp_set_reuseaddr(int sd)
+{
+    int reuse;
+    socklen_t len;
+
+    reuse = 1;
+    len = sizeof(reuse);
+
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
+}
+
+/* let the kernel coalesce datagrams of a flow into one receive */
+int
+udp_set_gro(int sd)
+{
+#ifdef UDP_HAVE_GSO
+    int gro;
+    socklen_t len;
+
+    gro = 1;
+    len = sizeof(gro);
+
+    return setsockopt(sd, IPPROTO_UDP, UDP_GRO, &gro, len);
+#else
+    (void)sd;
+    errno = ENOTSUP;
+
+    return -1;
+#endif
+}
+
+/* on error, returns CC_EAGAIN if the socket is not ready or CC_ERROR */
+static int
+_udp_error(struct udp_conn *c, const char *op)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        log_verb("%s on sd %d not ready - EAGAIN", op, c->sd);
+
+        return CC_EAGAIN;
+    }
+
+    c->err = errno;
+    log_error("%s on sd %d failed: %s", op, c->sd, strerror(errno));
+
+    return CC_ERROR;
+}
+
+ssize_t
+udp_recv(struct udp_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    for (;;) {
+        n = recv(c->sd, buf, nbyte, 0);
+        INCR(udp_metrics, udp_recv);
+
+        log_verb("recv on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n >= 0) {
+            c->recv_nbyte += (size_t)n;
+            INCR(udp_metrics, udp_recv_dgram);
+            INCR_N(udp_metrics, udp_recv_byte, n);
+            return n;
+        }
+
+        INCR(udp_metrics, udp_recv_ex);
+        if (errno != EINTR) {
+            return _udp_error(c, "recv");
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+ssize_t
+udp_send(struct udp_conn *c, void *buf, size_t nbyte)
+{
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+
+    for (;;) {
+        n = send(c->sd, buf, nbyte, 0);
+        INCR(udp_metrics, udp_send);
+
+        log_verb("send on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n >= 0) {
+            c->send_nbyte += (size_t)n;
+            INCR(udp_metrics, udp_send_dgram);
+            INCR_N(udp_metrics, udp_send_byte, n);
+            return n;
+        }
+
+        INCR(udp_metrics, udp_send_ex);
+        if (errno != EINTR) {
+            return _udp_error(c, "send");
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+static void
+_udp_msg_prep(struct msghdr *hdr, struct udp_msg *m, struct udp_dgram *dg,
+        bool recv)
+{
+    memset(hdr, 0, sizeof(*hdr));
+
+    if (recv) {
+        m->iov.iov_base = dg->data;
+        m->iov.iov_len = dg->cap;
+        hdr->msg_name = &dg->addr;
+        hdr->msg_namelen = sizeof(dg->addr);
+    } else {
+        m->iov.iov_base = dg->data;
+        m->iov.iov_len = dg->len;
+        hdr->msg_name = dg->addrlen > 0 ? &dg->addr : NULL;
+        hdr->msg_namelen = dg->addrlen;
+    }
+    hdr->msg_iov = &m->iov;
+    hdr->msg_iovlen = 1;
+
+#ifdef UDP_HAVE_GSO
+    if (recv) {
+        hdr->msg_control = m->control.buf;
+        hdr->msg_controllen = sizeof(m->control.buf);
+    } else if (dg->segsz > 0 && dg->len > dg->segsz) {
+        struct cmsghdr *cm;
+
+        hdr->msg_control = m->control.buf;
+        hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        cm = CMSG_FIRSTHDR(hdr);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cm), &dg->segsz, sizeof(uint16_t));
+    }
+#endif
+}
+
+static void
+_udp_msg_done(struct msghdr *hdr, struct udp_dgram *dg, size_t len)
+{
+    dg->len = (uint32_t)len;
+    dg->addrlen = hdr->msg_namelen;
+    dg->segsz = 0;
+    dg->truncated = false;
+
+    /* a partial datagram is of no use to anyone, hand it back empty */
+    if (hdr->msg_flags & MSG_TRUNC) {
+        INCR(udp_metrics, udp_recv_trunc);
+        log_debug("recv datagram of more than %"PRIu32" bytes, truncated",
+                dg->cap);
+        dg->len = 0;
+        dg->truncated = true;
+
+        return;
+    }
+
+#ifdef UDP_HAVE_GSO
+    struct cmsghdr *cm;
+    int segsz;
+
+    for (cm = CMSG_FIRSTHDR(hdr); cm != NULL; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            memcpy(&segsz, CMSG_DATA(cm), sizeof(segsz));
+            dg->segsz = (uint16_t)segsz;
+        }
+    }
+#endif
+}
+
+int
+udp_recv_batch(struct udp_conn *c, struct udp_dgram **dg, uint32_t n)
+{
+    struct udp_msg m[UDP_BATCH_MAX];
+    size_t nbyte = 0;
+    int i, ret;
+
+    ASSERT(dg != NULL);
+    ASSERT(n > 0);
+
+    n = MIN(n, UDP_BATCH_MAX);
+
+#ifdef OS_LINUX
+    struct mmsghdr msg[UDP_BATCH_MAX];
+
+    for (i = 0; i < (int)n; i++) {
+        _udp_msg_prep(&msg[i].msg_hdr, &m[i], dg[i], true);
+    }
+
+    for (;;) {
+        ret = recvmmsg(c->sd, msg, n, 0, NULL);
+        INCR(udp_metrics, udp_recv);
+        if (ret >= 0) {
+            break;
+        }
+
+        INCR(udp_metrics, udp_recv_ex);
+        if (errno != EINTR) {
+            return _udp_error(c, "recvmmsg");
+        }
+    }
+
+    for (i = 0; i < ret; i++) {
+        _udp_msg_done(&msg[i].msg_hdr, dg[i], msg[i].msg_len);
+        nbyte += dg[i]->len;
+    }
+#else
+    struct msghdr msg;
+    ssize_t len;
+
+    /* no recvmmsg, receive one at a time until the socket is drained */
+    for (ret = 0; ret < (int)n;) {
+        _udp_msg_prep(&msg, &m[ret], dg[ret], true);
+        len = recvmsg(c->sd, &msg, 0);
+        INCR(udp_metrics, udp_recv);
+        if (len >= 0) {
+            _udp_msg_done(&msg, dg[ret], (size_t)len);
+            nbyte += dg[ret]->len;
+            ret++;
+            continue;
+        }
+
+        INCR(udp_metrics, udp_recv_ex);
+        if (errno == EINTR) {
+            continue;
+        }
+        if (ret == 0) {
+            return _udp_error(c, "recvmsg");
+        }
+        break;
+    }
+    (void)i;
+#endif
+
+    c->recv_nbyte += nbyte;
+    INCR_N(udp_metrics, udp_recv_dgram, ret);
+    INCR_N(udp_metrics, udp_recv_byte, nbyte);
+    log_verb("recv %d datagrams %zu bytes on sd %d", ret, nbyte, c->sd);
+
+    return ret;
+}
+
+int
+udp_send_batch(struct udp_conn *c, struct udp_dgram **dg, uint32_t n)
+{
+    struct udp_msg m[UDP_BATCH_MAX];
+    size_t nbyte = 0;
+    int i, ret;
+
+    ASSERT(dg != NULL);
+    ASSERT(n > 0);
+
+    n = MIN(n, UDP_BATCH_MAX);
+
+#ifdef OS_LINUX
+    struct mmsghdr msg[UDP_BATCH_MAX];
+
+    for (i = 0; i < (int)n; i++) {
+        _udp_msg_prep(&msg[i].msg_hdr, &m[i], dg[i], false);
+    }
+
+    for (;;) {
+        ret = sendmmsg(c->sd, msg, n, 0);
+        INCR(udp_metrics, udp_send);
+        if (ret >= 0) {
+            break;
+        }
+
+        INCR(udp_metrics, udp_send_ex);
+        if (errno != EINTR) {
+            return _udp_error(c, "sendmmsg");
+        }
+    }
+
+    for (i = 0; i < ret; i++) {
+        nbyte += msg[i].msg_len;
+    }
+#else
+    struct msghdr msg;
+    ssize_t len;
+
+    /* no sendmmsg, send one at a time until the socket is full */
+    for (ret = 0; ret < (int)n;) {
+        _udp_msg_prep(&msg, &m[ret], dg[ret], false);
+        len = sendmsg(c->sd, &msg, 0);
+        INCR(udp_metrics, udp_send);
+        if (len >= 0) {
+            nbyte += (size_t)len;
+            ret++;
+            continue;
+        }
+
+        INCR(udp_metrics, udp_send_ex);
+        if (errno == EINTR) {
+            continue;
+        }
+        if (ret == 0) {
+            return _udp_error(c, "sendmsg");
+        }
+        break;
+    }
+    (void)i;
+#endif
+
+    c->send_nbyte += nbyte;
+    INCR_N(udp_metrics, udp_send_dgram, ret);
+    INCR_N(udp_metrics, udp_send_byte, nbyte);
+    log_verb("sent %d datagrams %zu bytes on sd %d", ret, nbyte, c->sd);
+
+    return ret;
+}
+
+static void
+udp_pool_destroy(void)
+{
+    if (cp != NULL) {
+        pool_destroy(&cp);
+    }
+    if (dp != NULL) {
+        pool_destroy(&dp);
+    }
+}
+
+static void
+udp_pool_create(uint32_t max, uint32_t dgram_max)
+{
+    if (cp != NULL || dp != NULL) {
+        log_warn("udp pools have already been created, re-creating");
+
+        udp_pool_destroy();
+    }
+
+    cp = pool_create("udp_conn", max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _udp_conn_create, _udp_conn_destroy,
+            POOL_METRICS(udp_metrics, udp_conn_pool_));
+    dp = pool_create("udp_dgram", dgram_max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _udp_dgram_create, _udp_dgram_destroy,
+            POOL_METRICS(udp_metrics, udp_dgram_pool_));
+    if (cp == NULL || dp == NULL) {
+        log_crit("cannot create udp pools due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
+
+    /* preallocating, see notes in buffer/cc_buf.c */
+    if (pool_prealloc(cp, max) < max ||
+            pool_prealloc(dp, dgram_max) < dgram_max) {
+        log_crit("cannot preallocate udp pools due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+udp_setup(udp_options_st *options, udp_metrics_st *metrics)
+{
+    uint32_t max = UDP_POOLSIZE, dgram_max = UDP_DGRAM_POOL;
+
+    log_info("set up the %s module", UDP_MODULE_NAME);
+
+    if (udp_init) {
+        log_warn("%s has already been setup, overwrite", UDP_MODULE_NAME);
+    }
+
+    udp_metrics = metrics;
+
+    if (options != NULL) {
+        max = option_uint(&options->udp_poolsize);
+        dgram_size = option_uint(&options->udp_dgram_size);
+        dgram_max = option_uint(&options->udp_dgram_poolsize);
+    }
+    udp_pool_create(max, dgram_max);
+
+    udp_init = true;
+}
+
+void
+udp_teardown(void)
+{
+    log_info("tear down the %s module", UDP_MODULE_NAME);
+
+    if (!udp_init) {
+        log_warn("%s has never been setup", UDP_MODULE_NAME);
+    }
+
+    udp_pool_destroy();
+    udp_metrics = NULL;
+
+    udp_init = false;
+}
@@ -0,0 +1,713 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <channel/cc_unix.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_pool.h>
+#include <cc_util.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define UNIX_MODULE_NAME "ccommon::unix"
+
+#ifdef MSG_CMSG_CLOEXEC
+#define UNIX_RECV_FLAGS MSG_CMSG_CLOEXEC
+#else
+#define UNIX_RECV_FLAGS 0
+#endif
+
+static struct pool *cp = NULL;
+
+static bool unix_init = false;
+static unix_metrics_st *unix_metrics = NULL;
+static int max_backlog = UNIX_BACKLOG;
+
+void
+unix_conn_reset(struct unix_conn *c)
+{
+    STAILQ_NEXT(c, next) = NULL;
+    c->free = false;
+
+    c->level = CHANNEL_INVALID;
+    c->sd = 0;
+
+    c->recv_nbyte = 0;
+    c->send_nbyte = 0;
+
+    c->state = CHANNEL_UNKNOWN;
+    c->flags = 0;
+
+    c->err = 0;
+}
+
+struct unix_conn *
+unix_conn_create(void)
+{
+    struct unix_conn *c = (struct unix_conn *)cc_alloc(sizeof(struct unix_conn));
+
+    if (c == NULL) {
+        log_info("connection creation failed due to OOM");
+        INCR(unix_metrics, unix_conn_create_ex);
+
+        return NULL;
+    }
+
+    unix_conn_reset(c);
+    INCR(unix_metrics, unix_conn_create);
+    INCR(unix_metrics, unix_conn_curr);
+
+    log_verb("created unix_conn %p", c);
+
+    return c;
+}
+
+void
+unix_conn_destroy(struct unix_conn **conn)
+{
+    struct unix_conn *c = *conn;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_verb("destroy unix_conn %p", c);
+
+    cc_free(c);
+    *conn = NULL;
+    INCR(unix_metrics, unix_conn_destroy);
+    DECR(unix_metrics, unix_conn_curr);
+}
+
+static void *
+_unix_conn_create(void)
+{
+    return unix_conn_create();
+}
+
+static void
+_unix_conn_destroy(void *c)
+{
+    unix_conn_destroy((struct unix_conn **)&c);
+}
+
+static void
+unix_conn_pool_destroy(void)
+{
+    if (cp == NULL) {
+        log_warn("unix_conn pool was never created, ignore");
+
+        return;
+    }
+
+    pool_destroy(&cp);
+}
+
+static void
+unix_conn_pool_create(uint32_t max)
+{
+    if (cp != NULL) {
+        log_warn("unix_conn pool has already been created, re-creating");
+
+        unix_conn_pool_destroy();
+    }
+
+    cp = pool_create("unix_conn", max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _unix_conn_create, _unix_conn_destroy,
+            POOL_METRICS(unix_metrics, unix_conn_pool_));
+    if (cp == NULL) {
+        log_crit("cannot create unix_conn pool due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
+
+    /* preallocating, see notes in buffer/cc_buf.c */
+    if (pool_prealloc(cp, max) < max) {
+        log_crit("cannot preallocate unix_conn pool due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
+}
+
+struct unix_conn *
+unix_conn_borrow(void)
+{
+    struct unix_conn *c = pool_borrow(cp);
+
+    if (c == NULL) {
+        log_debug("borrow unix_conn failed: OOM or over limit");
+        INCR(unix_metrics, unix_conn_borrow_ex);
+
+        return NULL;
+    }
+
+    unix_conn_reset(c);
+    INCR(unix_metrics, unix_conn_borrow);
+    INCR(unix_metrics, unix_conn_active);
+
+    log_verb("borrow unix_conn %p", c);
+
+    return c;
+}
+
+void
+unix_conn_return(struct unix_conn **c)
+{
+    if (c == NULL || *c == NULL || (*c)->free) {
+        return;
+    }
+
+    log_verb("return unix_conn %p", *c);
+
+    (*c)->free = true;
+    pool_return(cp, *c);
+
+    *c = NULL;
+    INCR(unix_metrics, unix_conn_return);
+    DECR(unix_metrics, unix_conn_active);
+}
+
+static bool
+_unix_addr(const char *path, struct sockaddr_un *addr)
+{
+    if (path == NULL || strlen(path) >= sizeof(addr->sun_path)) {
+        log_error("invalid unix socket path '%s'", path == NULL ? "" : path);
+        errno = ENAMETOOLONG;
+
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return true;
+}
+
+bool
+unix_connect(const char *path, struct unix_conn *c)
+{
+    struct sockaddr_un addr;
+    int ret;
+
+    ASSERT(c != NULL);
+
+    INCR(unix_metrics, unix_connect);
+    if (!_unix_addr(path, &addr)) {
+        goto error;
+    }
+
+    c->sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c->sd < 0) {
+        log_error("socket create for unix_conn %p failed: %s", c,
+                strerror(errno));
+
+        goto error;
+    }
+
+    ret = connect(c->sd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0) {
+        log_error("connect on c %p sd %d to %s failed: %s", c, c->sd, path,
+                strerror(errno));
+
+        goto error;
+    }
+
+    ret = unix_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on c %p sd %d failed: %s", c, c->sd,
+                strerror(errno));
+
+        goto error;
+    }
+
+    c->level = CHANNEL_BASE;
+    c->state = CHANNEL_ESTABLISHED;
+    log_info("connected on c %p sd %d to %s", c, c->sd, path);
+
+    return true;
+
+error:
+    c->err = errno;
+    INCR(unix_metrics, unix_connect_ex);
+    if (c->sd > 0) {
+        unix_close(c);
+    }
+
+    return false;
+}
+
+/* a socket file nobody listens on, as left behind by a previous listener */
+static bool
+_unix_stale(struct sockaddr_un *addr)
+{
+    int sd, ret, err;
+
+    sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0) {
+        log_error("socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    /* don't block on the backlog of a live listener */
+    ret = unix_set_nonblocking(sd);
+    if (ret == 0) {
+        ret = connect(sd, (struct sockaddr *)addr, sizeof(*addr));
+    }
+    err = errno;
+    close(sd);
+
+    return ret < 0 && err == ECONNREFUSED;
+}
+
+bool
+unix_listen(const char *path, struct unix_conn *c)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int ret;
+
+    ASSERT(c != NULL);
+
+    if (!_unix_addr(path, &addr)) {
+        goto error;
+    }
+
+    c->sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c->sd < 0) {
+        log_error("socket failed: %s", strerror(errno));
+        goto error;
+    }
+
+    /* a stale socket file would fail bind, a live one is not ours to take */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (!_unix_stale(&addr)) {
+            log_error("socket file %s is in use", path);
+            errno = EADDRINUSE;
+            goto error;
+        }
+        unlink(path);
+    }
+
+    ret = bind(c->sd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret < 0) {
+        log_error("bind on sd %d to %s failed: %s", c->sd, path,
+                strerror(errno));
+        goto error;
+    }
+
+    ret = listen(c->sd, max_backlog);
+    if (ret < 0) {
+        log_error("listen on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    ret = unix_set_nonblocking(c->sd);
+    if (ret < 0) {
+        log_error("set nonblock on sd %d failed: %s", c->sd, strerror(errno));
+        goto error;
+    }
+
+    c->level = CHANNEL_META;
+    c->state = CHANNEL_LISTEN;
+    log_info("server listen setup on socket descriptor %d at %s", c->sd, path);
+
+    return true;
+
+error:
+    c->err = errno;
+    if (c->sd > 0) {
+        unix_close(c);
+    }
+
+    return false;
+}
+
+void
+unix_close(struct unix_conn *c)
+{
+    int ret;
+
+    if (c == NULL) {
+        return;
+    }
+
+    log_info("closing unix_conn %p sd %d", c, c->sd);
+
+    INCR(unix_metrics, unix_close);
+    ret = close(c->sd);
+    if (ret < 0) {
+        log_warn("close c %d failed, ignored: %s", c->sd, strerror(errno));
+    }
+}
+
+/* see _tcp_accept for how failures are handled */
+static inline int
+_unix_accept(struct unix_conn *sc)
+{
+    int sd;
+
+    ASSERT(sc->sd >= 0);
+
+    for (;;) {
+#ifdef CC_ACCEPT4
+        sd = accept4(sc->sd, NULL, NULL, SOCK_NONBLOCK);
+#else
+        sd = accept(sc->sd, NULL, NULL);
+#endif /* CC_ACCEPT4 */
+        if (sd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                log_debug("accept on sd %d not ready: eagain", sc->sd);
+                sc->err = EAGAIN;
+
+                return -1;
+            }
+
+            if (errno == EINTR) {
+                log_debug("accept on sd %d not ready: eintr", sc->sd);
+
+                continue;
+            }
+
+            log_error("accept on sd %d failed: %s", sc->sd, strerror(errno));
+            INCR(unix_metrics, unix_accept_ex);
+            sc->err = errno;
+
+            return -1;
+        }
+
+        break;
+    }
+
+    ASSERT(sd >= 0);
+    sc->err = 0;
+
+    return sd;
+}
+
+bool
+unix_accept(struct unix_conn *sc, struct unix_conn *c)
+{
+    int sd;
+
+    sd = _unix_accept(sc);
+    INCR(unix_metrics, unix_accept);
+    if (sd < 0) {
+        return false;
+    }
+
+    c->sd = sd;
+    c->level = CHANNEL_BASE;
+    c->state = CHANNEL_ESTABLISHED;
+
+#ifndef CC_ACCEPT4 /* if we have accept4, nonblock will already have been set */
+    if (unix_set_nonblocking(sd) < 0) {
+        log_warn("set nonblock on sd %d failed, ignored: %s", sd,
+                strerror(errno));
+    }
+#endif
+
+    log_info("accepted c %d on sd %d", c->sd, sc->sd);
+
+    return true;
+}
+
+void
+unix_reject(struct unix_conn *sc)
+{
+    int sd;
+
+    INCR(unix_metrics, unix_reject);
+    sd = _unix_accept(sc);
+    if (sd < 0) {
+        INCR(unix_metrics, unix_reject_ex);
+        return;
+    }
+
+    if (close(sd) < 0) {
+        INCR(unix_metrics, unix_reject_ex);
+        log_warn("close c %d failed, ignored: %s", sd, strerror(errno));
+    }
+}
+
+int
+unix_set_nonblocking(int sd)
+{
+    int flags;
+
+    flags = fcntl(sd, F_GETFL, 0);
+    if (flags < 0) {
+        return flags;
+    }
+
+    return fcntl(sd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+ * recvmsg/sendmsg with optional fd passing, EINTR is continued, EAGAIN is
+ * explicitly flagged in return, other errors are returned as CC_ERROR
+ */
+static ssize_t
+_unix_recvmsg(struct unix_conn *c, void *buf, size_t nbyte, int *fd,
+        uint32_t *nfd)
+{
+    union {
+        char            buf[CMSG_SPACE(UNIX_NFD_MAX * sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    uint32_t i, n_fd = 0;
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fd != NULL) {
+            msg.msg_control = control.buf;
+            msg.msg_controllen = sizeof(control.buf);
+        }
+
+        n = recvmsg(c->sd, &msg, fd != NULL ? UNIX_RECV_FLAGS : 0);
+        INCR(unix_metrics, unix_recv);
+
+        log_verb("recvmsg on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            break;
+        }
+
+        if (n == 0) {
+            c->state = CHANNEL_TERM;
+            log_debug("eof recv'd on sd %d, total: rb %zu sb %zu", c->sd,
+                      c->recv_nbyte, c->send_nbyte);
+            return n;
+        }
+
+        /* n < 0 */
+        INCR(unix_metrics, unix_recv_ex);
+        if (errno == EINTR) {
+            log_debug("recv on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_debug("recv on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("recv on sd %d failed: %s", c->sd, strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    c->recv_nbyte += (size_t)n;
+    INCR_N(unix_metrics, unix_recv_byte, n);
+
+    if (fd == NULL) {
+        return n;
+    }
+
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        i = (uint32_t)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fd + n_fd, CMSG_DATA(cm), i * sizeof(int));
+        n_fd += i;
+    }
+    *nfd = n_fd;
+    INCR_N(unix_metrics, unix_recv_fd, n_fd);
+
+    if (msg.msg_flags & MSG_CTRUNC) {
+        /* fds beyond what fits are closed by the kernel, don't take a part */
+        log_error("fds passed on sd %d truncated, closing %"PRIu32" received",
+                c->sd, n_fd);
+        for (i = 0; i < n_fd; i++) {
+            close(fd[i]);
+        }
+        *nfd = 0;
+        c->err = EMSGSIZE;
+
+        return CC_ERROR;
+    }
+
+    return n;
+}
+
+static ssize_t
+_unix_sendmsg(struct unix_conn *c, void *buf, size_t nbyte, const int *fd,
+        uint32_t nfd)
+{
+    union {
+        char            buf[CMSG_SPACE(UNIX_NFD_MAX * sizeof(int))];
+        struct cmsghdr  align;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    ASSERT(buf != NULL);
+    ASSERT(nbyte > 0);
+    ASSERT(nfd <= UNIX_NFD_MAX);
+
+    iov.iov_base = buf;
+    iov.iov_len = nbyte;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfd > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfd * sizeof(int));
+        memcpy(CMSG_DATA(cm), fd, nfd * sizeof(int));
+    }
+
+    for (;;) {
+        n = sendmsg(c->sd, &msg, 0);
+        INCR(unix_metrics, unix_send);
+
+        log_verb("sendmsg on sd %d %zd of %zu", c->sd, n, nbyte);
+
+        if (n > 0) {
+            /* fds go out with the first byte sent */
+            INCR_N(unix_metrics, unix_send_fd, nfd);
+            INCR_N(unix_metrics, unix_send_byte, n);
+            c->send_nbyte += (size_t)n;
+            return n;
+        }
+
+        if (n == 0) {
+            log_warn("sendmsg on sd %d returned zero", c->sd);
+            return 0;
+        }
+
+        /* n < 0 */
+        INCR(unix_metrics, unix_send_ex);
+        if (errno == EINTR) {
+            log_verb("send on sd %d not ready - EINTR", c->sd);
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            log_verb("send on sd %d not ready - EAGAIN", c->sd);
+            return CC_EAGAIN;
+        } else {
+            c->err = errno;
+            log_error("send on sd %d failed: %s", c->sd, strerror(errno));
+            return CC_ERROR;
+        }
+    }
+
+    NOT_REACHED();
+
+    return CC_ERROR;
+}
+
+ssize_t
+unix_recv(struct unix_conn *c, void *buf, size_t nbyte)
+{
+    return _unix_recvmsg(c, buf, nbyte, NULL, NULL);
+}
+
+ssize_t
+unix_send(struct unix_conn *c, void *buf, size_t nbyte)
+{
+    return _unix_sendmsg(c, buf, nbyte, NULL, 0);
+}
+
+ssize_t
+unix_recv_fd(struct unix_conn *c, void *buf, size_t nbyte, int *fd,
+        uint32_t *nfd)
+{
+    ASSERT(fd != NULL && nfd != NULL);
+
+    *nfd = 0;
+
+    return _unix_recvmsg(c, buf, nbyte, fd, nfd);
+}
+
+ssize_t
+unix_send_fd(struct unix_conn *c, void *buf, size_t nbyte, const int *fd,
+        uint32_t nfd)
+{
+    ASSERT(fd != NULL || nfd == 0);
+
+    if (nfd > UNIX_NFD_MAX) {
+        log_error("cannot pass %"PRIu32" fds on sd %d, max is %d", nfd, c->sd,
+                UNIX_NFD_MAX);
+        c->err = EINVAL;
+
+        return CC_ERROR;
+    }
+
+    return _unix_sendmsg(c, buf, nbyte, fd, nfd);
+}
+
+void
+unix_setup(unix_options_st *options, unix_metrics_st *metrics)
+{
+    uint32_t max = UNIX_POOLSIZE;
+
+    log_info("set up the %s module", UNIX_MODULE_NAME);
+
+    if (unix_init) {
+        log_warn("%s has already been setup, overwrite", UNIX_MODULE_NAME);
+    }
+
+    unix_metrics = metrics;
+
+    if (options != NULL) {
+        max_backlog = option_uint(&options->unix_backlog);
+        max = option_uint(&options->unix_poolsize);
+    }
+    unix_conn_pool_create(max);
+
+    channel_sigpipe_ignore(); /* does it ever fail? */
+    unix_init = true;
+}
+
+void
+unix_teardown(void)
+{
+    log_info("tear down the %s module", UNIX_MODULE_NAME);
+
+    if (!unix_init) {
+        log_warn("%s has never been setup", UNIX_MODULE_NAME);
+    }
+
+    unix_conn_pool_destroy();
+    unix_metrics = NULL;
+
+    unix_init = false;
+}
@@ -22,11 +22,13 @@
 #include <cc_debug.h>
 #include <cc_define.h>
 #include <cc_mm.h>
+#include <time/cc_clock.h>
 
 #include <inttypes.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/errno.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #include "cc_shared.h"
@@ -39,6 +41,13 @@
 # define EPOLLRDHUP 0x2000
 #endif
 
+/* same for EPOLLEXCLUSIVE, which became available in linux 4.5 */
+#ifndef EPOLLEXCLUSIVE
+# define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+#define EVENT_BUSY_POLL_BUDGET 8 /* packets per busy poll, the kernel default */
+
 struct event_base {
     int                ep;      /* epoll descriptor */
 
@@ -46,6 +55,8 @@ struct event_base {
     int                nevent;  /* # events */
 
     event_cb_fn         cb;      /* event callback */
+    struct event_batch  batch;   /* batched dispatch, if cb is set */
+    struct event_spin   spin;    /* spin before blocking waits */
 };
 
 struct event_base *
@@ -86,6 +97,8 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->event = event;
     evb->nevent = nevent;
     evb->cb = cb;
+    memset(&evb->batch, 0, sizeof(evb->batch));
+    memset(&evb->spin, 0, sizeof(evb->spin));
 
     log_info("epoll fd %d with nevent %d", evb->ep, evb->nevent);
 
@@ -105,6 +118,7 @@ event_base_destroy(struct event_base **evb)
     ASSERT(e->ep > 0);
 
     cc_free(e->event);
+    cc_free(e->batch.item);
 
     status = close(e->ep);
     if (status < 0) {
@@ -129,24 +143,39 @@ _event_update(struct event_base *evb, int fd, int op, uint32_t events, void *ptr
 }
 
 int event_add_read(struct event_base *evb, int fd, void *data)
+{
+    return event_add_read_mode(evb, fd, data, 0);
+}
+
+int
+event_add_read_mode(struct event_base *evb, int fd, void *data, uint32_t mode)
 {
     int status;
+    uint32_t events = EPOLLIN;
 
     ASSERT(evb != NULL && evb->ep > 0);
     ASSERT(fd >= 0);
 
+    if (mode & EVENT_MODE_ET) {
+        events |= EPOLLET;
+    }
+    if (mode & EVENT_MODE_EXCLUSIVE) {
+        events |= EPOLLEXCLUSIVE;
+    }
+
     /*
      * Note(yao): there have been tests showing EPOLL_CTL_ADD is cheaper than
      * EPOLL_CTL_MOD, and the only difference is we need to ignore EEXIST
      */
-    status = _event_update(evb, fd, EPOLL_CTL_ADD, EPOLLIN, data);
+    status = _event_update(evb, fd, EPOLL_CTL_ADD, events, data);
     if (status < 0 && errno != EEXIST) {
         log_error("ctl (add read) w/ epoll fd %d on fd %d failed: %s", evb->ep,
                 fd, strerror(errno));
     }
 
     INCR(event_metrics, event_read);
-    log_verb("add read event to epoll fd %d on fd %d", evb->ep, fd);
+    log_verb("add read event to epoll fd %d on fd %d mode %"PRIu32, evb->ep,
+            fd, mode);
 
     return status;
 }
@@ -195,8 +224,8 @@ event_del(struct event_base *evb, int fd)
 /*
  * create a timed event with event base function and timeout (in millisecond)
  */
-int
-event_wait(struct event_base *evb, int timeout)
+static int
+_event_wait(struct event_base *evb, int timeout)
 {
     struct epoll_event *ev_arr;
     int nevent;
@@ -217,6 +246,7 @@ event_wait(struct event_base *evb, int timeout)
 
         nreturned = epoll_wait(ep, ev_arr, nevent, timeout);
         INCR(event_metrics, event_loop);
+        clock_update(); /* callbacks see when the wait returned */
         if (nreturned > 0) {
             INCR_N(event_metrics, event_total, nreturned);
             for (i = 0; i < nreturned; i++) {
@@ -239,10 +269,13 @@ event_wait(struct event_base *evb, int timeout)
                     events |= EVENT_WRITE;
                 }
 
-                if (evb->cb != NULL) {
+                if (evb->batch.cb != NULL) {
+                    event_batch_add(&evb->batch, ev->data.ptr, events);
+                } else if (evb->cb != NULL) {
                     evb->cb(ev->data.ptr, events);
                 }
             }
+            event_batch_dispatch(&evb->batch);
 
             log_verb("returned %d events from epoll fd %d",
                     nreturned, ep);
@@ -274,3 +307,81 @@ event_wait(struct event_base *evb, int timeout)
 
     NOT_REACHED();
 }
+
+int
+event_wait(struct event_base *evb, int timeout)
+{
+    ASSERT(evb != NULL);
+
+    return event_spin_wait(&evb->spin, evb, timeout, _event_wait);
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t us)
+{
+    ASSERT(evb != NULL);
+
+    event_spin_set(&evb->spin, us);
+
+#ifdef EPIOCSPARAMS
+    {
+        struct epoll_params params;
+
+        /* have epoll_wait busy poll the device queues of the fds added */
+        memset(&params, 0, sizeof(params));
+        params.busy_poll_usecs = us;
+        params.busy_poll_budget = EVENT_BUSY_POLL_BUDGET;
+        params.prefer_busy_poll = us > 0;
+        if (ioctl(evb->ep, EPIOCSPARAMS, &params) < 0) {
+            log_warn("set busy poll on epoll fd %d failed, ignored: %s",
+                    evb->ep, strerror(errno));
+        }
+    }
+#endif
+}
+
+int
+event_base_set_batch_cb(struct event_base *evb, event_batch_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    return event_batch_set(&evb->batch, evb->nevent, cb);
+}
+
+/* completion-based I/O is not available with epoll */
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    log_warn("no completion-based I/O w/ epoll, I/O callback ignored");
+}
+
+int
+event_register_buf(struct event_base *evb, const struct iovec *iov, int niov)
+{
+    log_warn("register buf not supported w/ epoll");
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    log_error("recv on fd %d not supported w/ epoll", fd);
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+int
+event_send(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    log_error("send on fd %d not supported w/ epoll", fd);
+    errno = ENOTSUP;
+
+    return -1;
+}
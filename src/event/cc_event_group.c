@@ -0,0 +1,525 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_event_group.h>
+
+#include <cc_debug.h>
+#include <cc_mm.h>
+#include <cc_ring_array.h>
+#include <channel/cc_pipe.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+struct event_worker {
+    struct event_group      *group;
+    uint32_t                id;
+    pthread_t               thread;
+
+    struct event_base       *evb;
+    struct ring_array       *queue;     /* conns handed over, acceptor -> worker */
+    pthread_mutex_t         lock;       /* serializes pops when stealing */
+    struct pipe_conn        *wakeup;    /* acceptor writes, worker reads */
+    bool                    asleep;     /* may be waiting, wake up on dispatch */
+
+    /* load, read by the acceptor and the other workers */
+    uint32_t                nconn;      /* # conns owned */
+    uint32_t                nqueue;     /* # conns queued */
+
+    event_worker_metrics_st metrics;
+};
+
+struct event_group {
+    struct event_worker     *worker;    /* worker[] */
+    uint32_t                nworker;    /* # worker */
+    uint32_t                nthread;    /* # worker threads started */
+    uint32_t                next;       /* where the next search starts */
+
+    int                     nevent;
+    int                     timeout;
+    uint32_t                nqueue;     /* queue capacity per worker */
+    bool                    pin;
+    bool                    steal;
+
+    event_cb_fn             cb;
+    event_group_conn_fn     conn_cb;
+    event_group_close_fn    close_cb;
+
+    bool                    running;
+    bool                    stop;
+};
+
+static __thread struct event_worker *worker_self = NULL;
+
+static void
+_worker_pin(struct event_worker *w)
+{
+#ifdef OS_LINUX
+    cpu_set_t cpuset;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = (int)(w->id % (ncpu > 0 ? ncpu : 1));
+    int status;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    status = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (status != 0) {
+        log_warn("pin worker %"PRIu32" to cpu %d failed, ignored: %s", w->id,
+                cpu, strerror(status));
+        return;
+    }
+
+    log_info("pinned worker %"PRIu32" to cpu %d", w->id, cpu);
+#else
+    log_warn("pinning worker %"PRIu32" not supported, ignored", w->id);
+#endif
+}
+
+static void
+_worker_adopt(struct event_worker *w, struct tcp_conn *c)
+{
+    __atomic_add_fetch(&w->nconn, 1, __ATOMIC_RELAXED);
+    INCR(&w->metrics, worker_conn_curr);
+
+    log_verb("worker %"PRIu32" adopts conn %p", w->id, c);
+
+    w->group->conn_cb(w, c);
+}
+
+/* pop a conn queued for worker `from', called by itself or a thief */
+static struct tcp_conn *
+_worker_pop(struct event_worker *from)
+{
+    struct tcp_conn *c = NULL;
+    bool steal = from->group->steal;
+    rstatus_i status;
+
+    if (ring_array_empty(from->queue)) {
+        return NULL;
+    }
+
+    if (steal) {
+        pthread_mutex_lock(&from->lock);
+    }
+    status = ring_array_pop(&c, from->queue);
+    if (steal) {
+        pthread_mutex_unlock(&from->lock);
+    }
+
+    if (status != CC_OK) {
+        return NULL; /* someone else got it first */
+    }
+
+    __atomic_sub_fetch(&from->nqueue, 1, __ATOMIC_RELAXED);
+    DECR(&from->metrics, worker_queue_curr);
+
+    return c;
+}
+
+static void
+_worker_drain(struct event_worker *w)
+{
+    struct tcp_conn *c;
+
+    while ((c = _worker_pop(w)) != NULL) {
+        _worker_adopt(w, c);
+    }
+}
+
+/* take one conn queued for the most backlogged other worker, if any */
+static void
+_worker_steal(struct event_worker *w)
+{
+    struct event_group *g = w->group;
+    struct event_worker *victim = NULL;
+    struct tcp_conn *c;
+    uint32_t i, nqueue, max = 0;
+
+    for (i = 0; i < g->nworker; i++) {
+        if (i == w->id) {
+            continue;
+        }
+        nqueue = __atomic_load_n(&g->worker[i].nqueue, __ATOMIC_RELAXED);
+        if (nqueue > max) {
+            max = nqueue;
+            victim = &g->worker[i];
+        }
+    }
+
+    if (victim == NULL || (c = _worker_pop(victim)) == NULL) {
+        return;
+    }
+
+    INCR(&w->metrics, worker_steal);
+    log_verb("worker %"PRIu32" steals conn %p from worker %"PRIu32, w->id, c,
+            victim->id);
+
+    _worker_adopt(w, c);
+}
+
+/* wakeup notifications are consumed here, other events go to the group cb */
+static void
+_worker_event(void *data, uint32_t events)
+{
+    struct event_worker *w = worker_self;
+    char buf[64];
+
+    if (data != w) {
+        w->group->cb(data, events);
+        return;
+    }
+
+    /* clear the flag before draining, so later dispatches write again */
+    __atomic_store_n(&w->asleep, false, __ATOMIC_RELEASE);
+    while (pipe_recv(w->wakeup, buf, sizeof(buf)) > 0) {}
+    _worker_drain(w);
+}
+
+static void *
+_worker_loop(void *arg)
+{
+    struct event_worker *w = arg;
+    struct event_group *g = w->group;
+    int n;
+
+    worker_self = w;
+    if (g->pin) {
+        _worker_pin(w);
+    }
+
+    log_info("worker %"PRIu32" started", w->id);
+
+    while (!__atomic_load_n(&g->stop, __ATOMIC_ACQUIRE)) {
+        /*
+         * pairs with the fence in event_group_dispatch: either the queue is
+         * seen non-empty here, or asleep is seen set there and we get woken
+         */
+        __atomic_store_n(&w->asleep, true, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        _worker_drain(w);
+
+        n = event_wait(w->evb, g->timeout);
+        INCR(&w->metrics, worker_loop);
+        if (n > 0) {
+            INCR_N(&w->metrics, worker_event, n);
+        } else if (n == 0 && g->steal) {
+            _worker_steal(w);
+        }
+    }
+
+    log_info("worker %"PRIu32" stopped", w->id);
+
+    return NULL;
+}
+
+static void
+_worker_deinit(struct event_worker *w)
+{
+    struct tcp_conn *c;
+
+    /* conns queued but never adopted have no owner but us */
+    if (w->queue != NULL) {
+        while (ring_array_pop(&c, w->queue) == CC_OK) {
+            DECR(&w->metrics, worker_queue_curr);
+            w->group->close_cb(c);
+        }
+        w->nqueue = 0;
+    }
+
+    if (w->evb != NULL && w->wakeup != NULL) {
+        event_del(w->evb, pipe_read_id(w->wakeup));
+    }
+    event_base_destroy(&w->evb);
+    if (w->queue != NULL) {
+        ring_array_destroy(&w->queue);
+    }
+    if (w->wakeup != NULL) {
+        pipe_close(w->wakeup);
+        pipe_conn_destroy(&w->wakeup);
+    }
+    pthread_mutex_destroy(&w->lock);
+}
+
+static rstatus_i
+_worker_init(struct event_group *g, struct event_worker *w, uint32_t id)
+{
+    w->group = g;
+    w->id = id;
+    w->metrics = (event_worker_metrics_st) { EVENT_WORKER_METRIC(METRIC_INIT) };
+    pthread_mutex_init(&w->lock, NULL);
+
+    w->evb = event_base_create(g->nevent, _worker_event);
+    if (w->evb == NULL) {
+        return CC_ERROR;
+    }
+
+    w->queue = ring_array_create(sizeof(struct tcp_conn *), g->nqueue);
+    if (w->queue == NULL) {
+        return CC_ENOMEM;
+    }
+
+    w->wakeup = pipe_conn_create();
+    if (w->wakeup == NULL) {
+        return CC_ENOMEM;
+    }
+    if (!pipe_open(NULL, w->wakeup)) {
+        pipe_conn_destroy(&w->wakeup);
+        return CC_ERROR;
+    }
+    pipe_set_nonblocking(w->wakeup);
+
+    if (event_add_read(w->evb, pipe_read_id(w->wakeup), w) < 0) {
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+struct event_group *
+event_group_create(event_group_options_st *options, event_cb_fn cb,
+        event_group_conn_fn conn_cb, event_group_close_fn close_cb)
+{
+    struct event_group *g;
+    uint32_t i;
+
+    ASSERT(cb != NULL && conn_cb != NULL && close_cb != NULL);
+
+    g = (struct event_group *)cc_zalloc(sizeof(*g));
+    if (g == NULL) {
+        return NULL;
+    }
+
+    g->nworker = EVENT_GROUP_NWORKER;
+    g->nevent = EVENT_GROUP_NEVENT;
+    g->timeout = EVENT_GROUP_TIMEOUT;
+    g->nqueue = EVENT_GROUP_QUEUE;
+    if (options != NULL) {
+        g->nworker = option_uint(&options->event_group_nworker);
+        g->nevent = (int)option_uint(&options->event_group_nevent);
+        g->timeout = (int)option_uint(&options->event_group_timeout);
+        g->nqueue = option_uint(&options->event_group_queue);
+        g->pin = option_bool(&options->event_group_pin);
+        g->steal = option_bool(&options->event_group_steal);
+    }
+    if (g->nworker == 0 || g->nevent == 0 || g->nqueue == 0) {
+        log_error("invalid event group: %"PRIu32" workers, nevent %d, queue "
+                "%"PRIu32, g->nworker, g->nevent, g->nqueue);
+        cc_free(g);
+        return NULL;
+    }
+    g->cb = cb;
+    g->conn_cb = conn_cb;
+    g->close_cb = close_cb;
+
+    g->worker = (struct event_worker *)cc_calloc(g->nworker,
+            sizeof(*g->worker));
+    if (g->worker == NULL) {
+        cc_free(g);
+        return NULL;
+    }
+
+    for (i = 0; i < g->nworker; i++) {
+        if (_worker_init(g, &g->worker[i], i) != CC_OK) {
+            log_error("init worker %"PRIu32" of event group failed", i);
+            g->nworker = i + 1;
+            event_group_destroy(&g);
+
+            return NULL;
+        }
+    }
+
+    log_info("created event group of %"PRIu32" workers, pin %d steal %d",
+            g->nworker, g->pin, g->steal);
+
+    return g;
+}
+
+void
+event_group_destroy(struct event_group **g)
+{
+    struct event_group *eg = *g;
+    uint32_t i;
+
+    if (eg == NULL) {
+        return;
+    }
+
+    event_group_stop(eg);
+
+    for (i = 0; i < eg->nworker; i++) {
+        _worker_deinit(&eg->worker[i]);
+    }
+    cc_free(eg->worker);
+    cc_free(eg);
+
+    *g = NULL;
+}
+
+rstatus_i
+event_group_start(struct event_group *g)
+{
+    uint32_t i;
+    int status;
+
+    ASSERT(g != NULL && !g->running);
+
+    g->stop = false;
+    g->running = true;
+    for (g->nthread = 0; g->nthread < g->nworker; g->nthread++) {
+        i = g->nthread;
+        status = pthread_create(&g->worker[i].thread, NULL, _worker_loop,
+                &g->worker[i]);
+        if (status != 0) {
+            log_error("create thread for worker %"PRIu32" failed: %s", i,
+                    strerror(status));
+            event_group_stop(g);
+
+            return CC_ERROR;
+        }
+    }
+
+    return CC_OK;
+}
+
+static void
+_worker_wake(struct event_worker *w)
+{
+    char c = 0;
+
+    INCR(&w->metrics, worker_wakeup);
+    if (pipe_send(w->wakeup, &c, 1) < 0) {
+        /* pipe is full, a wakeup is pending anyway */
+        log_verb("wake up worker %"PRIu32" failed, ignored", w->id);
+    }
+}
+
+void
+event_group_stop(struct event_group *g)
+{
+    uint32_t i;
+
+    ASSERT(g != NULL);
+
+    if (!g->running) {
+        return;
+    }
+
+    __atomic_store_n(&g->stop, true, __ATOMIC_RELEASE);
+    for (i = 0; i < g->nthread; i++) {
+        _worker_wake(&g->worker[i]);
+    }
+    for (i = 0; i < g->nthread; i++) {
+        pthread_join(g->worker[i].thread, NULL);
+    }
+    g->nthread = 0;
+    g->running = false;
+
+    log_info("stopped event group of %"PRIu32" workers", g->nworker);
+}
+
+rstatus_i
+event_group_dispatch(struct event_group *g, struct tcp_conn *c)
+{
+    struct event_worker *w = NULL;
+    uint32_t i, id, load, min = UINT32_MAX;
+
+    ASSERT(g != NULL && c != NULL);
+
+    /* least loaded worker, starting after the previous pick to break ties */
+    for (i = 0; i < g->nworker; i++) {
+        id = (g->next + i) % g->nworker;
+        load = __atomic_load_n(&g->worker[id].nconn, __ATOMIC_RELAXED) +
+            __atomic_load_n(&g->worker[id].nqueue, __ATOMIC_RELAXED);
+        if (load < min) {
+            min = load;
+            w = &g->worker[id];
+        }
+    }
+    g->next = w->id + 1;
+
+    if (ring_array_push(&c, w->queue) != CC_OK) {
+        INCR(&w->metrics, worker_handoff_ex);
+        log_warn("queue of worker %"PRIu32" is full, cannot dispatch conn %p",
+                w->id, c);
+
+        return CC_EAGAIN;
+    }
+    __atomic_add_fetch(&w->nqueue, 1, __ATOMIC_RELAXED);
+    INCR(&w->metrics, worker_queue_curr);
+    INCR(&w->metrics, worker_handoff);
+
+    /* see _worker_loop */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&w->asleep, false, __ATOMIC_SEQ_CST)) {
+        _worker_wake(w);
+    }
+
+    log_verb("dispatched conn %p to worker %"PRIu32, c, w->id);
+
+    return CC_OK;
+}
+
+uint32_t
+event_group_nworker(struct event_group *g)
+{
+    return g->nworker;
+}
+
+struct event_base *
+event_group_base(struct event_group *g, uint32_t id)
+{
+    ASSERT(id < g->nworker);
+
+    return g->worker[id].evb;
+}
+
+event_worker_metrics_st *
+event_group_metrics(struct event_group *g, uint32_t id)
+{
+    ASSERT(id < g->nworker);
+
+    return &g->worker[id].metrics;
+}
+
+struct event_worker *
+event_worker_self(void)
+{
+    return worker_self;
+}
+
+uint32_t
+event_worker_id(struct event_worker *w)
+{
+    return w->id;
+}
+
+struct event_base *
+event_worker_base(struct event_worker *w)
+{
+    return w->evb;
+}
+
+void
+event_worker_release(struct event_worker *w)
+{
+    ASSERT(w != NULL);
+
+    __atomic_sub_fetch(&w->nconn, 1, __ATOMIC_RELAXED);
+    DECR(&w->metrics, worker_conn_curr);
+}
@@ -0,0 +1,942 @@
+/*
+ * ccommon - a cache common library.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cc_event.h>
+
+#include <cc_debug.h>
+#include <cc_define.h>
+#include <cc_mm.h>
+#include <time/cc_clock.h>
+
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/errno.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cc_shared.h"
+
+/*
+ * This backend implements the readiness-based interface of cc_event.h on top
+ * of io_uring, without depending on liburing.
+ *
+ * Interest in a fd is expressed as a one-shot IORING_OP_POLL_ADD, which the
+ * kernel completes as soon as the fd is ready (immediately if it already is).
+ * Once a completion is reaped and the callback returns, the poll is re-armed
+ * if the interest is still there, which gives us the same level-triggered
+ * behavior as the epoll backend.
+ *
+ * Nothing is submitted to the kernel when events are added or deleted, the
+ * submission queue entries are only flushed by event_wait (or when the queue
+ * is full), so a single io_uring_enter call both submits all the pending
+ * changes and waits for/reaps all completions of a loop iteration.
+ *
+ * event_recv/event_send queue the transfer itself (IORING_OP_RECV/SEND, or
+ * READ/WRITE_FIXED when the memory is a registered buffer), so a request on
+ * the hot path costs neither a readiness wakeup nor a separate read/write.
+ */
+
+#ifndef POLLRDHUP
+# define POLLRDHUP 0x2000
+#endif
+
+#ifndef EPOLLEXCLUSIVE
+# define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+/* what a submission is about, stored in the lowest byte of user_data */
+#define URING_POLL_READ     0x1
+#define URING_POLL_WRITE    0x2
+#define URING_IO_RECV       0x4
+#define URING_IO_SEND       0x8
+#define URING_CANCEL        0x10 /* poll remove or I/O cancel */
+#define URING_POLL          (URING_POLL_READ | URING_POLL_WRITE)
+
+#define URING_REG_MIN       1024 /* min # entries of the fd table */
+
+/*
+ * user_data carries the fd in the upper 32 bits, the generation of the
+ * registration in the middle and the kind of submission in the lowest byte.
+ * Generation is bumped whenever a fd is deleted, so completions that arrive
+ * after event_del (e.g. the ones canceled by it) are recognized and dropped.
+ */
+#define URING_UDATA(_fd, _gen, _kind)                                   \
+    (((uint64_t)(uint32_t)(_fd) << 32) |                                \
+     (((uint64_t)(_gen) & 0xffffff) << 8) | (uint64_t)(_kind))
+#define URING_UDATA_FD(_ud)     ((int)((_ud) >> 32))
+#define URING_UDATA_GEN(_ud)    ((uint32_t)(((_ud) >> 8) & 0xffffff))
+#define URING_UDATA_KIND(_ud)   ((uint8_t)((_ud) & 0xff))
+
+struct uring_reg {
+    void                *data;      /* caller data of the fd */
+    void                *recv_data; /* caller data of outstanding recv */
+    void                *send_data; /* caller data of outstanding send */
+    uint32_t            gen;        /* generation, see URING_UDATA */
+    uint8_t             want;       /* interest: URING_POLL_READ/WRITE */
+    uint8_t             armed;      /* polls and I/O currently submitted */
+    uint8_t             mode;       /* EVENT_MODE_* of the read interest */
+};
+
+struct event_base {
+    int                 ring;       /* io_uring descriptor */
+
+    /* submission queue, shared with the kernel */
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqe;       /* sqe[] - submission entries */
+    unsigned            sq_entries; /* # sqe */
+    unsigned            sq_local;   /* local tail, published before enter */
+
+    /* completion queue, shared with the kernel */
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqe;       /* cqe[] - completion entries */
+
+    void                *sq_ring;   /* mapped rings, kept for unmapping */
+    size_t              sq_ring_sz;
+    void                *cq_ring;
+    size_t              cq_ring_sz;
+    size_t              sqe_sz;
+
+    struct uring_reg    *reg;       /* reg[] - registration indexed by fd */
+    int                 nreg;       /* # reg */
+
+    struct iovec        *buf;       /* buf[] - registered (fixed) buffers */
+    int                 nbuf;       /* # buf */
+
+    int                 nevent;     /* max # events processed per wait */
+
+    event_cb_fn         cb;         /* event callback */
+    event_io_cb_fn      io_cb;      /* I/O completion callback */
+    struct event_batch  batch;      /* batched dispatch, if cb is set */
+    struct event_spin   spin;       /* spin before blocking waits */
+};
+
+static inline int
+_sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+_sys_io_uring_register(int ring, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring, opcode, arg, nr_args);
+}
+
+static inline int
+_sys_io_uring_enter(int ring, unsigned to_submit, unsigned min_complete,
+        unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, ring, to_submit, min_complete,
+            flags, arg, argsz);
+}
+
+static void
+_uring_unmap(struct event_base *evb)
+{
+    if (evb->sqe != NULL) {
+        munmap(evb->sqe, evb->sqe_sz);
+    }
+    if (evb->cq_ring != NULL && evb->cq_ring != evb->sq_ring) {
+        munmap(evb->cq_ring, evb->cq_ring_sz);
+    }
+    if (evb->sq_ring != NULL) {
+        munmap(evb->sq_ring, evb->sq_ring_sz);
+    }
+}
+
+static int
+_uring_map(struct event_base *evb, struct io_uring_params *p)
+{
+    uint8_t *sq, *cq;
+
+    evb->sq_ring_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    evb->cq_ring_sz = p->cq_off.cqes + p->cq_entries *
+        sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        evb->sq_ring_sz = MAX(evb->sq_ring_sz, evb->cq_ring_sz);
+        evb->cq_ring_sz = evb->sq_ring_sz;
+    }
+
+    evb->sq_ring = mmap(NULL, evb->sq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, evb->ring, IORING_OFF_SQ_RING);
+    if (evb->sq_ring == MAP_FAILED) {
+        evb->sq_ring = NULL;
+        return -1;
+    }
+
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        evb->cq_ring = evb->sq_ring;
+    } else {
+        evb->cq_ring = mmap(NULL, evb->cq_ring_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, evb->ring, IORING_OFF_CQ_RING);
+        if (evb->cq_ring == MAP_FAILED) {
+            evb->cq_ring = NULL;
+            return -1;
+        }
+    }
+
+    evb->sqe_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+    evb->sqe = mmap(NULL, evb->sqe_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, evb->ring, IORING_OFF_SQES);
+    if (evb->sqe == MAP_FAILED) {
+        evb->sqe = NULL;
+        return -1;
+    }
+
+    sq = evb->sq_ring;
+    evb->sq_head = (unsigned *)(sq + p->sq_off.head);
+    evb->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    evb->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    evb->sq_array = (unsigned *)(sq + p->sq_off.array);
+    evb->sq_entries = p->sq_entries;
+    evb->sq_local = *evb->sq_tail;
+
+    cq = evb->cq_ring;
+    evb->cq_head = (unsigned *)(cq + p->cq_off.head);
+    evb->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    evb->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    evb->cqe = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    return 0;
+}
+
+struct event_base *
+event_base_create(int nevent, event_cb_fn cb)
+{
+    struct event_base *evb;
+    struct io_uring_params p;
+    int status;
+
+    ASSERT(nevent > 0);
+
+    evb = (struct event_base *)cc_zalloc(sizeof(*evb));
+    if (evb == NULL) {
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP; /* cap entries instead of failing */
+    evb->ring = _sys_io_uring_setup((unsigned)nevent, &p);
+    if (evb->ring < 0) {
+        log_error("io_uring setup failed: %s", strerror(errno));
+        cc_free(evb);
+        return NULL;
+    }
+
+    /* timed waits rely on IORING_ENTER_EXT_ARG (linux 5.11) */
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        log_error("io_uring on this kernel does not support timed wait");
+        goto error;
+    }
+
+    if (_uring_map(evb, &p) < 0) {
+        log_error("io_uring mmap failed: %s", strerror(errno));
+        goto error;
+    }
+
+    evb->nreg = MAX(URING_REG_MIN, nevent);
+    evb->reg = (struct uring_reg *)cc_calloc(evb->nreg, sizeof(*evb->reg));
+    if (evb->reg == NULL) {
+        goto error;
+    }
+
+    evb->nevent = nevent;
+    evb->cb = cb;
+
+    log_info("io_uring fd %d with nevent %d, sq %u cq %u", evb->ring,
+            evb->nevent, p.sq_entries, p.cq_entries);
+
+    return evb;
+
+error:
+    _uring_unmap(evb);
+    status = close(evb->ring);
+    if (status < 0) {
+        log_warn("close io_uring fd %d failed, ignored: %s", evb->ring,
+                strerror(errno));
+    }
+    cc_free(evb);
+
+    return NULL;
+}
+
+void
+event_base_destroy(struct event_base **evb)
+{
+    int status;
+    struct event_base *e = *evb;
+
+    if (e == NULL) {
+        return;
+    }
+
+    ASSERT(e->ring > 0);
+
+    _uring_unmap(e);
+    cc_free(e->reg);
+    cc_free(e->buf);
+    cc_free(e->batch.item);
+
+    status = close(e->ring);
+    if (status < 0) {
+        log_warn("close io_uring fd %d failed, ignored: %s", e->ring,
+                strerror(errno));
+    }
+    e->ring = -1;
+
+    cc_free(e);
+
+    *evb = NULL;
+}
+
+/* # of sqe queued but not yet consumed by the kernel, publishes the tail */
+static inline unsigned
+_uring_pending(struct event_base *evb)
+{
+    __atomic_store_n(evb->sq_tail, evb->sq_local, __ATOMIC_RELEASE);
+
+    return evb->sq_local - __atomic_load_n(evb->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* submit whatever is queued without waiting for completion */
+static int
+_uring_submit(struct event_base *evb)
+{
+    unsigned nsubmit = _uring_pending(evb);
+    int n;
+
+    if (nsubmit == 0) {
+        return 0;
+    }
+
+    for (;;) {
+        n = _sys_io_uring_enter(evb->ring, nsubmit, 0, 0, NULL, 0);
+        if (n >= 0) {
+            return n;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        log_error("submit %u entries to io_uring fd %d failed: %s", nsubmit,
+                evb->ring, strerror(errno));
+
+        return -1;
+    }
+}
+
+static struct io_uring_sqe *
+_uring_get_sqe(struct event_base *evb)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head, idx;
+
+    head = __atomic_load_n(evb->sq_head, __ATOMIC_ACQUIRE);
+    if (evb->sq_local - head >= evb->sq_entries) {
+        /* queue is full, flush what we have to make room */
+        if (_uring_submit(evb) <= 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(evb->sq_head, __ATOMIC_ACQUIRE);
+        if (evb->sq_local - head >= evb->sq_entries) {
+            return NULL;
+        }
+    }
+
+    idx = evb->sq_local & *evb->sq_mask;
+    sqe = &evb->sqe[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    evb->sq_array[idx] = idx;
+    evb->sq_local++;
+
+    return sqe;
+}
+
+static int
+_uring_poll_add(struct event_base *evb, int fd, uint8_t kind)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_reg *r = &evb->reg[fd];
+
+    sqe = _uring_get_sqe(evb);
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = (kind == URING_POLL_READ) ? (POLLIN | POLLRDHUP) :
+        POLLOUT;
+    if (kind == URING_POLL_READ && (r->mode & EVENT_MODE_EXCLUSIVE)) {
+        sqe->poll32_events |= EPOLLEXCLUSIVE;
+    }
+    sqe->user_data = URING_UDATA(fd, r->gen, kind);
+    r->armed |= kind;
+
+    return 0;
+}
+
+static int
+_uring_cancel(struct event_base *evb, int fd, uint8_t kind)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_reg *r = &evb->reg[fd];
+
+    sqe = _uring_get_sqe(evb);
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    sqe->opcode = (kind & URING_POLL) ? IORING_OP_POLL_REMOVE :
+        IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_UDATA(fd, r->gen, kind);
+    sqe->user_data = URING_UDATA(fd, r->gen, URING_CANCEL);
+
+    return 0;
+}
+
+static int
+_uring_reg_grow(struct event_base *evb, int fd)
+{
+    struct uring_reg *reg;
+    int nreg = evb->nreg;
+
+    while (nreg <= fd) {
+        nreg *= 2;
+    }
+
+    reg = (struct uring_reg *)cc_realloc(evb->reg, nreg * sizeof(*reg));
+    if (reg == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(reg + evb->nreg, 0, (nreg - evb->nreg) * sizeof(*reg));
+    evb->reg = reg;
+    evb->nreg = nreg;
+
+    return 0;
+}
+
+static int
+_event_add(struct event_base *evb, int fd, uint8_t kind, void *data,
+        uint32_t mode)
+{
+    struct uring_reg *r;
+
+    if (fd >= evb->nreg && _uring_reg_grow(evb, fd) < 0) {
+        return -1;
+    }
+
+    r = &evb->reg[fd];
+    r->data = data;
+    if (r->want & kind) {
+        /* same as epoll, adding an existing interest is not an error */
+        return 0;
+    }
+    r->want |= kind;
+    if (kind == URING_POLL_READ) {
+        /* one-shot polls re-armed until deleted are level-triggered anyway */
+        r->mode = (uint8_t)(mode & EVENT_MODE_EXCLUSIVE);
+    }
+
+    return _uring_poll_add(evb, fd, kind);
+}
+
+int
+event_add_read(struct event_base *evb, int fd, void *data)
+{
+    return event_add_read_mode(evb, fd, data, 0);
+}
+
+int
+event_add_read_mode(struct event_base *evb, int fd, void *data, uint32_t mode)
+{
+    int status;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd >= 0);
+
+    status = _event_add(evb, fd, URING_POLL_READ, data, mode);
+    if (status < 0) {
+        log_error("add read w/ io_uring fd %d on fd %d failed: %s", evb->ring,
+                fd, strerror(errno));
+    }
+
+    INCR(event_metrics, event_read);
+    log_verb("add read event to io_uring fd %d on fd %d", evb->ring, fd);
+
+    return status;
+}
+
+int
+event_add_write(struct event_base *evb, int fd, void *data)
+{
+    int status;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd >= 0);
+
+    status = _event_add(evb, fd, URING_POLL_WRITE, data, 0);
+    if (status < 0) {
+        log_error("add write w/ io_uring fd %d on fd %d failed: %s", evb->ring,
+                fd, strerror(errno));
+    }
+
+    INCR(event_metrics, event_write);
+    log_verb("add write event to io_uring fd %d on fd %d", evb->ring, fd);
+
+    return status;
+}
+
+int
+event_del(struct event_base *evb, int fd)
+{
+    struct uring_reg *r;
+    int status = 0;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd >= 0);
+
+    if (fd >= evb->nreg || (evb->reg[fd].want | evb->reg[fd].armed) == 0) {
+        log_error("del w/ io_uring fd %d on fd %d failed: %s", evb->ring, fd,
+                strerror(ENOENT));
+        errno = ENOENT;
+        return -1;
+    }
+
+    r = &evb->reg[fd];
+    if (r->armed & URING_POLL_READ) {
+        status |= _uring_cancel(evb, fd, URING_POLL_READ);
+    }
+    if (r->armed & URING_POLL_WRITE) {
+        status |= _uring_cancel(evb, fd, URING_POLL_WRITE);
+    }
+    if (r->armed & URING_IO_RECV) {
+        status |= _uring_cancel(evb, fd, URING_IO_RECV);
+    }
+    if (r->armed & URING_IO_SEND) {
+        status |= _uring_cancel(evb, fd, URING_IO_SEND);
+    }
+    /*
+     * I/O in flight still references caller memory, which is likely to be
+     * recycled as soon as we return, so cancel it now instead of waiting for
+     * the next event_wait
+     */
+    if (status == 0 && (r->armed & (URING_IO_RECV | URING_IO_SEND)) &&
+            _uring_submit(evb) < 0) {
+        status = -1;
+    }
+    if (status < 0) {
+        log_error("del w/ io_uring fd %d on fd %d failed: %s", evb->ring, fd,
+                strerror(errno));
+    }
+
+    /* completions of the old generation, including cancellations, are ignored */
+    r->gen++;
+    r->want = 0;
+    r->armed = 0;
+    r->mode = 0;
+    r->data = NULL;
+    r->recv_data = NULL;
+    r->send_data = NULL;
+
+    log_verb("del fd %d from io_uring fd %d", fd, evb->ring);
+
+    return status;
+}
+
+static uint32_t
+_uring_events(int32_t res, uint8_t kind)
+{
+    uint32_t events = 0;
+
+    if (res < 0) {
+        return EVENT_ERR;
+    }
+
+    if (res & (POLLERR | POLLHUP)) {
+        events |= EVENT_ERR;
+    }
+
+    if (res & (POLLIN | POLLRDHUP)) {
+        events |= EVENT_READ;
+    }
+
+    if (res & POLLOUT) {
+        events |= EVENT_WRITE;
+    }
+
+    if (events == 0) {
+        /* e.g. POLLNVAL, treat it as an error on what we were polling for */
+        events = EVENT_ERR | (kind == URING_POLL_READ ? EVENT_READ : EVENT_WRITE);
+    }
+
+    return events;
+}
+
+/* process completions, returns the # of events delivered to the callback */
+static int
+_uring_reap(struct event_base *evb)
+{
+    unsigned head, tail;
+    int nreturned = 0;
+
+    head = *evb->cq_head;
+    tail = __atomic_load_n(evb->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && nreturned < evb->nevent) {
+        struct io_uring_cqe *cqe = &evb->cqe[head & *evb->cq_mask];
+        uint64_t ud = cqe->user_data;
+        int32_t res = cqe->res;
+        int fd = URING_UDATA_FD(ud);
+        uint8_t kind = URING_UDATA_KIND(ud);
+        struct uring_reg *r;
+        uint32_t events;
+
+        /* release the slot before calling back, which may queue more work */
+        __atomic_store_n(evb->cq_head, ++head, __ATOMIC_RELEASE);
+
+        log_verb("io_uring completion %"PRIx64" with res %"PRId32, ud, res);
+
+        if (kind == URING_CANCEL || fd >= evb->nreg) {
+            continue;
+        }
+
+        r = &evb->reg[fd];
+        if (URING_UDATA_GEN(ud) != (r->gen & 0xffffff)) {
+            continue; /* stale: fd was deleted after the poll was submitted */
+        }
+        r->armed &= ~kind;
+
+        if (kind == URING_IO_RECV || kind == URING_IO_SEND) {
+            void *data = (kind == URING_IO_RECV) ? r->recv_data : r->send_data;
+
+            nreturned++;
+            if (evb->io_cb != NULL) {
+                evb->io_cb(data, kind == URING_IO_RECV ? EVENT_READ :
+                        EVENT_WRITE, res);
+            }
+            tail = __atomic_load_n(evb->cq_tail, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        if (!(r->want & kind)) {
+            continue;
+        }
+
+        events = _uring_events(res, kind);
+        nreturned++;
+        if (evb->batch.cb != NULL) {
+            /* polls re-armed below are only submitted by the next wait */
+            event_batch_add(&evb->batch, r->data, events);
+        } else if (evb->cb != NULL) {
+            evb->cb(r->data, events);
+        }
+
+        /* callback may have deleted or re-added the fd, check again */
+        r = &evb->reg[fd];
+        if (URING_UDATA_GEN(ud) == (r->gen & 0xffffff) && (r->want & kind) &&
+                !(r->armed & kind)) {
+            if (_uring_poll_add(evb, fd, kind) < 0) {
+                log_error("re-arm poll w/ io_uring fd %d on fd %d failed: %s",
+                        evb->ring, fd, strerror(errno));
+            }
+        }
+
+        tail = __atomic_load_n(evb->cq_tail, __ATOMIC_ACQUIRE);
+    }
+    event_batch_dispatch(&evb->batch);
+
+    return nreturned;
+}
+
+/*
+ * submit pending changes and wait for completions with a single syscall,
+ * timeout is in millisecond
+ */
+static int
+_event_wait(struct event_base *evb, int timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags, min_complete;
+    int ring, nevent;
+
+    ASSERT(evb != NULL);
+
+    ring = evb->ring;
+    nevent = evb->nevent;
+
+    ASSERT(ring > 0);
+    ASSERT(nevent > 0);
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000LL;
+        ts.tv_nsec = (timeout % 1000LL) * 1000000LL;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    min_complete = (timeout == 0) ? 0 : 1;
+
+    for (;;) {
+        int n, nreturned;
+
+        n = _sys_io_uring_enter(ring, _uring_pending(evb), min_complete, flags,
+                &arg, sizeof(arg));
+        INCR(event_metrics, event_loop);
+        clock_update(); /* callbacks see when the wait returned */
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno != ETIME && errno != EBUSY) {
+            log_error("wait on io_uring fd %d with nevent %d and timeout %d "
+                    "failed: %s", ring, nevent, timeout, strerror(errno));
+
+            return -1;
+        }
+
+        nreturned = _uring_reap(evb);
+        if (nreturned > 0) {
+            INCR_N(event_metrics, event_total, nreturned);
+            log_verb("returned %d events from io_uring fd %d", nreturned, ring);
+
+            return nreturned;
+        }
+
+        /* only stale completions were reaped, keep waiting if indefinite */
+        if (timeout == -1 && n >= 0) {
+            continue;
+        }
+
+        log_vverb("wait on io_uring fd %d with nevent %d timeout %d returned "
+                "no events", ring, nevent, timeout);
+
+        return 0;
+    }
+
+    NOT_REACHED();
+}
+
+int
+event_wait(struct event_base *evb, int timeout)
+{
+    ASSERT(evb != NULL);
+
+    return event_spin_wait(&evb->spin, evb, timeout, _event_wait);
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t us)
+{
+    ASSERT(evb != NULL);
+
+    event_spin_set(&evb->spin, us);
+}
+
+int
+event_base_set_batch_cb(struct event_base *evb, event_batch_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    return event_batch_set(&evb->batch, evb->nevent, cb);
+}
+
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    evb->io_cb = cb;
+}
+
+/*
+ * register buffers with the ring, replacing any previous registration. The
+ * kernel pins the pages and maps them once, instead of on every transfer.
+ */
+int
+event_register_buf(struct event_base *evb, const struct iovec *iov, int niov)
+{
+    struct iovec *buf;
+    int status;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(iov != NULL && niov > 0);
+
+    if (niov > EVENT_NBUF_MAX) {
+        log_error("cannot register %d buf w/ io_uring fd %d, max is %d", niov,
+                evb->ring, EVENT_NBUF_MAX);
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf = (struct iovec *)cc_alloc(niov * sizeof(*buf));
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(buf, iov, niov * sizeof(*buf));
+
+    if (evb->nbuf > 0) {
+        status = _sys_io_uring_register(evb->ring, IORING_UNREGISTER_BUFFERS,
+                NULL, 0);
+        if (status < 0) {
+            log_warn("unregister buf w/ io_uring fd %d failed, ignored: %s",
+                    evb->ring, strerror(errno));
+        }
+        cc_free(evb->buf);
+        evb->nbuf = 0;
+    }
+
+    status = _sys_io_uring_register(evb->ring, IORING_REGISTER_BUFFERS, buf,
+            (unsigned)niov);
+    if (status < 0) {
+        /* e.g. ENOMEM if over RLIMIT_MEMLOCK */
+        log_error("register %d buf w/ io_uring fd %d failed: %s", niov,
+                evb->ring, strerror(errno));
+        cc_free(buf);
+
+        return -1;
+    }
+
+    evb->buf = buf;
+    evb->nbuf = niov;
+    log_info("registered %d buf w/ io_uring fd %d", niov, evb->ring);
+
+    return 0;
+}
+
+/* is [addr, addr + nbyte) within registered buffer idx */
+static inline bool
+_uring_fixed(struct event_base *evb, int idx, char *addr, size_t nbyte)
+{
+    char *base;
+
+    if (idx < 0 || idx >= evb->nbuf) {
+        return false;
+    }
+
+    base = evb->buf[idx].iov_base;
+
+    return addr >= base && addr + nbyte <= base + evb->buf[idx].iov_len;
+}
+
+static int
+_event_io(struct event_base *evb, int fd, uint8_t kind, void *buf,
+        size_t nbyte, int idx, void *data)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_reg *r;
+    bool fixed;
+
+    if (fd >= evb->nreg && _uring_reg_grow(evb, fd) < 0) {
+        return -1;
+    }
+
+    r = &evb->reg[fd];
+    if (r->armed & kind) {
+        errno = EBUSY; /* one outstanding transfer per direction */
+        return -1;
+    }
+
+    sqe = _uring_get_sqe(evb);
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    fixed = _uring_fixed(evb, idx, buf, nbyte);
+    if (fixed) {
+        sqe->opcode = (kind == URING_IO_RECV) ? IORING_OP_READ_FIXED :
+            IORING_OP_WRITE_FIXED;
+        sqe->buf_index = (uint16_t)idx; /* idx < nbuf <= EVENT_NBUF_MAX */
+        INCR(event_metrics, event_io_fixed);
+    } else {
+        sqe->opcode = (kind == URING_IO_RECV) ? IORING_OP_RECV :
+            IORING_OP_SEND;
+        sqe->msg_flags = (kind == URING_IO_SEND) ? MSG_NOSIGNAL : 0;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)nbyte;
+    sqe->user_data = URING_UDATA(fd, r->gen, kind);
+
+    r->armed |= kind;
+    if (kind == URING_IO_RECV) {
+        r->recv_data = data;
+    } else {
+        r->send_data = data;
+    }
+    INCR(event_metrics, event_io);
+
+    log_verb("queued %s of %zu bytes%s on fd %d w/ io_uring fd %d",
+            kind == URING_IO_RECV ? "recv" : "send", nbyte,
+            fixed ? " (fixed)" : "", fd, evb->ring);
+
+    return 0;
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    int status;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd >= 0 && buf != NULL && nbyte > 0);
+
+    status = _event_io(evb, fd, URING_IO_RECV, buf, nbyte, idx, data);
+    if (status < 0) {
+        log_error("recv w/ io_uring fd %d on fd %d failed: %s", evb->ring, fd,
+                strerror(errno));
+    }
+
+    return status;
+}
+
+int
+event_send(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    int status;
+
+    ASSERT(evb != NULL && evb->ring > 0);
+    ASSERT(fd >= 0 && buf != NULL && nbyte > 0);
+
+    status = _event_io(evb, fd, URING_IO_SEND, buf, nbyte, idx, data);
+    if (status < 0) {
+        log_error("send w/ io_uring fd %d on fd %d failed: %s", evb->ring, fd,
+                strerror(errno));
+    }
+
+    return status;
+}
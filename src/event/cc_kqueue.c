@@ -20,6 +20,7 @@
 #include <cc_debug.h>
 #include <cc_define.h>
 #include <cc_mm.h>
+#include <time/cc_clock.h>
 
 #include <inttypes.h>
 #include <string.h>
@@ -41,6 +42,8 @@ struct event_base {
     int           nprocessed;   /* # events processed from event[] */
 
     event_cb_fn    cb;           /* event callback */
+    struct event_batch batch;   /* batched dispatch, if cb is set */
+    struct event_spin  spin;    /* spin before blocking waits */
 };
 
 struct event_base *
@@ -99,6 +102,8 @@ event_base_create(int nevent, event_cb_fn cb)
     evb->nreturned = 0;
     evb->nprocessed = 0;
     evb->cb = cb;
+    memset(&evb->batch, 0, sizeof(evb->batch));
+    memset(&evb->spin, 0, sizeof(evb->spin));
 
     log_info("kqueue fd %d with nevent %d", evb->kq, evb->nevent);
 
@@ -121,6 +126,7 @@ event_base_destroy(struct event_base **evb)
 
     cc_free(e->change);
     cc_free(e->event);
+    cc_free(e->batch.item);
 
     status = close(e->kq);
     if (status < 0) {
@@ -152,10 +158,18 @@ _event_update(struct event_base *evb, int fd, uint16_t flags, uint32_t fflags,
 int
 event_add_read(struct event_base *evb, int fd, void *data)
 {
-    _event_update(evb, fd, EVFILT_READ, EV_ADD, data);
+    return event_add_read_mode(evb, fd, data, 0);
+}
+
+int
+event_add_read_mode(struct event_base *evb, int fd, void *data, uint32_t mode)
+{
+    /* no exclusive wakeup with kqueue, EVENT_MODE_EXCLUSIVE is ignored */
+    _event_update(evb, fd, EVFILT_READ,
+            (mode & EVENT_MODE_ET) ? EV_ADD | EV_CLEAR : EV_ADD, data);
     INCR(event_metrics, event_read);
 
-    log_verb("adding read event to fd %d", fd);
+    log_verb("adding read event to fd %d mode %"PRIu32, fd, mode);
 
     return 0;
 }
@@ -180,8 +194,8 @@ event_del(struct event_base *evb, int fd)
     return 0;
 }
 
-int
-event_wait(struct event_base *evb, int timeout)
+static int
+_event_wait(struct event_base *evb, int timeout)
 {
     int kq;
     struct timespec ts, *tsp;
@@ -218,6 +232,7 @@ event_wait(struct event_base *evb, int timeout)
         evb->nreturned = kevent(kq, evb->change, evb->nchange, evb->event,
                                 evb->nevent, tsp);
         INCR(event_metrics, event_loop);
+        clock_update(); /* callbacks see when the wait returned */
         evb->nchange = 0;
         if (evb->nreturned > 0) {
             INCR_N(event_metrics, event_total, evb->nreturned);
@@ -263,10 +278,17 @@ event_wait(struct event_base *evb, int timeout)
                     events |= EVENT_WRITE;
                 }
 
-                if (evb->cb != NULL && events != 0) {
+                if (events == 0) {
+                    continue;
+                }
+
+                if (evb->batch.cb != NULL) {
+                    event_batch_add(&evb->batch, ev->udata, events);
+                } else if (evb->cb != NULL) {
                     evb->cb(ev->udata, events);
                 }
             }
+            event_batch_dispatch(&evb->batch);
 
             log_verb("returned %d events from kqueue fd %d", evb->nreturned, kq);
 
@@ -299,3 +321,65 @@ event_wait(struct event_base *evb, int timeout)
 
     NOT_REACHED();
 }
+
+int
+event_wait(struct event_base *evb, int timeout)
+{
+    ASSERT(evb != NULL);
+
+    return event_spin_wait(&evb->spin, evb, timeout, _event_wait);
+}
+
+void
+event_base_set_spin(struct event_base *evb, uint32_t us)
+{
+    ASSERT(evb != NULL);
+
+    event_spin_set(&evb->spin, us);
+}
+
+int
+event_base_set_batch_cb(struct event_base *evb, event_batch_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    return event_batch_set(&evb->batch, evb->nevent, cb);
+}
+
+/* completion-based I/O is not available with kqueue */
+void
+event_base_set_io_cb(struct event_base *evb, event_io_cb_fn cb)
+{
+    ASSERT(evb != NULL);
+
+    log_warn("no completion-based I/O w/ kqueue, I/O callback ignored");
+}
+
+int
+event_register_buf(struct event_base *evb, const struct iovec *iov, int niov)
+{
+    log_warn("register buf not supported w/ kqueue");
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+int
+event_recv(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    log_error("recv on fd %d not supported w/ kqueue", fd);
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+int
+event_send(struct event_base *evb, int fd, void *buf, size_t nbyte, int idx,
+        void *data)
+{
+    log_error("send on fd %d not supported w/ kqueue", fd);
+    errno = ENOTSUP;
+
+    return -1;
+}
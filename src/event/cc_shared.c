@@ -18,6 +18,13 @@
 #include "cc_shared.h"
 
 #include <cc_debug.h>
+#include <cc_mm.h>
+#include <time/cc_timer.h>
+
+#include <string.h>
+#include <sys/param.h>
+
+#define EVENT_SPIN_SHRINK 16 /* spin at least budget / EVENT_SPIN_SHRINK */
 
 static bool event_init = false;
 event_metrics_st *event_metrics = NULL;
@@ -46,3 +53,107 @@ event_teardown(void)
     event_metrics = NULL;
     event_init = false;
 }
+
+int
+event_batch_set(struct event_batch *batch, int nevent, event_batch_fn cb)
+{
+    cc_free(batch->item);
+    batch->nitem = 0;
+    batch->cb = NULL;
+
+    if (cb == NULL) {
+        return 0;
+    }
+
+    batch->item = (struct event_item *)cc_alloc(nevent * sizeof(*batch->item));
+    if (batch->item == NULL) {
+        log_error("allocating %d batch items failed", nevent);
+        return -1;
+    }
+    batch->nitem = nevent;
+    batch->nread = 0;
+    batch->nother = 0;
+    batch->cb = cb;
+
+    return 0;
+}
+
+void
+event_batch_dispatch(struct event_batch *batch)
+{
+    int n = batch->nread + batch->nother;
+
+    if (n == 0) {
+        return;
+    }
+
+    /* close the gap between reads at the front and the rest at the back */
+    if (batch->nother > 0 && n < batch->nitem) {
+        memmove(&batch->item[batch->nread],
+                &batch->item[batch->nitem - batch->nother],
+                batch->nother * sizeof(*batch->item));
+    }
+    batch->nread = 0;
+    batch->nother = 0;
+
+    INCR(event_metrics, event_batch);
+    batch->cb(batch->item, n);
+}
+
+void
+event_spin_set(struct event_spin *spin, uint32_t us)
+{
+    spin->budget = (uint64_t)us * 1000;
+    spin->limit = spin->budget;
+}
+
+int
+event_spin_wait(struct event_spin *spin, struct event_base *evb, int timeout,
+        event_wait_fn wait)
+{
+    struct duration d, s;
+    double spun, limit;
+    int n;
+
+    if (spin->budget == 0 || timeout == 0) {
+        n = wait(evb, timeout);
+        goto done;
+    }
+
+    limit = (double)spin->limit;
+    if (timeout > 0) { /* never spin past the caller's timeout */
+        limit = MIN(limit, (double)timeout * 1000000);
+    }
+    duration_start_type(&d, DURATION_FAST);
+    do {
+        n = wait(evb, 0);
+        if (n != 0) { /* events, or an error */
+            if (n > 0) {
+                INCR(event_metrics, event_spin_hit);
+                spin->limit = spin->budget;
+            }
+            goto done;
+        }
+        duration_snapshot(&s, &d);
+        spun = duration_ns(&s);
+    } while (spun < limit);
+
+    if (timeout > 0 && spun >= (double)timeout * 1000000) {
+        n = 0; /* timed out while spinning */
+        goto done;
+    }
+
+    INCR(event_metrics, event_spin_block);
+    spin->limit = MAX(spin->limit / 2, spin->budget / EVENT_SPIN_SHRINK);
+    if (timeout > 0) {
+        timeout = MAX(timeout - (int)(spun / 1000000), 1); /* in ms */
+    }
+    n = wait(evb, timeout);
+
+done:
+    if (n >= 0) {
+        event_wait_stat(n);
+    }
+
+    return n;
+}
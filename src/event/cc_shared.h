@@ -22,14 +22,69 @@
 extern "C" {
 #endif
 
+#include <cc_debug.h>
 #include <cc_event.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define EVENT_MODULE_NAME "ccommon::event"
 
 extern event_metrics_st *event_metrics;
 
+/*
+ * ready events staged for batched dispatch: reads are filled in from the
+ * front of item[] and the rest from the back, which puts reads first without
+ * a separate sorting pass
+ */
+struct event_batch {
+    struct event_item   *item;      /* item[] - staged events */
+    int                 nitem;      /* capacity of item[] */
+    int                 nread;      /* # items staged at the front */
+    int                 nother;     /* # items staged at the back */
+    event_batch_fn      cb;         /* batch callback */
+};
+
+int event_batch_set(struct event_batch *batch, int nevent, event_batch_fn cb);
+void event_batch_dispatch(struct event_batch *batch);
+
+struct event_spin {
+    uint64_t            budget;     /* ns to spin before blocking, 0: off */
+    uint64_t            limit;      /* ns to spin next, adapted to outcomes */
+};
+
+/* a backend's wait, which doesn't record event_wait_stat */
+typedef int (*event_wait_fn)(struct event_base *, int);
+
+void event_spin_set(struct event_spin *spin, uint32_t us);
+/* wait with spinning as configured, the result is recorded by event_wait_stat */
+int event_spin_wait(struct event_spin *spin, struct event_base *evb,
+        int timeout, event_wait_fn wait);
+
+static inline void
+event_batch_add(struct event_batch *batch, void *data, uint32_t events)
+{
+    struct event_item *it;
+
+    ASSERT(batch->nread + batch->nother < batch->nitem);
+
+    if (events & EVENT_READ) {
+        it = &batch->item[batch->nread++];
+    } else {
+        it = &batch->item[batch->nitem - ++batch->nother];
+    }
+    it->data = data;
+    it->events = events;
+}
+
+/* record the # events returned by a wakeup */
+static inline void
+event_wait_stat(int nreturned)
+{
+    INCR_LOG2(event_metrics, event_wait_0, EVENT_WAIT_NBUCKET,
+            (uint64_t)nreturned);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,8 +25,12 @@
 #include <cc_pool.h>
 #include <cc_util.h>
 #include <channel/cc_tcp.h>
+#include <time/cc_clock.h>
 
+#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <sys/param.h>
 #include <sys/uio.h>
 
 /*
@@ -39,13 +43,27 @@
 
 #define SOCKIO_MODULE_NAME "ccommon::sockio"
 
-FREEPOOL(buf_sock_pool, buf_sockq, buf_sock);
-struct buf_sock_pool bsp;
+static struct pool *bsp = NULL;
+static uint32_t wq_size = BUFSOCK_WQ_SIZE;
 
 static bool sockio_init = false;
-static bool bsp_init = false;
 static sockio_metrics_st *sockio_metrics = NULL;
 
+enum buf_sock_wseg_type {
+    WSEG_WBUF,  /* data in wbuf, located when flushing */
+    WSEG_BUF,   /* a buf taken over from the caller */
+    WSEG_REF,   /* memory borrowed from the caller */
+};
+
+struct buf_sock_wseg {
+    enum buf_sock_wseg_type type;
+    char                    *pos;   /* first byte not yet sent, not WBUF */
+    size_t                  len;    /* # bytes not yet sent */
+    struct buf              *buf;
+    buf_sock_release_fn     release;
+    void                    *arg;
+};
+
 rstatus_i
 buf_tcp_read(struct buf_sock *s)
 {
@@ -87,6 +105,7 @@ buf_tcp_read(struct buf_sock *s)
 
     if (n > 0) {
         buf->wpos += n;
+        buf_sock_touch(s);
         log_verb("recv %zd bytes on conn %p", n, c);
     }
 
@@ -202,12 +221,535 @@ dbuf_tcp_read(struct buf_sock *s)
 
 done:
     if (total_n > 0) {
+        buf_sock_touch(s);
         log_verb("recv %zd bytes on conn %p", total_n, c);
     }
 
     return status;
 }
 
+/* the queued write completes: sent or discarded */
+static void
+_buf_sock_wseg_done(struct buf_sock_wseg *seg)
+{
+    switch (seg->type) {
+    case WSEG_BUF:
+        buf_return(&seg->buf);
+        break;
+
+    case WSEG_REF:
+        if (seg->release != NULL) {
+            seg->release(seg->arg);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static struct buf_sock_wseg *
+_buf_sock_wq_push(struct buf_sock *s, enum buf_sock_wseg_type type, char *pos,
+        size_t len)
+{
+    uint32_t nalloc = array_nalloc(s->wiov);
+    struct buf_sock_wseg *seg;
+
+    ASSERT(s->wq_nseg < nalloc);
+
+    seg = &s->wq[(s->wq_head + s->wq_nseg) % nalloc];
+    seg->type = type;
+    seg->pos = pos;
+    seg->len = len;
+    seg->buf = NULL;
+    seg->release = NULL;
+    seg->arg = NULL;
+    s->wq_nseg++;
+
+    return seg;
+}
+
+/* # bytes written into wbuf since it was last queued */
+static inline uint32_t
+_buf_sock_wbuf_unqueued(struct buf_sock *s)
+{
+    return buf_rsize(s->wbuf) - s->wq_wbuf;
+}
+
+/* queue what has been written into wbuf so far, if there is room */
+static rstatus_i
+_buf_sock_wq_seal(struct buf_sock *s)
+{
+    uint32_t len = _buf_sock_wbuf_unqueued(s);
+
+    if (len == 0) {
+        return CC_OK;
+    }
+    if (s->wq_nseg == array_nalloc(s->wiov)) {
+        return CC_ENOMEM;
+    }
+
+    /*
+     * wbuf can be grown (moving it) or shifted before the flush, so only the
+     * length is kept: wbuf segments are back to back from wbuf->rpos
+     */
+    _buf_sock_wq_push(s, WSEG_WBUF, NULL, len);
+    s->wq_wbuf += len;
+
+    return CC_OK;
+}
+
+/* make room for a new write, which goes after what is in wbuf */
+static rstatus_i
+_buf_sock_wq_reserve(struct buf_sock *s)
+{
+    uint32_t need = 1 + (_buf_sock_wbuf_unqueued(s) > 0);
+
+    if (s->wq_nseg + need > array_nalloc(s->wiov)) {
+        log_verb("write queue of buf_sock %p is full", s);
+        INCR(sockio_metrics, buf_sock_wq_full);
+
+        return CC_ENOMEM;
+    }
+
+    return _buf_sock_wq_seal(s);
+}
+
+/* n bytes from the front of the queue have been sent */
+static void
+_buf_sock_wq_advance(struct buf_sock *s, size_t n)
+{
+    struct buf_sock_wseg *seg;
+    size_t len;
+
+    while (n > 0) {
+        ASSERT(s->wq_nseg > 0);
+
+        seg = &s->wq[s->wq_head];
+        len = MIN(seg->len, n);
+        seg->len -= len;
+        n -= len;
+        if (seg->type == WSEG_WBUF) {
+            s->wbuf->rpos += len;
+            s->wq_wbuf -= len;
+        } else {
+            seg->pos += len;
+        }
+        if (seg->len == 0) {
+            _buf_sock_wseg_done(seg);
+            s->wq_head = (s->wq_head + 1) % array_nalloc(s->wiov);
+            s->wq_nseg--;
+        }
+    }
+
+    if (s->wq_wbuf == 0 && buf_rsize(s->wbuf) == 0) {
+        s->wbuf->rpos = s->wbuf->wpos = s->wbuf->begin;
+    }
+}
+
+static void
+_buf_sock_wq_discard(struct buf_sock *s)
+{
+    for (; s->wq_nseg > 0; s->wq_nseg--) {
+        _buf_sock_wseg_done(&s->wq[s->wq_head]);
+        s->wq_head = (s->wq_head + 1) % array_nalloc(s->wiov);
+    }
+    s->wq_head = 0;
+    s->wq_wbuf = 0;
+}
+
+rstatus_i
+buf_sock_queue_buf(struct buf_sock *s, struct buf *buf)
+{
+    struct buf_sock_wseg *seg;
+    rstatus_i status;
+
+    ASSERT(s != NULL && buf != NULL);
+
+    if (buf_rsize(buf) == 0) {
+        buf_return(&buf);
+
+        return CC_OK;
+    }
+
+    status = _buf_sock_wq_reserve(s);
+    if (status != CC_OK) {
+        return status;
+    }
+
+    seg = _buf_sock_wq_push(s, WSEG_BUF, buf->rpos, buf_rsize(buf));
+    seg->buf = buf;
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_sock_queue_ref(struct buf_sock *s, const void *data, size_t len,
+        buf_sock_release_fn release, void *arg)
+{
+    struct buf_sock_wseg *seg;
+    rstatus_i status;
+
+    ASSERT(s != NULL && (data != NULL || len == 0));
+
+    if (len == 0) {
+        if (release != NULL) {
+            release(arg);
+        }
+
+        return CC_OK;
+    }
+
+    status = _buf_sock_wq_reserve(s);
+    if (status != CC_OK) {
+        return status;
+    }
+
+    seg = _buf_sock_wq_push(s, WSEG_REF, (char *)data, len);
+    seg->release = release;
+    seg->arg = arg;
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_writev(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    struct tcp_conn *c = (struct tcp_conn *)s->ch;
+    struct buf_sock_wseg *seg;
+    struct iovec *v;
+    rstatus_i status = CC_OK;
+    uint32_t i, nalloc, off = 0;
+    size_t nbyte = 0;
+    ssize_t n;
+
+    ASSERT(c != NULL && s->wbuf != NULL && s->wiov != NULL);
+
+    /* if the queue is full, wbuf data left out goes with the next flush */
+    _buf_sock_wq_seal(s);
+
+    if (s->wq_nseg == 0) {
+        log_verb("no data to send on buf_sock %p", s);
+
+        return CC_EEMPTY;
+    }
+
+    nalloc = array_nalloc(s->wiov);
+    s->wiov->nelem = 0;
+    for (i = 0; i < s->wq_nseg; i++) {
+        seg = &s->wq[(s->wq_head + i) % nalloc];
+        v = array_push(s->wiov);
+        if (seg->type == WSEG_WBUF) {
+            v->iov_base = s->wbuf->rpos + off;
+            off += seg->len;
+        } else {
+            v->iov_base = seg->pos;
+        }
+        v->iov_len = seg->len;
+        nbyte += seg->len;
+    }
+
+    n = tcp_sendv(c, s->wiov, nbyte);
+    INCR(sockio_metrics, buf_sock_writev);
+    if (n < 0) {
+        if (n == CC_EAGAIN) {
+            log_verb("sendv on conn %p returns rescuable error: EAGAIN", c);
+            status = CC_EAGAIN;
+        } else {
+            log_info("sendv on conn %p returns other error: %d", c, n);
+            status = CC_ERROR;
+            c->state = CHANNEL_ERROR;
+        }
+    }
+
+    if (n > 0) {
+        _buf_sock_wq_advance(s, (size_t)n);
+        log_verb("sendv %zd bytes on conn %p", n, c);
+    }
+
+    if (status == CC_OK && (s->wq_nseg > 0 || buf_rsize(s->wbuf) > 0)) {
+        log_debug("unwritten data remain on conn %p, should retry", c);
+        status = CC_ERETRY;
+    }
+
+    return status;
+}
+
+static void _buf_sock_deadline_check(void *arg);
+
+/* schedule the next check ns from now, within what the wheel covers */
+static rstatus_i
+_buf_sock_deadline_schedule(struct buf_sock *s, int64_t ns)
+{
+    struct timing_wheel *tw = s->tw;
+    struct timeout_event *tev;
+    struct timeout delay;
+    uint64_t max = MIN((tw->span - 1) * tw->tick_ns, INT64_MAX);
+
+    ASSERT(s->tev == TIMEOUT_HANDLE_INVALID);
+
+    ns = MAX(MIN(ns, (int64_t)max), 1);
+    timeout_set_ns(&delay, (uint64_t)ns);
+    tev = timing_wheel_insert(tw, &delay, false, _buf_sock_deadline_check, s);
+    if (tev == NULL) {
+        log_error("schedule deadline check of buf_sock %p failed", s);
+
+        return CC_ERROR;
+    }
+    s->tev = timeout_event_handle(tev);
+    timeout_add_ns(&s->check_due, (uint64_t)ns);
+
+    return CC_OK;
+}
+
+static void
+_buf_sock_deadline_check(void *arg)
+{
+    struct buf_sock *s = arg;
+    int64_t idle_ns = INT64_MAX, req_ns = INT64_MAX;
+
+    s->tev = TIMEOUT_HANDLE_INVALID; /* stale now */
+
+    if (s->req_due.is_set) {
+        req_ns = clock_timeout_ns(&s->req_due);
+    }
+    if (s->idle_due.is_set) {
+        idle_ns = clock_timeout_ns(&s->idle_due);
+    }
+
+    if (req_ns <= 0 || idle_ns <= 0) {
+        log_debug("%s deadline of buf_sock %p passed", req_ns <= 0 ?
+                "request" : "idle", s);
+        if (req_ns <= 0) {
+            INCR(sockio_metrics, buf_sock_req_to);
+        } else {
+            INCR(sockio_metrics, buf_sock_idle_to);
+        }
+        s->ch->err = ETIMEDOUT;
+        s->expire(s, req_ns > 0);
+
+        return;
+    }
+
+    if (req_ns == INT64_MAX && idle_ns == INT64_MAX) {
+        return; /* nothing to wait for until the next request starts */
+    }
+
+    /* there was activity since the check was scheduled */
+    INCR(sockio_metrics, buf_sock_dl_check);
+    _buf_sock_deadline_schedule(s, MIN(req_ns, idle_ns));
+}
+
+rstatus_i
+buf_sock_deadline_arm(struct timing_wheel *tw, struct buf_sock *s,
+        struct timeout *idle, struct timeout *req, buf_sock_expire_fn expire)
+{
+    ASSERT(tw != NULL && s != NULL && expire != NULL);
+    ASSERT(tw->span > 1);
+    ASSERT(idle == NULL || idle->is_intvl);
+    ASSERT(req == NULL || req->is_intvl);
+
+    buf_sock_deadline_disarm(s);
+
+    s->tw = tw;
+    s->expire = expire;
+    if (idle != NULL) {
+        s->idle = *idle;
+        clock_timeout_add(&s->idle_due, idle);
+    }
+    if (req != NULL) {
+        s->req = *req;
+    }
+
+    if (idle == NULL) {
+        return CC_OK; /* the first request schedules the first check */
+    }
+
+    return _buf_sock_deadline_schedule(s, timeout_ns(idle));
+}
+
+void
+buf_sock_deadline_disarm(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    if (s->tw != NULL) {
+        timing_wheel_cancel(s->tw, s->tev);
+    }
+    s->tev = TIMEOUT_HANDLE_INVALID;
+    s->tw = NULL;
+    s->expire = NULL;
+    timeout_reset(&s->idle);
+    timeout_reset(&s->req);
+    timeout_reset(&s->idle_due);
+    timeout_reset(&s->req_due);
+    timeout_reset(&s->check_due);
+}
+
+void
+buf_sock_touch(struct buf_sock *s)
+{
+    if (s->idle.is_set) {
+        clock_timeout_add(&s->idle_due, &s->idle);
+    }
+}
+
+rstatus_i
+buf_sock_request_start(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    if (!s->req.is_set) {
+        return CC_OK;
+    }
+
+    clock_timeout_add(&s->req_due, &s->req);
+    if (s->tev != TIMEOUT_HANDLE_INVALID &&
+            s->check_due.tp <= s->req_due.tp) {
+        return CC_OK; /* the pending check comes first */
+    }
+
+    timing_wheel_cancel(s->tw, s->tev);
+    s->tev = TIMEOUT_HANDLE_INVALID;
+
+    return _buf_sock_deadline_schedule(s, timeout_ns(&s->req));
+}
+
+void
+buf_sock_request_done(struct buf_sock *s)
+{
+    ASSERT(s != NULL);
+
+    timeout_reset(&s->req_due);
+}
+
+rstatus_i
+buf_tcp_read_submit(struct event_base *evb, struct buf_sock *s)
+{
+    ASSERT(evb != NULL && s != NULL);
+
+    struct tcp_conn *c = (struct tcp_conn *)s->ch;
+    struct buf *buf = s->rbuf;
+    uint32_t cap;
+
+    ASSERT(c != NULL && buf != NULL);
+
+    cap = buf_wsize(buf);
+
+    if (cap == 0) {
+        return CC_ENOMEM;
+    }
+
+    if (event_recv(evb, c->sd, buf->wpos, cap, buf->fixed, s) < 0) {
+        c->err = errno;
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_read_done(struct buf_sock *s, int res)
+{
+    ASSERT(s != NULL);
+
+    struct tcp_conn *c = (struct tcp_conn *)s->ch;
+    struct buf *buf = s->rbuf;
+    rstatus_i status = CC_OK;
+
+    ASSERT(c != NULL && buf != NULL);
+
+    if (res < 0) {
+        if (res == -EAGAIN) {
+            status = CC_OK;
+        } else {
+            log_info("recv on conn %p returns other error: %d", c, res);
+            status = CC_ERROR;
+            c->err = -res;
+            c->state = CHANNEL_ERROR;
+        }
+    } else if (res == 0) {
+        status = CC_ERDHUP;
+        c->state = CHANNEL_TERM;
+    } else {
+        ASSERT((uint32_t)res <= buf_wsize(buf));
+
+        buf->wpos += res;
+        c->recv_nbyte += (size_t)res;
+        buf_sock_touch(s);
+        /* filled up what was submitted, there may be more to read */
+        status = (buf_wsize(buf) == 0) ? CC_ERETRY : CC_OK;
+        log_verb("recv %d bytes on conn %p", res, c);
+    }
+
+    return status;
+}
+
+rstatus_i
+buf_tcp_write_submit(struct event_base *evb, struct buf_sock *s)
+{
+    ASSERT(evb != NULL && s != NULL);
+
+    struct tcp_conn *c = (struct tcp_conn *)s->ch;
+    struct buf *buf = s->wbuf;
+    uint32_t cap;
+
+    ASSERT(c != NULL && buf != NULL);
+
+    cap = buf_rsize(buf);
+
+    if (cap == 0) {
+        log_verb("no data to send in buf at %p ", buf);
+
+        return CC_EEMPTY;
+    }
+
+    if (event_send(evb, c->sd, buf->rpos, cap, buf->fixed, s) < 0) {
+        c->err = errno;
+        return CC_ERROR;
+    }
+
+    return CC_OK;
+}
+
+rstatus_i
+buf_tcp_write_done(struct buf_sock *s, int res)
+{
+    ASSERT(s != NULL);
+
+    struct tcp_conn *c = (struct tcp_conn *)s->ch;
+    struct buf *buf = s->wbuf;
+    rstatus_i status = CC_OK;
+
+    ASSERT(c != NULL && buf != NULL);
+
+    if (res < 0) {
+        if (res == -EAGAIN) {
+            log_verb("send on conn %p returns rescuable error: EAGAIN", c);
+            status = CC_EAGAIN;
+        } else {
+            log_info("send on conn %p returns other error: %d", c, res);
+            status = CC_ERROR;
+            c->err = -res;
+            c->state = CHANNEL_ERROR;
+        }
+    } else {
+        ASSERT((uint32_t)res <= buf_rsize(buf));
+
+        buf->rpos += res;
+        c->send_nbyte += (size_t)res;
+        if (buf_rsize(buf) > 0) {
+            log_debug("unwritten data remain on conn %p, should retry", c);
+            status = CC_ERETRY;
+        }
+        log_verb("send %d bytes on conn %p", res, c);
+    }
+
+    return status;
+}
+
 struct buf_sock *
 buf_sock_create(void)
 {
@@ -225,6 +767,13 @@ buf_sock_create(void)
     s->ch = NULL;
     s->rbuf = NULL;
     s->wbuf = NULL;
+    s->wq = NULL;
+    s->wq_head = 0;
+    s->wq_nseg = 0;
+    s->wq_wbuf = 0;
+    s->wiov = NULL;
+    s->tw = NULL;
+    buf_sock_deadline_disarm(s);
 
     s->ch = tcp_conn_create();
     if (s->ch == NULL) {
@@ -238,6 +787,13 @@ buf_sock_create(void)
     if (s->wbuf == NULL) {
         goto error;
     }
+    s->wq = (struct buf_sock_wseg *)cc_alloc(wq_size * sizeof(*s->wq));
+    if (s->wq == NULL) {
+        goto error;
+    }
+    if (array_create(&s->wiov, wq_size, sizeof(struct iovec)) != CC_OK) {
+        goto error;
+    }
 
     INCR(sockio_metrics, buf_sock_create);
     INCR(sockio_metrics, buf_sock_curr);
@@ -263,6 +819,12 @@ buf_sock_destroy(struct buf_sock **s)
 
     log_verb("destroy buffered socket %p", *s);
 
+    buf_sock_deadline_disarm(*s);
+    if ((*s)->wiov != NULL) {
+        _buf_sock_wq_discard(*s);
+    }
+    array_destroy(&(*s)->wiov);
+    cc_free((*s)->wq);
     tcp_conn_destroy(&(*s)->ch);
     buf_destroy(&(*s)->rbuf);
     buf_destroy(&(*s)->wbuf);
@@ -273,47 +835,128 @@ buf_sock_destroy(struct buf_sock **s)
     DECR(sockio_metrics, buf_sock_curr);
 }
 
+static void *
+_buf_sock_create(void)
+{
+    return buf_sock_create();
+}
+
 static void
-buf_sock_pool_destroy(void)
+_buf_sock_destroy(void *s)
 {
-    struct buf_sock *s, *ts;
+    buf_sock_destroy((struct buf_sock **)&s);
+}
 
-    if (!bsp_init) {
+static void
+buf_sock_pool_destroy(void)
+{
+    if (bsp == NULL) {
         log_warn("buffered socket pool was never created, ignore");
 
         return;
     }
 
-    log_info("destroying buffered socket pool: free %"PRIu32, bsp.nfree);
-
-    FREEPOOL_DESTROY(s, ts, &bsp, next, buf_sock_destroy);
-    bsp_init = false;
+    pool_destroy(&bsp);
 }
 
 static void
 buf_sock_pool_create(uint32_t max)
 {
-    struct buf_sock *s;
-
-    if (bsp_init) {
+    if (bsp != NULL) {
         log_warn("buffered socket pool has already been created, re-creating");
 
         buf_sock_pool_destroy();
     }
 
-    log_info("creating buffered socket pool: max %"PRIu32, max);
-
-    FREEPOOL_CREATE(&bsp, max);
-    bsp_init = true;
+    bsp = pool_create("buf_sock", max, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _buf_sock_create, _buf_sock_destroy,
+            POOL_METRICS(sockio_metrics, buf_sock_pool_));
+    if (bsp == NULL) {
+        log_crit("cannot create buffered socket pool due to OOM, abort");
+        exit(EXIT_FAILURE);
+    }
 
     /* preallocating, see notes in cc_buf.c */
-    FREEPOOL_PREALLOC(s, &bsp, max, next, buf_sock_create);
-    if (bsp.nfree < max) {
+    if (pool_prealloc(bsp, max) < max) {
         log_crit("cannot preallocate buffered socket pool due to OOM, abort");
         exit(EXIT_FAILURE);
     }
 }
 
+struct buf_sock_iov {
+    struct iovec    *iov;
+    uint32_t        niov;   /* # iovec filled */
+    uint32_t        max;
+};
+
+static void
+_buf_sock_iov_add(void *obj, void *arg)
+{
+    struct buf_sock *s = obj;
+    struct buf_sock_iov *bi = arg;
+
+    /* past max, or returned since the pool was counted: left unregistered */
+    if (bi->niov + 2 > bi->max) {
+        return;
+    }
+
+    bi->iov[bi->niov].iov_base = s->rbuf->begin;
+    bi->iov[bi->niov].iov_len = buf_capacity(s->rbuf);
+    s->rbuf->fixed = bi->niov++;
+    bi->iov[bi->niov].iov_base = s->wbuf->begin;
+    bi->iov[bi->niov].iov_len = buf_capacity(s->wbuf);
+    s->wbuf->fixed = bi->niov++;
+}
+
+static void
+_buf_sock_iov_reset(void *obj, void *arg)
+{
+    struct buf_sock *s = obj;
+
+    s->rbuf->fixed = -1;
+    s->wbuf->fixed = -1;
+}
+
+rstatus_i
+buf_sock_register(struct event_base *evb)
+{
+    struct buf_sock_iov bi;
+    uint32_t nfree;
+
+    ASSERT(evb != NULL);
+
+    if (bsp == NULL || (nfree = pool_nfree(bsp)) == 0) {
+        log_warn("no pooled buffered socket to register");
+
+        return CC_EEMPTY;
+    }
+
+    /* past the limit, buffers are left unregistered and used as is */
+    bi.max = MIN(nfree * 2, EVENT_NBUF_MAX);
+    bi.iov = (struct iovec *)cc_alloc(bi.max * sizeof(*bi.iov));
+    if (bi.iov == NULL) {
+        return CC_ENOMEM;
+    }
+    bi.niov = 0;
+
+    pool_foreach_free(bsp, _buf_sock_iov_reset, NULL);
+    pool_foreach_free(bsp, _buf_sock_iov_add, &bi);
+
+    if (event_register_buf(evb, bi.iov, bi.niov) < 0) {
+        pool_foreach_free(bsp, _buf_sock_iov_reset, NULL);
+        cc_free(bi.iov);
+
+        return CC_ERROR;
+    }
+    cc_free(bi.iov);
+
+    log_info("registered %"PRIu32" buffers of %"PRIu32" buffered sockets, "
+            "%"PRIu32" left unregistered", bi.niov, bi.niov / 2,
+            nfree - bi.niov / 2);
+
+    return CC_OK;
+}
+
 void
 buf_sock_reset(struct buf_sock *s)
 {
@@ -328,6 +971,8 @@ buf_sock_reset(struct buf_sock *s)
     s->data = NULL;
     s->hdl = NULL;
 
+    buf_sock_deadline_disarm(s);
+    _buf_sock_wq_discard(s);
     tcp_conn_reset(s->ch);
     buf_reset(s->rbuf);
     buf_reset(s->wbuf);
@@ -336,9 +981,8 @@ buf_sock_reset(struct buf_sock *s)
 struct buf_sock *
 buf_sock_borrow(void)
 {
-    struct buf_sock *s;
+    struct buf_sock *s = pool_borrow(bsp);
 
-    FREEPOOL_BORROW(s, &bsp, next, buf_sock_create);
     if (s == NULL) {
         log_debug("borrow buffered socket failed: OOM or over limit");
         INCR(sockio_metrics, buf_sock_borrow_ex);
@@ -364,7 +1008,7 @@ buf_sock_return(struct buf_sock **s)
     log_verb("return buffered socket %p", *s);
 
     (*s)->free = true;
-    FREEPOOL_RETURN(*s, &bsp, next);
+    pool_return(bsp, *s);
 
     *s = NULL;
     INCR(sockio_metrics, buf_sock_return);
@@ -386,6 +1030,12 @@ sockio_setup(sockio_options_st *options, sockio_metrics_st *metrics)
 
     if (options != NULL) {
         max = option_uint(&options->buf_sock_poolsize);
+        wq_size = option_uint(&options->buf_sock_wq_size);
+    }
+    if (wq_size == 0 || wq_size > IOV_MAX) {
+        log_warn("invalid write queue size %"PRIu32", use %d", wq_size,
+                BUFSOCK_WQ_SIZE);
+        wq_size = BUFSOCK_WQ_SIZE;
     }
 
     buf_sock_pool_create(max);
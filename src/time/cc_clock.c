@@ -0,0 +1,214 @@
+#include <time/cc_clock.h>
+
+#include <cc_debug.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#define CLOCK_MODULE_NAME "ccommon::clock"
+
+#define NS_PER_US  1000LL
+#define NS_PER_MS  1000000LL
+#define NS_PER_SEC 1000000000LL
+
+static bool clock_init = false;
+static int64_t clock_tp = 0;        /* cached timestamp, as in timeout.tp */
+static time_t clock_wall = 0;       /* cached wall clock */
+
+static pthread_t ticker;
+static bool ticker_running = false;
+static bool ticker_stop = false;
+static uint64_t ticker_us = CLOCK_TICKER_US;
+
+static inline int64_t
+_clock_now(void)
+{
+    struct timeout t;
+
+    timeout_add_ns(&t, 0);
+
+    return t.tp;
+}
+
+static inline int64_t
+_clock_tp(void)
+{
+    if (!__atomic_load_n(&clock_init, __ATOMIC_ACQUIRE)) {
+        return _clock_now();
+    }
+
+    return __atomic_load_n(&clock_tp, __ATOMIC_RELAXED);
+}
+
+void
+clock_update(void)
+{
+    int64_t now = _clock_now();
+    int64_t tp = __atomic_load_n(&clock_tp, __ATOMIC_RELAXED);
+
+    /*
+     * two updaters may read the clock in one order and publish in the other:
+     * only ever move the cached value forward, or readers could see it go
+     * back. The wall clock may step back legitimately, so it's left as is.
+     */
+    while (tp < now && !__atomic_compare_exchange_n(&clock_tp, &tp, now, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* tp reloaded, retry */
+    }
+    __atomic_store_n(&clock_wall, time(NULL), __ATOMIC_RELAXED);
+}
+
+int64_t
+clock_ns(void)
+{
+    struct timeout e = { .tp = _clock_tp(), .is_set = true, .is_intvl = true };
+
+    return timeout_ns(&e);
+}
+
+int64_t
+clock_us(void)
+{
+    return clock_ns() / NS_PER_US;
+}
+
+int64_t
+clock_ms(void)
+{
+    return clock_ns() / NS_PER_MS;
+}
+
+int64_t
+clock_sec(void)
+{
+    return clock_ns() / NS_PER_SEC;
+}
+
+time_t
+clock_unix(void)
+{
+    if (!__atomic_load_n(&clock_init, __ATOMIC_ACQUIRE)) {
+        return time(NULL);
+    }
+
+    return __atomic_load_n(&clock_wall, __ATOMIC_RELAXED);
+}
+
+void
+clock_timeout_add(struct timeout *e, struct timeout *t)
+{
+    struct timeout now = { .tp = _clock_tp(), .is_set = true, .is_intvl = false };
+
+    ASSERT(t->is_intvl);
+
+    timeout_sum_intvl(e, &now, t);
+}
+
+int64_t
+clock_timeout_ns(struct timeout *e)
+{
+    struct timeout d;
+
+    if (e->is_intvl) {
+        return timeout_ns(e);
+    }
+
+    d = (struct timeout){ .tp = e->tp - _clock_tp(), .is_set = true,
+        .is_intvl = true };
+
+    return timeout_ns(&d);
+}
+
+bool
+clock_timeout_expired(struct timeout *e)
+{
+    ASSERT(!e->is_intvl);
+
+    if (!e->is_set) {
+        return false;
+    }
+
+    return e->tp <= _clock_tp();
+}
+
+static void *
+_clock_ticker(void *arg)
+{
+    struct timespec ts;
+
+    (void)arg;
+
+    ts.tv_sec = ticker_us / 1000000;
+    ts.tv_nsec = (ticker_us % 1000000) * NS_PER_US;
+    while (!__atomic_load_n(&ticker_stop, __ATOMIC_RELAXED)) {
+        nanosleep(&ts, NULL);
+        clock_update();
+    }
+
+    return NULL;
+}
+
+static void
+_clock_ticker_stop(void)
+{
+    if (!ticker_running) {
+        return;
+    }
+
+    __atomic_store_n(&ticker_stop, true, __ATOMIC_RELAXED);
+    pthread_join(ticker, NULL);
+    ticker_running = false;
+}
+
+rstatus_i
+clock_setup(clock_options_st *options)
+{
+    int status;
+
+    log_info("set up the %s module", CLOCK_MODULE_NAME);
+
+    if (clock_init) {
+        log_warn("%s has already been setup, overwrite", CLOCK_MODULE_NAME);
+        _clock_ticker_stop();
+    }
+
+    ticker_us = CLOCK_TICKER_US;
+    if (options != NULL) {
+        ticker_us = option_uint(&options->clock_ticker_us);
+    }
+
+    clock_update();
+    __atomic_store_n(&clock_init, true, __ATOMIC_RELEASE);
+
+    if (ticker_us == 0) {
+        return CC_OK;
+    }
+
+    ticker_stop = false;
+    status = pthread_create(&ticker, NULL, _clock_ticker, NULL);
+    if (status != 0) {
+        log_error("create clock ticker failed: %s", strerror(status));
+        __atomic_store_n(&clock_init, false, __ATOMIC_RELEASE);
+
+        return CC_ERROR;
+    }
+    ticker_running = true;
+
+    return CC_OK;
+}
+
+void
+clock_teardown(void)
+{
+    log_info("tear down the %s module", CLOCK_MODULE_NAME);
+
+    if (!clock_init) {
+        log_warn("%s has never been setup", CLOCK_MODULE_NAME);
+    }
+
+    _clock_ticker_stop();
+    ticker_us = CLOCK_TICKER_US;
+
+    __atomic_store_n(&clock_init, false, __ATOMIC_RELEASE);
+}
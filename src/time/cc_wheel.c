@@ -3,37 +3,89 @@
 #include <cc_debug.h>
 #include <cc_metric.h>
 #include <cc_mm.h>
-#include <cc_pool.h>
 
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
 #define TIMING_WHEEL_MODULE_NAME "ccommon::timing_wheel"
 
+/*
+ * Events link to each other by index rather than by address, which, along with
+ * what is only needed while an event is queued sharing space with what is only
+ * needed while it is in the wheel, keeps an event at 72 bytes on 64-bit
+ * platforms (112 with pointer links).
+ */
+#define TEVENT_NIL UINT32_MAX   /* index of no event, ends a list */
+
 struct timeout_event {
     /* user provided */
     timeout_cb_fn               cb;     /* callback when timed out */
     void                        *data;  /* argument of the timeout callback */
-    bool                        recur;  /* will be reinserted upon firing */
     struct timeout              delay;  /* delay */
     /* the following is set internally */
-    size_t                      offset; /* bucket offset in the timing wheel */
+    union {
+        uint64_t                expire; /* tick the event is due at */
+        int64_t                 due;    /* when a queued insertion is due */
+        timeout_handle_i        target; /* event a queued cancel is for */
+    };
+    uint32_t                    idx;    /* index in the slabs */
+    uint32_t                    gen;    /* bumped each time it is returned */
+    uint32_t                    offset; /* bucket offset in the timing wheel */
+    uint32_t                    qnext;  /* next in the queue, or free list */
+    uint32_t                    next;   /* next in the bucket */
+    uint32_t                    prev;   /* previous in the bucket */
+    bool                        recur;  /* will be reinserted upon firing */
+    uint8_t                     qstate; /* see enum tev_qstate */
     bool                        free;   /* is this object free to reuse? */
-    TAILQ_ENTRY(timeout_event)  tqe;    /* entry in the wheel TAILQ */
-    STAILQ_ENTRY(timeout_event) next;   /* next timeout_event in pool */
 };
 
-STAILQ_HEAD(tevent_sqh, timeout_event); /* corresponding header type for the STAILQ */
-TAILQ_HEAD(tevent_tqh, timeout_event);  /* head type for timeout events */
+/* events in a bucket, in the order of insertion */
+struct tevent_tqh {
+    uint32_t                    first;
+    uint32_t                    last;
+};
+
+/* what a queued event stands for */
+enum tev_qstate {
+    TEV_QNONE,      /* not queued */
+    TEV_QINSERT,    /* insertion of the event itself */
+    TEV_QDROP,      /* insertion canceled before it was applied */
+    TEV_QCANCEL,    /* cancellation of the event at target */
+};
+
+/*
+ * Timeout events are carved out of slabs, which are only freed at teardown, so
+ * an event can be found by its index as well as its address. A handle pairs
+ * the index with the generation of the event, which is bumped every time the
+ * event is returned, so a handle outliving its event (e.g. one that has fired)
+ * is recognized as stale rather than referring to whatever reuses the slot.
+ * Events are borrowed by any thread inserting, but only returned by the thread
+ * owning the wheel, which is also the one looking up handles.
+ */
+#define TEVENT_SLAB_NBIT 10
+#define TEVENT_SLAB_SIZE (1U << TEVENT_SLAB_NBIT)   /* # events per slab */
+#define TEVENT_NSLAB     16384                      /* max # slabs */
 
-FREEPOOL(tevent_pool, teventq, timeout_event);
-static struct tevent_pool teventp;
-static bool teventp_init = false;
+static struct timeout_event **tevent_slab = NULL;
+static uint32_t tevent_nslab = 0;                   /* # slabs allocated */
+static uint32_t tevent_free = TEVENT_NIL;
+static pthread_mutex_t tevent_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static timing_wheel_metrics_st *timing_wheel_metrics = NULL;
 static bool timing_wheel_init = false;
 
 /* timeout_event related functions */
 
+static inline struct timeout_event *
+_tev(uint32_t idx)
+{
+    return &tevent_slab[idx >> TEVENT_SLAB_NBIT][idx & (TEVENT_SLAB_SIZE - 1)];
+}
+
 static void
 timeout_event_reset(struct timeout_event *t)
 {
@@ -41,50 +93,66 @@ timeout_event_reset(struct timeout_event *t)
 
     t->cb = NULL;
     t->data = NULL;
-    t->recur = false;
     timeout_reset(&t->delay);
+    t->expire = 0;
     t->offset = 0;
+    t->qnext = TEVENT_NIL;
+    t->next = TEVENT_NIL;
+    t->prev = TEVENT_NIL;
+    t->recur = false;
+    t->qstate = TEV_QNONE;
     t->free = false;
     /* queue-related members are set/cleared by timing wheel ops */
 }
 
-static struct timeout_event *
-timeout_event_create(void)
+/* add a slab of events to the free list, with tevent_lock held */
+static rstatus_i
+timeout_event_slab_add(void)
 {
-    struct timeout_event *t = (struct timeout_event *)cc_alloc(sizeof(*t));
-    if (t == NULL) {
-        log_info("timeout_event creation failed due to OOM");
+    struct timeout_event *slab, *t;
+    uint32_t i;
 
-        return NULL;
+    if (tevent_nslab == TEVENT_NSLAB) {
+        return CC_ENOMEM;
     }
 
-    timeout_event_reset(t);
-    INCR(timing_wheel_metrics, timeout_event_curr);
-    log_verb("created timeout_event %p", t);
+    slab = (struct timeout_event *)cc_alloc(TEVENT_SLAB_SIZE * sizeof(*slab));
+    if (slab == NULL) {
+        log_info("timeout_event slab creation failed due to OOM");
 
-    return t;
-}
+        return CC_ENOMEM;
+    }
 
-static void
-timeout_event_destroy(struct timeout_event **t)
-{
-    if (t == NULL || *t == NULL) {
-        return;
+    /* lower indices end up at the head of the free list */
+    for (i = TEVENT_SLAB_SIZE; i > 0; i--) {
+        t = &slab[i - 1];
+        t->idx = (tevent_nslab << TEVENT_SLAB_NBIT) + i - 1;
+        t->gen = 1;
+        t->free = true;
+        t->qnext = tevent_free;
+        tevent_free = t->idx;
     }
+    tevent_slab[tevent_nslab] = slab;
+    __atomic_store_n(&tevent_nslab, tevent_nslab + 1, __ATOMIC_RELEASE);
 
-    log_verb("destroy timeout_event %p", *t);
+    INCR_N(timing_wheel_metrics, timeout_event_curr, TEVENT_SLAB_SIZE);
+    log_verb("created timeout_event slab %p", slab);
 
-    cc_free(*t);
-    *t = NULL;
-    DECR(timing_wheel_metrics, timeout_event_curr);
+    return CC_OK;
 }
 
 static struct timeout_event *
 timeout_event_borrow(void)
 {
-    struct timeout_event *t;
+    struct timeout_event *t = NULL;
 
-    FREEPOOL_BORROW(t, &teventp, next, timeout_event_create);
+    pthread_mutex_lock(&tevent_lock);
+    if (tevent_slab != NULL &&
+            (tevent_free != TEVENT_NIL || timeout_event_slab_add() == CC_OK)) {
+        t = _tev(tevent_free);
+        tevent_free = t->qnext;
+    }
+    pthread_mutex_unlock(&tevent_lock);
 
     if (t == NULL) {
         log_debug("borrow timeout_event failed: OOM or over limit");
@@ -102,6 +170,15 @@ timeout_event_borrow(void)
     return t;
 }
 
+/* make the handles of t stale */
+static inline void
+_timeout_event_gen_bump(struct timeout_event *t)
+{
+    if (++t->gen == 0) { /* a handle is never 0 */
+        t->gen = 1;
+    }
+}
+
 static void
 timeout_event_return(struct timeout_event **t)
 {
@@ -111,53 +188,79 @@ timeout_event_return(struct timeout_event **t)
 
     log_verb("return timeout_event %p", *t);
 
+    pthread_mutex_lock(&tevent_lock);
+    _timeout_event_gen_bump(*t);
     (*t)->free = true;
-    FREEPOOL_RETURN(*t, &teventp, next);
+    (*t)->qnext = tevent_free;
+    tevent_free = (*t)->idx;
+    pthread_mutex_unlock(&tevent_lock);
     *t = NULL;
 
     INCR(timing_wheel_metrics, timeout_event_return);
     DECR(timing_wheel_metrics, timeout_event_active);
 }
 
-static void
-timeout_event_pool_create(uint32_t max)
+static struct timeout_event *
+timeout_event_get(timeout_handle_i h)
 {
+    uint32_t idx = (uint32_t)h;
     struct timeout_event *t;
 
-    if (teventp_init) {
-        log_warn("timeout_event pool has already been created, ignore");
-
-        return;
+    if ((idx >> TEVENT_SLAB_NBIT) >=
+            __atomic_load_n(&tevent_nslab, __ATOMIC_ACQUIRE)) {
+        return NULL;
     }
 
-    log_info("creating timeout_event pool: max %"PRIu32, max);
+    t = _tev(idx);
+
+    return (t->free || t->gen != (uint32_t)(h >> 32)) ? NULL : t;
+}
+
+timeout_handle_i
+timeout_event_handle(struct timeout_event *t)
+{
+    ASSERT(t != NULL && !t->free);
+
+    return ((uint64_t)t->gen << 32) | t->idx;
+}
 
-    FREEPOOL_CREATE(&teventp, max);
-    teventp_init = true;
+static void
+timeout_event_slab_create(void)
+{
+    if (tevent_slab != NULL) {
+        log_warn("timeout_event slabs have already been created, ignore");
 
-    /* preallocating, see notes in buffer/cc_buf.c */
-    FREEPOOL_PREALLOC(t, &teventp, max, next, timeout_event_create);
-    if (teventp.nfree < max) {
-        log_crit("cannot preallocate timeout_event pool due to OOM, abort");
+        return;
+    }
+
+    tevent_slab = (struct timeout_event **)cc_alloc(TEVENT_NSLAB *
+            sizeof(*tevent_slab));
+    if (tevent_slab == NULL) {
+        log_crit("cannot create timeout_event slabs due to OOM, abort");
         exit(EXIT_FAILURE);
     }
 }
 
 static void
-timeout_event_pool_destroy(void)
+timeout_event_slab_destroy(void)
 {
-    struct timeout_event *t, *tt;
+    uint32_t i;
 
-    if (!teventp_init) {
-        log_warn("timeout_event pool was never created, ignore");
+    if (tevent_slab == NULL) {
+        log_warn("timeout_event slabs were never created, ignore");
 
         return;
     }
 
-    log_info("destroying timeout_event pool: free %"PRIu32, teventp.nfree);
-
-    FREEPOOL_DESTROY(t, tt, &teventp, next, timeout_event_destroy);
-    teventp_init = false;
+    for (i = 0; i < tevent_nslab; i++) {
+        cc_free(tevent_slab[i]);
+    }
+    DECR_N(timing_wheel_metrics, timeout_event_curr,
+            (uint64_t)tevent_nslab * TEVENT_SLAB_SIZE);
+    cc_free(tevent_slab);
+    tevent_slab = NULL;
+    tevent_nslab = 0;
+    tevent_free = TEVENT_NIL;
 }
 
 
@@ -175,7 +278,7 @@ timing_wheel_setup(timing_wheel_metrics_st *metrics)
 
     timing_wheel_metrics = metrics;
 
-    timeout_event_pool_create(0); /* TODO(yao): add an option to set this */
+    timeout_event_slab_create();
 
     timing_wheel_init = true;
 }
@@ -189,20 +292,136 @@ timing_wheel_teardown(void)
         log_warn("%s has never been setup", TIMING_WHEEL_MODULE_NAME);
     }
 
-    timeout_event_pool_destroy();
+    timeout_event_slab_destroy();
     timing_wheel_metrics = NULL;
 
     timing_wheel_init = false;
 }
 
+static inline void
+_tq_init(struct tevent_tqh *head)
+{
+    head->first = TEVENT_NIL;
+    head->last = TEVENT_NIL;
+}
+
+static inline void
+_tq_insert_tail(struct tevent_tqh *head, struct timeout_event *t)
+{
+    t->next = TEVENT_NIL;
+    t->prev = head->last;
+    if (head->last == TEVENT_NIL) {
+        head->first = t->idx;
+    } else {
+        _tev(head->last)->next = t->idx;
+    }
+    head->last = t->idx;
+}
+
+static inline void
+_tq_remove(struct tevent_tqh *head, struct timeout_event *t)
+{
+    if (t->prev == TEVENT_NIL) {
+        head->first = t->next;
+    } else {
+        _tev(t->prev)->next = t->next;
+    }
+    if (t->next == TEVENT_NIL) {
+        head->last = t->prev;
+    } else {
+        _tev(t->next)->prev = t->prev;
+    }
+}
+
+/* # bitmap words per level */
+static inline size_t
+_nword(size_t cap)
+{
+    return (cap + 63) / 64;
+}
+
+/* occupied bits of table entry idx */
+static inline void
+_occupied_set(struct timing_wheel *tw, size_t idx)
+{
+    size_t bit = idx % tw->cap;
+
+    tw->occupied[idx / tw->cap * _nword(tw->cap) + bit / 64] |=
+        (uint64_t)1 << (bit % 64);
+}
+
+static inline void
+_occupied_update(struct timing_wheel *tw, size_t idx)
+{
+    size_t bit = idx % tw->cap;
+
+    if (tw->table[idx].first == TEVENT_NIL) {
+        tw->occupied[idx / tw->cap * _nword(tw->cap) + bit / 64] &=
+            ~((uint64_t)1 << (bit % 64));
+    }
+}
+
+/* distance from slot start to the first occupied slot of level, or cap */
+static size_t
+_occupied_next(struct timing_wheel *tw, size_t level, size_t start)
+{
+    uint64_t *map = tw->occupied + level * _nword(tw->cap);
+    uint64_t word;
+    size_t slot = start, end;
+
+    /* scan [start, cap), then wrap around to [0, start) */
+    for (end = tw->cap; ; end = start, slot = 0) {
+        while (slot < end) {
+            word = map[slot / 64] >> (slot % 64);
+            if (word != 0) {
+                slot += __builtin_ctzll(word);
+                if (slot >= end) {
+                    break;
+                }
+                return (slot + tw->cap - start) % tw->cap;
+            }
+            slot = (slot / 64 + 1) * 64;
+        }
+        if (end == start) {
+            return tw->cap;
+        }
+    }
+}
+
 struct timing_wheel *
 timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick)
 {
-    struct timing_wheel *tw = (struct timing_wheel *)cc_alloc(sizeof(*tw));
+    return timing_wheel_create_nlevel(tick, cap, 1, ntick);
+}
+
+struct timing_wheel *
+timing_wheel_create_nlevel(struct timeout *tick, size_t cap, size_t nlevel,
+        size_t ntick)
+{
+    struct timing_wheel *tw;
+    uint64_t span = 1;
+    size_t i;
 
     ASSERT(tick != NULL);
-    ASSERT(cap > 0);
+    ASSERT(cap > 0 && nlevel > 0);
 
+    for (i = 0; i < nlevel; i++) {
+        if (span > UINT64_MAX / cap / (uint64_t)timeout_ns(tick)) {
+            log_error("timing_wheel creation failed: %zu levels of %zu ticks "
+                    "overflow", nlevel, cap);
+
+            return NULL;
+        }
+        span *= cap;
+    }
+    if (cap * nlevel > TEVENT_NIL) {
+        log_error("timing_wheel creation failed: %zu levels of %zu ticks "
+                "are too many buckets", nlevel, cap);
+
+        return NULL;
+    }
+
+    tw = (struct timing_wheel *)cc_alloc(sizeof(*tw));
     if (tw == NULL) {
         log_error("timing_wheel creation failed due to OOM");
 
@@ -212,22 +431,36 @@ timing_wheel_create(struct timeout *tick, size_t cap, size_t ntick)
     tw->tick = *tick;
     tw->tick_ns = timeout_ns(tick);
     tw->cap = cap;
+    tw->nlevel = nlevel;
+    tw->span = span;
     tw->max_ntick = ntick; /* if ntick is 0, there's no limit */
     tw->active = false;
     timeout_reset(&tw->due);
     tw->curr = 0;
     tw->nevent = 0;
+    tw->queue = TEVENT_NIL;
 
-    tw->table = (struct tevent_tqh *)cc_alloc(cap * sizeof(struct tevent_tqh));
+    tw->table = (struct tevent_tqh *)cc_alloc(cap * nlevel *
+            sizeof(struct tevent_tqh));
     if (tw->table == NULL) {
         log_error("timing_wheel creation failed due to table allocation OOM");
         cc_free(tw);
 
         return NULL;
     }
-    for (size_t i = 0; i < cap; i++) {
-        TAILQ_INIT(&tw->table[i]);
+    for (i = 0; i < cap * nlevel; i++) {
+        _tq_init(&tw->table[i]);
+    }
+    tw->occupied = (uint64_t *)cc_alloc(_nword(cap) * nlevel *
+            sizeof(uint64_t));
+    if (tw->occupied == NULL) {
+        log_error("timing_wheel creation failed due to bitmap allocation OOM");
+        cc_free(tw->table);
+        cc_free(tw);
+
+        return NULL;
     }
+    memset(tw->occupied, 0, _nword(cap) * nlevel * sizeof(uint64_t));
 
     tw->nprocess = 0;
     tw->ntick = 0;
@@ -245,6 +478,7 @@ timing_wheel_destroy(struct timing_wheel **tw)
 
     log_info("destroying timing_wheel %p", w);
 
+    cc_free(w->occupied);
     cc_free(w->table);
     cc_free(w);
 
@@ -258,6 +492,29 @@ _offset(struct timing_wheel *tw, struct timeout *delay) {
     return (delay_ns == 0) ? 0 : (delay_ns - 1) / tw->tick_ns + 1;
 }
 
+/**
+ * An event due in d ticks goes to the lowest level whose rotation covers d,
+ * into the slot of that level which is current when it is due. Level k slots
+ * are cascaded (moved down) as the tick count reaches a multiple of cap^k,
+ * which is when the events in the slot have less than cap^k ticks to go. So
+ * an event is never due before its slot on level 0 is processed.
+ */
+static uint32_t
+_slot(struct timing_wheel *tw, uint64_t expire)
+{
+    uint64_t d = expire - tw->ntick;
+    uint64_t span = 1;
+    size_t level = 0;
+
+    while (d / span >= tw->cap) {
+        span *= tw->cap;
+        level++;
+    }
+    ASSERT(level < tw->nlevel);
+
+    return (uint32_t)(level * tw->cap + (expire / span) % tw->cap);
+}
+
 /**
  * Since timing wheel is discrete, the events are bucket'ed approximately.
  * Here we treat ms == 0 as a special case and add event to the current slot,
@@ -266,16 +523,18 @@ _offset(struct timing_wheel *tw, struct timeout *delay) {
 static void
 _timing_wheel_insert(struct timing_wheel *tw, struct timeout_event *tev)
 {
-    TAILQ_INSERT_TAIL(&tw->table[tev->offset], tev, tqe);
+    _tq_insert_tail(&tw->table[tev->offset], tev);
+    _occupied_set(tw, tev->offset);
     tw->nevent++;
 
     INCR(timing_wheel_metrics, timing_wheel_insert);
     INCR(timing_wheel_metrics, timing_wheel_event);
 }
 
-struct timeout_event *
-timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
-                    timeout_cb_fn cb, void *arg)
+/* borrow an event for delay, only reading what is fixed at wheel creation */
+static struct timeout_event *
+_timeout_event_prepare(struct timing_wheel *tw, struct timeout *delay,
+        bool recur, timeout_cb_fn cb, void *arg)
 {
     struct timeout_event *tev;
     size_t offset;
@@ -294,10 +553,10 @@ timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
     tev->delay = *delay;
 
     offset = _offset(tw, delay);
-    if (offset >= tw->cap) { /* wraps around */
+    if (offset >= tw->span) { /* wraps around */
         log_error("insert timeout event into timing wheel failed: timeout "
                 "%"PRIi64"ns too long for wheel capacity %"PRIu64"ns",
-                timeout_ns(delay), tw->tick_ns * tw->cap);
+                timeout_ns(delay), tw->tick_ns * tw->span);
         goto error;
     }
     if (recur && offset == 0) {
@@ -306,11 +565,6 @@ timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
         goto error;
     }
 
-    tev->offset = (tw->curr + offset) % tw->cap; /* convert to absolute offset */
-    log_verb("inserting timeout event %p into timing wheel %p: curr tick %zu, "
-            "scheduled offset %zu", tev, tw, tw->curr, tev->offset);
-    _timing_wheel_insert(tw, tev);
-
     return tev;
 
 error:
@@ -319,12 +573,35 @@ error:
     return NULL;
 }
 
+struct timeout_event *
+timing_wheel_insert(struct timing_wheel *tw, struct timeout *delay, bool recur,
+                    timeout_cb_fn cb, void *arg)
+{
+    struct timeout_event *tev;
+    size_t offset;
+
+    tev = _timeout_event_prepare(tw, delay, recur, cb, arg);
+    if (tev == NULL) {
+        return NULL;
+    }
+
+    offset = _offset(tw, delay);
+    tev->expire = tw->ntick + offset;
+    tev->offset = _slot(tw, tev->expire); /* convert to absolute offset */
+    log_verb("inserting timeout event %p into timing wheel %p: curr tick %zu, "
+            "scheduled offset %"PRIu32, tev, tw, tw->curr, tev->offset);
+    _timing_wheel_insert(tw, tev);
+
+    return tev;
+}
+
 static void
 _timing_wheel_remove(struct timing_wheel *tw, struct timeout_event *tev)
 {
     ASSERT(tw != NULL && tev != NULL);
 
-    TAILQ_REMOVE(&tw->table[tev->offset], tev, tqe);
+    _tq_remove(&tw->table[tev->offset], tev);
+    _occupied_update(tw, tev->offset);
     tw->nevent--;
 
     INCR(timing_wheel_metrics, timing_wheel_remove);
@@ -336,12 +613,166 @@ timing_wheel_remove(struct timing_wheel *tw, struct timeout_event **tev)
 {
     /* consider the timeout event canceled if removed externally, and recycle */
     log_verb("removing timeout event %p from timing wheel %p: curr tick %zu, "
-            "scheduled offset %zu", *tev, tw, tw->curr, (*tev)->offset);
+            "scheduled offset %"PRIu32, *tev, tw, tw->curr, (*tev)->offset);
 
     _timing_wheel_remove(tw, *tev);
     timeout_event_return(tev);
 }
 
+static void
+_timing_wheel_push(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    uint32_t head = __atomic_load_n(&tw->queue, __ATOMIC_RELAXED);
+
+    do {
+        tev->qnext = head;
+    } while (!__atomic_compare_exchange_n(&tw->queue, &head, tev->idx, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    INCR(timing_wheel_metrics, timing_wheel_queue);
+}
+
+timeout_handle_i
+timing_wheel_insert_async(struct timing_wheel *tw, struct timeout *delay,
+        bool recur, timeout_cb_fn cb, void *arg)
+{
+    struct timeout_event *tev;
+    struct timeout due;
+    timeout_handle_i h;
+
+    tev = _timeout_event_prepare(tw, delay, recur, cb, arg);
+    if (tev == NULL) {
+        return TIMEOUT_HANDLE_INVALID;
+    }
+
+    /* the delay runs from now rather than from when the queue is drained */
+    timeout_add_intvl(&due, delay);
+    tev->due = due.tp;
+    __atomic_store_n(&tev->qstate, TEV_QINSERT, __ATOMIC_RELAXED);
+    /* once pushed, the event may fire and be reused before we get to it */
+    h = timeout_event_handle(tev);
+    log_verb("queueing insertion of timeout event %p into timing wheel %p",
+            tev, tw);
+    _timing_wheel_push(tw, tev);
+
+    return h;
+}
+
+rstatus_i
+timing_wheel_cancel_async(struct timing_wheel *tw, timeout_handle_i h)
+{
+    struct timeout_event *tev;
+
+    /* the event may be gone any time, so the request goes in a record of its own */
+    tev = timeout_event_borrow();
+    if (tev == NULL) {
+        log_error("cannot queue cancellation of timeout event due to OOM");
+
+        return CC_ENOMEM;
+    }
+
+    tev->target = h;
+    __atomic_store_n(&tev->qstate, TEV_QCANCEL, __ATOMIC_RELAXED);
+    log_verb("queueing cancellation of timeout event %#"PRIx64" in timing "
+            "wheel %p", h, tw);
+    _timing_wheel_push(tw, tev);
+
+    return CC_OK;
+}
+
+static void
+_timing_wheel_cancel(struct timing_wheel *tw, struct timeout_event *tev)
+{
+    /*
+     * an insertion still queued is dropped when the queue is drained, its
+     * handle goes stale right away so it isn't canceled twice
+     */
+    if (__atomic_load_n(&tev->qstate, __ATOMIC_RELAXED) == TEV_QINSERT) {
+        __atomic_store_n(&tev->qstate, TEV_QDROP, __ATOMIC_RELAXED);
+        _timeout_event_gen_bump(tev);
+
+        return;
+    }
+
+    timing_wheel_remove(tw, &tev);
+}
+
+bool
+timing_wheel_cancel(struct timing_wheel *tw, timeout_handle_i h)
+{
+    struct timeout_event *tev = timeout_event_get(h);
+
+    if (tev == NULL) {
+        log_verb("timeout event %#"PRIx64" has fired or been canceled", h);
+
+        return false;
+    }
+
+    _timing_wheel_cancel(tw, tev);
+
+    return true;
+}
+
+/* apply the operations queued by other threads, in the order they came in */
+static void
+_timing_wheel_drain(struct timing_wheel *tw)
+{
+    struct timeout_event *t, *target;
+    struct timeout delay, due;
+    uint32_t i, next, fifo = TEVENT_NIL;
+    int64_t ns;
+    size_t offset;
+
+    if (__atomic_load_n(&tw->queue, __ATOMIC_RELAXED) == TEVENT_NIL) {
+        return;
+    }
+
+    i = __atomic_exchange_n(&tw->queue, TEVENT_NIL, __ATOMIC_ACQUIRE);
+    for (; i != TEVENT_NIL; i = next) {
+        t = _tev(i);
+        next = t->qnext;
+        t->qnext = fifo;
+        fifo = i;
+    }
+
+    for (i = fifo; i != TEVENT_NIL; i = next) {
+        t = _tev(i);
+        next = t->qnext;
+        INCR(timing_wheel_metrics, timing_wheel_apply);
+
+        switch (t->qstate) {
+        case TEV_QINSERT:
+            t->qstate = TEV_QNONE;
+            due = (struct timeout){ .tp = t->due, .is_set = true,
+                .is_intvl = false };
+            ns = timeout_ns(&due);
+            timeout_set_ns(&delay, MAX(ns, 0));
+            offset = _offset(tw, &delay);
+            if (t->recur && offset == 0) {
+                offset = 1;
+            }
+            t->expire = tw->ntick + offset;
+            t->offset = _slot(tw, t->expire);
+            _timing_wheel_insert(tw, t);
+            break;
+
+        case TEV_QCANCEL:
+            target = timeout_event_get(t->target);
+            if (target != NULL) {
+                _timing_wheel_cancel(tw, target);
+            }
+            timeout_event_return(&t);
+            break;
+
+        default:
+            ASSERT(t->qstate == TEV_QDROP);
+
+            timeout_event_return(&t);
+            break;
+        }
+    }
+}
+
 void
 timing_wheel_start(struct timing_wheel *tw)
 {
@@ -370,6 +801,35 @@ timing_wheel_stop(struct timing_wheel *tw)
     timeout_reset(&tw->due);
 }
 
+/* move events down from the higher level slots that are now current */
+static inline void
+_cascade(struct timing_wheel *tw)
+{
+    struct timeout_event *t;
+    struct tevent_tqh *head;
+    uint64_t span = tw->cap;
+    uint32_t i, next;
+    size_t level;
+
+    size_t idx;
+
+    for (level = 1; level < tw->nlevel && tw->ntick % span == 0; level++) {
+        idx = level * tw->cap + (tw->ntick / span) % tw->cap;
+        head = &tw->table[idx];
+        for (i = head->first; i != TEVENT_NIL; i = next) {
+            t = _tev(i);
+            next = t->next;
+            _tq_remove(head, t);
+            t->offset = _slot(tw, t->expire);
+            _tq_insert_tail(&tw->table[t->offset], t);
+            _occupied_set(tw, t->offset);
+            INCR(timing_wheel_metrics, timing_wheel_cascade);
+        }
+        _occupied_update(tw, idx);
+        span *= tw->cap;
+    }
+}
+
 static inline void
 _advance_curr(struct timing_wheel *tw)
 {
@@ -381,38 +841,59 @@ _advance_curr(struct timing_wheel *tw)
 
     tw->ntick++;
     INCR(timing_wheel_metrics, timing_wheel_tick);
+
+    _cascade(tw);
 }
 
 static inline void
-_process_tick(struct timing_wheel *tw, bool endmode)
+_process_slot(struct timing_wheel *tw, size_t idx, bool endmode)
 {
-    struct timeout_event *t, *tt;
+    struct timeout_event *t;
     uint64_t nprocess = tw->nprocess;
+    timeout_cb_fn cb;
+    void *data;
+    uint32_t i, next;
 
-    TAILQ_FOREACH_SAFE(t, &tw->table[tw->curr], tqe, tt) {
+    for (i = tw->table[idx].first; i != TEVENT_NIL; i = next) {
+        t = _tev(i);
+        next = t->next;
         tw->nprocess++;
         INCR(timing_wheel_metrics, timing_wheel_process);
 
         log_vverb("(internal) removing timeout event %p from timing wheel %p: "
                 "curr tick %zu", t, tw, tw->curr);
         _timing_wheel_remove(tw, t);
-        /* allowing t->cb to be NULL makes it easier to test/benchmark */
-        if (t->cb != NULL) {
-            t->cb(t->data);
-        }
+        /*
+         * settle the event before the callback, so that by the time it runs
+         * the handle of a one-off event is stale and that of a recurring one
+         * refers to its next occurrence, either can be canceled safely
+         */
+        cb = t->cb;
+        data = t->data;
         if (!endmode && t->recur) {
             /* re-calculate offset & insert if recurring and not ending */
-            t->offset = (tw->curr + _offset(tw, &t->delay)) % tw->cap;
+            t->expire = tw->ntick + _offset(tw, &t->delay);
+            t->offset = _slot(tw, t->expire);
             log_vverb("(internal) inserting timeout event %p into timing wheel "
-                    "%p: scheduled offset %zu", t, tw, t->offset);
+                    "%p: scheduled offset %"PRIu32, t, tw, t->offset);
             _timing_wheel_insert(tw, t);
         } else {
             timeout_event_return(&t);
         }
+        /* allowing cb to be NULL makes it easier to test/benchmark */
+        if (cb != NULL) {
+            cb(data);
+        }
     }
 
-    log_vverb("processed %"PRIu64" timeout events during tick %zu of timing "
-            "wheel %p", tw->nprocess - nprocess, tw->curr, tw);
+    log_vverb("processed %"PRIu64" timeout events in slot %zu of timing "
+            "wheel %p", tw->nprocess - nprocess, idx, tw);
+}
+
+static inline void
+_process_tick(struct timing_wheel *tw, bool endmode)
+{
+    _process_slot(tw, tw->curr, endmode);
 }
 
 static inline bool
@@ -442,6 +923,8 @@ timing_wheel_execute(struct timing_wheel *tw)
      * dictated by the wheel, and user can choose any mechanism to advance the
      * clock, e.g. nanosleep, select, epoll_wait/kqueue...
      */
+    _timing_wheel_drain(tw);
+
     while (_tick_allowed(tw, ntick) && timeout_expired(&tw->due)) {
         struct duration d;
         struct timeout to;
@@ -469,6 +952,74 @@ timing_wheel_execute(struct timing_wheel *tw)
     INCR(timing_wheel_metrics, timing_wheel_exec);
 }
 
+int64_t
+timing_wheel_next_ns(struct timing_wheel *tw)
+{
+    uint64_t span = tw->cap, d, ntick = UINT64_MAX;
+    size_t level, dist;
+    int64_t ns;
+
+    ASSERT(tw != NULL);
+
+    if (!tw->active) {
+        return -1;
+    }
+    if (__atomic_load_n(&tw->queue, __ATOMIC_RELAXED) != TEVENT_NIL) {
+        return 0; /* queued operations are applied by the next execution */
+    }
+
+    /* the current tick is processed when due, each one after a tick later */
+    dist = _occupied_next(tw, 0, tw->curr);
+    if (dist < tw->cap) {
+        ntick = dist;
+    }
+
+    /*
+     * higher levels are cascaded on the tick a slot becomes current, right
+     * after processing the tick before; an occupied current slot is a full
+     * rotation away
+     */
+    for (level = 1; level < tw->nlevel; level++, span *= tw->cap) {
+        dist = _occupied_next(tw, level, (tw->ntick / span + 1) % tw->cap);
+        if (dist < tw->cap) {
+            d = (tw->ntick / span + dist + 1) * span - 1 - tw->ntick;
+            ntick = MIN(ntick, d);
+        }
+    }
+
+    if (ntick == UINT64_MAX) {
+        return -1;
+    }
+
+    ns = timeout_ns(&tw->due) + (int64_t)(ntick * tw->tick_ns);
+
+    return MAX(ns, 0);
+}
+
+int
+timing_wheel_event_wait(struct timing_wheel *tw, struct event_base *evb,
+        int timeout)
+{
+    int64_t ns;
+    int n;
+
+    ASSERT(tw != NULL && evb != NULL);
+
+    ns = timing_wheel_next_ns(tw);
+    if (ns >= 0) {
+        /* round up, waking up before the tick is due does nothing */
+        ns = (ns + 999999) / 1000000;
+        if (timeout < 0 || ns < timeout) {
+            timeout = (int)MIN(ns, INT_MAX);
+        }
+    }
+
+    n = event_wait(evb, timeout);
+    timing_wheel_execute(tw);
+
+    return n;
+}
+
 void
 timing_wheel_flush(struct timing_wheel *tw)
 {
@@ -478,6 +1029,12 @@ timing_wheel_flush(struct timing_wheel *tw)
 
     log_info("flushing all remaining ticks in timing wheel %p", tw);
 
+    _timing_wheel_drain(tw);
+
+    /* events further out than a rotation of the lowest level go first */
+    for (size_t idx = tw->cap; idx < tw->cap * tw->nlevel; idx++) {
+        _process_slot(tw, idx, true);
+    }
     do {
         _process_tick(tw, true);
         _advance_curr(tw);
@@ -1,4 +1,5 @@
 #include <cc_array.h>
+#include <cc_mm.h>
 
 #include <check.h>
 
@@ -160,6 +161,42 @@ START_TEST(test_sort)
 }
 END_TEST
 
+START_TEST(test_arena)
+{
+#define SIZE 8
+#define NELEM 2
+#define NPUSH 20
+    struct arena *arena;
+    struct array *arr;
+    uint32_t i;
+    uint64_t *el;
+
+    test_reset();
+
+    arena = arena_create(0);
+    ck_assert_ptr_ne(arena, NULL);
+    ck_assert_int_eq(array_create_arena(&arr, NELEM, SIZE, arena), CC_OK);
+
+    /* expansion copies into new arena space */
+    for (i = 0; i < NPUSH; i++) {
+        el = array_push(arr);
+        ck_assert_ptr_ne(el, NULL);
+        *el = i;
+    }
+    ck_assert_uint_ge(array_nalloc(arr), NPUSH);
+    for (i = 0; i < NPUSH; i++) {
+        ck_assert_int_eq(*(uint64_t *)array_get(arr, i), i);
+    }
+
+    array_destroy(&arr);
+    ck_assert_ptr_eq(arr, NULL);
+    arena_destroy(&arena);
+#undef NPUSH
+#undef NELEM
+#undef SIZE
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -177,6 +214,7 @@ array_suite(void)
     tcase_add_test(tc_array, test_expand_max);
     tcase_add_test(tc_array, test_each);
     tcase_add_test(tc_array, test_sort);
+    tcase_add_test(tc_array, test_arena);
 
     return s;
 }
@@ -1,4 +1,5 @@
 #include <cc_bstring.h>
+#include <cc_mm.h>
 
 #include <check.h>
 
@@ -204,6 +205,30 @@ START_TEST(test_bstring_alloc_and_free)
 }
 END_TEST
 
+START_TEST(test_bstring_alloc_arena)
+{
+#define BSTRING_SIZE 9000
+    struct arena *arena;
+    struct bstring *bs;
+
+    arena = arena_create(0);
+    ck_assert_ptr_ne(arena, NULL);
+
+    bs = bstring_alloc_arena(BSTRING_SIZE, arena);
+    ck_assert_ptr_ne(bs, NULL);
+    ck_assert_uint_eq(bs->len, BSTRING_SIZE);
+    for (int i = 0; i < BSTRING_SIZE; i++) {
+        bs->data[i] = 'a';
+    }
+
+    /* released with the arena, not with bstring_free */
+    arena_reset(arena);
+    arena_destroy(&arena);
+    ck_assert_ptr_null(arena);
+#undef BSTRING_SIZE
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -223,6 +248,7 @@ bstring_suite(void)
     tcase_add_test(tc_bstring, test_atoi64);
     tcase_add_test(tc_bstring, test_atou64);
     tcase_add_test(tc_bstring, test_bstring_alloc_and_free);
+    tcase_add_test(tc_bstring, test_bstring_alloc_arena);
 
     return s;
 }
@@ -1,10 +1,16 @@
+#include <buffer/cc_bchain.h>
 #include <buffer/cc_buf.h>
 #include <buffer/cc_dbuf.h>
 
+#include <cc_array.h>
 #include <cc_bstring.h>
 
 #include <check.h>
 
+#include <pthread.h>
+#include <string.h>
+#include <sys/uio.h>
+
 #define SUITE_NAME "buffer"
 #define DEBUG_LOG  SUITE_NAME ".log"
 
@@ -12,12 +18,15 @@
 #define TEST_BUF_SIZE      (TEST_BUF_CAP + BUF_HDR_SIZE)
 #define TEST_BUF_POOLSIZE                              0
 #define TEST_DBUF_MAX                                  2
+#define TEST_BCHAIN_MAX                                4
 
 static buf_metrics_st bmetrics;
 static dbuf_metrics_st dmetrics;
+static bchain_metrics_st cmetrics;
 
 static buf_options_st boptions;
 static dbuf_options_st doptions;
+static bchain_options_st coptions;
 
 /*
  * utilities
@@ -27,6 +36,7 @@ test_setup(void)
 {
     bmetrics = (buf_metrics_st) { BUF_METRIC(METRIC_INIT) };
     dmetrics = (dbuf_metrics_st) { DBUF_METRIC(METRIC_INIT) };
+    cmetrics = (bchain_metrics_st) { BCHAIN_METRIC(METRIC_INIT) };
 
     boptions  = (buf_options_st){
         .buf_init_size = {
@@ -47,8 +57,16 @@ test_setup(void)
             .val.vuint = TEST_DBUF_MAX,
         }};
 
+    coptions = (bchain_options_st){
+        .bchain_max_nbuf = {
+            .set = true,
+            .type = OPTION_TYPE_UINT,
+            .val.vuint = TEST_BCHAIN_MAX,
+        }};
+
     buf_setup(&boptions, &bmetrics);
     dbuf_setup(&doptions, &dmetrics);
+    bchain_setup(&coptions, &cmetrics);
 }
 
 static void
@@ -56,6 +74,7 @@ test_teardown(void)
 {
     buf_teardown();
     dbuf_teardown();
+    bchain_teardown();
 }
 
 static void
@@ -68,6 +87,16 @@ test_reset(void)
 /*
  * tests
  */
+static void *
+_tcache_thread(void *arg)
+{
+    struct buf *buf = buf_borrow();
+
+    buf_return(&buf);
+
+    return arg;
+}
+
 START_TEST(test_create_write_read_destroy_basic)
 {
 #define MSG "Hello World"
@@ -245,6 +274,63 @@ START_TEST(test_rshift)
 }
 END_TEST
 
+START_TEST(test_tcache)
+{
+#define NBUF 8
+#define HIGH 4
+#define LOW  2
+    struct buf *buf[NBUF];
+    pthread_t thread;
+    int i;
+
+    test_teardown();
+    boptions.buf_tcache_high = (struct option){
+        .set = true, .type = OPTION_TYPE_UINT, .val.vuint = HIGH};
+    boptions.buf_tcache_low = (struct option){
+        .set = true, .type = OPTION_TYPE_UINT, .val.vuint = LOW};
+    bmetrics = (buf_metrics_st) { BUF_METRIC(METRIC_INIT) };
+    buf_setup(&boptions, &bmetrics);
+    dbuf_setup(&doptions, &dmetrics);
+    bchain_setup(&coptions, &cmetrics);
+
+    for (i = 0; i < NBUF; i++) {
+        buf[i] = buf_borrow();
+        ck_assert_ptr_ne(buf[i], NULL);
+    }
+    ck_assert_int_eq(bmetrics.buf_create.counter, NBUF);
+
+    /* cache goes over HIGH on the 5th and 8th return, back to LOW each time */
+    for (i = 0; i < NBUF; i++) {
+        buf_return(&buf[i]);
+    }
+    ck_assert_int_eq(bmetrics.buf_pool_spill.counter, 2);
+    ck_assert_int_eq(bmetrics.buf_pool_refill.counter, 0);
+
+    /* LOW bufs from the cache, then a refill from the shared pool */
+    for (i = 0; i < LOW + 1; i++) {
+        buf[i] = buf_borrow();
+        ck_assert_ptr_ne(buf[i], NULL);
+    }
+    ck_assert_int_eq(bmetrics.buf_pool_refill.counter, 1);
+    ck_assert_int_eq(bmetrics.buf_create.counter, NBUF);
+    for (i = 0; i < LOW + 1; i++) {
+        buf_return(&buf[i]);
+    }
+
+    /* another thread reuses bufs, and spills its cache when it exits */
+    ck_assert_int_eq(pthread_create(&thread, NULL, _tcache_thread, NULL), 0);
+    ck_assert_int_eq(pthread_join(thread, NULL), 0);
+    ck_assert_int_eq(bmetrics.buf_create.counter, NBUF);
+    ck_assert_int_eq(bmetrics.buf_pool_spill.counter, 3);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+
+    test_reset();
+#undef NBUF
+#undef HIGH
+#undef LOW
+}
+END_TEST
+
 START_TEST(test_dbuf_double_basic)
 {
 #define EXPECTED_BUF_SIZE                (TEST_BUF_SIZE * 2)
@@ -380,6 +466,111 @@ START_TEST(test_dbuf_shrink)
 }
 END_TEST
 
+START_TEST(test_bchain_write_read)
+{
+#define LEN (TEST_BUF_CAP * TEST_BCHAIN_MAX)
+    struct bchain chain;
+    char src[LEN + 1], dst[LEN];
+    int i;
+
+    test_reset();
+
+    for (i = 0; i < LEN + 1; i++) {
+        src[i] = 'a' + i % 26;
+    }
+
+    bchain_init(&chain);
+    ck_assert_uint_eq(bchain_rsize(&chain), 0);
+
+    /* writes span bufs until the chain is at its max */
+    ck_assert_uint_eq(bchain_write(&chain, src, 10), 10);
+    ck_assert_uint_eq(bchain_write(&chain, src + 10, LEN + 1 - 10), LEN - 10);
+    ck_assert_uint_eq(bchain_rsize(&chain), LEN);
+    ck_assert_uint_eq(chain.nbuf, TEST_BCHAIN_MAX);
+    ck_assert_int_eq(cmetrics.bchain_grow.counter, TEST_BCHAIN_MAX);
+    ck_assert_int_eq(cmetrics.bchain_grow_ex.counter, 1);
+
+    /* peek leaves data in place, reads across a buf boundary release it */
+    ck_assert_uint_eq(bchain_peek(dst, &chain, LEN), LEN);
+    ck_assert_int_eq(memcmp(dst, src, LEN), 0);
+    ck_assert_uint_eq(bchain_read(dst, &chain, TEST_BUF_CAP + 1),
+            TEST_BUF_CAP + 1);
+    ck_assert_int_eq(memcmp(dst, src, TEST_BUF_CAP + 1), 0);
+    ck_assert_uint_eq(chain.nbuf, TEST_BCHAIN_MAX - 1);
+    ck_assert_int_eq(cmetrics.bchain_shrink.counter, 1);
+
+    /* room is available again at the end */
+    ck_assert_uint_eq(bchain_write(&chain, src, TEST_BUF_CAP), TEST_BUF_CAP);
+    ck_assert_uint_eq(bchain_read(dst, &chain, LEN), LEN - 1);
+    ck_assert_int_eq(memcmp(dst, src + TEST_BUF_CAP + 1,
+            LEN - TEST_BUF_CAP - 1), 0);
+    ck_assert_int_eq(memcmp(dst + LEN - TEST_BUF_CAP - 1, src, TEST_BUF_CAP), 0);
+    ck_assert_uint_eq(bchain_rsize(&chain), 0);
+    ck_assert_uint_le(chain.nbuf, 1);
+
+    bchain_deinit(&chain);
+    ck_assert_uint_eq(chain.nbuf, 0);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef LEN
+}
+END_TEST
+
+START_TEST(test_bchain_iov)
+{
+#define NIOV 8
+#define MSG "this message is longer than a single buf in the test"
+    struct bchain chain;
+    struct array *iov;
+    struct iovec *v;
+    char dst[sizeof(MSG)];
+    size_t n, len = sizeof(MSG);
+    uint32_t i;
+
+    test_reset();
+
+    ck_assert_int_eq(array_create(&iov, NIOV, sizeof(struct iovec)), CC_OK);
+    bchain_init(&chain);
+
+    /* room for a receive grows the chain, fill it as readv would */
+    n = bchain_wiov(&chain, iov, len);
+    ck_assert_uint_ge(n, len);
+    ck_assert_uint_eq(array_nelem(iov), 2);
+    n = 0;
+    for (i = 0; i < array_nelem(iov); i++) {
+        v = array_get(iov, i);
+        memcpy(v->iov_base, MSG + n, MIN(v->iov_len, len - n));
+        n += MIN(v->iov_len, len - n);
+    }
+    bchain_commit(&chain, len);
+    ck_assert_uint_eq(bchain_rsize(&chain), len);
+    ck_assert_uint_eq(bchain_peek(dst, &chain, len), len);
+    ck_assert_str_eq(dst, MSG);
+
+    /* data for a send, partially consumed as after a short writev */
+    iov->nelem = 0;
+    ck_assert_uint_eq(bchain_riov(&chain, iov), len);
+    ck_assert_uint_eq(array_nelem(iov), 2);
+    bchain_consume(&chain, TEST_BUF_CAP);
+    iov->nelem = 0;
+    ck_assert_uint_eq(bchain_riov(&chain, iov), len - TEST_BUF_CAP);
+    ck_assert_uint_eq(array_nelem(iov), 1);
+    v = array_first(iov);
+    ck_assert_int_eq(memcmp(v->iov_base, MSG + TEST_BUF_CAP,
+            len - TEST_BUF_CAP), 0);
+
+    /* an iov array that is full takes nothing */
+    ck_assert_uint_eq(bchain_riov(&chain, iov), len - TEST_BUF_CAP);
+    iov->nelem = NIOV;
+    ck_assert_uint_eq(bchain_riov(&chain, iov), 0);
+
+    bchain_deinit(&chain);
+    array_destroy(&iov);
+    ck_assert_int_eq(bmetrics.buf_active.gauge, 0);
+#undef NIOV
+#undef MSG
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -395,6 +586,7 @@ buf_suite(void)
     tcase_add_test(tc_buf, test_create_write_read_destroy_long);
     tcase_add_test(tc_buf, test_lshift);
     tcase_add_test(tc_buf, test_rshift);
+    tcase_add_test(tc_buf, test_tcache);
 
     TCase *tc_dbuf = tcase_create("dbuf test");
     suite_add_tcase(s, tc_dbuf);
@@ -404,6 +596,12 @@ buf_suite(void)
     tcase_add_test(tc_dbuf, test_dbuf_fit);
     tcase_add_test(tc_dbuf, test_dbuf_shrink);
 
+    TCase *tc_bchain = tcase_create("bchain test");
+    suite_add_tcase(s, tc_bchain);
+
+    tcase_add_test(tc_bchain, test_bchain_write_read);
+    tcase_add_test(tc_bchain, test_bchain_iov);
+
     return s;
 }
 
@@ -1,9 +1,17 @@
+#include <buffer/cc_buf.h>
+#include <buffer/cc_dbuf.h>
 #include <channel/cc_tcp.h>
+#include <channel/cc_tcp_info.h>
+#include <stream/cc_sockio.h>
+#include <time/cc_clock.h>
 #include <time/cc_timer.h>
+#include <time/cc_wheel.h>
 
 #include <check.h>
 
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -273,6 +281,583 @@ START_TEST(test_client_sendv_server_recvv)
 }
 END_TEST
 
+static void
+_count_release(void *arg)
+{
+    (*(int *)arg)++;
+}
+
+START_TEST(test_buf_sock_writev)
+{
+#define HDR "VALUE "
+#define PAYLOAD "payload owned by someone else"
+#define TAIL "\r\n"
+#define END "END\r\n"
+#define MSG HDR PAYLOAD TAIL END
+#define LEN (sizeof(MSG) - 1)
+    struct tcp_conn *conn_listen, *conn_server;
+    struct addrinfo *ai;
+    struct buf_sock *s;
+    struct buf *buf;
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    char recv_data[LEN + 1];
+    int released = 0;
+    ssize_t recv;
+    uint32_t i;
+
+    buf_setup(NULL, NULL);
+    sockio_setup(NULL, &metrics);
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    s = buf_sock_create();
+    ck_assert_ptr_ne(s, NULL);
+    ck_assert_int_eq(tcp_connect(ai, s->ch), true);
+
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    ck_assert_int_eq(buf_tcp_writev(s), CC_EEMPTY);
+
+    /* wbuf data, borrowed memory and bufs go out in order, without copying */
+    buf_write(s->wbuf, HDR, sizeof(HDR) - 1);
+    ck_assert_int_eq(buf_sock_queue_ref(s, PAYLOAD, sizeof(PAYLOAD) - 1,
+            _count_release, &released), CC_OK);
+    buf = buf_borrow();
+    buf_write(buf, TAIL, sizeof(TAIL) - 1);
+    ck_assert_int_eq(buf_sock_queue_buf(s, buf), CC_OK);
+    buf_write(s->wbuf, END, sizeof(END) - 1);
+    ck_assert_int_eq(released, 0);
+
+    ck_assert_int_eq(buf_tcp_writev(s), CC_OK);
+    ck_assert_int_eq(metrics.buf_sock_writev.counter, 1);
+    ck_assert_int_eq(released, 1);
+    ck_assert_int_eq(buf_rsize(s->wbuf), 0);
+    while ((recv = tcp_recv(conn_server, recv_data, LEN + 1)) == CC_EAGAIN) {}
+    ck_assert_int_eq(recv, LEN);
+    ck_assert_int_eq(memcmp(recv_data, MSG, LEN), 0);
+
+    /* queued wbuf data can be shifted and moved before the flush */
+    buf_write(s->wbuf, "x" HDR, sizeof(HDR));
+    s->wbuf->rpos++;
+    ck_assert_int_eq(buf_sock_queue_ref(s, PAYLOAD, sizeof(PAYLOAD) - 1,
+            _count_release, &released), CC_OK);
+    buf_lshift(s->wbuf);
+    ck_assert_int_eq(dbuf_double(&s->wbuf), CC_OK);
+    buf_write(s->wbuf, TAIL END, sizeof(TAIL END) - 1);
+    ck_assert_int_eq(buf_tcp_writev(s), CC_OK);
+    ck_assert_int_eq(released, 2);
+    ck_assert_int_eq(buf_rsize(s->wbuf), 0);
+    while ((recv = tcp_recv(conn_server, recv_data, LEN + 1)) == CC_EAGAIN) {}
+    ck_assert_int_eq(recv, LEN);
+    ck_assert_int_eq(memcmp(recv_data, MSG, LEN), 0);
+
+    /* a full queue refuses writes, unsent ones are released on destroy */
+    for (i = 0; i < BUFSOCK_WQ_SIZE; i++) {
+        ck_assert_int_eq(buf_sock_queue_ref(s, PAYLOAD, 1, _count_release,
+                &released), CC_OK);
+    }
+    ck_assert_int_eq(buf_sock_queue_ref(s, PAYLOAD, 1, _count_release,
+            &released), CC_ENOMEM);
+    ck_assert_int_eq(metrics.buf_sock_wq_full.counter, 1);
+    tcp_close(s->ch);
+    buf_sock_destroy(&s);
+    ck_assert_int_eq(released, 2 + BUFSOCK_WQ_SIZE);
+
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+
+    sockio_teardown();
+    buf_teardown();
+#undef HDR
+#undef PAYLOAD
+#undef TAIL
+#undef END
+#undef MSG
+#undef LEN
+}
+END_TEST
+
+static void *io_arg;
+static uint32_t io_events;
+static int io_res;
+static int nio;
+
+static void
+_io_event(void *arg, uint32_t events)
+{
+}
+
+static void
+_io_done(void *arg, uint32_t events, int res)
+{
+    io_arg = arg;
+    io_events = events;
+    io_res = res;
+    nio++;
+}
+
+START_TEST(test_buf_sock_io)
+{
+#define MSG "completion-based I/O"
+#define NSOCK (EVENT_NBUF_MAX / 2 + 1) /* one more than can be registered */
+    struct tcp_conn *conn_listen, *conn_server;
+    struct addrinfo *ai;
+    struct event_base *evb;
+    struct buf_sock *s, *sock[NSOCK];
+    buf_options_st buf_options = { BUF_OPTION(OPTION_INIT) };
+    sockio_options_st options = { SOCKIO_OPTION(OPTION_INIT) };
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    event_metrics_st event_metrics = { EVENT_METRIC(METRIC_INIT) };
+    char recv_data[sizeof(MSG)];
+    uint32_t i, nfixed = 0;
+    ssize_t recv;
+
+    option_load_default((struct option *)&buf_options,
+            OPTION_CARDINALITY(buf_options));
+    buf_options.buf_init_size.val.vuint = 256;
+    option_load_default((struct option *)&options,
+            OPTION_CARDINALITY(options));
+    options.buf_sock_poolsize.val.vuint = NSOCK;
+    buf_setup(&buf_options, NULL);
+    sockio_setup(&options, &metrics);
+    event_setup(&event_metrics);
+
+    evb = event_base_create(1024, _io_event);
+    ck_assert_ptr_ne(evb, NULL);
+    event_base_set_io_cb(evb, _io_done);
+
+#ifdef CC_IO_URING
+    /* registration stops at the kernel limit, the rest is left as is */
+    ck_assert_int_eq(buf_sock_register(evb), CC_OK);
+    for (i = 0; i < NSOCK; i++) {
+        sock[i] = buf_sock_borrow();
+        ck_assert_ptr_ne(sock[i], NULL);
+        ck_assert_int_lt(sock[i]->rbuf->fixed, EVENT_NBUF_MAX);
+        ck_assert_int_lt(sock[i]->wbuf->fixed, EVENT_NBUF_MAX);
+        ck_assert((sock[i]->rbuf->fixed < 0) == (sock[i]->wbuf->fixed < 0));
+        nfixed += (sock[i]->rbuf->fixed >= 0);
+    }
+    ck_assert_int_eq(nfixed, EVENT_NBUF_MAX / 2);
+    for (i = 0, s = NULL; i < NSOCK; i++) {
+        if (s == NULL && sock[i]->rbuf->fixed >= 0) {
+            s = sock[i];
+        } else {
+            buf_sock_return(&sock[i]);
+        }
+    }
+#else
+    ck_assert_int_eq(buf_sock_register(evb), CC_ERROR);
+    s = buf_sock_borrow();
+    ck_assert_int_eq(s->rbuf->fixed, -1);
+    (void)sock;
+    (void)i;
+    (void)nfixed;
+#endif
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    ck_assert_int_eq(tcp_connect(ai, s->ch), true);
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    ck_assert_int_eq(buf_tcp_write_submit(evb, s), CC_EEMPTY);
+    buf_write(s->wbuf, MSG, sizeof(MSG));
+#ifdef CC_IO_URING
+    /* write from and read into the registered bufs */
+    nio = 0;
+    ck_assert_int_eq(buf_tcp_write_submit(evb, s), CC_OK);
+    while (nio == 0) {
+        ck_assert_int_ge(event_wait(evb, 1000), 0);
+    }
+    ck_assert_ptr_eq(io_arg, s);
+    ck_assert_int_eq(io_events, EVENT_WRITE);
+    ck_assert_int_eq(buf_tcp_write_done(s, io_res), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->wbuf), 0);
+    while ((recv = tcp_recv(conn_server, recv_data, sizeof(recv_data))) ==
+            CC_EAGAIN) {}
+    ck_assert_int_eq(recv, sizeof(MSG));
+    ck_assert_str_eq(recv_data, MSG);
+
+    nio = 0;
+    ck_assert_int_eq(buf_tcp_read_submit(evb, s), CC_OK);
+    ck_assert_int_eq(tcp_send(conn_server, MSG, sizeof(MSG)), sizeof(MSG));
+    while (nio == 0) {
+        ck_assert_int_ge(event_wait(evb, 1000), 0);
+    }
+    ck_assert_ptr_eq(io_arg, s);
+    ck_assert_int_eq(io_events, EVENT_READ);
+    ck_assert_int_eq(buf_tcp_read_done(s, io_res), CC_OK);
+    ck_assert_int_eq(buf_rsize(s->rbuf), sizeof(MSG));
+    ck_assert_str_eq(s->rbuf->rpos, MSG);
+    ck_assert_int_eq(event_metrics.event_io.counter, 2);
+    ck_assert_int_eq(event_metrics.event_io_fixed.counter, 2);
+#else
+    (void)recv;
+    (void)recv_data;
+    ck_assert_int_eq(buf_tcp_write_submit(evb, s), CC_ERROR);
+    ck_assert_int_eq(s->ch->err, ENOTSUP);
+    ck_assert_int_eq(buf_tcp_read_submit(evb, s), CC_ERROR);
+    ck_assert_int_eq(s->ch->err, ENOTSUP);
+#endif
+
+    /* results are mapped to the statuses of buf_tcp_read/write */
+    buf_reset(s->wbuf);
+    buf_write(s->wbuf, MSG, sizeof(MSG));
+    ck_assert_int_eq(buf_tcp_write_done(s, 1), CC_ERETRY);
+    ck_assert_int_eq(buf_tcp_write_done(s, -EAGAIN), CC_EAGAIN);
+    ck_assert_int_eq(buf_tcp_read_done(s, -EAGAIN), CC_OK);
+    ck_assert_int_eq(buf_tcp_read_done(s, 0), CC_ERDHUP);
+    ck_assert_int_eq(s->ch->state, CHANNEL_TERM);
+    ck_assert_int_eq(buf_tcp_write_done(s, -EPIPE), CC_ERROR);
+    ck_assert_int_eq(s->ch->err, EPIPE);
+    ck_assert_int_eq(s->ch->state, CHANNEL_ERROR);
+
+    tcp_close(s->ch);
+    buf_sock_return(&s);
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    event_base_destroy(&evb);
+
+    event_teardown();
+    sockio_teardown();
+    buf_teardown();
+#undef NSOCK
+#undef MSG
+}
+END_TEST
+
+static int nexpire;
+static bool expire_idle;
+
+static void
+_expire(struct buf_sock *s, bool idle)
+{
+    ck_assert_int_eq(s->ch->err, ETIMEDOUT);
+    nexpire++;
+    expire_idle = idle;
+}
+
+/*
+ * turn the wheel for about ms milliseconds, touching s if asked to; with evb,
+ * each turn waits on it like an event loop would instead of sleeping
+ */
+static void
+_turn_wheel(struct timing_wheel *tw, struct event_base *evb,
+        struct buf_sock *s, int ms, bool touch)
+{
+    int i;
+
+    for (i = 0; i < ms && nexpire == 0; i++) {
+        if (evb == NULL) {
+            usleep(1000);
+        } else {
+            event_wait(evb, 1);
+        }
+        if (touch) {
+            buf_sock_touch(s);
+        }
+        timing_wheel_execute(tw);
+    }
+}
+
+START_TEST(test_buf_sock_deadline)
+{
+#define TICK_NS 1000000
+#define NSLOT 16
+#define IDLE_MS 40      /* longer than the wheel covers */
+#define REQ_MS 5
+    struct timing_wheel *tw;
+    struct timeout tick, idle, req;
+    struct buf_sock *s;
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+    timing_wheel_metrics_st tw_metrics = { TIMING_WHEEL_METRIC(METRIC_INIT) };
+
+    buf_setup(NULL, NULL);
+    sockio_setup(NULL, &metrics);
+    timing_wheel_setup(&tw_metrics);
+
+    timeout_set_ns(&tick, TICK_NS);
+    timeout_set_ms(&idle, IDLE_MS);
+    timeout_set_ms(&req, REQ_MS);
+    tw = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(tw);
+    s = buf_sock_create();
+    ck_assert_ptr_ne(s, NULL);
+
+    /* activity keeps the conn alive without moving its timeout event */
+    nexpire = 0;
+    ck_assert_int_eq(buf_sock_deadline_arm(tw, s, &idle, &req, _expire),
+            CC_OK);
+    _turn_wheel(tw, NULL, s, 2 * IDLE_MS, true);
+    ck_assert_int_eq(nexpire, 0);
+    ck_assert_int_eq(tw->nevent, 1);
+    ck_assert_int_eq(tw_metrics.timing_wheel_remove.counter,
+            tw_metrics.timing_wheel_process.counter);
+    ck_assert_int_lt(tw_metrics.timing_wheel_insert.counter, IDLE_MS);
+    ck_assert_int_gt(metrics.buf_sock_dl_check.counter, 0);
+
+    /* idle */
+    _turn_wheel(tw, NULL, s, 4 * IDLE_MS, false);
+    ck_assert_int_eq(nexpire, 1);
+    ck_assert(expire_idle);
+    ck_assert_int_eq(metrics.buf_sock_idle_to.counter, 1);
+    ck_assert_int_eq(tw->nevent, 0);
+
+    /* a request in progress times out before the idle deadline */
+    nexpire = 0;
+    ck_assert_int_eq(buf_sock_deadline_arm(tw, s, &idle, &req, _expire),
+            CC_OK);
+    ck_assert_int_eq(buf_sock_request_start(s), CC_OK);
+    _turn_wheel(tw, NULL, s, 4 * IDLE_MS, true);
+    ck_assert_int_eq(nexpire, 1);
+    ck_assert(!expire_idle);
+    ck_assert_int_eq(metrics.buf_sock_req_to.counter, 1);
+
+    /* a finished request doesn't */
+    nexpire = 0;
+    ck_assert_int_eq(buf_sock_deadline_arm(tw, s, &idle, &req, _expire),
+            CC_OK);
+    ck_assert_int_eq(buf_sock_request_start(s), CC_OK);
+    buf_sock_request_done(s);
+    _turn_wheel(tw, NULL, s, 3 * REQ_MS, true);
+    ck_assert_int_eq(nexpire, 0);
+
+    /* disarmed by reset */
+    buf_sock_reset(s);
+    ck_assert_int_eq(s->tev, TIMEOUT_HANDLE_INVALID);
+    ck_assert_int_eq(tw->nevent, 0);
+
+    buf_sock_destroy(&s);
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+    timing_wheel_teardown();
+    sockio_teardown();
+    buf_teardown();
+#undef TICK_NS
+#undef NSLOT
+#undef IDLE_MS
+#undef REQ_MS
+}
+END_TEST
+
+START_TEST(test_buf_sock_deadline_clock)
+{
+#define TICK_NS 1000000
+#define NSLOT 16
+#define IDLE_MS 40
+#define REQ_MS 5
+    struct event_base *evb;
+    struct timing_wheel *tw;
+    struct timeout tick, idle, req;
+    struct buf_sock *s;
+    sockio_metrics_st metrics = { SOCKIO_METRIC(METRIC_INIT) };
+
+    /* the cached clock is only advanced by the event loop */
+    ck_assert_int_eq(clock_setup(NULL), CC_OK);
+    buf_setup(NULL, NULL);
+    sockio_setup(NULL, &metrics);
+    timing_wheel_setup(NULL);
+    evb = event_base_create(1024, _io_event);
+    ck_assert_ptr_ne(evb, NULL);
+
+    timeout_set_ns(&tick, TICK_NS);
+    timeout_set_ms(&idle, IDLE_MS);
+    timeout_set_ms(&req, REQ_MS);
+    tw = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(tw);
+    s = buf_sock_create();
+    ck_assert_ptr_ne(s, NULL);
+
+    nexpire = 0;
+    ck_assert_int_eq(buf_sock_deadline_arm(tw, s, &idle, &req, _expire),
+            CC_OK);
+    _turn_wheel(tw, evb, s, 4 * IDLE_MS, false);
+    ck_assert_int_eq(nexpire, 1);
+    ck_assert(expire_idle);
+    ck_assert_int_eq(metrics.buf_sock_idle_to.counter, 1);
+
+    nexpire = 0;
+    ck_assert_int_eq(buf_sock_deadline_arm(tw, s, &idle, &req, _expire),
+            CC_OK);
+    ck_assert_int_eq(buf_sock_request_start(s), CC_OK);
+    _turn_wheel(tw, evb, s, 4 * IDLE_MS, true);
+    ck_assert_int_eq(nexpire, 1);
+    ck_assert(!expire_idle);
+    ck_assert_int_eq(metrics.buf_sock_req_to.counter, 1);
+
+    buf_sock_destroy(&s);
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+    event_base_destroy(&evb);
+    timing_wheel_teardown();
+    sockio_teardown();
+    buf_teardown();
+    clock_teardown();
+#undef TICK_NS
+#undef NSLOT
+#undef IDLE_MS
+#undef REQ_MS
+}
+END_TEST
+
+START_TEST(test_send_zcopy)
+{
+#define LEN (64 * 1024)
+#define SMALL 100
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct addrinfo *ai;
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    static char send_data[LEN], recv_data[LEN];
+    uint32_t ticket;
+    ssize_t n, recv, total;
+    int i;
+
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    tcp_teardown();
+    tcp_setup(NULL, &metrics);
+
+    conn_client = tcp_conn_create();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    if (tcp_zcopy_enable(conn_client) != CC_OK) {
+        /* not supported here, sends are still delivered by copying */
+        ck_assert_int_eq(tcp_send_zcopy(conn_client, send_data, SMALL), SMALL);
+        ck_assert_int_eq(metrics.tcp_zcopy_fallback.counter, 1);
+        goto done;
+    }
+
+    /* small sends copy and complete right away */
+    ck_assert_int_eq(tcp_send_zcopy(conn_client, send_data, SMALL), SMALL);
+    ck_assert_int_eq(metrics.tcp_zcopy_fallback.counter, 1);
+    ck_assert_int_eq(metrics.tcp_zcopy.counter, 0);
+    ck_assert(tcp_zcopy_done(conn_client, tcp_zcopy_ticket(conn_client)));
+    total = SMALL;
+    while (total > 0) {
+        recv = tcp_recv(conn_server, recv_data, total);
+        if (recv != CC_EAGAIN) {
+            ck_assert_int_gt(recv, 0);
+            total -= recv;
+        }
+    }
+
+    /* large sends complete once the kernel is done with the pages */
+    n = tcp_send_zcopy(conn_client, send_data, LEN);
+    ck_assert_int_gt(n, 0);
+    ck_assert_int_eq(metrics.tcp_zcopy.counter, 1);
+    ticket = tcp_zcopy_ticket(conn_client);
+    for (total = 0; total < n;) {
+        recv = tcp_recv(conn_server, recv_data + total, n - total);
+        if (recv != CC_EAGAIN) {
+            ck_assert_int_gt(recv, 0);
+            total += recv;
+        }
+    }
+    ck_assert_int_eq(memcmp(send_data, recv_data, n), 0);
+    for (i = 0; i < 1000 && !tcp_zcopy_done(conn_client, ticket); i++) {
+        ck_assert_int_ge(tcp_zcopy_reap(conn_client), 0);
+        usleep(1000);
+    }
+    ck_assert(tcp_zcopy_done(conn_client, ticket));
+    ck_assert_int_eq(metrics.tcp_zcopy_done.counter, 1);
+
+done:
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    test_reset();
+#undef LEN
+#undef SMALL
+}
+END_TEST
+
+START_TEST(test_sendfile)
+{
+#define LEN 4096
+#define NMAX 1000
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct addrinfo *ai;
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    char path[] = "/tmp/check_tcp_XXXXXX";
+    char send_data[LEN], recv_data[LEN];
+    off_t offset = 0;
+    ssize_t n, recv, total = 0;
+    int i, fd;
+
+    for (i = 0; i < LEN; i++) {
+        send_data[i] = i % CHAR_MAX;
+    }
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    unlink(path);
+    ck_assert_int_eq(write(fd, send_data, LEN), LEN);
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.tcp_sendfile_max.val.vuint = NMAX;
+    tcp_teardown();
+    tcp_setup(&options, &metrics);
+
+    conn_client = tcp_conn_create();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    conn_server = tcp_conn_create();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+
+    /* each call sends at most tcp_sendfile_max */
+    ck_assert_int_eq(tcp_sendfile(conn_client, fd, &offset, LEN), NMAX);
+    ck_assert_int_eq(offset, NMAX);
+    while (offset < LEN) {
+        n = tcp_sendfile(conn_client, fd, &offset, LEN - offset);
+        ck_assert(n > 0 || n == CC_EAGAIN);
+    }
+    ck_assert_int_eq(tcp_sendfile(conn_client, fd, &offset, LEN), 0);
+    ck_assert_int_eq(metrics.tcp_sendfile_byte.counter, LEN);
+
+    while (total < LEN) {
+        recv = tcp_recv(conn_server, recv_data + total, LEN - total);
+        if (recv != CC_EAGAIN) {
+            ck_assert_int_gt(recv, 0);
+            total += recv;
+        }
+    }
+    ck_assert_int_eq(memcmp(send_data, recv_data, LEN), 0);
+
+    close(fd);
+    tcp_close(conn_listen);
+    tcp_close(conn_server);
+    tcp_close(conn_client);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_destroy(&conn_client);
+    tcp_conn_destroy(&conn_server);
+    freeaddrinfo(ai);
+    test_reset();
+#undef LEN
+#undef NMAX
+}
+END_TEST
+
 struct task {
     useconds_t usleep;
     struct tcp_conn *c;
@@ -349,6 +934,286 @@ START_TEST(test_nonblocking)
 }
 END_TEST
 
+START_TEST(test_accept_drain)
+{
+#define NCONN 3
+    struct tcp_conn *conn_listen, *conn_client[NCONN], *conn_server[NCONN + 1];
+    struct addrinfo *ai;
+    int i, n;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+
+    for (i = 0; i < NCONN; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+
+    /* accept until the backlog is drained, as edge-triggered listeners do */
+    for (n = 0; n <= NCONN; n++) {
+        conn_server[n] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_server[n], NULL);
+        if (!tcp_accept(conn_listen, conn_server[n])) {
+            break;
+        }
+    }
+    ck_assert_int_eq(n, NCONN);
+    ck_assert_int_eq(conn_listen->err, EAGAIN);
+
+    for (i = 0; i < NCONN; i++) {
+        tcp_close(conn_server[i]);
+        tcp_close(conn_client[i]);
+        tcp_conn_destroy(&conn_client[i]);
+    }
+    for (i = 0; i <= NCONN; i++) {
+        tcp_conn_destroy(&conn_server[i]);
+    }
+    tcp_close(conn_listen);
+    tcp_conn_destroy(&conn_listen);
+    freeaddrinfo(ai);
+#undef NCONN
+}
+END_TEST
+
+START_TEST(test_accept_batch)
+{
+#define NCONN 5
+#define NBATCH 8
+    struct tcp_conn *conn_listen, *conn_client[NCONN + 2], *conn_server[NBATCH];
+    struct addrinfo *ai;
+    tcp_metrics_st metrics = { TCP_METRIC(METRIC_INIT) };
+    tcp_options_st options = { TCP_OPTION(OPTION_INIT) };
+    int i, n;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.tcp_max_active.val.vuint = 3;
+    tcp_teardown();
+    tcp_setup(&options, &metrics);
+
+    for (i = 0; i < NCONN; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+
+    /* no more than max active are borrowed, the rest stay in the backlog */
+    ck_assert_int_eq(tcp_accept_batch(conn_listen, conn_server, NBATCH), 3);
+    ck_assert_int_eq(conn_listen->err, EBUSY);
+    ck_assert_int_eq(metrics.tcp_accept_full.counter, 1);
+    ck_assert_int_eq(metrics.tcp_conn_active.gauge, 3);
+    for (i = 0; i < 3; i++) {
+        ck_assert_int_eq(conn_server[i]->state, CHANNEL_ESTABLISHED);
+    }
+
+    tcp_close(conn_server[0]);
+    tcp_conn_return(&conn_server[0]);
+    ck_assert_int_eq(tcp_accept_batch(conn_listen, conn_server, NBATCH), 1);
+    ck_assert_int_eq(conn_listen->err, EBUSY);
+    for (i = 0; i < 3; i++) {
+        tcp_close(conn_server[i]);
+        tcp_conn_return(&conn_server[i]);
+    }
+    ck_assert_int_eq(metrics.tcp_conn_active.gauge, 0);
+
+    /* over the accept rate, connections are shed until the backlog drains */
+    options.tcp_max_active.val.vuint = 0;
+    options.tcp_accept_rate.val.vuint = 1;
+    options.tcp_accept_shed.val.vbool = true;
+    tcp_teardown();
+    tcp_setup(&options, &metrics);
+    for (i = NCONN; i < NCONN + 2; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+    ck_assert_int_eq(tcp_accept_batch(conn_listen, conn_server, NBATCH), 1);
+    ck_assert_int_eq(conn_listen->err, EAGAIN);
+    ck_assert_int_eq(metrics.tcp_accept_paced.counter, 1);
+    ck_assert_int_eq(metrics.tcp_accept_shed.counter, 2);
+    tcp_close(conn_server[0]);
+    tcp_conn_return(&conn_server[0]);
+
+    /* drained without limits */
+    options.tcp_accept_rate.val.vuint = 0;
+    tcp_teardown();
+    tcp_setup(&options, &metrics);
+    n = tcp_accept_batch(conn_listen, conn_server, NBATCH);
+    ck_assert_int_eq(n, 0);
+    ck_assert_int_eq(conn_listen->err, EAGAIN);
+
+    for (i = 0; i < NCONN + 2; i++) {
+        tcp_close(conn_client[i]);
+        tcp_conn_destroy(&conn_client[i]);
+    }
+    tcp_close(conn_listen);
+    tcp_conn_destroy(&conn_listen);
+    freeaddrinfo(ai);
+    test_reset();
+#undef NCONN
+#undef NBATCH
+}
+END_TEST
+
+START_TEST(test_listen_reuseport)
+{
+#define NLISTEN 2
+#define NCONN 4
+    struct tcp_conn *conn_listen[NLISTEN], *conn_client[NCONN];
+    struct tcp_conn *conn_server[NCONN], *conn_other;
+    struct addrinfo *ai;
+    int i, n, total = 0, naccept[NLISTEN];
+#ifdef OS_LINUX
+    cpu_set_t cpuset, pinned;
+    socklen_t len;
+    int cpu, val;
+#endif
+
+    find_port_listen(&conn_listen[0], &ai, NULL);
+    tcp_close(conn_listen[0]);
+
+    for (i = 1; i < NLISTEN; i++) {
+        conn_listen[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_listen[i], NULL);
+    }
+    ck_assert(tcp_listen_reuseport(ai, conn_listen, NLISTEN, true));
+
+    /* the port is shared by the group only */
+    conn_other = tcp_conn_create();
+    ck_assert_ptr_ne(conn_other, NULL);
+    ck_assert(!tcp_listen(ai, conn_other));
+    tcp_conn_destroy(&conn_other);
+
+#ifdef OS_LINUX
+    /* listener i takes connections arriving on cpu i */
+    for (i = 0; i < NLISTEN; i++) {
+        len = sizeof(val);
+        ck_assert_int_eq(getsockopt(conn_listen[i]->sd, SOL_SOCKET,
+                SO_INCOMING_CPU, &val, &len), 0);
+        ck_assert_int_eq(val, i);
+    }
+
+    /* over loopback, connections arrive on the cpu they are made from */
+    ck_assert_int_eq(pthread_getaffinity_np(pthread_self(), sizeof(cpuset),
+            &cpuset), 0);
+    cpu = sched_getcpu();
+    ck_assert_int_ge(cpu, 0);
+    CPU_ZERO(&pinned);
+    CPU_SET(cpu, &pinned);
+    ck_assert_int_eq(pthread_setaffinity_np(pthread_self(), sizeof(pinned),
+            &pinned), 0);
+#endif
+
+    for (i = 0; i < NCONN; i++) {
+        conn_client[i] = tcp_conn_create();
+        ck_assert_ptr_ne(conn_client[i], NULL);
+        ck_assert_int_eq(tcp_connect(ai, conn_client[i]), true);
+    }
+
+    /* every connection lands on exactly one of the listeners */
+    for (i = 0; i < NLISTEN; i++) {
+        n = tcp_accept_batch(conn_listen[i], conn_server + total,
+                NCONN - total);
+        ck_assert_int_ge(n, 0);
+        naccept[i] = n;
+        total += n;
+    }
+    ck_assert_int_eq(total, NCONN);
+
+#ifdef OS_LINUX
+    ck_assert_int_eq(naccept[cpu % NLISTEN], NCONN);
+    ck_assert_int_eq(pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+            &cpuset), 0);
+#else
+    (void)naccept;
+#endif
+
+    for (i = 0; i < NCONN; i++) {
+        tcp_close(conn_server[i]);
+        tcp_conn_return(&conn_server[i]);
+        tcp_close(conn_client[i]);
+        tcp_conn_destroy(&conn_client[i]);
+    }
+    for (i = 0; i < NLISTEN; i++) {
+        tcp_close(conn_listen[i]);
+        tcp_conn_destroy(&conn_listen[i]);
+    }
+    freeaddrinfo(ai);
+#undef NLISTEN
+#undef NCONN
+}
+END_TEST
+
+START_TEST(test_tcp_info)
+{
+#define MSG "hello"
+    struct tcp_conn *conn_listen, *conn_client, *conn_server;
+    struct tcp_info_sampler *sampler;
+    struct tcp_conn_info info;
+    struct addrinfo *ai;
+    tcp_info_metrics_st metrics = { TCP_INFO_METRIC(METRIC_INIT) };
+    tcp_info_options_st options = { TCP_INFO_OPTION(OPTION_INIT) };
+    char buf[sizeof(MSG)];
+    uint64_t nrtt = 0;
+    int i;
+
+    find_port_listen(&conn_listen, &ai, NULL);
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.tcp_info_nsample.val.vuint = 1;
+    tcp_info_setup(&options, &metrics);
+
+    conn_client = tcp_conn_borrow();
+    ck_assert_ptr_ne(conn_client, NULL);
+    ck_assert_int_eq(tcp_connect(ai, conn_client), true);
+    conn_server = tcp_conn_borrow();
+    ck_assert_ptr_ne(conn_server, NULL);
+    ck_assert(tcp_accept(conn_listen, conn_server));
+    ck_assert_int_eq(tcp_send(conn_client, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(tcp_recv(conn_server, buf, sizeof(buf)), sizeof(MSG));
+
+    ck_assert_int_eq(tcp_info_get(conn_client, &info), CC_OK);
+    ck_assert_uint_gt(info.cwnd, 0);
+    ck_assert_uint_eq(info.unacked, 0);
+
+    sampler = tcp_info_sampler_create();
+    ck_assert_ptr_ne(sampler, NULL);
+    tcp_info_add(sampler, conn_client);
+    tcp_info_add(sampler, conn_server);
+
+    /* one conn per run, round-robin */
+    tcp_info_sample(sampler);
+    ck_assert_int_eq(metrics.tcp_info_sample.counter, 1);
+    tcp_info_sample(sampler);
+    tcp_info_sample(sampler);
+    ck_assert_int_eq(metrics.tcp_info_sample.counter, 3);
+    ck_assert_int_eq(metrics.tcp_info_sample_ex.counter, 0);
+    for (i = 0; i < TCP_RTT_NBUCKET; i++) {
+        nrtt += (&metrics.tcp_rtt_0)[i].counter;
+    }
+    ck_assert_int_eq(nrtt, 3);
+    ck_assert_int_eq(metrics.tcp_unacked_0.counter, 3);
+    /* retransmits since the last sample, which is kept with the conn */
+    ck_assert_int_eq(metrics.tcp_retrans_0.counter, 3);
+    ck_assert_int_eq(conn_client->info_retrans, info.retrans);
+
+    tcp_info_del(sampler, conn_server);
+    tcp_info_sample(sampler);
+    tcp_info_sampler_destroy(&sampler); /* deletes conn_client */
+    ck_assert(!conn_client->sampled);
+    ck_assert_int_eq(metrics.tcp_info_sample.counter, 4);
+
+    tcp_info_teardown();
+    tcp_close(conn_listen);
+    tcp_close(conn_client);
+    tcp_close(conn_server);
+    tcp_conn_destroy(&conn_listen);
+    tcp_conn_return(&conn_client);
+    tcp_conn_return(&conn_server);
+    freeaddrinfo(ai);
+#undef MSG
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -364,7 +1229,17 @@ log_suite(void)
     tcase_add_test(tc_log, test_client_send_server_recv);
     tcase_add_test(tc_log, test_server_send_client_recv);
     tcase_add_test(tc_log, test_client_sendv_server_recvv);
+    tcase_add_test(tc_log, test_buf_sock_writev);
+    tcase_add_test(tc_log, test_buf_sock_io);
+    tcase_add_test(tc_log, test_buf_sock_deadline);
+    tcase_add_test(tc_log, test_buf_sock_deadline_clock);
+    tcase_add_test(tc_log, test_send_zcopy);
+    tcase_add_test(tc_log, test_sendfile);
     tcase_add_test(tc_log, test_nonblocking);
+    tcase_add_test(tc_log, test_accept_drain);
+    tcase_add_test(tc_log, test_accept_batch);
+    tcase_add_test(tc_log, test_listen_reuseport);
+    tcase_add_test(tc_log, test_tcp_info);
 
     return s;
 }
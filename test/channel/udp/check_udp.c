@@ -0,0 +1,319 @@
+#include <channel/cc_udp.h>
+
+#include <check.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "udp"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static udp_metrics_st metrics;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    udp_options_st options = { UDP_OPTION(OPTION_INIT) };
+
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    /* large enough for a GRO datagram */
+    options.udp_dgram_size.val.vuint = 65536;
+    metrics = (udp_metrics_st) { UDP_METRIC(METRIC_INIT) };
+    udp_setup(&options, &metrics);
+}
+
+static void
+test_teardown(void)
+{
+    udp_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* bind server to an ephemeral port on localhost and connect client to it */
+static void
+udp_pair(struct udp_conn **server, struct udp_conn **client)
+{
+    struct addrinfo hints, *ai;
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    char servname[CC_UINTMAX_MAXLEN + 1];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    *server = udp_conn_borrow();
+    *client = udp_conn_borrow();
+    ck_assert_ptr_ne(*server, NULL);
+    ck_assert_ptr_ne(*client, NULL);
+
+    ck_assert_int_eq(getaddrinfo("127.0.0.1", "0", &hints, &ai), 0);
+    ck_assert(udp_bind(ai, *server));
+    freeaddrinfo(ai);
+    ck_assert_int_eq(getsockname((*server)->sd, (struct sockaddr *)&sin, &len),
+            0);
+
+    sprintf(servname, "%"PRIu16, ntohs(sin.sin_port));
+    ck_assert_int_eq(getaddrinfo("127.0.0.1", servname, &hints, &ai), 0);
+    ck_assert(udp_connect(ai, *client));
+    freeaddrinfo(ai);
+}
+
+static void
+udp_pair_close(struct udp_conn **server, struct udp_conn **client)
+{
+    udp_close(*server);
+    udp_close(*client);
+    udp_conn_return(server);
+    udp_conn_return(client);
+}
+
+/* receive until n datagrams have arrived, tolerating a not yet ready socket */
+static int
+recv_n(struct udp_conn *c, struct udp_dgram **dg, uint32_t n)
+{
+    int ret, total = 0, i;
+
+    for (i = 0; i < 1000 && total < (int)n; i++) {
+        ret = udp_recv_batch(c, dg + total, n - total);
+        if (ret == CC_EAGAIN) {
+            usleep(1000);
+            continue;
+        }
+        ck_assert_int_gt(ret, 0);
+        total += ret;
+    }
+
+    return total;
+}
+
+/*
+ * tests
+ */
+START_TEST(test_send_recv)
+{
+#define MSG "hello"
+    struct udp_conn *server, *client;
+    char buf[sizeof(MSG)];
+    ssize_t n;
+    int i;
+
+    test_reset();
+    udp_pair(&server, &client);
+
+    ck_assert_int_eq(udp_send(client, MSG, sizeof(MSG)), sizeof(MSG));
+    for (i = 0; i < 1000; i++) {
+        n = udp_recv(server, buf, sizeof(buf));
+        if (n != CC_EAGAIN) {
+            break;
+        }
+        usleep(1000);
+    }
+    ck_assert_int_eq(n, sizeof(MSG));
+    ck_assert_str_eq(buf, MSG);
+    ck_assert_int_eq(udp_recv(server, buf, sizeof(buf)), CC_EAGAIN);
+
+    udp_pair_close(&server, &client);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+#define N 8
+    struct udp_conn *server, *client;
+    struct udp_dgram *dg[N], *reply;
+    uint32_t i;
+
+    test_reset();
+    udp_pair(&server, &client);
+
+    for (i = 0; i < N; i++) {
+        dg[i] = udp_dgram_borrow();
+        ck_assert_ptr_ne(dg[i], NULL);
+        dg[i]->len = sprintf(dg[i]->data, "datagram %"PRIu32, i) + 1;
+    }
+    ck_assert_int_eq(metrics.udp_dgram_active.gauge, N);
+
+    /* one call moves the whole batch each way */
+    ck_assert_int_eq(udp_send_batch(client, dg, N), N);
+    ck_assert_int_eq(metrics.udp_send_dgram.counter, N);
+    for (i = 0; i < N; i++) {
+        dg[i]->len = 0;
+    }
+    ck_assert_int_eq(recv_n(server, dg, N), N);
+    ck_assert_int_eq(metrics.udp_recv_dgram.counter, N);
+    for (i = 0; i < N; i++) {
+        char expect[32];
+
+        sprintf(expect, "datagram %"PRIu32, i);
+        ck_assert_str_eq(dg[i]->data, expect);
+        ck_assert_uint_gt(dg[i]->addrlen, 0);
+    }
+
+    /* reply to the source address of a received datagram */
+    reply = dg[0];
+    reply->len = 3;
+    memcpy(reply->data, "ack", 3);
+    ck_assert_int_eq(udp_send_batch(server, &reply, 1), 1);
+    ck_assert_int_eq(recv_n(client, &dg[1], 1), 1);
+    ck_assert_int_eq(dg[1]->len, 3);
+    ck_assert_int_eq(memcmp(dg[1]->data, "ack", 3), 0);
+
+    for (i = 0; i < N; i++) {
+        udp_dgram_return(&dg[i]);
+    }
+    ck_assert_int_eq(metrics.udp_dgram_active.gauge, 0);
+
+    udp_pair_close(&server, &client);
+#undef N
+}
+END_TEST
+
+START_TEST(test_gso_gro)
+{
+#define SEG 500
+#define NSEG 3
+    struct udp_conn *server, *client;
+    struct udp_dgram *dg, *rdg[NSEG];
+    uint32_t i, total = 0;
+    int n;
+
+    test_reset();
+    udp_pair(&server, &client);
+    udp_set_gro(server->sd); /* segments arrive separately without it */
+
+    dg = udp_dgram_borrow();
+    for (i = 0; i < SEG * NSEG; i++) {
+        dg->data[i] = i % SEG;
+    }
+    dg->len = SEG * NSEG;
+    dg->segsz = SEG;
+    ck_assert_int_eq(udp_send_batch(client, &dg, 1), 1);
+
+    for (i = 0; i < NSEG; i++) {
+        rdg[i] = udp_dgram_borrow();
+    }
+    /* whether coalesced or not, every segment is delivered */
+    for (n = 0; total < SEG * NSEG; n++) {
+        ck_assert_int_lt(n, NSEG);
+        ck_assert_int_eq(recv_n(server, &rdg[n], 1), 1);
+        ck_assert_int_eq(rdg[n]->len % SEG, 0);
+        ck_assert(rdg[n]->segsz == 0 || rdg[n]->segsz == SEG);
+        ck_assert_int_eq(memcmp(rdg[n]->data, dg->data, SEG), 0);
+        total += rdg[n]->len;
+    }
+
+    udp_dgram_return(&dg);
+    for (i = 0; i < NSEG; i++) {
+        udp_dgram_return(&rdg[i]);
+    }
+    udp_pair_close(&server, &client);
+#undef SEG
+#undef NSEG
+}
+END_TEST
+
+START_TEST(test_truncate)
+{
+#define CAP 16
+#define BIG (CAP * 4)
+    udp_options_st options = { UDP_OPTION(OPTION_INIT) };
+    struct udp_conn *server, *client;
+    struct udp_dgram *dg[3];
+    char buf[BIG];
+    uint32_t i;
+
+    test_teardown();
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.udp_dgram_size.val.vuint = CAP;
+    metrics = (udp_metrics_st) { UDP_METRIC(METRIC_INIT) };
+    udp_setup(&options, &metrics);
+    udp_pair(&server, &client);
+
+    memset(buf, 'x', sizeof(buf));
+    ck_assert_int_eq(udp_send(client, buf, CAP), CAP);
+    ck_assert_int_eq(udp_send(client, buf, BIG), BIG);
+    ck_assert_int_eq(udp_send(client, buf, 1), 1);
+
+    /* the oversized datagram keeps its slot, flagged and empty */
+    for (i = 0; i < 3; i++) {
+        dg[i] = udp_dgram_borrow();
+    }
+    ck_assert_int_eq(recv_n(server, dg, 3), 3);
+    ck_assert_int_eq(dg[0]->len, CAP);
+    ck_assert(!dg[0]->truncated);
+    ck_assert_int_eq(dg[1]->len, 0);
+    ck_assert(dg[1]->truncated);
+    ck_assert_int_eq(dg[2]->len, 1);
+    ck_assert(!dg[2]->truncated);
+    ck_assert_int_eq(metrics.udp_recv_trunc.counter, 1);
+    ck_assert_int_eq(metrics.udp_recv_dgram.counter, 3);
+    ck_assert_int_eq(metrics.udp_recv_byte.counter, CAP + 1);
+
+    /* borrowing anew clears the flag */
+    udp_dgram_return(&dg[1]);
+    dg[1] = udp_dgram_borrow();
+    ck_assert(!dg[1]->truncated);
+
+    for (i = 0; i < 3; i++) {
+        udp_dgram_return(&dg[i]);
+    }
+    udp_pair_close(&server, &client);
+    test_reset();
+#undef BIG
+#undef CAP
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+udp_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+    TCase *tc_udp = tcase_create("udp test");
+    suite_add_tcase(s, tc_udp);
+
+    tcase_add_test(tc_udp, test_send_recv);
+    tcase_add_test(tc_udp, test_batch);
+    tcase_add_test(tc_udp, test_gso_gro);
+    tcase_add_test(tc_udp, test_truncate);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = udp_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,229 @@
+#include <channel/cc_unix.h>
+
+#include <check.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUITE_NAME "unix"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static unix_metrics_st metrics;
+static char path[64];
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (unix_metrics_st) { UNIX_METRIC(METRIC_INIT) };
+    unix_setup(NULL, &metrics);
+    sprintf(path, "/tmp/check_unix_%d.sock", (int)getpid());
+}
+
+static void
+test_teardown(void)
+{
+    unix_teardown();
+    unlink(path);
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/* listen on path, connect a client and accept it */
+static void
+unix_trio(struct unix_conn **server, struct unix_conn **client,
+        struct unix_conn **conn)
+{
+    int i;
+
+    *server = unix_conn_borrow();
+    *client = unix_conn_borrow();
+    *conn = unix_conn_borrow();
+    ck_assert_ptr_ne(*server, NULL);
+    ck_assert_ptr_ne(*client, NULL);
+    ck_assert_ptr_ne(*conn, NULL);
+
+    ck_assert(unix_listen(path, *server));
+    ck_assert(unix_connect(path, *client));
+    for (i = 0; i < 1000 && !unix_accept(*server, *conn); i++) {
+        ck_assert_int_eq((*server)->err, EAGAIN);
+        usleep(1000);
+    }
+    ck_assert_int_eq((*conn)->state, CHANNEL_ESTABLISHED);
+}
+
+static void
+unix_trio_close(struct unix_conn **server, struct unix_conn **client,
+        struct unix_conn **conn)
+{
+    unix_close(*server);
+    unix_close(*client);
+    unix_close(*conn);
+    unix_conn_return(server);
+    unix_conn_return(client);
+    unix_conn_return(conn);
+}
+
+/*
+ * tests
+ */
+START_TEST(test_send_recv)
+{
+#define MSG "hello"
+    struct unix_conn *server, *client, *conn, *other;
+    char buf[sizeof(MSG)];
+
+    test_reset();
+    unix_trio(&server, &client, &conn);
+
+    /* a live listener's socket file is left alone */
+    other = unix_conn_borrow();
+    ck_assert_ptr_ne(other, NULL);
+    ck_assert(!unix_listen(path, other));
+    ck_assert_int_eq(other->err, EADDRINUSE);
+    unix_conn_return(&other);
+
+    /* a stale socket file doesn't keep a new listener from binding */
+    unix_close(server);
+    ck_assert(unix_listen(path, server));
+
+    ck_assert_int_eq(unix_recv(conn, buf, sizeof(buf)), CC_EAGAIN);
+    ck_assert_int_eq(unix_send(client, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(unix_recv(conn, buf, sizeof(buf)), sizeof(MSG));
+    ck_assert_str_eq(buf, MSG);
+    ck_assert_int_eq(metrics.unix_send_byte.counter, sizeof(MSG));
+    ck_assert_int_eq(metrics.unix_recv_byte.counter, sizeof(MSG));
+
+    unix_close(client);
+    ck_assert_int_eq(unix_recv(conn, buf, sizeof(buf)), 0);
+    ck_assert_int_eq(conn->state, CHANNEL_TERM);
+
+    unix_close(server);
+    unix_close(conn);
+    unix_conn_return(&server);
+    unix_conn_return(&client);
+    unix_conn_return(&conn);
+    ck_assert_int_eq(metrics.unix_conn_active.gauge, 0);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_fd_passing)
+{
+#define MSG "handoff"
+    struct unix_conn *server, *client, *conn;
+    int pfd[2], fd[UNIX_NFD_MAX];
+    uint32_t nfd;
+    char buf[sizeof(MSG)];
+
+    test_reset();
+    unix_trio(&server, &client, &conn);
+
+    ck_assert_int_eq(pipe(pfd), 0);
+
+    /* too many fds are refused without anything sent */
+    ck_assert_int_eq(unix_send_fd(client, MSG, sizeof(MSG), pfd,
+                UNIX_NFD_MAX + 1), CC_ERROR);
+    ck_assert_int_eq(client->err, EINVAL);
+
+    /* pass both ends of the pipe, then close the originals */
+    ck_assert_int_eq(unix_send_fd(client, MSG, sizeof(MSG), pfd, 2),
+            sizeof(MSG));
+    close(pfd[0]);
+    close(pfd[1]);
+    ck_assert_int_eq(unix_recv_fd(conn, buf, sizeof(buf), fd, &nfd),
+            sizeof(MSG));
+    ck_assert_str_eq(buf, MSG);
+    ck_assert_int_eq(nfd, 2);
+    ck_assert_int_eq(metrics.unix_send_fd.counter, 2);
+    ck_assert_int_eq(metrics.unix_recv_fd.counter, 2);
+
+    /* the received fds refer to the same pipe */
+    ck_assert_int_eq(write(fd[1], MSG, sizeof(MSG)), sizeof(MSG));
+    memset(buf, 0, sizeof(buf));
+    ck_assert_int_eq(read(fd[0], buf, sizeof(buf)), sizeof(MSG));
+    ck_assert_str_eq(buf, MSG);
+    close(fd[0]);
+    close(fd[1]);
+
+    /* data without fds */
+    ck_assert_int_eq(unix_send(client, MSG, sizeof(MSG)), sizeof(MSG));
+    ck_assert_int_eq(unix_recv_fd(conn, buf, sizeof(buf), fd, &nfd),
+            sizeof(MSG));
+    ck_assert_int_eq(nfd, 0);
+
+    unix_trio_close(&server, &client, &conn);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_reject)
+{
+    struct unix_conn *server, *client;
+    char buf[1];
+
+    test_reset();
+
+    server = unix_conn_borrow();
+    client = unix_conn_borrow();
+    ck_assert(unix_listen(path, server));
+    ck_assert(unix_connect(path, client));
+    unix_reject(server);
+    ck_assert_int_eq(metrics.unix_reject.counter, 1);
+    ck_assert_int_eq(metrics.unix_reject_ex.counter, 0);
+    ck_assert_int_eq(unix_recv(client, buf, sizeof(buf)), 0);
+
+    unix_close(server);
+    unix_close(client);
+    unix_conn_return(&server);
+    unix_conn_return(&client);
+}
+END_TEST
+
+/*
+ * test suite
+ */
+static Suite *
+unix_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+    TCase *tc_unix = tcase_create("unix test");
+    suite_add_tcase(s, tc_unix);
+
+    tcase_add_test(tc_unix, test_send_recv);
+    tcase_add_test(tc_unix, test_fd_passing);
+    tcase_add_test(tc_unix, test_reject);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = unix_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,11 +1,18 @@
 #include <cc_event.h>
+#include <cc_event_group.h>
 #include <channel/cc_pipe.h>
+#include <channel/cc_tcp.h>
+#include <time/cc_timer.h>
 
 #include <check.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -16,6 +23,7 @@
 struct event {
     void *arg;
     uint32_t events;
+    int res;
 };
 
 static struct event event_log[1024];
@@ -51,6 +59,24 @@ log_event(void *arg, uint32_t events)
     event_log[event_log_count++].events = events;
 }
 
+static void
+log_batch(struct event_item *item, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        log_event(item[i].data, item[i].events);
+    }
+}
+
+static void
+log_io(void *arg, uint32_t events, int res)
+{
+    event_log[event_log_count].arg = arg;
+    event_log[event_log_count].res = res;
+    event_log[event_log_count++].events = events;
+}
+
 START_TEST(test_read)
 {
 #define DATA "foo bar baz"
@@ -142,6 +168,474 @@ START_TEST(test_write)
 }
 END_TEST
 
+START_TEST(test_del_readd)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[2] = {1, 2};
+    struct pipe_conn *pipe[2];
+    int i;
+
+    test_reset();
+
+    event_base = event_base_create(1024, log_event);
+
+    for (i = 0; i < 2; i++) {
+        pipe[i] = pipe_conn_create();
+        ck_assert_int_eq(pipe_open(NULL, pipe[i]), true);
+        ck_assert_int_eq(pipe_send(pipe[i], DATA, sizeof(DATA)), sizeof(DATA));
+        event_add_read(event_base, pipe_read_id(pipe[i]), &random_pointer[i]);
+    }
+
+    ck_assert_int_eq(event_wait(event_base, -1), 2);
+    ck_assert_int_eq(event_log_count, 2);
+
+    /* deleted fd no longer reports events, the other one still does */
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe[0])), 0);
+    event_log_count = 0;
+    ck_assert_int_eq(event_wait(event_base, -1), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, &random_pointer[1]);
+
+    /* re-adding the deleted fd brings it back */
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe[1])), 0);
+    event_add_read(event_base, pipe_read_id(pipe[0]), &random_pointer[0]);
+    event_log_count = 0;
+    ck_assert_int_eq(event_wait(event_base, -1), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, &random_pointer[0]);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe[0])), 0);
+    event_base_destroy(&event_base);
+    for (i = 0; i < 2; i++) {
+        pipe_close(pipe[i]);
+        pipe_conn_destroy(&pipe[i]);
+    }
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_read_et)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+    char buf[sizeof(DATA)];
+
+    test_reset();
+
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    pipe_set_nonblocking(pipe);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+
+    event_base = event_base_create(1024, log_event);
+    ck_assert_int_eq(event_add_read_mode(event_base, pipe_read_id(pipe),
+                &random_pointer[0], EVENT_MODE_ET | EVENT_MODE_EXCLUSIVE), 0);
+
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_ptr_eq(event_log[0].arg, &random_pointer[0]);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+
+#ifndef CC_IO_URING
+    /* not drained, but nothing new either */
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log_count, 2);
+#endif
+
+    /* drained: no event until the next write */
+    while (pipe_recv(pipe, buf, sizeof(buf)) > 0) {}
+    event_log_count = 0;
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_int_eq(pipe_send(pipe, DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 1000), 1);
+    ck_assert_int_eq(event_log_count, 1);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+#undef DATA
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    event_metrics_st metrics = { EVENT_METRIC(METRIC_INIT) };
+    int random_pointer[3] = {1, 2, 3};
+    struct pipe_conn *pipe[2];
+    int i;
+
+    test_teardown();
+    event_log_count = 0;
+    event_setup(&metrics);
+
+    event_base = event_base_create(1024, log_event);
+    ck_assert_int_eq(event_base_set_batch_cb(event_base, log_batch), 0);
+
+    for (i = 0; i < 2; i++) {
+        pipe[i] = pipe_conn_create();
+        ck_assert_int_eq(pipe_open(NULL, pipe[i]), true);
+    }
+    /* added before the reads, but still dispatched after them */
+    event_add_write(event_base, pipe_write_id(pipe[0]), &random_pointer[2]);
+    for (i = 0; i < 2; i++) {
+        ck_assert_int_eq(pipe_send(pipe[i], DATA, sizeof(DATA)), sizeof(DATA));
+        event_add_read(event_base, pipe_read_id(pipe[i]), &random_pointer[i]);
+    }
+
+    ck_assert_int_eq(event_wait(event_base, 1000), 3);
+    ck_assert_int_eq(event_log_count, 3);
+    ck_assert_int_eq(event_log[0].events, EVENT_READ);
+    ck_assert_int_eq(event_log[1].events, EVENT_READ);
+    ck_assert_int_eq(event_log[2].events, EVENT_WRITE);
+    ck_assert_ptr_eq(event_log[2].arg, &random_pointer[2]);
+    ck_assert_int_eq(metrics.event_batch.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_2.counter, 1);
+
+    /* back to per-event dispatch */
+    ck_assert_int_eq(event_base_set_batch_cb(event_base, NULL), 0);
+    event_log_count = 0;
+    ck_assert_int_eq(event_wait(event_base, 1000), 3);
+    ck_assert_int_eq(event_log_count, 3);
+    ck_assert_int_eq(metrics.event_batch.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_2.counter, 2);
+
+    ck_assert_int_eq(event_del(event_base, pipe_write_id(pipe[0])), 0);
+    for (i = 0; i < 2; i++) {
+        ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe[i])), 0);
+    }
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_int_eq(metrics.event_wait_0.counter, 1);
+
+    event_base_destroy(&event_base);
+    for (i = 0; i < 2; i++) {
+        pipe_close(pipe[i]);
+        pipe_conn_destroy(&pipe[i]);
+    }
+    test_reset(); /* stop updating metrics on the stack */
+#undef DATA
+}
+END_TEST
+
+static void *
+_send_later(void *arg)
+{
+    usleep(1000);
+    pipe_send((struct pipe_conn *)arg, "x", 1);
+
+    return NULL;
+}
+
+START_TEST(test_spin)
+{
+    struct event_base *event_base;
+    event_metrics_st metrics = { EVENT_METRIC(METRIC_INIT) };
+    int random_pointer[1] = {1};
+    struct pipe_conn *pipe;
+    struct duration d;
+    pthread_t thread;
+    char c;
+
+    test_teardown();
+    event_log_count = 0;
+    event_setup(&metrics);
+
+    event_base = event_base_create(1024, log_event);
+    event_base_set_spin(event_base, 1000000);
+    pipe = pipe_conn_create();
+    ck_assert_int_eq(pipe_open(NULL, pipe), true);
+    event_add_read(event_base, pipe_read_id(pipe), random_pointer);
+
+    /* data arriving while spinning is picked up without blocking */
+    ck_assert_int_eq(pthread_create(&thread, NULL, _send_later, pipe), 0);
+    ck_assert_int_eq(event_wait(event_base, -1), 1);
+    pthread_join(thread, NULL);
+    ck_assert_int_eq(event_log_count, 1);
+    ck_assert_int_eq(metrics.event_spin_hit.counter, 1);
+    ck_assert_int_eq(metrics.event_spin_block.counter, 0);
+    ck_assert_int_eq(metrics.event_wait_1.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_0.counter, 0);
+    ck_assert_int_eq(pipe_recv(pipe, &c, 1), 1);
+
+    /* nothing arriving, the wait blocks once the spin is over */
+    event_base_set_spin(event_base, 1000);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    ck_assert_int_eq(metrics.event_spin_block.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_0.counter, 1);
+    ck_assert_uint_gt(metrics.event_loop.counter, 2);
+
+    /* a budget beyond the timeout spins for the timeout, then gives up */
+    event_base_set_spin(event_base, 1000000);
+    duration_start(&d);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    duration_stop(&d);
+    ck_assert_int_lt(duration_ms(&d), 500);
+    ck_assert_int_eq(metrics.event_spin_block.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_0.counter, 2);
+
+    /* no spinning without a budget or for a poll */
+    event_base_set_spin(event_base, 0);
+    ck_assert_int_eq(event_wait(event_base, 10), 0);
+    event_base_set_spin(event_base, 1000);
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_int_eq(metrics.event_spin_block.counter, 1);
+    ck_assert_int_eq(metrics.event_wait_0.counter, 4);
+
+    ck_assert_int_eq(event_del(event_base, pipe_read_id(pipe)), 0);
+    event_base_destroy(&event_base);
+    pipe_close(pipe);
+    pipe_conn_destroy(&pipe);
+    test_reset(); /* stop updating metrics on the stack */
+}
+END_TEST
+
+START_TEST(test_io)
+{
+#define DATA "foo bar baz"
+    struct event_base *event_base;
+    int random_pointer[2] = {1, 2};
+    char rbuf[64], sbuf[] = DATA;
+    struct iovec iov = {rbuf, sizeof(rbuf)};
+    int sv[2];
+
+    test_reset();
+
+    ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    event_base = event_base_create(1024, log_event);
+    event_base_set_io_cb(event_base, log_io);
+
+#ifdef CC_IO_URING
+    /* recv into a registered buffer, send from memory that is not */
+    ck_assert_int_eq(event_register_buf(event_base, &iov, 1), 0);
+    ck_assert_int_eq(event_recv(event_base, sv[0], rbuf, sizeof(rbuf), 0,
+                &random_pointer[0]), 0);
+    ck_assert_int_eq(event_send(event_base, sv[1], sbuf, sizeof(sbuf), -1,
+                &random_pointer[1]), 0);
+
+    while (event_log_count < 2) {
+        ck_assert_int_gt(event_wait(event_base, 1000), 0);
+    }
+    ck_assert_int_eq(event_log_count, 2);
+    ck_assert_int_eq(event_log[0].res, sizeof(DATA));
+    ck_assert_int_eq(event_log[1].res, sizeof(DATA));
+    ck_assert_int_ne(event_log[0].events, event_log[1].events);
+    ck_assert_int_eq(memcmp(rbuf, DATA, sizeof(DATA)), 0);
+
+    /* outstanding recv is canceled by del and never reported */
+    ck_assert_int_eq(event_recv(event_base, sv[0], rbuf, sizeof(rbuf), 0,
+                &random_pointer[0]), 0);
+    ck_assert_int_eq(event_wait(event_base, 0), 0);
+    ck_assert_int_eq(event_del(event_base, sv[0]), 0);
+    event_log_count = 0;
+    ck_assert_int_eq(write(sv[1], DATA, sizeof(DATA)), sizeof(DATA));
+    ck_assert_int_eq(event_wait(event_base, 100), 0);
+    ck_assert_int_eq(event_log_count, 0);
+#else
+    ck_assert_int_eq(event_register_buf(event_base, &iov, 1), -1);
+    ck_assert_int_eq(event_recv(event_base, sv[0], rbuf, sizeof(rbuf), 0,
+                &random_pointer[0]), -1);
+    ck_assert_int_eq(errno, ENOTSUP);
+    ck_assert_int_eq(event_send(event_base, sv[1], sbuf, sizeof(sbuf), -1,
+                &random_pointer[1]), -1);
+    ck_assert_int_eq(errno, ENOTSUP);
+#endif
+
+    event_base_destroy(&event_base);
+    close(sv[0]);
+    close(sv[1]);
+#undef DATA
+}
+END_TEST
+
+static uint32_t group_adopted;
+static uint32_t group_read;
+static uint32_t group_closed;
+static struct tcp_conn *group_busy;     /* its event keeps the worker busy */
+static bool group_block;
+
+static void
+group_conn(struct event_worker *w, struct tcp_conn *c)
+{
+    ck_assert_ptr_eq(w, event_worker_self());
+    ck_assert_int_eq(event_add_read(event_worker_base(w), c->sd, c), 0);
+    __atomic_add_fetch(&group_adopted, 1, __ATOMIC_RELAXED);
+}
+
+static void
+group_event(void *arg, uint32_t events)
+{
+    struct tcp_conn *c = arg;
+    char buf[16];
+
+    ck_assert_ptr_ne(event_worker_self(), NULL);
+    ck_assert_int_eq(events, EVENT_READ);
+    if (read(c->sd, buf, sizeof(buf)) > 0) {
+        __atomic_add_fetch(&group_read, 1, __ATOMIC_RELAXED);
+    }
+    while (c == group_busy && __atomic_load_n(&group_block, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+}
+
+static void
+group_close(struct tcp_conn *c)
+{
+    ck_assert_ptr_eq(event_worker_self(), NULL);
+    ck_assert_ptr_ne(c, NULL);
+    __atomic_add_fetch(&group_closed, 1, __ATOMIC_RELAXED);
+}
+
+static void
+group_wait(uint32_t *count, uint32_t expected)
+{
+    int i;
+
+    for (i = 0; i < 2000 && __atomic_load_n(count, __ATOMIC_RELAXED) <
+            expected; i++) {
+        usleep(1000);
+    }
+    ck_assert_int_eq(__atomic_load_n(count, __ATOMIC_RELAXED), expected);
+}
+
+START_TEST(test_group)
+{
+#define NWORKER 2
+#define NCONN 4
+    struct event_group *g;
+    event_group_options_st options = { EVENT_GROUP_OPTION(OPTION_INIT) };
+    struct tcp_conn *c[NCONN];
+    int sv[NCONN][2];
+    uint32_t i;
+
+    test_reset();
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.event_group_nworker.val.vuint = NWORKER;
+    options.event_group_timeout.val.vuint = 10;
+    group_adopted = 0;
+    group_read = 0;
+    group_closed = 0;
+    group_busy = NULL;
+
+    g = event_group_create(&options, group_event, group_conn, group_close);
+    ck_assert_ptr_ne(g, NULL);
+    ck_assert_int_eq(event_group_nworker(g), NWORKER);
+    ck_assert_int_eq(event_group_start(g), CC_OK);
+
+    for (i = 0; i < NCONN; i++) {
+        ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]), 0);
+        c[i] = tcp_conn_create();
+        c[i]->sd = sv[i][0];
+        ck_assert_int_eq(event_group_dispatch(g, c[i]), CC_OK);
+    }
+    group_wait(&group_adopted, NCONN);
+
+    for (i = 0; i < NCONN; i++) {
+        ck_assert_int_eq(write(sv[i][1], "a", 1), 1);
+    }
+    group_wait(&group_read, NCONN);
+
+    /* least loaded dispatch spreads conns evenly */
+    for (i = 0; i < NWORKER; i++) {
+        event_worker_metrics_st *m = event_group_metrics(g, i);
+
+        ck_assert_int_eq(m->worker_conn_curr.gauge, NCONN / NWORKER);
+        ck_assert_int_eq(m->worker_queue_curr.gauge, 0);
+        ck_assert_int_eq(m->worker_handoff.counter, NCONN / NWORKER);
+    }
+
+    event_group_stop(g);
+    event_group_destroy(&g);
+    ck_assert_ptr_eq(g, NULL);
+    ck_assert_int_eq(group_closed, 0);
+    for (i = 0; i < NCONN; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+        tcp_conn_destroy(&c[i]);
+    }
+#undef NWORKER
+#undef NCONN
+}
+END_TEST
+
+START_TEST(test_group_steal)
+{
+#define NWORKER 2
+#define NCONN 3
+    struct event_group *g;
+    event_group_options_st options = { EVENT_GROUP_OPTION(OPTION_INIT) };
+    event_worker_metrics_st *m[NWORKER];
+    struct tcp_conn *c[NCONN + 1];
+    int sv[NCONN + 1][2];
+    uint32_t i;
+
+    test_reset();
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.event_group_nworker.val.vuint = NWORKER;
+    options.event_group_timeout.val.vuint = 10;
+    options.event_group_steal.val.vbool = true;
+    group_adopted = 0;
+    group_read = 0;
+    group_closed = 0;
+
+    g = event_group_create(&options, group_event, group_conn, group_close);
+    ck_assert_ptr_ne(g, NULL);
+    for (i = 0; i < NWORKER; i++) {
+        m[i] = event_group_metrics(g, i);
+    }
+    ck_assert_int_eq(event_group_start(g), CC_OK);
+    for (i = 0; i < NCONN + 1; i++) {
+        ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]), 0);
+        c[i] = tcp_conn_create();
+        c[i]->sd = sv[i][0];
+    }
+
+    /* one conn per worker, and the one of worker 0 keeps it busy */
+    group_busy = c[0];
+    __atomic_store_n(&group_block, true, __ATOMIC_RELEASE);
+    for (i = 0; i < NWORKER; i++) {
+        ck_assert_int_eq(event_group_dispatch(g, c[i]), CC_OK);
+    }
+    group_wait(&group_adopted, NWORKER);
+    ck_assert_int_eq(m[0]->worker_conn_curr.gauge, 1);
+    ck_assert_int_eq(write(sv[0][1], "a", 1), 1);
+    group_wait(&group_read, 1);
+
+    /* a tie goes to worker 0, which is stuck: idle worker 1 steals it */
+    ck_assert_int_eq(event_group_dispatch(g, c[NWORKER]), CC_OK);
+    ck_assert_int_eq(m[0]->worker_handoff.counter, 2);
+    group_wait(&group_adopted, NCONN);
+    ck_assert_int_eq(m[1]->worker_steal.counter, 1);
+    ck_assert_int_eq(m[1]->worker_conn_curr.gauge, 2);
+    ck_assert_int_eq(m[0]->worker_queue_curr.gauge, 0);
+
+    __atomic_store_n(&group_block, false, __ATOMIC_RELEASE);
+    event_group_stop(g);
+
+    /* a conn queued but never taken is handed back on destroy */
+    ck_assert_int_eq(event_group_dispatch(g, c[NCONN]), CC_OK);
+    event_group_destroy(&g);
+    ck_assert_int_eq(group_closed, 1);
+    ck_assert_int_eq(group_adopted, NCONN);
+
+    group_busy = NULL;
+    for (i = 0; i < NCONN + 1; i++) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+        tcp_conn_destroy(&c[i]);
+    }
+#undef NWORKER
+#undef NCONN
+}
+END_TEST
+
 /*
  * test suite
  */
@@ -157,6 +651,13 @@ event_suite(void)
     tcase_add_test(tc_event, test_read);
     tcase_add_test(tc_event, test_cannot_read);
     tcase_add_test(tc_event, test_write);
+    tcase_add_test(tc_event, test_del_readd);
+    tcase_add_test(tc_event, test_read_et);
+    tcase_add_test(tc_event, test_batch);
+    tcase_add_test(tc_event, test_spin);
+    tcase_add_test(tc_event, test_io);
+    tcase_add_test(tc_event, test_group);
+    tcase_add_test(tc_event, test_group_steal);
 
     return s;
 }
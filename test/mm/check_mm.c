@@ -0,0 +1,240 @@
+#include <cc_mm.h>
+
+#include <check.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUITE_NAME "mm"
+#define DEBUG_LOG  SUITE_NAME ".log"
+
+static mm_metrics_st metrics;
+
+/*
+ * utilities
+ */
+static void
+test_setup(void)
+{
+    metrics = (mm_metrics_st) { MM_METRIC(METRIC_INIT) };
+    mm_setup(&metrics);
+}
+
+static void
+test_teardown(void)
+{
+    mm_teardown();
+}
+
+static void
+test_reset(void)
+{
+    test_teardown();
+    test_setup();
+}
+
+/*
+ * tests
+ */
+START_TEST(test_alloc_realloc_free)
+{
+#define MSG "Hello World"
+    char *p, *z;
+    size_t i;
+
+    test_reset();
+
+    p = cc_alloc(sizeof(MSG));
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_uint_ge(cc_alloc_usable_size(p), sizeof(MSG));
+    memcpy(p, MSG, sizeof(MSG));
+
+    /* contents survive growing past slab classes and back */
+    p = cc_realloc(p, 1000);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_str_eq(p, MSG);
+    p = cc_realloc(p, 1024 * 1024);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_str_eq(p, MSG);
+    p = cc_realloc(p, sizeof(MSG));
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_str_eq(p, MSG);
+    cc_free(p);
+    ck_assert_ptr_eq(p, NULL);
+
+    z = cc_zalloc(4096);
+    ck_assert_ptr_ne(z, NULL);
+    for (i = 0; i < 4096; i++) {
+        ck_assert_int_eq(z[i], 0);
+    }
+    cc_free(z);
+
+    ck_assert_ptr_eq(cc_alloc(0), NULL);
+#undef MSG
+}
+END_TEST
+
+START_TEST(test_mmap_ex)
+{
+#define SIZE (2 * MM_HUGEPAGE_SIZE)
+    char *p;
+
+    test_reset();
+
+    /* whatever the host supports, exactly one backing is reported */
+    p = cc_mmap_ex(SIZE, MM_MMAP_HUGETLB | MM_MMAP_POPULATE, 0);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_int_eq(metrics.mm_mmap_hugetlb.counter +
+            metrics.mm_mmap_thp.counter + metrics.mm_mmap_default.counter, 1);
+    ck_assert_int_eq(metrics.mm_mmap_populate.counter, 1);
+    /* binding to node 0 and getting explicit hugepages can each fall back */
+    ck_assert_int_eq(metrics.mm_mmap_numa.counter +
+            metrics.mm_mmap_fallback.counter,
+            1 + (metrics.mm_mmap_hugetlb.counter == 0));
+    p[0] = p[SIZE - 1] = 1;
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+
+    /* transparent hugepage mappings are aligned to be fully backed */
+    p = cc_mmap_ex(SIZE, MM_MMAP_THP, -1);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_uint_eq((uintptr_t)p % MM_HUGEPAGE_SIZE, 0);
+    ck_assert_int_eq(cc_munmap(p, SIZE), 0);
+#undef SIZE
+}
+END_TEST
+
+START_TEST(test_arena)
+{
+#define CHUNK 1024
+    struct arena *arena;
+    char *p, *q, *large, *z;
+    int i;
+
+    test_reset();
+
+    arena = arena_create(CHUNK);
+    ck_assert_ptr_ne(arena, NULL);
+    ck_assert_ptr_eq(arena_alloc(arena, 0), NULL);
+
+    /* consecutive small allocations are aligned and bumped */
+    p = arena_alloc(arena, 1);
+    q = arena_alloc(arena, 1);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_uint_eq((uintptr_t)p % ARENA_ALIGN, 0);
+    ck_assert_ptr_eq(q, p + ARENA_ALIGN);
+
+    /* a large one does not disturb the current chunk */
+    large = arena_alloc(arena, CHUNK);
+    ck_assert_ptr_ne(large, NULL);
+    memset(large, 'x', CHUNK);
+    ck_assert_ptr_eq(arena_alloc(arena, 1), q + ARENA_ALIGN);
+
+    /* fill more chunks, then reset: the first chunk is reused */
+    for (i = 0; i < 100; i++) {
+        ck_assert_ptr_ne(arena_alloc(arena, 100), NULL);
+    }
+    arena_reset(arena);
+    z = arena_zalloc(arena, 200);
+    ck_assert_ptr_ne(z, NULL);
+    for (i = 0; i < 200; i++) {
+        ck_assert_int_eq(z[i], 0);
+    }
+
+    arena_destroy(&arena);
+    ck_assert_ptr_eq(arena, NULL);
+#undef CHUNK
+}
+END_TEST
+
+#if defined CC_SLAB_MM && CC_SLAB_MM == 1
+static void *
+_free_thread(void *arg)
+{
+    cc_free(arg);
+
+    return NULL;
+}
+
+START_TEST(test_slab_class)
+{
+    void *p, *q, *r, *large;
+    pthread_t thread;
+
+    test_reset();
+
+    /* a power of two fits its class exactly */
+    p = cc_alloc(16 * 1024);
+    ck_assert_ptr_ne(p, NULL);
+    ck_assert_uint_eq(cc_alloc_usable_size(p), 16 * 1024);
+    ck_assert_int_eq(metrics.mm_slab_16k.gauge, 1);
+
+    q = cc_alloc(17);
+    ck_assert_uint_eq(cc_alloc_usable_size(q), 32);
+    ck_assert_int_eq(metrics.mm_slab_32.gauge, 1);
+
+    /* growing within the class keeps the object, unless debugging moves it */
+    r = cc_realloc(q, 32);
+    ck_assert_ptr_ne(r, NULL);
+#if !defined CC_DEBUG_MM
+    ck_assert_ptr_eq(r, q);
+#endif
+    q = r;
+
+    large = cc_alloc(1024 * 1024);
+    ck_assert_ptr_ne(large, NULL);
+    ck_assert_int_eq(metrics.mm_large_curr.gauge, 1);
+    cc_free(large);
+    ck_assert_int_eq(metrics.mm_large_curr.gauge, 0);
+
+    /* objects can be freed on another thread */
+    ck_assert_int_eq(pthread_create(&thread, NULL, _free_thread, p), 0);
+    ck_assert_int_eq(pthread_join(thread, NULL), 0);
+    ck_assert_int_eq(metrics.mm_slab_16k.gauge, 0);
+
+    cc_free(q);
+    ck_assert_int_eq(metrics.mm_slab_32.gauge, 0);
+}
+END_TEST
+#endif
+
+/*
+ * test suite
+ */
+static Suite *
+mm_suite(void)
+{
+    Suite *s = suite_create(SUITE_NAME);
+
+    TCase *tc_mm = tcase_create("mm test");
+    tcase_add_test(tc_mm, test_alloc_realloc_free);
+    tcase_add_test(tc_mm, test_mmap_ex);
+    tcase_add_test(tc_mm, test_arena);
+#if defined CC_SLAB_MM && CC_SLAB_MM == 1
+    tcase_add_test(tc_mm, test_slab_class);
+#endif
+    suite_add_tcase(s, tc_mm);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int nfail;
+
+    /* setup */
+    test_setup();
+
+    Suite *suite = mm_suite();
+    SRunner *srunner = srunner_create(suite);
+    srunner_set_log(srunner, DEBUG_LOG);
+    srunner_run_all(srunner, CK_ENV); /* set CK_VEBOSITY in ENV to customize */
+    nfail = srunner_ntests_failed(srunner);
+    srunner_free(srunner);
+
+    /* teardown */
+    test_teardown();
+
+    return (nfail == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,6 +3,7 @@
 
 #include <check.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -31,6 +32,24 @@ foo_destroy(struct foo **foo)
     *foo = NULL;
 }
 
+static void *
+_foo_create(void)
+{
+    struct foo *foo = foo_create();
+
+    if (foo != NULL) {
+        foo->d = 0;
+    }
+
+    return foo;
+}
+
+static void
+_foo_destroy(void *foo)
+{
+    foo_destroy((struct foo **)&foo);
+}
+
 /*
  * utilities
  */
@@ -145,6 +164,228 @@ START_TEST(test_noprealloc_borrow_return)
 }
 END_TEST
 
+START_TEST(test_pool_max)
+{
+#define NMAX 4
+    pool_metrics_st metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+    struct pool *pool;
+    void *obj[NMAX + 2];
+
+    test_reset();
+
+    pool = pool_create("foo", NMAX, 2, 1, _foo_create, _foo_destroy, &metrics);
+    ck_assert_ptr_ne(pool, NULL);
+    ck_assert_int_eq(pool_prealloc(pool, NMAX), NMAX);
+    ck_assert_int_eq(pool_nfree(pool), NMAX);
+
+    /* no more than NMAX objects, ever */
+    ck_assert_int_eq(pool_borrow_n(pool, obj, NMAX + 2), NMAX);
+    ck_assert_int_eq(metrics.pool_borrow_ex.counter, 1);
+    ck_assert_ptr_eq(pool_borrow(pool), NULL);
+    ck_assert_int_eq(metrics.pool_active.gauge, NMAX);
+    ck_assert_int_eq(metrics.pool_curr.gauge, NMAX);
+
+    pool_return_n(pool, obj, NMAX);
+    ck_assert_int_eq(metrics.pool_active.gauge, 0);
+    ck_assert_int_eq(pool_nfree(pool), NMAX);
+    ck_assert_int_eq(metrics.pool_create.counter, NMAX);
+
+    pool_destroy(&pool);
+    ck_assert_ptr_eq(pool, NULL);
+    ck_assert_int_eq(metrics.pool_curr.gauge, 0);
+#undef NMAX
+}
+END_TEST
+
+START_TEST(test_pool_magazine)
+{
+#define NOBJ 8
+#define HIGH 4
+#define LOW  2
+    pool_metrics_st metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+    struct pool *pool;
+    void *obj[NOBJ];
+    int i;
+
+    test_reset();
+
+    pool = pool_create("foo", 0, HIGH, LOW, _foo_create, _foo_destroy,
+            &metrics);
+    ck_assert_ptr_ne(pool, NULL);
+
+    for (i = 0; i < NOBJ; i++) {
+        obj[i] = pool_borrow(pool);
+        ck_assert_ptr_ne(obj[i], NULL);
+    }
+
+    /* magazine goes over HIGH on the 5th and 8th return, to LOW each time */
+    for (i = 0; i < NOBJ; i++) {
+        pool_return(pool, obj[i]);
+    }
+    ck_assert_int_eq(metrics.pool_spill.counter, 2);
+    ck_assert_int_eq(metrics.pool_refill.counter, 0);
+    ck_assert_int_eq(pool_nfree(pool), NOBJ);
+
+    /* LOW objects from the magazine, then a refill from the depot */
+    for (i = 0; i < LOW + 1; i++) {
+        obj[i] = pool_borrow(pool);
+        ck_assert_ptr_ne(obj[i], NULL);
+    }
+    ck_assert_int_eq(metrics.pool_refill.counter, 1);
+    ck_assert_int_eq(metrics.pool_create.counter, NOBJ);
+    pool_return_n(pool, obj, LOW + 1);
+
+    pool_flush(pool);
+    ck_assert_int_eq(metrics.pool_spill.counter, 3);
+    ck_assert_int_eq(pool_nfree(pool), NOBJ);
+
+    pool_destroy(&pool);
+    ck_assert_int_eq(metrics.pool_curr.gauge, 0);
+#undef NOBJ
+#undef HIGH
+#undef LOW
+}
+END_TEST
+
+static void *
+_pool_thread(void *arg)
+{
+    struct pool *pool = arg;
+
+    pool_return(pool, pool_borrow(pool));
+
+    return NULL;
+}
+
+START_TEST(test_pool_thread_exit)
+{
+    pool_metrics_st metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+    struct pool *pool;
+    pthread_t thread;
+    void *foo;
+
+    test_reset();
+
+    pool = pool_create("foo", 0, POOL_CACHE_HIGH, POOL_CACHE_LOW,
+            _foo_create, _foo_destroy, &metrics);
+    ck_assert_ptr_ne(pool, NULL);
+
+    /* the thread's magazine is moved to the depot when the thread exits */
+    ck_assert_int_eq(pthread_create(&thread, NULL, _pool_thread, pool), 0);
+    ck_assert_int_eq(pthread_join(thread, NULL), 0);
+    ck_assert_int_eq(metrics.pool_spill.counter, 1);
+
+    foo = pool_borrow(pool);
+    ck_assert_ptr_ne(foo, NULL);
+    ck_assert_int_eq(metrics.pool_refill.counter, 1);
+    ck_assert_int_eq(metrics.pool_create.counter, 1);
+    pool_return(pool, foo);
+
+    pool_destroy(&pool);
+    ck_assert_int_eq(metrics.pool_curr.gauge, 0);
+}
+END_TEST
+
+#define NTHREAD 4
+#define NLOOP   20000
+#define NBATCH  3
+
+struct user {
+    struct pool *pool;
+    int         id;
+    int         nerr;   /* objects handed out to two users at once */
+};
+
+static void *
+_pool_user(void *arg)
+{
+    struct user *u = arg;
+    struct foo *foo[NBATCH];
+    uint32_t i, n;
+    int l;
+
+    for (l = 0; l < NLOOP; l++) {
+        n = pool_borrow_n(u->pool, (void **)foo, 1 + l % NBATCH);
+        for (i = 0; i < n; i++) {
+            u->nerr += (foo[i]->d != 0);
+            foo[i]->d = u->id;
+        }
+        for (i = 0; i < n; i++) {
+            u->nerr += (foo[i]->d != u->id);
+            foo[i]->d = 0;
+        }
+        pool_return_n(u->pool, (void **)foo, n);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_pool_concurrent)
+{
+    pool_metrics_st metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+    struct pool *pool;
+    pthread_t thread[NTHREAD];
+    struct user u[NTHREAD];
+    uint32_t high;
+    int i;
+
+    test_reset();
+
+    /* without magazines every call goes to the lock-free depot */
+    for (high = 0; high <= 2; high += 2) {
+        metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+        pool = pool_create("foo", 0, high, high / 2, _foo_create,
+                _foo_destroy, &metrics);
+        ck_assert_ptr_ne(pool, NULL);
+
+        for (i = 0; i < NTHREAD; i++) {
+            u[i] = (struct user){ pool, i + 1, 0 };
+            ck_assert_int_eq(pthread_create(&thread[i], NULL, _pool_user,
+                        &u[i]), 0);
+        }
+        for (i = 0; i < NTHREAD; i++) {
+            ck_assert_int_eq(pthread_join(thread[i], NULL), 0);
+            ck_assert_int_eq(u[i].nerr, 0);
+        }
+
+        /* nothing lost or duplicated */
+        ck_assert_int_eq(metrics.pool_active.gauge, 0);
+        ck_assert_int_le(metrics.pool_curr.gauge, NTHREAD * NBATCH);
+        ck_assert_int_eq(pool_nfree(pool), metrics.pool_curr.gauge);
+
+        pool_destroy(&pool);
+        ck_assert_int_eq(metrics.pool_curr.gauge, 0);
+    }
+}
+END_TEST
+#undef NBATCH
+#undef NLOOP
+#undef NTHREAD
+
+START_TEST(test_pool_nocache)
+{
+    pool_metrics_st metrics = (pool_metrics_st) { POOL_METRIC(METRIC_INIT) };
+    struct pool *pool;
+    void *obj[2];
+
+    test_reset();
+
+    pool = pool_create("foo", 0, 0, 0, _foo_create, _foo_destroy, &metrics);
+    ck_assert_ptr_ne(pool, NULL);
+
+    ck_assert_int_eq(pool_borrow_n(pool, obj, 2), 2);
+    pool_return_n(pool, obj, 2);
+    ck_assert_int_eq(pool_nfree(pool), 2);
+    ck_assert_int_eq(pool_borrow_n(pool, obj, 2), 2);
+    ck_assert_int_eq(metrics.pool_create.counter, 2);
+    ck_assert_int_eq(metrics.pool_spill.counter, 0);
+    pool_return_n(pool, obj, 2);
+
+    pool_destroy(&pool);
+    ck_assert_int_eq(metrics.pool_curr.gauge, 0);
+}
+END_TEST
+
 
 /*
  * test suite
@@ -158,6 +399,11 @@ pool_suite(void)
     tcase_add_test(tc_pool, test_create_prealloc_destroy);
     tcase_add_test(tc_pool, test_prealloc_borrow_return);
     tcase_add_test(tc_pool, test_noprealloc_borrow_return);
+    tcase_add_test(tc_pool, test_pool_max);
+    tcase_add_test(tc_pool, test_pool_magazine);
+    tcase_add_test(tc_pool, test_pool_thread_exit);
+    tcase_add_test(tc_pool, test_pool_concurrent);
+    tcase_add_test(tc_pool, test_pool_nocache);
 
     suite_add_tcase(s, tc_pool);
 
@@ -1,9 +1,11 @@
+#include <time/cc_clock.h>
 #include <time/cc_timer.h>
 
 #include <check.h>
 
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -164,6 +166,117 @@ START_TEST(test_timeout_absolute)
 }
 END_TEST
 
+START_TEST(test_clock)
+{
+#define SLEEP_NS 1000000
+#define TICKER_US 100
+
+    clock_options_st options = { CLOCK_OPTION(OPTION_INIT) };
+    struct timeout e, f;
+    struct timespec ts = (struct timespec){0, SLEEP_NS};
+    int64_t ns;
+    int i;
+
+    /* not set up: every reading is fresh */
+    ns = clock_ns();
+    nanosleep(&ts, NULL);
+    ck_assert_int_ge(clock_ns() - ns, SLEEP_NS);
+
+    /* set up without a ticker: only moves on update */
+    ck_assert_int_eq(clock_setup(NULL), CC_OK);
+    ns = clock_ns();
+    nanosleep(&ts, NULL);
+    ck_assert_int_eq(clock_ns(), ns);
+    ck_assert_int_eq(clock_us(), ns / 1000);
+    ck_assert_int_eq(clock_ms(), ns / 1000000);
+    ck_assert_int_eq(clock_sec(), ns / 1000000000);
+    ck_assert_int_le(clock_unix(), time(NULL));
+    clock_update();
+    ck_assert_int_ge(clock_ns() - ns, SLEEP_NS);
+
+    /* cached timeouts are comparable with precise ones */
+    timeout_set_ns(&f, SLEEP_NS);
+    clock_timeout_add(&e, &f);
+    ck_assert_int_eq(clock_timeout_ns(&e), SLEEP_NS);
+    ck_assert_int_le(timeout_ns(&e), SLEEP_NS);
+    ck_assert(!clock_timeout_expired(&e));
+    nanosleep(&ts, NULL);
+    ck_assert(timeout_expired(&e));
+    ck_assert(!clock_timeout_expired(&e)); /* until updated */
+    clock_update();
+    ck_assert(clock_timeout_expired(&e));
+    ck_assert_int_le(clock_timeout_ns(&e), 0);
+    ck_assert_int_eq(clock_timeout_ns(&f), SLEEP_NS);
+    timeout_reset(&e);
+    ck_assert(!clock_timeout_expired(&e));
+    clock_teardown();
+
+    /* with a ticker the clock moves by itself */
+    option_load_default((struct option *)&options, OPTION_CARDINALITY(options));
+    options.clock_ticker_us.val.vuint = TICKER_US;
+    ck_assert_int_eq(clock_setup(&options), CC_OK);
+    ns = clock_ns();
+    for (i = 0; i < 1000 && clock_ns() == ns; i++) {
+        nanosleep(&ts, NULL);
+    }
+    ck_assert_int_gt(clock_ns(), ns);
+    clock_teardown();
+
+    /* torn down: fresh again */
+    ns = clock_ns();
+    nanosleep(&ts, NULL);
+    ck_assert_int_ge(clock_ns() - ns, SLEEP_NS);
+
+#undef TICKER_US
+#undef SLEEP_NS
+}
+END_TEST
+
+static bool clock_stop;
+
+static void *
+_update(void *arg)
+{
+    (void)arg;
+
+    while (!__atomic_load_n(&clock_stop, __ATOMIC_RELAXED)) {
+        clock_update();
+    }
+
+    return NULL;
+}
+
+START_TEST(test_clock_race)
+{
+#define NTHREAD 4
+#define NREAD 1000000
+
+    pthread_t t[NTHREAD];
+    int64_t ns, last = 0;
+    int i;
+
+    /* concurrent updates never move the clock back */
+    ck_assert_int_eq(clock_setup(NULL), CC_OK);
+    clock_stop = false;
+    for (i = 0; i < NTHREAD; i++) {
+        ck_assert_int_eq(pthread_create(&t[i], NULL, _update, NULL), 0);
+    }
+    for (i = 0; i < NREAD; i++) {
+        ns = clock_ns();
+        ck_assert_int_ge(ns, last);
+        last = ns;
+    }
+    __atomic_store_n(&clock_stop, true, __ATOMIC_RELAXED);
+    for (i = 0; i < NTHREAD; i++) {
+        pthread_join(t[i], NULL);
+    }
+    clock_teardown();
+
+#undef NREAD
+#undef NTHREAD
+}
+END_TEST
+
 
 /*
  * test suite
@@ -186,6 +299,13 @@ timer_suite(void)
     tcase_add_test(tc_timeout, test_timeout_intvl);
     tcase_add_test(tc_timeout, test_timeout_absolute);
 
+    /* cached clock */
+    TCase *tc_clock = tcase_create("timer/clock test");
+    suite_add_tcase(s, tc_clock);
+
+    tcase_add_test(tc_clock, test_clock);
+    tcase_add_test(tc_clock, test_clock_race);
+
     return s;
 }
 
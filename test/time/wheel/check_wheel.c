@@ -2,6 +2,7 @@
 
 #include <check.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -180,6 +181,439 @@ START_TEST(test_timing_wheel_recur)
 }
 END_TEST
 
+struct fire {
+    struct duration d;  /* started at insertion */
+    double          ms; /* elapsed when fired */
+};
+
+static void
+_fire_cb(void *v)
+{
+    struct fire *f = v;
+    struct duration s;
+
+    duration_snapshot(&s, &f->d);
+    f->ms = duration_ms(&s);
+}
+
+START_TEST(test_timing_wheel_nlevel)
+{
+#define TICK_NS 1000000
+#define NSLOT 4
+#define NLEVEL 3
+#define NEVENT 4
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timeout_event *tev;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    struct fire f[NEVENT];
+    /* one event per level, plus one that is removed before due */
+    uint32_t delay_ms[NEVENT] = {2, 9, 45, 50};
+    int i;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create_nlevel(&tick, NSLOT, NLEVEL, 0);
+    ck_assert_ptr_ne(tw, NULL);
+    ck_assert_int_eq(tw->span, NSLOT * NSLOT * NSLOT);
+    timing_wheel_start(tw);
+
+    /* beyond what all levels cover */
+    timeout_set_ns(&delay, TICK_NS * NSLOT * NSLOT * NSLOT);
+    ck_assert(timing_wheel_insert(tw, &delay, false, _incr_cb, &i) == NULL);
+
+    for (i = 0; i < NEVENT; i++) {
+        f[i].ms = 0;
+        duration_start(&f[i].d);
+        timeout_set_ms(&delay, delay_ms[i]);
+        tev = timing_wheel_insert(tw, &delay, false, _fire_cb, &f[i]);
+        ck_assert_ptr_ne(tev, NULL);
+    }
+    ck_assert_int_eq(tw->nevent, NEVENT);
+    timing_wheel_remove(tw, &tev);
+    ck_assert_int_eq(tw->nevent, NEVENT - 1);
+
+    while (tw->nevent > 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_gt(metrics.timing_wheel_cascade.counter, 0);
+    /* long timeouts don't fire early */
+    for (i = 0; i < NEVENT - 1; i++) {
+        ck_assert(f[i].ms >= delay_ms[i]);
+    }
+    ck_assert(f[NEVENT - 1].ms == 0);
+
+    /* events on higher levels are flushed too */
+    timeout_set_ms(&delay, delay_ms[2]);
+    timing_wheel_insert(tw, &delay, true, _incr_cb, &i);
+    i = 0;
+    timing_wheel_stop(tw);
+    timing_wheel_flush(tw);
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(i, 1);
+    timing_wheel_destroy(&tw);
+
+#undef NEVENT
+#undef NLEVEL
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+
+struct producer {
+    pthread_t           thread;
+    struct timing_wheel *tw;
+    int                 nfire;  /* only touched by the owner, in callbacks */
+};
+
+#define ASYNC_NEVENT 200
+
+static void *
+_produce(void *arg)
+{
+    struct producer *p = arg;
+    struct timeout delay;
+    int i;
+
+    for (i = 0; i < ASYNC_NEVENT; i++) {
+        timeout_set_ms(&delay, i % 5);
+        ck_assert_int_ne(timing_wheel_insert_async(p->tw, &delay, false,
+                    _incr_cb, &p->nfire), TIMEOUT_HANDLE_INVALID);
+    }
+
+    return NULL;
+}
+
+START_TEST(test_timing_wheel_async)
+{
+#define TICK_NS 1000000
+#define NSLOT 16
+#define NTHREAD 4
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    timeout_handle_i h;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    struct producer p[NTHREAD];
+    int i, nfire = 0, ntry;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(tw);
+
+    /* canceled by the owner before the insertion is applied */
+    timeout_set_ns(&delay, TICK_NS);
+    h = timing_wheel_insert_async(tw, &delay, true, _incr_cb, &nfire);
+    ck_assert_int_ne(h, TIMEOUT_HANDLE_INVALID);
+    ck_assert(timing_wheel_cancel(tw, h));
+    ck_assert(!timing_wheel_cancel(tw, h)); /* stale before the drain too */
+    ck_assert_int_eq(tw->nevent, 0);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(metrics.timing_wheel_insert.counter, 0);
+    ck_assert_int_eq(metrics.timing_wheel_remove.counter, 0);
+    ck_assert(!timing_wheel_cancel(tw, h));
+
+    /* canceled through the queue, applied in order */
+    h = timing_wheel_insert_async(tw, &delay, true, _incr_cb, &nfire);
+    ck_assert_int_eq(timing_wheel_cancel_async(tw, h), CC_OK);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(tw->nevent, 0);
+
+    h = timing_wheel_insert_async(tw, &delay, true, _incr_cb, &nfire);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(tw->nevent, 1);
+    ck_assert_int_eq(timing_wheel_cancel_async(tw, h), CC_OK);
+    ck_assert_int_eq(tw->nevent, 1);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(metrics.timing_wheel_queue.counter, 5);
+    ck_assert_int_eq(metrics.timing_wheel_apply.counter, 5);
+
+    /* canceling again does nothing */
+    ck_assert_int_eq(timing_wheel_cancel_async(tw, h), CC_OK);
+    timing_wheel_execute(tw);
+    ck_assert_int_eq(metrics.timing_wheel_remove.counter, 2);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, 0);
+
+    /* other threads insert while the owner turns the wheel */
+    for (i = 0; i < NTHREAD; i++) {
+        p[i].tw = tw;
+        p[i].nfire = 0;
+        ck_assert_int_eq(pthread_create(&p[i].thread, NULL, _produce, &p[i]),
+                0);
+    }
+    for (ntry = 0; ntry < 1000 && nfire < NTHREAD * ASYNC_NEVENT; ntry++) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+        for (i = 0, nfire = 0; i < NTHREAD; i++) {
+            nfire += p[i].nfire;
+        }
+    }
+    for (i = 0; i < NTHREAD; i++) {
+        pthread_join(p[i].thread, NULL);
+        ck_assert_int_eq(p[i].nfire, ASYNC_NEVENT);
+    }
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_eq(metrics.timing_wheel_queue.counter,
+            metrics.timing_wheel_apply.counter);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, 0);
+
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+
+#undef NTHREAD
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+#undef ASYNC_NEVENT
+
+#define RACE_NEVENT 20000
+
+struct racer {
+    struct timing_wheel *tw;
+    int                 nfire;  /* only touched by the owner, in callbacks */
+    timeout_handle_i    h[RACE_NEVENT];
+};
+
+static void *
+_race(void *arg)
+{
+    struct racer *r = arg;
+    struct timeout delay;
+    int i;
+
+    timeout_set_ns(&delay, 0);
+    for (i = 0; i < RACE_NEVENT; i++) {
+        r->h[i] = timing_wheel_insert_async(r->tw, &delay, false, _incr_cb,
+                &r->nfire);
+    }
+
+    return NULL;
+}
+
+static int
+_handle_cmp(const void *a, const void *b)
+{
+    timeout_handle_i x = *(const timeout_handle_i *)a;
+    timeout_handle_i y = *(const timeout_handle_i *)b;
+
+    return (x > y) - (x < y);
+}
+
+START_TEST(test_timing_wheel_async_race)
+{
+#define TICK_NS 1000
+#define NSLOT 16
+
+    struct timeout tick;
+    struct racer *r;
+    pthread_t thread;
+    int i, ntry;
+
+    test_reset();
+
+    r = calloc(1, sizeof(*r));
+    ck_assert_ptr_ne(r, NULL);
+    timeout_set_ns(&tick, TICK_NS);
+    r->tw = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(r->tw);
+
+    /*
+     * events due right away fire, and their slots get reused, while the
+     * inserting thread is still returning from the insertion
+     */
+    ck_assert_int_eq(pthread_create(&thread, NULL, _race, r), 0);
+    for (ntry = 0; ntry < 10000000 && r->nfire < RACE_NEVENT; ntry++) {
+        timing_wheel_execute(r->tw);
+    }
+    pthread_join(thread, NULL);
+    ck_assert_int_eq(r->nfire, RACE_NEVENT);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, 0);
+
+    /* each insertion got a handle of its own, now stale */
+    qsort(r->h, RACE_NEVENT, sizeof(r->h[0]), _handle_cmp);
+    ck_assert_int_ne(r->h[0], TIMEOUT_HANDLE_INVALID);
+    for (i = 1; i < RACE_NEVENT; i++) {
+        ck_assert_int_ne(r->h[i], r->h[i - 1]);
+    }
+    ck_assert(!timing_wheel_cancel(r->tw, r->h[0]));
+
+    timing_wheel_stop(r->tw);
+    timing_wheel_destroy(&r->tw);
+    free(r);
+
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+#undef RACE_NEVENT
+
+START_TEST(test_timing_wheel_next)
+{
+#define TICK_NS 1000000
+#define NSLOT 8
+#define NLEVEL 2
+#define DELAY_MS 30 /* on the second level */
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timeout_event *tev;
+    struct event_base *evb;
+    struct fire f;
+    int64_t ns;
+    int nwait;
+
+    test_reset();
+    event_setup(NULL);
+    evb = event_base_create(16, NULL);
+    ck_assert_ptr_ne(evb, NULL);
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create_nlevel(&tick, NSLOT, NLEVEL, 0);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), -1);
+    timing_wheel_start(tw);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), -1);
+
+    timeout_set_ms(&delay, 5);
+    tev = timing_wheel_insert(tw, &delay, false, _fire_cb, &f);
+    ns = timing_wheel_next_ns(tw);
+    ck_assert_int_gt(ns, 4 * TICK_NS);
+    ck_assert_int_le(ns, 6 * TICK_NS);
+    timing_wheel_remove(tw, &tev);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), -1);
+
+    /* a few waits suffice: one to cascade, one to fire */
+    f.ms = 0;
+    duration_start(&f.d);
+    timeout_set_ms(&delay, DELAY_MS);
+    timing_wheel_insert(tw, &delay, false, _fire_cb, &f);
+    ns = timing_wheel_next_ns(tw);
+    ck_assert_int_gt(ns, 0);
+    ck_assert_int_le(ns, DELAY_MS * TICK_NS);
+    for (nwait = 0; nwait < 10 && tw->nevent > 0; nwait++) {
+        ck_assert_int_eq(timing_wheel_event_wait(tw, evb, -1), 0);
+    }
+    ck_assert_int_eq(tw->nevent, 0);
+    ck_assert_int_le(nwait, 4);
+    ck_assert(f.ms >= DELAY_MS);
+
+    /* the caller's timeout still applies */
+    timing_wheel_insert(tw, &delay, false, _fire_cb, &f);
+    ck_assert_int_eq(timing_wheel_event_wait(tw, evb, 0), 0);
+    ck_assert_int_eq(tw->nevent, 1);
+
+    /* queued operations are due right away */
+    timing_wheel_insert_async(tw, &delay, false, _fire_cb, &f);
+    ck_assert_int_eq(timing_wheel_next_ns(tw), 0);
+
+    timing_wheel_stop(tw);
+    timing_wheel_flush(tw);
+    timing_wheel_destroy(&tw);
+    event_base_destroy(&evb);
+    event_teardown();
+
+#undef DELAY_MS
+#undef NLEVEL
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+
+struct recur {
+    struct timing_wheel *tw;
+    timeout_handle_i    h;
+    int                 nfire;
+};
+
+static void
+_cancel_cb(void *v)
+{
+    struct recur *r = v;
+
+    r->nfire++;
+    ck_assert(timing_wheel_cancel(r->tw, r->h));
+}
+
+START_TEST(test_timing_wheel_handle)
+{
+#define TICK_NS 1000000
+#define NSLOT 8
+#define NEVENT 3000 /* a few slabs worth */
+
+    struct timeout tick, delay;
+    struct timing_wheel *tw;
+    struct timeout_event *tev;
+    struct timespec ts = (struct timespec){0, TICK_NS};
+    struct recur r;
+    timeout_handle_i h, h2;
+    int i = 0, n;
+
+    test_reset();
+
+    timeout_set_ns(&tick, TICK_NS);
+    tw = timing_wheel_create(&tick, NSLOT, 0);
+    timing_wheel_start(tw);
+    timeout_set_ns(&delay, TICK_NS);
+
+    /* the handle of a fired event is stale, even once its slot is reused */
+    tev = timing_wheel_insert(tw, &delay, false, _incr_cb, &i);
+    h = timeout_event_handle(tev);
+    ck_assert_int_ne(h, TIMEOUT_HANDLE_INVALID);
+    while (i == 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert(!timing_wheel_cancel(tw, h));
+    h2 = timeout_event_handle(timing_wheel_insert(tw, &delay, false, _incr_cb,
+                &i));
+    ck_assert_int_eq((uint32_t)h2, (uint32_t)h); /* same slot */
+    ck_assert_int_ne(h2, h);
+    ck_assert(!timing_wheel_cancel(tw, h));
+    ck_assert_int_eq(tw->nevent, 1);
+    ck_assert(timing_wheel_cancel(tw, h2));
+    ck_assert_int_eq(tw->nevent, 0);
+
+    /* a recurring event can cancel itself */
+    r.tw = tw;
+    r.nfire = 0;
+    r.h = timeout_event_handle(timing_wheel_insert(tw, &delay, true,
+                _cancel_cb, &r));
+    while (r.nfire == 0) {
+        nanosleep(&ts, NULL);
+        timing_wheel_execute(tw);
+    }
+    ck_assert_int_eq(r.nfire, 1);
+    ck_assert_int_eq(tw->nevent, 0);
+
+    /* slabs are added as needed */
+    for (n = 0; n < NEVENT; n++) {
+        ck_assert_ptr_ne(timing_wheel_insert(tw, &delay, false, NULL, NULL),
+                NULL);
+    }
+    ck_assert_int_ge(metrics.timeout_event_curr.gauge, NEVENT);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, NEVENT);
+    timing_wheel_flush(tw);
+    ck_assert_int_eq(metrics.timeout_event_active.gauge, 0);
+
+    timing_wheel_stop(tw);
+    timing_wheel_destroy(&tw);
+    test_teardown();
+    ck_assert_int_eq(metrics.timeout_event_curr.gauge, 0);
+    test_setup();
+
+#undef NEVENT
+#undef NSLOT
+#undef TICK_NS
+}
+END_TEST
+
 START_TEST(test_timing_wheel_edge_case)
 {
 #define TICK_NS 1000000
@@ -230,6 +664,11 @@ wheel_suite(void)
 
     tcase_add_test(tc_wheel, test_timing_wheel_basic);
     tcase_add_test(tc_wheel, test_timing_wheel_recur);
+    tcase_add_test(tc_wheel, test_timing_wheel_nlevel);
+    tcase_add_test(tc_wheel, test_timing_wheel_async);
+    tcase_add_test(tc_wheel, test_timing_wheel_async_race);
+    tcase_add_test(tc_wheel, test_timing_wheel_next);
+    tcase_add_test(tc_wheel, test_timing_wheel_handle);
     tcase_add_test(tc_wheel, test_timing_wheel_edge_case);
 
     return s;